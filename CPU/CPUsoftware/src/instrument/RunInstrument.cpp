@@ -415,6 +415,31 @@ int RunInstrument::StartUp() {
   printf("LIGHT_ACQ_TIME is %d\n", this->ConfigOut->light_acq_time);
   printf("STATUS_PERIOD is %d\n", this->ConfigOut->status_period);
   printf("POWER_ON_DELAY is %d\n", this->ConfigOut->pwr_on_delay);
+  printf("MMAP_INGEST is %d\n", this->ConfigOut->mmap_ingest);
+  printf("CRC_VERIFY is %d\n", this->ConfigOut->crc_verify);
+  printf("ASYNC_WRITE is %d\n", this->ConfigOut->async_write);
+  printf("ASYNC_QUEUE_MB is %d\n", this->ConfigOut->async_queue_mb);
+  printf("ASYNC_BACKPRESSURE is %d\n", this->ConfigOut->async_backpressure);
+  printf("FILE_BACKEND is %d\n", this->ConfigOut->file_backend);
+  printf("DIRECT_IO is %d\n", this->ConfigOut->direct_io);
+  printf("PIPELINE_INGEST is %d\n", this->ConfigOut->pipeline_ingest);
+  printf("FTP_CLIENT is %d\n", this->ConfigOut->ftp_client);
+  printf("FTP_POLL_MS is %d\n", this->ConfigOut->ftp_poll_ms);
+  printf("FTP_PASSIVE is %d\n", this->ConfigOut->ftp_passive);
+  printf("FTP_DIRECT is %d\n", this->ConfigOut->ftp_direct);
+  printf("SPLICE_INGEST is %d\n", this->ConfigOut->splice_ingest);
+  printf("COMPRESS is %d\n", this->ConfigOut->compress);
+  printf("CMP_THREADS is %d\n", this->ConfigOut->cmp_threads);
+  printf("CMP_NICE is %d\n", this->ConfigOut->cmp_nice);
+  printf("USB_MIRROR is %d\n", this->ConfigOut->usb_mirror);
+  printf("USB_BACKUP is %d\n", this->ConfigOut->usb_backup);
+  printf("FAT32_PREALLOC is %d\n", this->ConfigOut->fat32_prealloc);
+  printf("WRITE_BLOCK_KB is %d\n", this->ConfigOut->write_block_kb);
+  printf("RUN_ROTATE_PKTS is %d\n", this->ConfigOut->run_rotate_pkts);
+  printf("RUN_ROTATE_MB is %d\n", this->ConfigOut->run_rotate_mb);
+  printf("RUN_ROTATE_SEC is %d\n", this->ConfigOut->run_rotate_sec);
+  printf("CHECKPOINT_PKTS is %d\n", this->ConfigOut->checkpoint_pkts);
+  printf("FSYNC_CHECKPOINTS is %d\n", this->ConfigOut->fsync_checkpoints);
 
   std::cout << std::endl;
 
@@ -918,8 +943,8 @@ void RunInstrument::Stop() {
   std::cout << "stopping detached threads..." << std::endl;
   this->Cam.KillCamAcq();
 
-  /* USB backup disabled for now, plan to work with 1 USB */
-  //this->Usb.KillDataBackup();
+  /* stop the USB backup, if running */
+  this->Usb.KillDataBackup();
 
   /* turn off all subsystems */
   /* leave zynq on all the time, for now */
@@ -935,25 +960,35 @@ void RunInstrument::Stop() {
  * start running the instrument according to specifications
  * checks for execute and exit functions,
  * then moves on to automated loop over mode switching
+ * @return the exit status of the program, from the tool run with -bench, -readrun or -recover
  */
-void RunInstrument::Start() {
+int RunInstrument::Start() {
 
   #if ARDUINO_DEBUG !=1
   /* check for execute-and-exit commands */
   if (this->CmdLine->lvps_on) {
     LvpsSwitch();
-    return;
+    return 0;
   }
   if (this->CmdLine->check_status) {   //Zynq check
     CheckStatus();
-    return;
+    return 0;
   }
 #endif
+  if (this->CmdLine->bench) {
+    return PktCodec::Benchmark();
+  }
+  if (!this->CmdLine->read_run_file.empty()) {
+    return RunFileReader::Benchmark(this->CmdLine->read_run_file);
+  }
+  if (!this->CmdLine->recover_run_file.empty()) {
+    return RunFileReader::Recover(this->CmdLine->recover_run_file);
+  }
 
   /* run start-up  */
   int check = this->StartUp();
   if (check !=0 ){
-    return;
+    return 0;
   }
 
   
@@ -962,11 +997,11 @@ void RunInstrument::Start() {
   /* check for execute-and-exit commands which require config */
   if (this->CmdLine->hvps_switch) {
     HvpsSwitch();
-    return;
+    return 0;
   }
   else if (this->CmdLine->debug_mode) {
     DebugMode();
-    return;
+    return 0;
   }
 #endif
 
@@ -978,14 +1013,16 @@ void RunInstrument::Start() {
     std::unique_lock<std::mutex> lock(this->Zynq.m_zynq);
     if (!this->Zynq.telnet_connected) {
       std::cout << "no Zynq connection, exiting the program" << std::endl;
-      return;
+      return 0;
     }
   }
 #endif
 
   /* launch data backup in background */
-  /* disable for now, planning to work with a single USB system */
-  //this->Usb.RunDataBackup();
+  /* not needed if the run files are mirrored as they are written */
+  if (this->ConfigOut->usb_backup && !this->ConfigOut->usb_mirror) {
+    this->Usb.RunDataBackup();
+  }
 
   /* launch background process to monitor the instrument */
   this->MonitorInstrument();
@@ -1028,5 +1065,5 @@ void RunInstrument::Start() {
   Stop();
 
   std::cout << "exiting the program..." << std::endl;
-  return;
+  return 0;
 }
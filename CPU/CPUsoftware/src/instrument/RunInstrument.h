@@ -8,6 +8,7 @@
 #include "DataReduction.h"
 #include "ArduinoManager.h"
 #include "ConfigManager.h"
+#include "RunFileReader.h"
 
 /* location of data files */
 #define HOME_DIR "/home/software/CPU"
@@ -59,7 +60,7 @@ public:
   ArduinoManager::LightLevelStatus current_lightlevel_status;
 
   RunInstrument(CmdLineInputs * CmdLine);
-  void Start();
+  int Start();
   void Stop();
 
   int SetInstMode(InstrumentMode mode_to_set);
@@ -36,9 +36,7 @@ int main(int argc, char ** argv) {
   
   /* run instrument according to specifications */
   RunInstrument  MiniEuso(CmdLine);
-  MiniEuso.Start();
-
-  return 0; 
+  return MiniEuso.Start();
 }
 
   
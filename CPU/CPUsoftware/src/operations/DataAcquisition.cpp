@@ -13,6 +13,9 @@ DataAcquisition::DataAcquisition() {
   /* usb storage devices */
   this->usb_num_storage_dev = 0;
 
+  /* no CPU run yet */
+  this->_cpu_run_open = false;
+
   /* number of files written */
   {
     std::unique_lock<std::mutex> lock(this->m_nfiles);     
@@ -21,6 +24,7 @@ DataAcquisition::DataAcquisition() {
   
   /* scurve acquisition */
   this->_scurve = false;
+  this->_sc_read_out = false;
 }
   
 /** 
@@ -78,8 +82,15 @@ std::string DataAcquisition::CreateCpuRunName(RunType run_type, std::shared_ptr<
   struct tm * now_tm = localtime(&now);
   
   strftime(cpu_file_name, sizeof(cpu_file_name), kCpuCh, now_tm);
+
+  /* never append to a run started within the same second */
+  std::string run_file_name = cpu_file_name;
+  size_t ext_pos = run_file_name.rfind(".dat");
+  for (int i = 1; access(run_file_name.c_str(), F_OK) == 0; i++) {
+    run_file_name = std::string(cpu_file_name).substr(0, ext_pos) + "__" + std::to_string(i) + ".dat";
+  }
  
-  return cpu_file_name;
+  return run_file_name;
 }
 
 /**
@@ -121,37 +132,146 @@ std::string DataAcquisition::BuildCpuFileInfo(std::shared_ptr<Config> ConfigOut,
   return run_info_string;
 }
 
+/**
+ * size of an uncompressed CPU_PACKET in the run file
+ * @param ConfigOut the configuration, giving N1 and N2
+ */
+size_t DataAcquisition::CpuPktSize(std::shared_ptr<Config> ConfigOut) {
+
+  return sizeof(CpuPktHeader) + sizeof(CpuTimeStamp) + sizeof(HK_PACKET) + 2 * sizeof(uint8_t)
+    + MappedZynqFile::ExpectedSize(ConfigOut->N1, ConfigOut->N2);
+}
+
+/**
+ * expected size of a run file, used to preallocate it.
+ * CPU runs are sized for the uncompressed packets expected from RunRotation,
+ * or the length of a single run, and HV runs for the longest HVPS log
+ * @param run_type defines the file run type
+ * @param ConfigOut the configuration, giving N1 and N2
+ * @param CmdLine the command line parameters
+ */
+off_t DataAcquisition::ExpectedRunSize(RunType run_type, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine) {
+
+  off_t size = sizeof(CpuFileHeader) + sizeof(CpuFileTrailer);
+  switch (run_type) {
+  case CPU: {
+    off_t n_packets = CmdLine->single_run ? CmdLine->acq_len : this->_rotation.ExpectedPackets(CpuPktSize(ConfigOut));
+    size += n_packets * (CpuPktSize(ConfigOut) + sizeof(CpuPktIndexEntry)) + sizeof(CpuFileIndex);
+    break;
+  }
+  case SC:
+    size += sizeof(SC_PACKET);
+    break;
+  case HV:
+    size += sizeof(CpuPktHeader) + sizeof(CpuTimeStamp) + sizeof(uint32_t) + sizeof(ZynqBoardHeader)
+      + HVPS_LOG_SIZE_NRECORDS * sizeof(DATA_TYPE_HVPS_LOG_V1);
+    break;
+  }
+
+  return std::min(size, (off_t)MAX_RUN_FILE_SIZE);
+}
+
+/**
+ * open the file of a run, ready to write.
+ * the file is preallocated and written in blocks if configured, 
+ * so this may take some time on FAT32 USB storage
+ * @param run_type defines the file run type
+ * @param path path to the file
+ * @param ConfigOut the output of configuration parsing with ConfigManager
+ * @param CmdLine the command line parameters
+ */
+std::shared_ptr<SynchronisedFile> DataAcquisition::OpenRunFile(RunType run_type, std::string path, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine) {
+
+  FileBackend::BackendType backend_type = (FileBackend::BackendType)ConfigOut->file_backend;
+  std::shared_ptr<SynchronisedFile> run_file = std::make_shared<SynchronisedFile>(path, backend_type, ConfigOut->direct_io);
+  run_file->verify_checksum = ConfigOut->crc_verify;
+
+  /* write whole clusters to contiguous space, for FAT32 USB storage */
+  if (ConfigOut->write_block_kb > 0) {
+    run_file->SetBlockSize((size_t)ConfigOut->write_block_kb * 1024);
+  }
+  if (ConfigOut->fat32_prealloc) {
+    run_file->Preallocate(ExpectedRunSize(run_type, ConfigOut, CmdLine));
+  }
+
+  return run_file;
+}
+
 /**
  * make a cpu data file for a new run 
  * @param run_type defines the file run type
  * @param ConfigOut the output of configuration parsing with ConfigManager
- * sets up the synchonised file access and notifies the ThermManager object
+ * sets up the synchonised file access and notifies the ThermManager object.
+ * CPU runs use the file opened in the background for them, if there is one,
+ * and start opening the file of the next run
  */
 int DataAcquisition::CreateCpuRun(RunType run_type, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine) {
 
   CpuFileHeader * cpu_file_header = new CpuFileHeader();
+  std::shared_ptr<SynchronisedFile> next_file;
   
   /* set the cpu file name */
   switch (run_type) {
   case CPU: 
     this->cpu_main_file_name = CreateCpuRunName(CPU, ConfigOut, CmdLine);
     clog << "info: " << logstream::info << "Set cpu_main_file_name to: " << cpu_main_file_name << std::endl;
-    this->CpuFile = std::make_shared<SynchronisedFile>(this->cpu_main_file_name);
+
+    /* the file prepared for this run is renamed, as it was opened before the run started */
+    if (this->_next_run.valid()) {
+      next_file = this->_next_run.get();
+      if (!next_file->Rename(this->cpu_main_file_name)) {
+	next_file->Close();
+	std::remove(next_file->path.c_str());
+	next_file = nullptr;
+      }
+    }
+    this->CpuFile = next_file ? next_file : OpenRunFile(CPU, this->cpu_main_file_name, ConfigOut, CmdLine);
     cpu_file_header->header = CpuTools::BuildCpuHeader(CPU_FILE_TYPE, CPU_FILE_VER);
+
+    /* preallocate the packets for this run, sized from N1 and N2 */
+    this->_zynq_pool.Reserve(ZYNQ_POOL_SIZE, [ConfigOut](ZYNQ_PACKET & zynq_packet) {
+	zynq_packet.level1_data.reserve(ConfigOut->N1);
+	zynq_packet.level2_data.reserve(ConfigOut->N2);
+      });
+    this->_hk_pool.Reserve(ZYNQ_POOL_SIZE);
+    if (ConfigOut->compress) {
+      this->_cmp_buf.reserve(PktCodec::MaxSegmentSize(PktCodec::D1) * ConfigOut->N1
+			     + PktCodec::MaxSegmentSize(PktCodec::D2) * ConfigOut->N2
+			     + PktCodec::MaxSegmentSize(PktCodec::D3));
+      this->_cmp_scratch.Reserve(N_OF_PIXEL_PER_PDM);
+    }
     break;
   case SC: 
     this->cpu_sc_file_name = CreateCpuRunName(SC, ConfigOut, CmdLine);
     clog << "info: " << logstream::info << "Set cpu_sc_file_name to: " << cpu_sc_file_name << std::endl;
-    this->CpuFile = std::make_shared<SynchronisedFile>(this->cpu_sc_file_name);
+    this->CpuFile = OpenRunFile(SC, this->cpu_sc_file_name, ConfigOut, CmdLine);
     cpu_file_header->header = CpuTools::BuildCpuHeader(SC_FILE_TYPE, SC_FILE_VER);
+    this->_sc_pool.Reserve(1);
     break;
   case HV:
     this->cpu_hv_file_name = CreateCpuRunName(HV, ConfigOut, CmdLine);
     clog << "info: " << logstream::info << "Set cpu_hv_file_name to: " << cpu_hv_file_name << std::endl;
-    this->CpuFile = std::make_shared<SynchronisedFile>(this->cpu_hv_file_name);
+    this->CpuFile = OpenRunFile(HV, this->cpu_hv_file_name, ConfigOut, CmdLine);
     cpu_file_header->header = CpuTools::BuildCpuHeader(HV_FILE_TYPE, HV_FILE_VER);
+    this->_hv_pool.Reserve(1, [](HV_PACKET & hv_packet) {
+	hv_packet.hvps_log.reserve(HVPS_LOG_SIZE_NRECORDS);
+      });
     break;
   }
+
+  /* copy the run to the second USB storage device as it is written */
+  if (ConfigOut->usb_mirror && this->usb_num_storage_dev == 2) {
+    if (!this->_mirror) {
+      this->_mirror = std::make_shared<FileMirror>(USB_MOUNTPOINT_0, USB_MOUNTPOINT_1, true);
+    }
+    this->CpuFile->SetMirror(this->_mirror);
+  }
+
+  /* write from a separate thread to avoid waiting on USB storage */
+  if (ConfigOut->async_write) {
+    this->CpuFile->StartAsync((size_t)ConfigOut->async_queue_mb * 1024 * 1024,
+			      (SynchronisedFile::Backpressure)ConfigOut->async_backpressure, DONE_DIR);
+  }
   this->RunAccess = new Access(this->CpuFile);
 
   /* access for ThermManager */
@@ -161,16 +281,33 @@ int DataAcquisition::CreateCpuRun(RunType run_type, std::shared_ptr<Config> Conf
   std::string run_info_string = BuildCpuFileInfo(ConfigOut, CmdLine);
   strncpy(cpu_file_header->run_info, run_info_string.c_str(), (size_t)run_info_string.length());
 
+  /* the expected number of packets, the trailer has the number written */
   if (CmdLine->single_run) {
     cpu_file_header->run_size = CmdLine->acq_len;
   }
+  else if (run_type == CPU) {
+    cpu_file_header->run_size = this->_rotation.ExpectedPackets(CpuPktSize(ConfigOut));
+  }
   else {
-    cpu_file_header->run_size = RUN_SIZE;
+    cpu_file_header->run_size = 1;
   }
  
   /* write to file */
   this->RunAccess->WriteToSynchFile<CpuFileHeader *>(cpu_file_header, SynchronisedFile::CONSTANT, ConfigOut);
   delete cpu_file_header;
+
+  /* open the file of the next run in the background, next to this one */
+  if (run_type == CPU) {
+    this->_cpu_run_open = true;
+    this->_rotation.Started();
+    if (!CmdLine->single_run) {
+      std::string next_path = this->cpu_main_file_name.substr(0, this->cpu_main_file_name.find_last_of('/') + 1)
+	+ NEXT_RUN_FILE_NAME;
+      std::remove(next_path.c_str());
+      this->_next_run = std::async(std::launch::async, &DataAcquisition::OpenRunFile, this,
+				   CPU, next_path, ConfigOut, CmdLine);
+    }
+  }
   
   /* notify the ThermManager */
   /* will this only work the first time? */
@@ -180,28 +317,127 @@ int DataAcquisition::CreateCpuRun(RunType run_type, std::shared_ptr<Config> Conf
   return 0;
 }
 
+/**
+ * start the first CPU run, then a new one each time RunRotation finds the
+ * current run complete. the new run goes to the file already opened for it
+ * and the last run is finished in the background, so that no packet waits
+ * for the run files. called before writing each CPU packet
+ * @param ConfigOut the output of configuration parsing with ConfigManager
+ * @param CmdLine the command line parameters
+ * @return true if a new run was started
+ */
+bool DataAcquisition::RotateCpuRun(std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine) {
+
+  if (!this->_cpu_run_open) {
+    CreateCpuRun(CPU, ConfigOut, CmdLine);
+    return true;
+  }
+
+  RunRotation::Reason reason = this->_rotation.Due(this->CpuFile->Size(), CpuPktSize(ConfigOut));
+  if (reason == RunRotation::NONE) {
+    return false;
+  }
+  clog << "info: " << logstream::info << "run file " << this->CpuFile->path << " reached the "
+       << RunRotation::ReasonName(reason) << " with " << this->_rotation.Packets() << " packets, "
+       << this->CpuFile->Size() << " bytes, starting a new run" << std::endl;
+
+  std::shared_ptr<SynchronisedFile> last_file = this->CpuFile;
+  unsigned int n_packets = this->_rotation.Packets();
+
+  /* only one run is finished at a time */
+  if (this->_closing_run.valid()) {
+    this->_closing_run.get();
+  }
+  CreateCpuRun(CPU, ConfigOut, CmdLine);
+  this->_closing_run = std::async(std::launch::async, &DataAcquisition::FinishRun, this,
+				  CPU, last_file, n_packets);
+
+  return true;
+}
+
+/**
+ * count a CPU packet written to the run, and write a checkpoint record
+ * every CHECKPOINT_PKTS packets, synced to the storage device every
+ * FSYNC_CHECKPOINTS checkpoints
+ * @param ConfigOut the output of configuration parsing with ConfigManager
+ */
+void DataAcquisition::CpuPktWritten(std::shared_ptr<Config> ConfigOut) {
+
+  this->_rotation.Written();
+
+  unsigned int n_packets = this->_rotation.Packets();
+  if (ConfigOut->checkpoint_pkts <= 0 || n_packets % ConfigOut->checkpoint_pkts != 0) {
+    return;
+  }
+  unsigned int n_checkpoints = n_packets / ConfigOut->checkpoint_pkts;
+  bool sync = ConfigOut->fsync_checkpoints > 0 && n_checkpoints % ConfigOut->fsync_checkpoints == 0;
+  this->RunAccess->WriteCheckpointToSynchFile(n_packets, sync);
+}
+
 /**
  * close the CPU file run and append CRC.
  * this closes the run and runs a CRC calculation which is 
- * the stored in the file trailer and appended
+ * the stored in the file trailer and appended.
+ * for CPU runs, waits for the last run to be finished and removes
+ * the file opened for the next run
  */
 int DataAcquisition::CloseCpuRun(RunType run_type) {
 
+  unsigned int n_packets = 1;
+  if (run_type == CPU) {
+    if (this->_closing_run.valid()) {
+      this->_closing_run.get();
+    }
+    DiscardNextRun();
+    n_packets = this->_rotation.Packets();
+    this->_cpu_run_open = false;
+  }
+
+  return FinishRun(run_type, this->CpuFile, n_packets);
+}
+
+/**
+ * write the trailer of a run and close its file,
+ * with the packet index first for CPU runs
+ * @param run_type defines the file run type
+ * @param run_file the file of the run
+ * @param n_packets the number of CPU packets in the run, stored in the trailer
+ */
+int DataAcquisition::FinishRun(RunType run_type, std::shared_ptr<SynchronisedFile> run_file, unsigned int n_packets) {
+
   CpuFileTrailer * cpu_file_trailer = new CpuFileTrailer();
+  Access run_access(run_file);
   
-  clog << "info: " << logstream::info << "closing the cpu run file called " << this->CpuFile->path << std::endl;
+  clog << "info: " << logstream::info << "closing the cpu run file called " << run_file->path << std::endl;
   
-  /* set up the cpu file trailer */
-  cpu_file_trailer->header = CpuTools::BuildCpuHeader(TRAILER_PACKET_TYPE, CPU_FILE_VER);
-  cpu_file_trailer->run_size = RUN_SIZE;
-  cpu_file_trailer->crc = this->RunAccess->GetChecksum(); 
+  /* set up the cpu file trailer, CPU runs also get the packet index */
+  switch (run_type) {
+  case CPU:
+    run_access.WriteIndexToSynchFile();
+    if (this->_cmp_pool) {
+      this->_cmp_pool->PrintStats();
+    }
+    cpu_file_trailer->header = CpuTools::BuildCpuHeader(TRAILER_PACKET_TYPE, CPU_FILE_VER);
+    break;
+  case SC:
+    cpu_file_trailer->header = CpuTools::BuildCpuHeader(TRAILER_PACKET_TYPE, SC_FILE_VER);
+    break;
+  case HV:
+    cpu_file_trailer->header = CpuTools::BuildCpuHeader(TRAILER_PACKET_TYPE, HV_FILE_VER);
+    break;
+  }
+  cpu_file_trailer->run_size = n_packets;
+  cpu_file_trailer->crc = run_access.GetChecksum(); 
 
   /* write to file */
-  this->RunAccess->WriteToSynchFile<CpuFileTrailer *>(cpu_file_trailer, SynchronisedFile::CONSTANT);
+  run_access.WriteToSynchFile<CpuFileTrailer *>(cpu_file_trailer, SynchronisedFile::CONSTANT);
   delete cpu_file_trailer;
 
-  /* close the current SynchronisedFile */
-  this->RunAccess->CloseSynchFile();
+  /* close the SynchronisedFile */
+  run_access.CloseSynchFile();
+  if (this->_mirror) {
+    this->_mirror->PrintStats();
+  }
 
   /* update number of packets written */
   {
@@ -212,14 +448,29 @@ int DataAcquisition::CloseCpuRun(RunType run_type) {
   return 0;
 }
 
+/**
+ * close and remove the file opened for the next CPU run, if not used
+ */
+void DataAcquisition::DiscardNextRun() {
+
+  if (!this->_next_run.valid()) {
+    return;
+  }
+  std::shared_ptr<SynchronisedFile> next_file = this->_next_run.get();
+  if (next_file) {
+    std::string path = next_file->path;
+    next_file->Close();
+    std::remove(path.c_str());
+  }
+}
+
 
 /**
  * read out an scurve file into an SC_PACKET. 
  */
-SC_PACKET * DataAcquisition::ScPktReadOut(std::string sc_file_name, std::shared_ptr<Config> ConfigOut) {
+PktHandle<SC_PACKET> DataAcquisition::ScPktReadOut(std::string sc_file_name, std::shared_ptr<Config> ConfigOut) {
 
   FILE * ptr_scfile;
-  SC_PACKET * sc_packet = new SC_PACKET();
   const char * kScFileName = sc_file_name.c_str();
   size_t check;
 
@@ -228,10 +479,15 @@ SC_PACKET * DataAcquisition::ScPktReadOut(std::string sc_file_name, std::shared_
   ptr_scfile = fopen(kScFileName, "rb");
   if (!ptr_scfile) {
     clog << "error: " << logstream::error << "cannot open the file " << sc_file_name << std::endl;
-    return NULL;
+    return PktHandle<SC_PACKET>();
   }
   
   /* prepare the scurve packet */
+  PktHandle<SC_PACKET> sc_packet = this->_sc_pool.Acquire();
+  if (!sc_packet) {
+    fclose(ptr_scfile);
+    return sc_packet;
+  }
   sc_packet->sc_packet_header.header = CpuTools::BuildCpuHeader(SC_PACKET_TYPE, SC_PACKET_VER);
   sc_packet->sc_packet_header.pkt_size = sizeof(SC_PACKET);
   sc_packet->sc_time.cpu_time_stamp = CpuTools::BuildCpuTimeStamp();
@@ -240,12 +496,6 @@ SC_PACKET * DataAcquisition::ScPktReadOut(std::string sc_file_name, std::shared_
   sc_packet->sc_stop = ConfigOut->scurve_stop;
   sc_packet->sc_acc = ConfigOut->scurve_acc;
 
-  ptr_scfile = fopen(kScFileName, "rb");
-  if (!ptr_scfile) {
-    clog << "error: " << logstream::error << "cannot open the file " << sc_file_name << std::endl;
-    return NULL;
-  }
-
   /* read out the scurve data from the file */
   check = fread(&sc_packet->sc_data, sizeof(sc_packet->sc_data), 1, ptr_scfile);
   if (check != 1) {
@@ -256,8 +506,9 @@ SC_PACKET * DataAcquisition::ScPktReadOut(std::string sc_file_name, std::shared_
     std::cout << "check: " << check << std::endl;
     std::cout << "feof: " << feof(ptr_scfile) << std::endl;
     std::cout << "ferror: " << ferror(ptr_scfile) << std::endl;
- 
-    return NULL;   
+
+    fclose(ptr_scfile);
+    return PktHandle<SC_PACKET>();   
   }
  
   /* close the scurve file */
@@ -270,13 +521,21 @@ SC_PACKET * DataAcquisition::ScPktReadOut(std::string sc_file_name, std::shared_
 /**
  * read out a hv file into an HV_PACKET 
  */
-HV_PACKET * DataAcquisition::HvPktReadOut(std::string hv_file_name, std::shared_ptr<Config> ConfigOut) {
-
-  HV_PACKET * hv_packet = new HV_PACKET();
+PktHandle<HV_PACKET> DataAcquisition::HvPktReadOut(std::string hv_file_name, std::shared_ptr<Config> ConfigOut) {
 
   clog << "info: " << logstream::info << "reading out the file " << hv_file_name << std::endl;
-    
+
+  std::ifstream hv_file(hv_file_name, std::ios::binary);
+  if (!hv_file) {
+    clog << "error: " << logstream::error << "cannot open the file " << hv_file_name << std::endl;
+    return PktHandle<HV_PACKET>();
+  }
+  
   /* prepare the hv packet */
+  PktHandle<HV_PACKET> hv_packet = this->_hv_pool.Acquire();
+  if (!hv_packet) {
+    return hv_packet;
+  }
   hv_packet->hv_packet_header.header = CpuTools::BuildCpuHeader(HV_PACKET_TYPE, HV_PACKET_VER);
   hv_packet->hv_packet_header.pkt_size = sizeof(HV_PACKET);
   hv_packet->hv_time.cpu_time_stamp = CpuTools::BuildCpuTimeStamp();
@@ -289,23 +548,18 @@ HV_PACKET * DataAcquisition::HvPktReadOut(std::string hv_file_name, std::shared_
   }
   hv_packet->N = n_entries;
   ConfigOut->hvps_log_len = n_entries;
+  /* capacity is reserved in the pool, so this does not allocate */
   hv_packet->hvps_log.resize(n_entries);
 
-  std::ifstream hv_file(hv_file_name, std::ios::binary);
-  if (!hv_file) {
-    clog << "error: " << logstream::error << "cannot open the file " << hv_file_name << std::endl;
-    return NULL;
-  }
-
   /* read out the zbh */
   hv_file.read(reinterpret_cast<char*>(&hv_packet->zbh), sizeof(ZynqBoardHeader));
   
   /* read out the hv data from the file */
-  hv_file.read(reinterpret_cast<char*>(&hv_packet->hvps_log[0]), hv_packet->hvps_log.size() * sizeof(DATA_TYPE_HVPS_LOG_V1));
+  hv_file.read(reinterpret_cast<char*>(hv_packet->hvps_log.data()), hv_packet->hvps_log.size() * sizeof(DATA_TYPE_HVPS_LOG_V1));
   if (!hv_file) {
     std::cout << "ERROR: fread from " << hv_file_name << " failed" << std::endl;
     clog << "error: " << logstream::error << "read from " << hv_file_name << " failed" << std::endl;
-    return NULL;
+    return PktHandle<HV_PACKET>();
   }
   
   /* close the hv file */
@@ -318,13 +572,9 @@ HV_PACKET * DataAcquisition::HvPktReadOut(std::string hv_file_name, std::shared_
 /**
  * read out a zynq data file into a ZYNQ_PACKET 
  */
-ZYNQ_PACKET * DataAcquisition::ZynqPktReadOut(std::string zynq_file_name, std::shared_ptr<Config> ConfigOut) {
+PktHandle<ZYNQ_PACKET> DataAcquisition::ZynqPktReadOut(std::string zynq_file_name, std::shared_ptr<Config> ConfigOut) {
 
   FILE * ptr_zfile;
-  ZYNQ_PACKET * zynq_packet = new ZYNQ_PACKET();
-  Z_DATA_TYPE_SCI_L1_V2 * zynq_d1_packet_holder = new Z_DATA_TYPE_SCI_L1_V2();
-  Z_DATA_TYPE_SCI_L2_V2 * zynq_d2_packet_holder = new Z_DATA_TYPE_SCI_L2_V2();
-
   const char * kZynqFileName = zynq_file_name.c_str();
   size_t check;
 
@@ -333,60 +583,47 @@ ZYNQ_PACKET * DataAcquisition::ZynqPktReadOut(std::string zynq_file_name, std::s
   ptr_zfile = fopen(kZynqFileName, "rb");
   if (!ptr_zfile) {
     clog << "error: " << logstream::error << "cannot open the file " << zynq_file_name << std::endl;
-    return nullptr;
+    return PktHandle<ZYNQ_PACKET>();
   }
 
-  
-  /* DEBUG */
-
-  /*
-  long fsize;
-  fseek(ptr_zfile, 0L, SEEK_END);
-  fsize = ftell(ptr_zfile);
-  rewind(ptr_zfile);
-
-  std::cout << "file size: " << fsize << std::endl;
-  std::cout << "sizeof(*zynq_packet): " << sizeof(*zynq_packet) << std::endl;  
-  std::cout << "zynq file name: " << zynq_file_name << std::endl;
-  std::cout << "ptr_zfile: " << ptr_zfile << std::endl;
-  std::cout << "zynq_packet: " << zynq_packet << std::endl;
-  */
+  PktHandle<ZYNQ_PACKET> zynq_packet = this->_zynq_pool.Acquire();
+  if (!zynq_packet) {
+    fclose(ptr_zfile);
+    return zynq_packet;
+  }
   
   /* write the number of N1 and N2 */
   zynq_packet->N1 = ConfigOut->N1;
   zynq_packet->N2 = ConfigOut->N2;
 
   /* read out a number of Zynq packets, depending on ConfigOut->N1 and ConfigOut->N2 */
+  /* capacity is reserved in the pool, so resizing does not allocate */
+  zynq_packet->level1_data.resize(ConfigOut->N1);
+  zynq_packet->level2_data.resize(ConfigOut->N2);
+  
   /* data level D1 */
-  for (int i = 0; i < ConfigOut->N1; i++) {
-    check = fread(zynq_d1_packet_holder, sizeof(*zynq_d1_packet_holder), 1, ptr_zfile);
-    if (check != 1) {
-      std::cout << "ERROR: fread from " << zynq_file_name << " failed" << std::endl;
-      std::cout << "Check: " << check << std::endl;
-      std::cout << "feof: " << feof(ptr_zfile) << std::endl;
-      std::cout << "ferror: " << ferror(ptr_zfile) << std::endl;
+  check = fread(zynq_packet->level1_data.data(), sizeof(Z_DATA_TYPE_SCI_L1_V2), ConfigOut->N1, ptr_zfile);
+  if (check != (size_t)ConfigOut->N1) {
+    std::cout << "ERROR: fread from " << zynq_file_name << " failed" << std::endl;
+    std::cout << "Check: " << check << std::endl;
+    std::cout << "feof: " << feof(ptr_zfile) << std::endl;
+    std::cout << "ferror: " << ferror(ptr_zfile) << std::endl;
   
-      clog << "error: " << logstream::error << "fread from " << zynq_file_name << " failed" << std::endl;
-      return nullptr;
-    }
-    zynq_packet->level1_data.push_back(*zynq_d1_packet_holder);
-    zynq_packet->level1_data.shrink_to_fit();
+    clog << "error: " << logstream::error << "fread from " << zynq_file_name << " failed" << std::endl;
+    fclose(ptr_zfile);
+    return PktHandle<ZYNQ_PACKET>();
   }
   /* data level D2 */
-  for (int i = 0; i < ConfigOut->N2; i++) {
-    check = fread(zynq_d2_packet_holder, sizeof(*zynq_d2_packet_holder), 1, ptr_zfile);
-    if (check != 1) {
-      std::cout << "ERROR: fread from " << zynq_file_name << " failed" << std::endl;
-      std::cout << "Check: " << check << std::endl;
-      std::cout << "feof: " << feof(ptr_zfile) << std::endl;
-      std::cout << "ferror: " << ferror(ptr_zfile) << std::endl;
+  check = fread(zynq_packet->level2_data.data(), sizeof(Z_DATA_TYPE_SCI_L2_V2), ConfigOut->N2, ptr_zfile);
+  if (check != (size_t)ConfigOut->N2) {
+    std::cout << "ERROR: fread from " << zynq_file_name << " failed" << std::endl;
+    std::cout << "Check: " << check << std::endl;
+    std::cout << "feof: " << feof(ptr_zfile) << std::endl;
+    std::cout << "ferror: " << ferror(ptr_zfile) << std::endl;
   
-      clog << "error: " << logstream::error << "fread from " << zynq_file_name << " failed" << std::endl;
-
-      return nullptr;
-    }
-    zynq_packet->level2_data.push_back(*zynq_d2_packet_holder);
-    zynq_packet->level2_data.shrink_to_fit();
+    clog << "error: " << logstream::error << "fread from " << zynq_file_name << " failed" << std::endl;
+    fclose(ptr_zfile);
+    return PktHandle<ZYNQ_PACKET>();
   } 
   /* data level D3 */
   check = fread(&zynq_packet->level3_data, sizeof(zynq_packet->level3_data), 1, ptr_zfile);
@@ -396,33 +633,26 @@ ZYNQ_PACKET * DataAcquisition::ZynqPktReadOut(std::string zynq_file_name, std::s
     std::cout << "feof: " << feof(ptr_zfile) << std::endl;
     std::cout << "ferror: " << ferror(ptr_zfile) << std::endl;
     clog << "error: " << logstream::error << "fread from " << zynq_file_name << " failed" << std::endl;
-    return nullptr;
+    fclose(ptr_zfile);
+    return PktHandle<ZYNQ_PACKET>();
   }
   
-  /* DEBUG */
-  /*
-  std::cout << "header D1 P0 = " << zynq_packet->level1_data[0].zbh.header << std::endl;
-  std::cout << "payload_size D1 P0 = " << zynq_packet->level1_data[0].zbh.payload_size << std::endl;
-  std::cout << "n_gtu D1 P0 = " << zynq_packet->level1_data[0].payload.ts.n_gtu << std::endl; 
-  */
-  
   /* close the zynq file */
   fclose(ptr_zfile);
 
-  /* clean up */
-  delete zynq_d1_packet_holder;
-  delete zynq_d2_packet_holder;
-  
   return zynq_packet;
 }
 
 /**
  * read out a HK_PACKET from the analog board 
  */
-HK_PACKET * DataAcquisition::AnalogPktReadOut() {
+PktHandle<HK_PACKET> DataAcquisition::AnalogPktReadOut() {
 
   int i, j = 0;
-  HK_PACKET * hk_packet = new HK_PACKET();
+  PktHandle<HK_PACKET> hk_packet = this->_hk_pool.Acquire();
+  if (!hk_packet) {
+    return hk_packet;
+  }
  
   /* collect data */
   auto light_level = this->Analog->ReadLightLevel();
@@ -453,64 +683,184 @@ HK_PACKET * DataAcquisition::AnalogPktReadOut() {
  * @param ConfigOut the configuration struct output of ConfigManager
  * asynchronous writes to the CPU file are handled with the SynchronisedFile class
  */
-int DataAcquisition::WriteCpuPkt(ZYNQ_PACKET * zynq_packet, HK_PACKET * hk_packet, std::shared_ptr<Config> ConfigOut) {
+int DataAcquisition::WriteCpuPkt(PktHandle<ZYNQ_PACKET> zynq_packet, PktHandle<HK_PACKET> hk_packet, std::shared_ptr<Config> ConfigOut) {
+
+  /* check for NULL */
+  if (!zynq_packet) {
+    std::cout << "ERROR: Zynq packet is NULL, packet not written" << std::endl;
+    clog << "error: " << logstream::error << "Zynq packet is NULL, packet not written" << std::endl;
+    return 1;
+  }
+
+  /* write from the packet held in memory */
+  /* the packets go back to their pools on return */
+  ZynqPktView zynq_view = MappedZynqFile::MakeView(zynq_packet.get());
+  return WriteCpuPkt(zynq_view, std::move(hk_packet), ConfigOut);
+}
+
+/**
+ * write the CPU_PACKET to the current CPU file 
+ * @param zynq_file_name the frm_cc file from the Zynq
+ * @param hk_packet the HK data acquired from the analog board
+ * @param ConfigOut the configuration struct output of ConfigManager
+ * the Zynq data is copied from the file by the kernel and never read into memory
+ * asynchronous writes to the CPU file are handled with the SynchronisedFile class
+ * @return 0 on success, 1 if the file is bad or its data could not be copied, so that it is kept
+ */
+int DataAcquisition::WriteCpuPkt(std::string zynq_file_name, PktHandle<HK_PACKET> hk_packet, std::shared_ptr<Config> ConfigOut) {
+
+  /* the data has to be read to be compressed */
+  if (ConfigOut->compress) {
+    MappedZynqFile zynq_file(zynq_file_name, ConfigOut->N1, ConfigOut->N2);
+    if (!zynq_file.IsValid()) {
+      return 1;
+    }
+    return WriteCpuPkt(zynq_file.view, std::move(hk_packet), ConfigOut);
+  }
+
+  int fd = open(zynq_file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    clog << "error: " << logstream::error << "cannot open the file " << zynq_file_name << std::endl;
+    return 1;
+  }
+
+  /* check the file holds a full packet */
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < MappedZynqFile::ExpectedSize(ConfigOut->N1, ConfigOut->N2)) {
+    clog << "error: " << logstream::error << "file " << zynq_file_name << " is too small for N1 = "
+	 << (int)ConfigOut->N1 << " and N2 = " << (int)ConfigOut->N2 << std::endl;
+    close(fd);
+    return 1;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  /* only N1 and N2 are taken from the view */
+  ZynqPktView zynq_view;
+  zynq_view.N1 = ConfigOut->N1;
+  zynq_view.N2 = ConfigOut->N2;
+  zynq_view.level3_data = nullptr;
+  int ret = WriteCpuPkt(zynq_view, std::move(hk_packet), ConfigOut, fd);
+
+  close(fd);
+  return ret;
+}
+
+/**
+ * write the CPU_PACKET to the current CPU file 
+ * @param zynq_view views of the Zynq data acquired from the PDM, eg. from a MappedZynqFile
+ * @param hk_packet the HK data acquired from the analog board
+ * @param ConfigOut the configuration struct output of ConfigManager
+ * @param zynq_fd if given, the D1, D2 and D3 data are copied from the start of this file
+ * instead of from the views
+ * the Zynq data is written directly from the views, without building a CPU_PACKET in memory
+ * asynchronous writes to the CPU file are handled with the SynchronisedFile class
+ * @return 0 on success, 1 if the Zynq data could not be copied from zynq_fd
+ */
+int DataAcquisition::WriteCpuPkt(const ZynqPktView & zynq_view, PktHandle<HK_PACKET> hk_packet, std::shared_ptr<Config> ConfigOut, int zynq_fd) {
 
-  CPU_PACKET * cpu_packet = new CPU_PACKET();
+  CpuPktHeader cpu_packet_header;
+  CpuTimeStamp cpu_time;
+  HK_PACKET hk_out = HK_PACKET();
+  uint8_t N1 = zynq_view.N1;
+  uint8_t N2 = zynq_view.N2;
   static unsigned int pkt_counter = 0;
 
   clog << "info: " << logstream::info << "writing new packet to " << this->cpu_main_file_name << std::endl;
   
   /* create the cpu packet header */
-  cpu_packet->cpu_packet_header.header = CpuTools::BuildCpuHeader(CPU_PACKET_TYPE, CPU_PACKET_VER);
-  cpu_packet->cpu_packet_header.pkt_size = sizeof(*cpu_packet);
-  cpu_packet->cpu_packet_header.pkt_num = pkt_counter; 
-  cpu_packet->cpu_time.cpu_time_stamp = CpuTools::BuildCpuTimeStamp();
-  hk_packet->hk_packet_header.pkt_num = pkt_counter;
-
-  /* add the zynq and hk packets, checking for NULL */
-  if (zynq_packet != nullptr) {
-    cpu_packet->zynq_packet = * zynq_packet;
-  }
-  else {
-    std::cout << "ERROR: Zynq packet is NULL, writing empty packet" << std::endl;
-    clog << "error: " << logstream::error << "Zynq packet is NULL, writing empty packet" << std::endl;
-  }
-  delete zynq_packet;
- 
-  if (hk_packet != nullptr) {
-    cpu_packet->hk_packet = * hk_packet;
+  cpu_packet_header.header = CpuTools::BuildCpuHeader(CPU_PACKET_TYPE, CPU_PACKET_VER);
+  cpu_packet_header.pkt_size = sizeof(CPU_PACKET);
+  cpu_packet_header.pkt_num = pkt_counter; 
+  cpu_time.cpu_time_stamp = CpuTools::BuildCpuTimeStamp();
+
+  /* add the hk packet, checking for NULL */
+  if (hk_packet) {
+    hk_out = * hk_packet;
+    hk_out.hk_packet_header.pkt_num = pkt_counter;
   }
   else {
     std::cout << "ERROR: HK packet is NULL, writing empty packet" << std::endl;
     clog << "error: " << logstream::error << "HK packet is NULL, writing empty packet" << std::endl;    
   }
-  delete hk_packet;
- 
+  hk_packet.Reset();
 
-  /* write the CPU packet */
-  //this->RunAccess->WriteToSynchFile<CPU_PACKET *>(cpu_packet, SynchronisedFile::VARIABLE, ConfigOut);
+  /* gather the CPU packet */
+  PacketBuilder cpu_packet;
   /* cpu header */
-  this->RunAccess->WriteToSynchFile<CpuPktHeader *>(&cpu_packet->cpu_packet_header,
-						    SynchronisedFile::CONSTANT);
-  this->RunAccess->WriteToSynchFile<CpuTimeStamp *>(&cpu_packet->cpu_time,
-						    SynchronisedFile::CONSTANT);
+  cpu_packet.Add(&cpu_packet_header);
+  cpu_packet.Add(&cpu_time);
   /* hk packet */
-  this->RunAccess->WriteToSynchFile<HK_PACKET *> (&cpu_packet->hk_packet,
-						  SynchronisedFile::CONSTANT);
+  cpu_packet.Add(&hk_out);
   /* zynq packet */
-  this->RunAccess->WriteToSynchFile<uint8_t *>(&cpu_packet->zynq_packet.N1,
-					       SynchronisedFile::CONSTANT);
-  this->RunAccess->WriteToSynchFile<uint8_t *>(&cpu_packet->zynq_packet.N2,
-					       SynchronisedFile::CONSTANT);
-  this->RunAccess->WriteToSynchFile<Z_DATA_TYPE_SCI_L1_V2 *>(&cpu_packet->zynq_packet.level1_data[0],
-							     SynchronisedFile::VARIABLE_D1, ConfigOut);
-  this->RunAccess->WriteToSynchFile<Z_DATA_TYPE_SCI_L2_V2 *>(&cpu_packet->zynq_packet.level2_data[0],
-							      SynchronisedFile::VARIABLE_D2, ConfigOut);
-  this->RunAccess->WriteToSynchFile<Z_DATA_TYPE_SCI_L3_V2 *>(&cpu_packet->zynq_packet.level3_data,
-							      SynchronisedFile::CONSTANT);
-
-  delete cpu_packet; 
+  cpu_packet.Add(&N1);
+  cpu_packet.Add(&N2);
+
+  /* entry in the packet index of the run, the offset is set when written */
+  CpuPktIndexEntry index_entry = CpuPktIndexEntry();
+  index_entry.pkt_type = CPU_PACKET_TYPE;
+  index_entry.pkt_num = pkt_counter;
+  index_entry.unix_time = cpu_time.cpu_time_stamp;
+  /* GTU counter of the packet, from the timestamp of the D3 data */
+  if (zynq_view.level3_data) {
+    index_entry.n_gtu = zynq_view.level3_data->payload.ts.n_gtu;
+  }
+  else if (zynq_fd >= 0) {
+    off_t gtu_offset = N1 * sizeof(Z_DATA_TYPE_SCI_L1_V2) + N2 * sizeof(Z_DATA_TYPE_SCI_L2_V2)
+      + offsetof(Z_DATA_TYPE_SCI_L3_V2, payload.ts.n_gtu);
+    if (pread(zynq_fd, &index_entry.n_gtu, sizeof(index_entry.n_gtu), gtu_offset) != sizeof(index_entry.n_gtu)) {
+      index_entry.n_gtu = 0;
+    }
+  }
+
+  if (zynq_fd >= 0) {
+
+    /* D1, D2 and D3 are contiguous in the file */
+    /* the file is kept if the packet is not completely written */
+    size_t zynq_size = MappedZynqFile::ExpectedSize(N1, N2);
+    size_t written = this->RunAccess->WritePktFromFileToSynchFile(cpu_packet, zynq_fd, 0, zynq_size,
+								  SynchronisedFile::SCIENCE, &index_entry);
+    if (written != cpu_packet.Size() + zynq_size) {
+      clog << "error: " << logstream::error << "cannot copy the Zynq data to " << this->cpu_main_file_name << std::endl;
+      return 1;
+    }
+  }
+  else if (ConfigOut->compress) {
+
+    /* the pixel data is replaced by its compressed version */
+    size_t cmp_size = 0;
+    if (ConfigOut->cmp_threads > 0) {
+      if (!this->_cmp_pool) {
+	this->_cmp_pool.reset(new CompressionPool(ConfigOut->cmp_threads, ConfigOut->cmp_nice));
+      }
+      cmp_size = this->_cmp_pool->EncodeZynqData(zynq_view, ConfigOut->compress, this->_cmp_buf);
+    }
+    else {
+      cmp_size = PktCodec::EncodeZynqData(zynq_view, ConfigOut->compress, this->_cmp_buf, this->_cmp_scratch);
+    }
+    cpu_packet.Add(this->_cmp_buf.data(), cmp_size);
+    cpu_packet_header.header = CpuTools::BuildCpuHeader(CPU_PACKET_TYPE, CPU_PACKET_VER_CMP);
+    cpu_packet_header.pkt_size = cpu_packet.Size();
+    
+    this->RunAccess->WritePktToSynchFile(cpu_packet, SynchronisedFile::SCIENCE, &index_entry);
+  }
+  else {
+    cpu_packet.Add(zynq_view.level1_data.data(), zynq_view.level1_data.size());
+    cpu_packet.Add(zynq_view.level2_data.data(), zynq_view.level2_data.size());
+    cpu_packet.Add(zynq_view.level3_data);
+
+    /* write the CPU packet in one go */
+    this->RunAccess->WritePktToSynchFile(cpu_packet, SynchronisedFile::SCIENCE, &index_entry);
+  }
+
   pkt_counter++;
+
+  /* packets queued earlier that the asynchronous writer could not write */
+  unsigned int n_lost = this->RunAccess->LostFromSynchFile();
+  if (n_lost > 0) {
+    std::cout << "ERROR: " << n_lost << " packets were lost writing " << this->cpu_main_file_name << std::endl;
+    clog << "error: " << logstream::error << n_lost << " packets were lost writing "
+	 << this->cpu_main_file_name << std::endl;
+  }
   
   return 0;
 }
@@ -521,15 +871,18 @@ int DataAcquisition::WriteCpuPkt(ZYNQ_PACKET * zynq_packet, HK_PACKET * hk_packe
  * @param sc_packet the Scurve data from the Zynq board
  * asynchronous writes to the CPU file are handled with the SynchronisedFile class
  */
-int DataAcquisition::WriteScPkt(SC_PACKET * sc_packet) {
+int DataAcquisition::WriteScPkt(PktHandle<SC_PACKET> sc_packet) {
 
   static unsigned int pkt_counter = 0;
 
+  if (!sc_packet) {
+    return 1;
+  }
+
   clog << "info: " << logstream::info << "writing new packet to " << this->cpu_sc_file_name << std::endl;
 
   /* write the SC packet */
-  this->RunAccess->WriteToSynchFile<SC_PACKET *>(sc_packet, SynchronisedFile::CONSTANT);
-  delete sc_packet;
+  this->RunAccess->WriteToSynchFile<SC_PACKET *>(sc_packet.get(), SynchronisedFile::CONSTANT);
   pkt_counter++;
   
   return 0;
@@ -541,25 +894,27 @@ int DataAcquisition::WriteScPkt(SC_PACKET * sc_packet) {
  * @param hv_packet HV data from the Zynq board
  * asynchronous writes to the CPU file are handled with the SynchronisedFile class
  */
-int DataAcquisition::WriteHvPkt(HV_PACKET * hv_packet, std::shared_ptr<Config> ConfigOut) {
+int DataAcquisition::WriteHvPkt(PktHandle<HV_PACKET> hv_packet) {
 
   static unsigned int pkt_counter = 0;
 
+  if (!hv_packet) {
+    return 1;
+  }
+
   clog << "info: " << logstream::info << "writing new packet to " << this->cpu_hv_file_name << std::endl;
 
-  /* write the HV packet */
-  this->RunAccess->WriteToSynchFile<CpuPktHeader *>(&hv_packet->hv_packet_header,
-						    SynchronisedFile::CONSTANT);
-  this->RunAccess->WriteToSynchFile<CpuTimeStamp *>(&hv_packet->hv_time,
-						    SynchronisedFile::CONSTANT);
-  this->RunAccess->WriteToSynchFile<uint32_t *>(&hv_packet->N,
-						SynchronisedFile::CONSTANT);
-  this->RunAccess->WriteToSynchFile<ZynqBoardHeader *>(&hv_packet->zbh,
-						       SynchronisedFile::CONSTANT);
-  this->RunAccess->WriteToSynchFile<DATA_TYPE_HVPS_LOG_V1 *>(&hv_packet->hvps_log[0],
-							     SynchronisedFile::VARIABLE_HV, ConfigOut);
-
-  delete hv_packet;
+  /* gather the HV packet */
+  PacketBuilder hv_out;
+  hv_out.Add(&hv_packet->hv_packet_header);
+  hv_out.Add(&hv_packet->hv_time);
+  hv_out.Add(&hv_packet->N);
+  hv_out.Add(&hv_packet->zbh);
+  hv_out.Add(hv_packet->hvps_log.data(), hv_packet->hvps_log.size());
+
+  /* write the HV packet in one go */
+  this->RunAccess->WritePktToSynchFile(hv_out);
+
   pkt_counter++;
   
   return 0;
@@ -571,8 +926,15 @@ int DataAcquisition::WriteHvPkt(HV_PACKET * hv_packet, std::shared_ptr<Config> C
  * Also clears old files from lftp server before starting.
  * @param monitor If true, wait until the instrument mode switch is sent to 
  * stop polling the FTP server.
+ * @param ConfigOut output of the configuration file parsing with ConfigManager
+ * uses DataAcquisition::FtpClientPoll() if FTP_CLIENT is set
  */
-void DataAcquisition::FtpPoll(bool monitor) {
+void DataAcquisition::FtpPoll(bool monitor, std::shared_ptr<Config> ConfigOut) {
+
+  if (ConfigOut->ftp_client) {
+    FtpClientPoll(monitor, ConfigOut);
+    return;
+  }
 
   std::string output;
 
@@ -632,6 +994,167 @@ void DataAcquisition::FtpPoll(bool monitor) {
 }
 
 
+/**
+ * Transfer new files from the Zynq with the built-in FtpClient.
+ * Keeps one connection open, downloads each new file into DATA_DIR,
+ * where it is picked up by DataAcquisition::ProcessIncomingData(),
+ * then deletes it from the Zynq.
+ * A file is only downloaded once the Zynq has finished writing it: frm files
+ * when they have the size expected from N1 and N2, other files when their size
+ * is the same on two polls. A frm file which stops growing short of that size,
+ * or a download which does not match the size, is left on the Zynq.
+ * With FTP_DIRECT, frm files are passed from memory to the IngestPipeline
+ * when it is running, and only written to DATA_DIR otherwise.
+ * @param monitor If true, wait until the instrument mode switch is sent to 
+ * stop polling the FTP server, otherwise transfer the files present once,
+ * polling up to FTP_ONESHOT_POLLS times for those still being written.
+ * @param ConfigOut output of the configuration file parsing with ConfigManager
+ */
+void DataAcquisition::FtpClientPoll(bool monitor, std::shared_ptr<Config> ConfigOut) {
+
+  FtpClient Ftp(ZYNQ_IP, FTP_PORT, ConfigOut->ftp_passive);
+  std::vector<std::string> file_names;
+  std::vector<char> file_data;
+  std::string data_str(DATA_DIR);
+  size_t frm_size = MappedZynqFile::ExpectedSize(ConfigOut->N1, ConfigOut->N2);
+
+  /* size of the files still being written at the last poll */
+  std::map<std::string, size_t> growing;
+  /* incomplete frm files, left on the Zynq */
+  std::set<std::string> rejected;
+  int n_polls = 0;
+
+  /* buffers for files passed directly to the pipeline, reused for each file */
+  if (ConfigOut->ftp_direct) {
+    size_t buffer_size = frm_size + FTP_CHUNK_SIZE;
+    this->_ftp_pool.Reserve(FTP_POOL_SIZE, [buffer_size](std::vector<char> & buffer) {
+	buffer.reserve(buffer_size);
+      });
+  }
+
+  /* start FTP polling */
+  clog << "info: " << logstream::info << "starting FTP server polling" << std::endl;
+
+  while (true) {
+
+    /* stop when instrument mode switching is requested */
+    if (monitor) {
+      std::unique_lock<std::mutex> lock(this->_m_ftp);
+      if (this->_ftp) {
+	break;
+      }
+    }
+
+    /* reconnect after an error */
+    int n_transferred = 0;
+    std::map<std::string, size_t> last_sizes;
+    last_sizes.swap(growing);
+    if (Ftp.IsConnected() || Ftp.Connect() == 0) {
+
+      if (Ftp.List(file_names) == 0) {
+	for (const std::string & file_name : file_names) {
+
+	  if (rejected.count(file_name)) {
+	    continue;
+	  }
+	  std::string file_path = data_str + "/" + file_name;
+	  bool is_frm = (file_name.compare(0, 3, "frm") == 0);
+
+	  /* wait for the Zynq to finish writing the file */
+	  size_t size = 0;
+	  if (Ftp.Size(file_name, size) != 0) {
+	    if (!Ftp.IsConnected()) {
+	      break;
+	    }
+	    continue;
+	  }
+	  auto last_size = last_sizes.find(file_name);
+	  bool stable = (last_size != last_sizes.end() && last_size->second == size);
+	  if (!(is_frm && size == frm_size) && !stable) {
+	    growing[file_name] = size;
+	    continue;
+	  }
+	  if (is_frm && size != frm_size) {
+	    clog << "error: " << logstream::error << file_name << " stopped at " << size << " bytes instead of "
+		 << frm_size << ", left on the FTP server" << std::endl;
+	    rejected.insert(file_name);
+	    continue;
+	  }
+
+	  /* frm files go into a pool buffer if they can be passed on directly */
+	  PktHandle<std::vector<char>> buffer;
+	  if (ConfigOut->ftp_direct && is_frm) {
+	    buffer = this->_ftp_pool.Acquire();
+	  }
+	  std::vector<char> & data = buffer ? *buffer : file_data;
+
+	  if (Ftp.Retrieve(file_name, data) != 0) {
+	    break;
+	  }
+
+	  /* try again at the next poll if the transfer was cut short */
+	  if (data.size() != size) {
+	    clog << "error: " << logstream::error << "received " << data.size() << " of " << size
+		 << " bytes of " << file_name << ", left on the FTP server" << std::endl;
+	    continue;
+	  }
+
+	  if (buffer) {
+	    std::shared_ptr<IngestPipeline> pipeline;
+	    {
+	      std::unique_lock<std::mutex> lock(this->_m_pipeline);
+	      pipeline = this->_pipeline.lock();
+	    }
+	    if (pipeline) {
+	      pipeline->Push(file_path, std::move(buffer));
+	      Ftp.Delete(file_name);
+	      n_transferred++;
+	      continue;
+	    }
+	  }
+
+	  /* write in one go, so the watcher sees a complete file on close */
+	  FILE * ptr_file = fopen(file_path.c_str(), "wb");
+	  if (!ptr_file) {
+	    clog << "error: " << logstream::error << "cannot open the file " << file_path << std::endl;
+	    continue;
+	  }
+	  size_t n_written = fwrite(data.data(), 1, data.size(), ptr_file);
+	  fclose(ptr_file);
+	  if (n_written != data.size()) {
+	    clog << "error: " << logstream::error << "cannot write the file " << file_path << std::endl;
+	    continue;
+	  }
+
+	  /* only delete once safely stored */
+	  Ftp.Delete(file_name);
+	  n_transferred++;
+	}
+      }
+    }
+
+    /* a one-shot poll only waits for the files still being written */
+    if (!monitor && (growing.empty() || ++n_polls >= FTP_ONESHOT_POLLS)) {
+      break;
+    }
+
+    /* nothing new, or files still being written, wait before checking again */
+    if (n_transferred == 0 || !growing.empty()) {
+      if (monitor) {
+	std::unique_lock<std::mutex> lock(this->_m_ftp);
+	this->_cv_ftp.wait_for(lock,
+			       std::chrono::milliseconds(ConfigOut->ftp_poll_ms),
+			       [this] { return this->_ftp; });
+      }
+      else {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ConfigOut->ftp_poll_ms));
+      }
+    }
+  }
+
+  Ftp.Disconnect();
+}
+
 /**
  * Look for new files in the data directory and process them depending on file type
  * @param ConfigOut output of the configuration file parsing with ConfigManager
@@ -665,10 +1188,25 @@ int DataAcquisition::ProcessIncomingData(std::shared_ptr<Config> ConfigOut, CmdL
   clog << "info: " << logstream::info << "start watching " << DONE_DIR << std::endl;
   wd = inotify_add_watch(fd, DATA_DIR, IN_CLOSE_WRITE);
 
+  /* staged processing of frm files, if enabled */
+  /* stopped on return, after finishing the files already passed to it */
+  /* shared with the FTP thread to pass files received in memory */
+  std::shared_ptr<IngestPipeline> pipeline;
+  if (ConfigOut->pipeline_ingest && !scurve) {
+    pipeline = std::make_shared<IngestPipeline>(this, ConfigOut, CmdLine, main_thread);
+    pipeline->Start();
+    std::unique_lock<std::mutex> pipeline_lock(this->_m_pipeline);
+    this->_pipeline = pipeline;
+  }
+
   /* to keep track of good and bad packets */
   int packet_counter = 0;
+  int total_packets = 0;
   int bad_packet_counter = 0;
 
+  /* new runs are started as configured with RUN_ROTATE_PKTS, RUN_ROTATE_MB and RUN_ROTATE_SEC */
+  this->_rotation.Configure(ConfigOut, CmdLine->single_run);
+
   /* initilaise timeout timer */
   time_t start = time(0);
   int time_left = FTP_TIMEOUT;
@@ -679,7 +1217,7 @@ int DataAcquisition::ProcessIncomingData(std::shared_ptr<Config> ConfigOut, CmdL
   while(!this->_cv_switch.wait_for(lock,
 				       std::chrono::milliseconds(WAIT_PERIOD),
 				   [this] { return this->_switch; }) /* no signal */
-	&& (time_left > 0 || !first_loop) ) { /* no timeout */
+	&& (time_left > 0 || !first_loop || (scurve && !IsScurveDone())) ) { /* no timeout */
 
     /* timeout if no activity after FTP_TIMEOUT reached */
     time_t end = time(0);
@@ -723,25 +1261,30 @@ int DataAcquisition::ProcessIncomingData(std::shared_ptr<Config> ConfigOut, CmdL
 		 && (event_name.compare(event_name.length() - 3, event_name.length(), "dat") == 0) ) {
 
 	      /* ignore frm files if waiting for an Scurve */
-	      if(!scurve) {
+	      if (!scurve && pipeline) {
+
+		/* hand over to the pipeline stages */
+		zynq_file_name = data_str + "/" + event->name;
+		pipeline->Push(zynq_file_name);
+
+		/* reset first_loop status */
+		if (first_loop) {
+		  first_loop = false;
+		}
+		
+	      }
+	      else if(!scurve) {
 		
 		zynq_file_name = data_str + "/" + event->name;
 	    
-		/* new run file every RUN_SIZE packets */
-		if (packet_counter == RUN_SIZE) {
-		  CloseCpuRun(CPU);
+		/* first run, then a new run file when RunRotation finds this one complete */
+		if (RotateCpuRun(ConfigOut, CmdLine)) {
 	      
 		  /* reset the packet counter */
-		  packet_counter = 0;
-		  std::cout << "PACKET COUNTER is reset to 0" << std::endl;
-		  
-		}
-	    
-		/* first packet */
-		if (packet_counter == 0) {
-	      
-		  /* create a new run */
-		  CreateCpuRun(CPU, ConfigOut, CmdLine);
+		  if (packet_counter > 0) {
+		    packet_counter = 0;
+		    std::cout << "PACKET COUNTER is reset to 0" << std::endl;
+		  }
 
 		  /* reset first_loop status */
 		  if (first_loop) {
@@ -750,15 +1293,42 @@ int DataAcquisition::ProcessIncomingData(std::shared_ptr<Config> ConfigOut, CmdL
 		  
 		}
 	    	    
-		/* generate sub packets */
-		ZYNQ_PACKET * zynq_packet = ZynqPktReadOut(zynq_file_name, ConfigOut);
-		HK_PACKET * hk_packet = AnalogPktReadOut();
+		/* generate sub packets and append to file */
+		bool packet_written = false;
+		if (ConfigOut->splice_ingest) {
+
+		  /* copy the Zynq data from the file within the kernel */
+		  PktHandle<HK_PACKET> hk_packet = AnalogPktReadOut();
+		  if (hk_packet && WriteCpuPkt(zynq_file_name, std::move(hk_packet), ConfigOut) == 0) {
+		    packet_written = true;
+		  }
+		}
+		else if (ConfigOut->mmap_ingest) {
+
+		  /* map the file and write directly from the mapping */
+		  MappedZynqFile zynq_file(zynq_file_name, ConfigOut->N1, ConfigOut->N2);
+		  PktHandle<HK_PACKET> hk_packet = AnalogPktReadOut();
+
+		  /* check for bad files and NULL packets */
+		  if (zynq_file.IsValid() && hk_packet) {
+		    WriteCpuPkt(zynq_file.view, std::move(hk_packet), ConfigOut);
+		    packet_written = true;
+		  }
+		}
+		else {
+		  PktHandle<ZYNQ_PACKET> zynq_packet = ZynqPktReadOut(zynq_file_name, ConfigOut);
+		  PktHandle<HK_PACKET> hk_packet = AnalogPktReadOut();
 		
-		/* check for NULL packets */
-		if ((zynq_packet != nullptr) && (hk_packet != nullptr)) {
+		  /* check for NULL packets */
+		  if (zynq_packet && hk_packet) {
 	      
-		  /* generate cpu packet and append to file */
-		  WriteCpuPkt(zynq_packet, hk_packet, ConfigOut);
+		    /* generate cpu packet and append to file */
+		    WriteCpuPkt(std::move(zynq_packet), std::move(hk_packet), ConfigOut);
+		    packet_written = true;
+		  }
+		}
+		
+		if (packet_written) {
 	      
 		  /* delete upon completion */
 		  if (!CmdLine->keep_zynq_pkt) {
@@ -771,9 +1341,11 @@ int DataAcquisition::ProcessIncomingData(std::shared_ptr<Config> ConfigOut, CmdL
 	      
 		  /* increment the packet counter */
 		  packet_counter++;
+		  total_packets++;
+		  CpuPktWritten(ConfigOut);
 	      
 		/* leave loop for a single run file */
-		if (packet_counter == CmdLine->acq_len-1 && CmdLine->single_run) {
+		if (total_packets == CmdLine->acq_len-1 && CmdLine->single_run) {
 
 		  /* send shutdown signal to RunInstrument */
 		  /* interrupt signal to main thread */
@@ -813,31 +1385,32 @@ int DataAcquisition::ProcessIncomingData(std::shared_ptr<Config> ConfigOut, CmdL
 	    
 	      sc_file_name = data_str + "/" + event->name;
 
-	      /* wait for scurve completion */
-	      std::unique_lock<std::mutex> sc_lock(this->_m_scurve);
-	      while(!this->_cv_scurve.wait_for(sc_lock,
-					       std::chrono::milliseconds(WAIT_PERIOD),
-					       [this] { return this->_scurve; })) {}	
-	      sleep(1);
-	      std::cout << "S-curve acquisition complete" << std::endl;
-	      
-	      CreateCpuRun(SC, ConfigOut, CmdLine);
-	      
-	      /* generate sc packet and append to file */
-	      SC_PACKET * sc_packet = ScPktReadOut(sc_file_name, ConfigOut);
-
-	      if (sc_packet != NULL) {
-		WriteScPkt(sc_packet);
+	      /* finish any frm files first */
+	      if (pipeline) {
+		pipeline->Flush();
 	      }
-
-	      /* print update to screen */
-	      printf("The scurve %s was read out\n", sc_file_name.c_str());
-	    
-	      CloseCpuRun(SC);
-
-	      /* delete upon completion */
-	      if (!CmdLine->keep_zynq_pkt) {
-		std::remove(sc_file_name.c_str());
+	      
+	      /* the file is read out by ScurveDone() once the Zynq reports the end of the */
+	      /* S-curve, or straight away if it already has */
+	      {
+		std::unique_lock<std::mutex> sc_lock(this->_m_scurve);
+		if (this->_scurve) {
+		  sc_lock.unlock();
+		  ReadOutSc(sc_file_name, ConfigOut, CmdLine);
+		}
+		else {
+		  this->_sc_file_name = sc_file_name;
+		  if (this->_cv_scurve.wait_for(sc_lock, std::chrono::seconds(SCURVE_DONE_TIMEOUT),
+						[this] { return this->_scurve; })) {
+		    /* the read out has started, and only depends on the file */
+		    this->_cv_scurve.wait(sc_lock, [this] { return this->_sc_read_out; });
+		  }
+		  else {
+		    this->_sc_file_name.clear();
+		    clog << "error: " << logstream::error << "no S-curve completion " << SCURVE_DONE_TIMEOUT
+			 << " s after " << sc_file_name << " arrived, not read out" << std::endl;
+		  }
+		}
 	      }
               
 	      /* exit without waiting for more files */
@@ -860,12 +1433,17 @@ int DataAcquisition::ProcessIncomingData(std::shared_ptr<Config> ConfigOut, CmdL
 	    
 	      hv_file_name = data_str + "/" + event->name;
 	      sleep(1);
+
+	      /* finish any frm files first */
+	      if (pipeline) {
+		pipeline->Flush();
+	      }
 	    
 	      CreateCpuRun(HV, ConfigOut, CmdLine);
 	    
 	      /* generate hv packet to append to the file */
-	      HV_PACKET * hv_packet = HvPktReadOut(hv_file_name, ConfigOut);
-	      WriteHvPkt(hv_packet, ConfigOut);
+	      PktHandle<HV_PACKET> hv_packet = HvPktReadOut(hv_file_name, ConfigOut);
+	      WriteHvPkt(std::move(hv_packet));
 	    
 	      CloseCpuRun(HV);
 	    
@@ -917,7 +1495,7 @@ int DataAcquisition::GetHvInfo(std::shared_ptr<Config> ConfigOut, CmdLineInputs
   std::cout << "waiting for HV file..." << std::endl;
 
   /* Poll the FTP server */
-  FtpPoll(false);
+  FtpPoll(false, ConfigOut);
   sleep(HV_FILE_TIMEOUT);
   
   /* get the filename */
@@ -937,9 +1515,9 @@ int DataAcquisition::GetHvInfo(std::shared_ptr<Config> ConfigOut, CmdLineInputs
 	CreateCpuRun(HV, ConfigOut, CmdLine);
 	
 	/* generate hv packet to append to the file */
-	HV_PACKET * hv_packet = HvPktReadOut(hv_file_name, ConfigOut);
-	if (hv_packet != NULL) {
-	  WriteHvPkt(hv_packet, ConfigOut);
+	PktHandle<HV_PACKET> hv_packet = HvPktReadOut(hv_file_name, ConfigOut);
+	if (hv_packet) {
+	  WriteHvPkt(std::move(hv_packet));
 	}
 	
 	CloseCpuRun(HV);
@@ -966,17 +1544,64 @@ int DataAcquisition::GetHvInfo(std::shared_ptr<Config> ConfigOut, CmdLineInputs
 }
 
 /**
- * signal that the scurve is done to data gathering thread
+ * signal that the scurve is done to data gathering thread,
+ * called by ZynqManager when the scurve started by CollectSc() ends.
+ * the S-curve file is read out here if it has already arrived
+ * @param result 0 if the scurve is complete, 1 if it failed
+ * @param ConfigOut output of the configuration file parsing with ConfigManager
+ * @param CmdLine output of command line options parsing with InputParser
  */
-void DataAcquisition::SignalScurveDone() {
-	
+void DataAcquisition::ScurveDone(int result, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine) {
+
+  if (result != 0) {
+    clog << "error: " << logstream::error << "S-curve acquisition failed" << std::endl;
+  }
+  std::string sc_file_name;
   {
     std::unique_lock<std::mutex> lock(this->_m_scurve);   
     this->_scurve = true;
+    sc_file_name.swap(this->_sc_file_name);
+  } /* release mutex */
+  this->_cv_scurve.notify_all();
+
+  if (!sc_file_name.empty()) {
+    ReadOutSc(sc_file_name, ConfigOut, CmdLine);
+  }
+}
+
+/**
+ * read out an S-curve file to its own SC run
+ * @param sc_file_name the file from the Zynq
+ * @param ConfigOut output of the configuration file parsing with ConfigManager
+ * @param CmdLine output of command line options parsing with InputParser
+ */
+void DataAcquisition::ReadOutSc(std::string sc_file_name, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine) {
+
+  std::cout << "S-curve acquisition complete" << std::endl;
+
+  CreateCpuRun(SC, ConfigOut, CmdLine);
+  PktHandle<SC_PACKET> sc_packet = ScPktReadOut(sc_file_name, ConfigOut);
+
+  /* append the sc packet to the file */
+  if (sc_packet) {
+    WriteScPkt(std::move(sc_packet));
+  }
+
+  /* print update to screen */
+  printf("The scurve %s was read out\n", sc_file_name.c_str());
+
+  CloseCpuRun(SC);
+
+  /* delete upon completion */
+  if (!CmdLine->keep_zynq_pkt) {
+    std::remove(sc_file_name.c_str());
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(this->_m_scurve);   
+    this->_sc_read_out = true;
   } /* release mutex */
   this->_cv_scurve.notify_all();
-	
-  return;
 }
 	
 /**
@@ -1004,23 +1629,45 @@ int DataAcquisition::CollectSc(ZynqManager * Zynq, std::shared_ptr<Config> Confi
 
   long unsigned int main_thread = pthread_self();
 
-  /* tell zynq to gather Scurve */
+  {
+    std::unique_lock<std::mutex> lock(this->_m_scurve);   
+    this->_scurve = false;
+    this->_sc_read_out = false;
+    this->_sc_file_name.clear();
+  }
+
+  /* tell zynq to gather Scurve, printing each threshold as it is reached, */
+  /* the S-curve file is read out as it completes */
   {
     std::unique_lock<std::mutex> lock(Zynq->m_zynq);  
-    Zynq->Scurve(ConfigOut->scurve_start, ConfigOut->scurve_step, ConfigOut->scurve_stop, ConfigOut->scurve_acc);
+    Zynq->StartScurve(ConfigOut->scurve_start, ConfigOut->scurve_step,
+		      ConfigOut->scurve_stop, ConfigOut->scurve_acc,
+		      [](int threshold) {
+			std::cout << "S-curve threshold: " << threshold << std::endl;
+		      },
+		      [this, ConfigOut, CmdLine](int result) {
+			this->ScurveDone(result, ConfigOut, CmdLine);
+		      });
   }
   
-  /* FTP polling */
-  std::thread ftp_poll (&DataAcquisition::FtpPoll, this, false);
+  /* FTP polling, running during the S-curve until the file is read out */
+  std::thread ftp_poll (&DataAcquisition::FtpPoll, this, true, ConfigOut);
   
-  /* collect the data */
+  /* collect the data, until the S-curve file is read out */
   std::thread collect_data (&DataAcquisition::ProcessIncomingData, this, ConfigOut, CmdLine, main_thread, true);
 
-  /* signal that scurve is done */
-  this->SignalScurveDone();
-  
   /* join threads */
   collect_data.join();
+
+  /* no more calls to ScurveDone() if the scurve did not complete */
+  Zynq->StopScurve();
+
+  /* stop the FTP polling */
+  {
+    std::unique_lock<std::mutex> lock(this->_m_ftp);
+    this->_ftp = true;
+  } /* release mutex */
+  this->_cv_ftp.notify_all();
   ftp_poll.join();
   
 #endif /* __APPLE__ */
@@ -1041,7 +1688,7 @@ int DataAcquisition::CollectData(ZynqManager * Zynq, std::shared_ptr<Config> Con
 
  #if ARDUINO_DEBUG !=1 
   /* FTP polling */
-  std::thread ftp_poll (&DataAcquisition::FtpPoll, this, true);
+  std::thread ftp_poll (&DataAcquisition::FtpPoll, this, true, ConfigOut);
   
   /* collect the data */
   std::thread collect_main_data (&DataAcquisition::ProcessIncomingData, this, ConfigOut, CmdLine, main_thread, false);
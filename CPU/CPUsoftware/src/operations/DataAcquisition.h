@@ -4,6 +4,9 @@
 #ifndef __APPLE__
 #include <sys/inotify.h>
 #endif /* __APPLE__ */
+#include <future>
+#include <map>
+#include <set>
 #include <thread>
 
 #include "OperationMode.h"
@@ -11,6 +14,13 @@
 #include "ArduinoManager.h"
 #include "InputParser.h"
 #include "ConfigManager.h"
+#include "MappedZynqFile.h"
+#include "PacketPool.h"
+#include "IngestPipeline.h"
+#include "FtpClient.h"
+#include "PktCodec.h"
+#include "CompressionPool.h"
+#include "RunRotation.h"
 
 #define DATA_DIR "/home/minieusouser/DATA"
 #define DONE_DIR "/home/minieusouser/DONE"
@@ -20,14 +30,28 @@
 /* maximum filename size (CPU is Ext4 but USB is FAT32) */
 #define MAX_FILENAME_LENGTH 255
 
+/* name of the next CPU run file while it is prepared, hidden from the data backup */
+#define NEXT_RUN_FILE_NAME ".CPU_RUN_NEXT.dat"
+
 /* for use with inotify in ProcessIncomingData() */
 #define EVENT_SIZE (sizeof(struct inotify_event))
 #define BUF_LEN (1024 * (EVENT_SIZE + 16))
 #define FTP_TIMEOUT 10 /* seconds */
+/* longest wait for the Zynq to report the end of an S-curve once its file has arrived */
+#define SCURVE_DONE_TIMEOUT 60 /* seconds */
 
 /* number of seconds to wait for HV file transfer on FTP */
 #define HV_FILE_TIMEOUT 7
 
+/* polls made by a one-shot FtpClientPoll() for files which are still growing */
+#define FTP_ONESHOT_POLLS 10
+
+/* number of files received in memory which can be waiting for the pipeline */
+#define FTP_POOL_SIZE (PIPELINE_POOL_SIZE + 1)
+
+/* number of Zynq and HK packets preallocated at run start */
+#define ZYNQ_POOL_SIZE 2
+
 
 /** NIGHT operational mode: data acquisition
  * class for controlling the main acquisition 
@@ -75,6 +99,9 @@ public:
   static int ReadFakeZynqPkt();
   
 private:
+  /* the pipeline stages use the read out and write functions */
+  friend class IngestPipeline;
+
   /**
    * to handle scurve acquisition in a thread-safe way
    */
@@ -87,21 +114,92 @@ private:
    * to notify a completed scurve
    */
   bool _scurve;  
+  /**
+   * S-curve file waiting for the scurve to complete before it is read out
+   */
+  std::string _sc_file_name;
+  /**
+   * set once the S-curve file has been read out
+   */
+  bool _sc_read_out;
+
+  /**
+   * preallocated packets, reused for each file read out
+   */
+  PacketPool<ZYNQ_PACKET> _zynq_pool;
+  PacketPool<HK_PACKET> _hk_pool;
+
+  /**
+   * buffers for files received by DataAcquisition::FtpClientPoll() with FTP_DIRECT
+   */
+  PacketPool<std::vector<char>> _ftp_pool;
+  /**
+   * pipeline of DataAcquisition::ProcessIncomingData(), while running,
+   * to pass it the files received in memory
+   */
+  std::weak_ptr<IngestPipeline> _pipeline;
+  /**
+   * to share _pipeline between threads
+   */
+  std::mutex _m_pipeline;
+  PacketPool<SC_PACKET> _sc_pool;
+  PacketPool<HV_PACKET> _hv_pool;
+  /**
+   * compressed Zynq data for DataAcquisition::WriteCpuPkt() with COMPRESS,
+   * reused for each packet
+   */
+  std::vector<char> _cmp_buf;
+  PktCodec::Scratch _cmp_scratch;
+  /**
+   * threads compressing the Zynq data with CMP_THREADS, started with the first packet
+   */
+  std::unique_ptr<CompressionPool> _cmp_pool;
+  /**
+   * copies the run files to USB_MOUNTPOINT_1 with USB_MIRROR, started with the first run
+   */
+  std::shared_ptr<FileMirror> _mirror;
+  /**
+   * decides when to start a new CPU run, with RUN_ROTATE_PKTS, RUN_ROTATE_MB and RUN_ROTATE_SEC
+   */
+  RunRotation _rotation;
+  /**
+   * true while a CPU run is open
+   */
+  bool _cpu_run_open;
+  /**
+   * the file of the next CPU run, opened and preallocated in the background
+   */
+  std::future<std::shared_ptr<SynchronisedFile>> _next_run;
+  /**
+   * the last CPU run, finished in the background
+   */
+  std::future<int> _closing_run;
 
   std::string CreateCpuRunName(RunType run_type, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
   std::string BuildCpuFileInfo(std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
-  SC_PACKET * ScPktReadOut(std::string sc_file_name, std::shared_ptr<Config> ConfigOut);
-  HV_PACKET * HvPktReadOut(std::string hv_file_name, std::shared_ptr<Config> ConfigOut);
-  ZYNQ_PACKET * ZynqPktReadOut(std::string zynq_file_name, std::shared_ptr<Config> ConfigOut);
-  HK_PACKET * AnalogPktReadOut();
-  int WriteScPkt(SC_PACKET * sc_packet);
-  int WriteHvPkt(HV_PACKET * hv_packet, std::shared_ptr<Config> ConfigOut);
-  int WriteCpuPkt(ZYNQ_PACKET * zynq_packet, HK_PACKET * hk_packet, std::shared_ptr<Config> ConfigOut);
+  static size_t CpuPktSize(std::shared_ptr<Config> ConfigOut);
+  off_t ExpectedRunSize(RunType run_type, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
+  std::shared_ptr<SynchronisedFile> OpenRunFile(RunType run_type, std::string path, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
+  bool RotateCpuRun(std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
+  void CpuPktWritten(std::shared_ptr<Config> ConfigOut);
+  int FinishRun(RunType run_type, std::shared_ptr<SynchronisedFile> run_file, unsigned int n_packets);
+  void DiscardNextRun();
+  PktHandle<SC_PACKET> ScPktReadOut(std::string sc_file_name, std::shared_ptr<Config> ConfigOut);
+  PktHandle<HV_PACKET> HvPktReadOut(std::string hv_file_name, std::shared_ptr<Config> ConfigOut);
+  PktHandle<ZYNQ_PACKET> ZynqPktReadOut(std::string zynq_file_name, std::shared_ptr<Config> ConfigOut);
+  PktHandle<HK_PACKET> AnalogPktReadOut();
+  int WriteScPkt(PktHandle<SC_PACKET> sc_packet);
+  int WriteHvPkt(PktHandle<HV_PACKET> hv_packet);
+  int WriteCpuPkt(PktHandle<ZYNQ_PACKET> zynq_packet, PktHandle<HK_PACKET> hk_packet, std::shared_ptr<Config> ConfigOut);
+  int WriteCpuPkt(std::string zynq_file_name, PktHandle<HK_PACKET> hk_packet, std::shared_ptr<Config> ConfigOut);
+  int WriteCpuPkt(const ZynqPktView & zynq_view, PktHandle<HK_PACKET> hk_packet, std::shared_ptr<Config> ConfigOut, int zynq_fd = -1);
   int GetHvInfo(std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
   int GetScurve(ZynqManager * Zynq, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
-  void FtpPoll(bool monitor);
+  void FtpPoll(bool monitor, std::shared_ptr<Config> ConfigOut);
+  void FtpClientPoll(bool monitor, std::shared_ptr<Config> ConfigOut);
   int ProcessIncomingData(std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine, long unsigned int main_thread, bool scurve);
-  void SignalScurveDone();
+  void ScurveDone(int result, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
+  void ReadOutSc(std::string sc_file_name, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine);
   
 };
 
@@ -0,0 +1,393 @@
+#include "IngestPipeline.h"
+#include "DataAcquisition.h"
+
+/* stage names for the statistics */
+static const char * kStageNames[IngestPipeline::N_STAGES] = {"read", "assemble", "write", "cleanup"};
+
+/**
+ * constructor.
+ * @param Acq the DataAcquisition object doing the read out and writing
+ * @param ConfigOut output of the configuration file parsing with ConfigManager
+ * @param CmdLine output of command line options parsing with InputParser
+ * @param main_thread p_thread ID of the main thread, signalled at the end of a single run
+ */
+IngestPipeline::IngestPipeline(DataAcquisition * Acq, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine, long unsigned int main_thread) {
+
+  this->_Acq = Acq;
+  this->_ConfigOut = ConfigOut;
+  this->_CmdLine = CmdLine;
+  this->_main_thread = main_thread;
+
+  for (int i = 0; i < N_STAGES; i++) {
+    this->_rings[i].reset(new SpscRing<IngestItem>(PIPELINE_DEPTH));
+    this->_done[i] = false;
+    this->_stats[i].n_items = 0;
+    this->_stats[i].max_depth = 0;
+    this->_stats[i].busy_us = 0;
+  }
+  this->_n_pushed = 0;
+  this->_n_finished = 0;
+  this->_n_bad = 0;
+  this->_packet_counter = 0;
+  this->_total_packets = 0;
+  this->_running = false;
+}
+
+/**
+ * destructor
+ * stops the pipeline, finishing any files already pushed
+ */
+IngestPipeline::~IngestPipeline() {
+
+  Stop();
+}
+
+/**
+ * preallocate the packets and start the stage threads
+ */
+void IngestPipeline::Start() {
+
+  if (this->_running) {
+    return;
+  }
+
+  /* enough packets for every stage to be busy at once */
+  std::shared_ptr<Config> ConfigOut = this->_ConfigOut;
+  if (!ConfigOut->mmap_ingest) {
+    this->_Acq->_zynq_pool.Reserve(PIPELINE_POOL_SIZE, [ConfigOut](ZYNQ_PACKET & zynq_packet) {
+	zynq_packet.level1_data.reserve(ConfigOut->N1);
+	zynq_packet.level2_data.reserve(ConfigOut->N2);
+      });
+  }
+  this->_Acq->_hk_pool.Reserve(PIPELINE_POOL_SIZE);
+
+  clog << "info: " << logstream::info << "starting the ingest pipeline" << std::endl;
+
+  for (int i = 0; i < N_STAGES; i++) {
+    this->_threads[i] = std::thread(&IngestPipeline::RunStage, this, (Stage)i);
+  }
+  this->_running = true;
+}
+
+/**
+ * pass a new Zynq file to the pipeline, called by the watcher.
+ * waits if the pipeline is full
+ * @param zynq_file_name path to the file
+ */
+void IngestPipeline::Push(std::string zynq_file_name) {
+
+  IngestItem item;
+  item.file_name = zynq_file_name;
+
+  std::unique_lock<std::mutex> lock(this->_m_push);
+  this->_n_pushed++;
+  PushTo(READ, std::move(item));
+}
+
+/**
+ * pass the contents of a new Zynq file to the pipeline, called by the FTP thread.
+ * the file is only written to disk if it cannot be processed.
+ * waits if the pipeline is full
+ * @param zynq_file_name path the file is spilled to on failure
+ * @param file_data the contents of the file, returned to its pool once processed
+ */
+void IngestPipeline::Push(std::string zynq_file_name, PktHandle<std::vector<char>> file_data) {
+
+  IngestItem item;
+  item.file_name = zynq_file_name;
+  item.file_data = std::move(file_data);
+
+  std::unique_lock<std::mutex> lock(this->_m_push);
+  this->_n_pushed++;
+  PushTo(READ, std::move(item));
+}
+
+/**
+ * wait until every file pushed so far has been through the pipeline.
+ * the stages still holding files are reported if they do not finish in time
+ * @param timeout_ms how long to wait, in ms
+ * @return true if the pipeline is empty, false on timeout
+ */
+bool IngestPipeline::Flush(unsigned int timeout_ms) {
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (this->_running && this->_n_finished < this->_n_pushed) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    usleep(PIPELINE_BACKOFF);
+  }
+  if (!this->_running || this->_n_finished >= this->_n_pushed) {
+    return true;
+  }
+
+  /* a stage holds the files passed to it and not yet passed on */
+  clog << "error: " << logstream::error << "ingest pipeline not flushed after " << timeout_ms << " ms, "
+       << this->_n_pushed - this->_n_finished << " files left" << std::endl;
+  unsigned int n_in = this->_n_pushed;
+  for (int i = 0; i < N_STAGES; i++) {
+    unsigned int n_out = this->_stats[i].n_items;
+    if (n_in > n_out) {
+      clog << "error: " << logstream::error << "ingest pipeline " << kStageNames[i] << " stage stuck with "
+	   << n_in - n_out << " files" << std::endl;
+    }
+    n_in = n_out;
+  }
+  return false;
+}
+
+/**
+ * finish the files in the pipeline and stop the stage threads
+ */
+void IngestPipeline::Stop() {
+
+  if (!this->_running) {
+    return;
+  }
+
+  /* no more files from the watcher, each stage stops once its input is empty */
+  this->_done[READ] = true;
+  for (int i = 0; i < N_STAGES; i++) {
+    this->_threads[i].join();
+  }
+  this->_running = false;
+
+  clog << "info: " << logstream::info << "stopped the ingest pipeline" << std::endl;
+  PrintStats();
+}
+
+/**
+ * print and log the per-stage statistics
+ */
+void IngestPipeline::PrintStats() {
+
+  std::cout << "ingest pipeline: " << this->_n_finished << " files, "
+	    << this->_n_bad << " bad" << std::endl;
+  for (int i = 0; i < N_STAGES; i++) {
+    std::cout << "  " << kStageNames[i] << ": " << this->_stats[i].n_items << " files, queue depth "
+	      << this->_rings[i]->Size() << " (max " << this->_stats[i].max_depth << "), busy "
+	      << this->_stats[i].busy_us / 1000 << " ms" << std::endl;
+    clog << "info: " << logstream::info << "ingest pipeline " << kStageNames[i] << ": "
+	 << this->_stats[i].n_items << " files, queue depth " << this->_rings[i]->Size()
+	 << " (max " << this->_stats[i].max_depth << "), busy "
+	 << this->_stats[i].busy_us / 1000 << " ms" << std::endl;
+  }
+}
+
+/**
+ * add an item to the ring feeding a stage, waiting if it is full
+ * @param stage the stage to pass the item to
+ * @param item the item, moved into the ring
+ */
+void IngestPipeline::PushTo(Stage stage, IngestItem && item) {
+
+  /* track the queue depth */
+  unsigned int depth = this->_rings[stage]->Size() + 1;
+  unsigned int max_depth = this->_stats[stage].max_depth;
+  while (depth > max_depth && !this->_stats[stage].max_depth.compare_exchange_weak(max_depth, depth)) {}
+
+  while (!this->_rings[stage]->TryPush(std::move(item))) {
+    usleep(PIPELINE_BACKOFF);
+  }
+}
+
+/**
+ * the loop run by each stage thread
+ * @param stage the stage to run
+ */
+void IngestPipeline::RunStage(Stage stage) {
+
+  IngestItem item;
+
+  while (true) {
+
+    /* get the next item, stopping once the previous stage is done and the ring is empty */
+    if (!this->_rings[stage]->TryPop(item)) {
+      if (!this->_done[stage]) {
+	usleep(PIPELINE_BACKOFF);
+	continue;
+      }
+      if (!this->_rings[stage]->TryPop(item)) {
+	break;
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    switch (stage) {
+    case READ:
+      ReadStage(item);
+      break;
+    case ASSEMBLE:
+      AssembleStage(item);
+      break;
+    case WRITE:
+      WriteStage(item);
+      break;
+    case CLEANUP:
+      CleanupStage(item);
+      break;
+    case N_STAGES:
+      break;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    this->_stats[stage].busy_us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    this->_stats[stage].n_items++;
+
+    if (stage < CLEANUP) {
+      PushTo((Stage)(stage + 1), std::move(item));
+    }
+    else {
+      this->_n_finished++;
+    }
+
+    /* release anything left, returning packets to their pools */
+    item = IngestItem();
+  }
+
+  /* nothing more for the next stage */
+  if (stage < CLEANUP) {
+    this->_done[stage + 1] = true;
+  }
+}
+
+/**
+ * read out and validate a Zynq file
+ * @param item holds the file name, the packet or mapping is added
+ */
+void IngestPipeline::ReadStage(IngestItem & item) {
+
+  if (item.file_data) {
+    item.valid = MappedZynqFile::MakeView(item.file_data->data(), item.file_data->size(),
+					  this->_ConfigOut->N1, this->_ConfigOut->N2, item.file_view);
+    if (!item.valid) {
+      clog << "error: " << logstream::error << "received file " << item.file_name << " is too small for N1 = "
+	   << (int)this->_ConfigOut->N1 << " and N2 = " << (int)this->_ConfigOut->N2 << std::endl;
+    }
+  }
+  else if (this->_ConfigOut->splice_ingest) {
+
+    /* the data is copied by the kernel when written, only check the size here */
+    struct stat st;
+    item.valid = (stat(item.file_name.c_str(), &st) == 0)
+      && ((size_t)st.st_size >= MappedZynqFile::ExpectedSize(this->_ConfigOut->N1, this->_ConfigOut->N2));
+  }
+  else if (this->_ConfigOut->mmap_ingest) {
+    item.zynq_file.reset(new MappedZynqFile(item.file_name, this->_ConfigOut->N1, this->_ConfigOut->N2));
+    item.valid = item.zynq_file->IsValid();
+  }
+  else {
+    item.zynq_packet = this->_Acq->ZynqPktReadOut(item.file_name, this->_ConfigOut);
+    item.valid = (bool)item.zynq_packet;
+  }
+}
+
+/**
+ * add the HK data from the analog board
+ * @param item the HK packet is added
+ */
+void IngestPipeline::AssembleStage(IngestItem & item) {
+
+  if (!item.valid) {
+    return;
+  }
+
+  item.hk_packet = this->_Acq->AnalogPktReadOut();
+  item.valid = (bool)item.hk_packet;
+}
+
+/**
+ * write the CPU packet, starting a new run when the RunRotation
+ * of the DataAcquisition finds the current run complete
+ * @param item the packets are moved out to be written
+ */
+void IngestPipeline::WriteStage(IngestItem & item) {
+
+  if (!item.valid) {
+    this->_n_bad++;
+    return;
+  }
+
+  /* first run, then a new run file when RunRotation finds this one complete */
+  if (this->_Acq->RotateCpuRun(this->_ConfigOut, this->_CmdLine) && this->_packet_counter > 0) {
+
+    /* reset the packet counter */
+    this->_packet_counter = 0;
+    std::cout << "PACKET COUNTER is reset to 0" << std::endl;
+  }
+
+  /* generate cpu packet and append to file */
+  if (item.file_data) {
+    this->_Acq->WriteCpuPkt(item.file_view, std::move(item.hk_packet), this->_ConfigOut);
+  }
+  else if (this->_ConfigOut->splice_ingest) {
+    if (this->_Acq->WriteCpuPkt(item.file_name, std::move(item.hk_packet), this->_ConfigOut) != 0) {
+      this->_n_bad++;
+      return;
+    }
+  }
+  else if (item.zynq_file) {
+    this->_Acq->WriteCpuPkt(item.zynq_file->view, std::move(item.hk_packet), this->_ConfigOut);
+  }
+  else {
+    this->_Acq->WriteCpuPkt(std::move(item.zynq_packet), std::move(item.hk_packet), this->_ConfigOut);
+  }
+  item.written = true;
+
+  /* print update to screen */
+  printf("PACKET COUNTER = %i\n", this->_packet_counter);
+  printf("The packet %s was read out\n", item.file_name.c_str());
+
+  /* increment the packet counter */
+  this->_packet_counter++;
+  this->_total_packets++;
+  this->_Acq->CpuPktWritten(this->_ConfigOut);
+
+  /* end of a single run */
+  if (this->_total_packets == this->_CmdLine->acq_len - 1 && this->_CmdLine->single_run) {
+
+    /* send shutdown signal to RunInstrument */
+    /* interrupt signal to main thread */
+    pthread_kill((pthread_t)this->_main_thread, SIGINT);
+  }
+}
+
+/**
+ * delete the Zynq file once written.
+ * files received in memory are spilled to disk if not written
+ * or if they are to be kept, as for files from the watcher
+ * @param item the file to delete, packets are released after this
+ */
+void IngestPipeline::CleanupStage(IngestItem & item) {
+
+  if (item.file_data) {
+    if (!item.written || this->_CmdLine->keep_zynq_pkt) {
+
+      /* written in a subdirectory then moved, so the watcher does not process it again */
+      size_t pos = item.file_name.find_last_of('/') + 1;
+      std::string tmp_dir = item.file_name.substr(0, pos) + PIPELINE_SPILL_DIR;
+      std::string tmp_name = tmp_dir + "/" + item.file_name.substr(pos);
+      mkdir(tmp_dir.c_str(), 0755);
+      FILE * ptr_file = fopen(tmp_name.c_str(), "wb");
+      if (!ptr_file) {
+	clog << "error: " << logstream::error << "cannot spill the file " << item.file_name << std::endl;
+	return;
+      }
+      size_t written = fwrite(item.file_data->data(), 1, item.file_data->size(), ptr_file);
+      if (fclose(ptr_file) != 0 || written != item.file_data->size()) {
+	clog << "error: " << logstream::error << "cannot spill the file " << item.file_name << ", wrote "
+	     << written << " of " << item.file_data->size() << " bytes" << std::endl;
+	std::remove(tmp_name.c_str());
+	return;
+      }
+      std::rename(tmp_name.c_str(), item.file_name.c_str());
+    }
+    return;
+  }
+
+  /* delete upon completion */
+  if (item.written && !this->_CmdLine->keep_zynq_pkt) {
+    std::remove(item.file_name.c_str());
+  }
+}
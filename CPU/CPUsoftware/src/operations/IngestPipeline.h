@@ -0,0 +1,160 @@
+#ifndef _INGEST_PIPELINE_H
+#define _INGEST_PIPELINE_H
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "log.h"
+#include "ConfigManager.h"
+#include "InputParser.h"
+#include "MappedZynqFile.h"
+#include "PacketPool.h"
+#include "SpscRing.h"
+
+/* number of slots in each ring between stages */
+#define PIPELINE_DEPTH 8
+/* number of Zynq packets that can be in the pipeline at once */
+#define PIPELINE_POOL_SIZE 4
+/* time to wait when a ring is empty or full, in us */
+#define PIPELINE_BACKOFF 500
+/* longest wait for the files in the pipeline to be written, in ms */
+#define PIPELINE_FLUSH_TIMEOUT 30000
+/* subdirectory used to spill files received in memory without them being seen by the watcher */
+#define PIPELINE_SPILL_DIR ".spill"
+
+class DataAcquisition;
+
+/**
+ * a Zynq file on its way through the IngestPipeline
+ */
+struct IngestItem {
+  std::string file_name;
+  PktHandle<ZYNQ_PACKET> zynq_packet;
+  std::unique_ptr<MappedZynqFile> zynq_file;
+  PktHandle<std::vector<char>> file_data;
+  ZynqPktView file_view;
+  PktHandle<HK_PACKET> hk_packet;
+  bool valid = false;
+  bool written = false;
+};
+
+/**
+ * counters for one stage of the IngestPipeline
+ */
+struct StageStats {
+  std::atomic<unsigned int> n_items;
+  std::atomic<unsigned int> max_depth;
+  std::atomic<unsigned long> busy_us;
+};
+
+/**
+ * staged processing of the Zynq files found by DataAcquisition::ProcessIncomingData().
+ * the watcher pushes file names, then each stage runs on its own thread:
+ * read/validate -> assemble with HK -> write -> cleanup,
+ * connected by lock-free SPSC rings so that slow stages do not hold up the others.
+ * files can also be pushed from memory by DataAcquisition::FtpClientPoll(),
+ * in which case they only go to disk if they cannot be written
+ */
+class IngestPipeline {
+public:
+  /**
+   * the stages, named after the ring feeding them
+   */
+  enum Stage : uint8_t {
+    READ = 0,
+    ASSEMBLE = 1,
+    WRITE = 2,
+    CLEANUP = 3,
+    N_STAGES = 4,
+  };
+
+  IngestPipeline(DataAcquisition * Acq, std::shared_ptr<Config> ConfigOut, CmdLineInputs * CmdLine, long unsigned int main_thread);
+  ~IngestPipeline();
+  void Start();
+  void Push(std::string zynq_file_name);
+  void Push(std::string zynq_file_name, PktHandle<std::vector<char>> file_data);
+  bool Flush(unsigned int timeout_ms = PIPELINE_FLUSH_TIMEOUT);
+  void Stop();
+  void PrintStats();
+
+private:
+  /**
+   * the DataAcquisition using the pipeline, which does the actual work
+   */
+  DataAcquisition * _Acq;
+  /**
+   * output of the configuration parsing
+   */
+  std::shared_ptr<Config> _ConfigOut;
+  /**
+   * output of the command line parsing
+   */
+  CmdLineInputs * _CmdLine;
+  /**
+   * thread ID of the main thread, to signal the end of a single run
+   */
+  long unsigned int _main_thread;
+  /**
+   * rings feeding each stage
+   */
+  std::unique_ptr<SpscRing<IngestItem>> _rings[N_STAGES];
+  /**
+   * stage threads
+   */
+  std::thread _threads[N_STAGES];
+  /**
+   * set when a stage, or the watcher for READ, will send no more items to the next
+   */
+  std::atomic<bool> _done[N_STAGES];
+  /**
+   * per-stage counters
+   */
+  StageStats _stats[N_STAGES];
+  /**
+   * serialises Push() from the watcher and the FTP thread, as the rings take one producer
+   */
+  std::mutex _m_push;
+  /**
+   * number of files pushed, by the watcher or the FTP thread
+   */
+  std::atomic<unsigned int> _n_pushed;
+  /**
+   * number of files through the whole pipeline
+   */
+  std::atomic<unsigned int> _n_finished;
+  /**
+   * number of bad files
+   */
+  std::atomic<unsigned int> _n_bad;
+  /**
+   * packets written in the current run, only used by the write stage
+   */
+  int _packet_counter;
+  /**
+   * packets written in total, only used by the write stage
+   */
+  int _total_packets;
+  /**
+   * true once the threads have started
+   */
+  bool _running;
+
+  void RunStage(Stage stage);
+  void ReadStage(IngestItem & item);
+  void AssembleStage(IngestItem & item);
+  void WriteStage(IngestItem & item);
+  void CleanupStage(IngestItem & item);
+  void PushTo(Stage stage, IngestItem && item);
+};
+
+#endif
+/* _INGEST_PIPELINE_H */
@@ -134,8 +134,14 @@ int ThermManager::WriteThermPkt(TemperatureAcq * temperature_result) {
   }
   delete temperature_result;
   
-  /* write the therm packet */
-  this->RunAccess->WriteToSynchFile<THERM_PACKET *>(therm_packet, SynchronisedFile::CONSTANT);
+  /* write the therm packet, can be dropped first if the write queue is full */
+  PacketBuilder therm_out;
+  therm_out.Add(therm_packet);
+  CpuPktIndexEntry index_entry = CpuPktIndexEntry();
+  index_entry.pkt_type = THERM_PACKET_TYPE;
+  index_entry.pkt_num = pkt_counter;
+  index_entry.unix_time = therm_packet->therm_time.cpu_time_stamp;
+  this->RunAccess->WritePktToSynchFile(therm_out, SynchronisedFile::HK, &index_entry);
   delete therm_packet; 
   pkt_counter++;
 
@@ -7,9 +7,19 @@
 UsbManager::UsbManager() {
   this->num_storage_dev = N_USB_UNDEF;
   this->backup_launched = false;  
+  this->_stop_backup = false;
   
 }
 
+/**
+ * destructor.
+ * stops the data backup if running
+ */
+UsbManager::~UsbManager() {
+
+  KillDataBackup();
+}
+
 /**
  * check cpu model to select correct storage_bus 
  */
@@ -233,94 +243,308 @@ int UsbManager::GetDeviceInterface(libusb_device * dev) {
 
 
 /**
- * define data backup based on num_storage_dev 
+ * define data backup based on num_storage_dev.
+ * requires 2 storage devices, and copies the run files from DONE_DIR and
+ * USB_MOUNTPOINT_0 to USB_MOUNTPOINT_1 as they are closed, until KillDataBackup()
  */
 int UsbManager::DataBackup() {
 
-  std::string cmd;
-  std::string log_path(LOG_DIR);
-  std::string inotify_log = "/inotify.log";
-  std::string mp_0(USB_MOUNTPOINT_0);
-  std::string mp_1(USB_MOUNTPOINT_1);
+  std::string watch_dirs[] = {DONE_DIR, USB_MOUNTPOINT_0};
 
   clog << "info: " << logstream::info << "defining data backup procedure" << std::endl;
   this->num_storage_dev = LookupUsbStorage();
-  
+
   /* require 2+ storage devices for backup */
-  if (this->num_storage_dev >= 2 && this->num_storage_dev != N_USB_UNDEF) {
-
-    this->backup_launched = true;
-    
-    /* run backup */
-    std::cout << "running data backup in the background" << std::endl;
-
-    /* synchronise /media/usb0 to /media/usb1 */
-    cmd = "while true; do rsync -avzr /media/usb0/* /media/usb1; done 2>&1";
-
-    /*
-    alternative command which works on creation/modification/deletion
-    cmd = "while inotifywait -m -r -e modify,create,delete -o "
-    + log_path + inotify_log + " " + mp_0 +
-    "; do rsync -avz " + mp_0 + " " + mp_1 + "; done"; 
-    */
-    
-    clog << "info: " << logstream::info << "running backup with: " << cmd << std::endl;
- 
-    const char * command = cmd.c_str();
-
-    /* run the backup command */
-    std::string output = CpuTools::CommandToStr(command);
-
-    size_t found = output.find("sending incremental file list"); 
-    if (found != std::string::npos) {
-      clog << "info: " << logstream::info << "the following: " << cmd << " exited successfully" << std::endl;
-    }
-    else{
-      clog << "error: " << logstream::error << "the following: " << cmd << " exited with an error" << std::endl;
+  if (this->num_storage_dev < 2 || this->num_storage_dev == N_USB_UNDEF) {
+    clog << "info: " << logstream::info << "not enough storage devices for backup" << std::endl;
+    return 0;
+  }
+
+  this->backup_launched = true;
+  std::cout << "running data backup in the background" << std::endl;
+
+#ifndef __APPLE__
+  /* watch for run files being closed */
+  int fd = inotify_init();
+  if (fd < 0) {
+    clog << "error: " << logstream::error << "unable to start inotify service for the data backup" << std::endl;
+    return 1;
+  }
+  std::map<int, std::string> watches;
+  for (const std::string & dir : watch_dirs) {
+    int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+      clog << "warning: " << logstream::warning << "cannot watch " << dir << " for the data backup" << std::endl;
+      continue;
     }
-    
+    watches[wd] = dir;
   }
-  else {
-    clog << "info: " << logstream::info << "not enough storage devices for backup" << std::endl;
+
+  /* catch up with files closed while the backup was not running */
+  LoadManifest();
+  for (const std::string & dir : watch_dirs) {
+    BackupDir(dir);
   }
 
+  alignas(struct inotify_event) char buffer[BACKUP_EVENT_BUF];
+  while (!this->_stop_backup) {
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, BACKUP_POLL_MS) <= 0) {
+      continue;
+    }
+    ssize_t len = read(fd, buffer, sizeof(buffer));
+    if (len <= 0) {
+      continue;
+    }
+
+    ssize_t pos = 0;
+    while (pos < len) {
+      struct inotify_event * event = (struct inotify_event *) &buffer[pos];
+      pos += sizeof(struct inotify_event) + event->len;
+
+      /* events were lost, so look through the directories again */
+      if (event->mask & IN_Q_OVERFLOW) {
+	clog << "warning: " << logstream::warning << "data backup events lost, checking all files" << std::endl;
+	for (const std::string & dir : watch_dirs) {
+	  BackupDir(dir);
+	}
+      }
+      else if (event->len && watches.count(event->wd)) {
+	BackupFile(watches[event->wd], event->name);
+      }
+    }
+  }
+
+  close(fd);
+#endif /* __APPLE__ */
+
+  clog << "info: " << logstream::info << "data backup stopped" << std::endl;
   return 0;
 }
 
+/**
+ * read the manifest of the files already backed up.
+ * files no longer on USB_MOUNTPOINT_1, or with a different size, are left out
+ * so that they are copied again
+ */
+void UsbManager::LoadManifest() {
+
+  std::string manifest_path = std::string(USB_MOUNTPOINT_1) + BACKUP_MANIFEST;
+  std::ifstream manifest(manifest_path);
+
+  this->_manifest.clear();
+  std::string file_name;
+  off_t size;
+  uint32_t crc;
+  while (manifest >> file_name >> size >> std::hex >> crc >> std::dec) {
+    struct stat st;
+    std::string backup_path = std::string(USB_MOUNTPOINT_1) + "/" + file_name;
+    if (stat(backup_path.c_str(), &st) == 0 && st.st_size == size) {
+      this->_manifest[file_name] = size;
+    }
+  }
+
+  clog << "info: " << logstream::info << this->_manifest.size() << " files already backed up in "
+       << manifest_path << std::endl;
+}
+
+/**
+ * add a file to the manifest, synced to USB_MOUNTPOINT_1 straight away
+ * @param file_name the file backed up
+ * @param size its size in bytes
+ * @param crc the CRC from its CpuFileTrailer
+ */
+void UsbManager::AddToManifest(std::string file_name, off_t size, uint32_t crc) {
+
+  std::string manifest_path = std::string(USB_MOUNTPOINT_1) + BACKUP_MANIFEST;
+  FILE * ptr_manifest = fopen(manifest_path.c_str(), "a");
+  if (!ptr_manifest) {
+    clog << "error: " << logstream::error << "cannot open the backup manifest " << manifest_path << std::endl;
+    return;
+  }
+  fprintf(ptr_manifest, "%s %ld %08X\n", file_name.c_str(), (long)size, crc);
+  fflush(ptr_manifest);
+  fsync(fileno(ptr_manifest));
+  fclose(ptr_manifest);
+
+  this->_manifest[file_name] = size;
+}
+
+/**
+ * back up all the run files in a directory not yet in the manifest
+ * @param dir the directory to look in
+ */
+void UsbManager::BackupDir(std::string dir) {
+
+  DIR * ptr_dir = opendir(dir.c_str());
+  if (!ptr_dir) {
+    return;
+  }
+  struct dirent * entry;
+  while ((entry = readdir(ptr_dir)) != NULL && !this->_stop_backup) {
+    BackupFile(dir, entry->d_name);
+  }
+  closedir(ptr_dir);
+}
+
+/**
+ * copy a closed run file to USB_MOUNTPOINT_1 and check it.
+ * the file is copied by the kernel in chunks of BACKUP_CHUNK_SIZE to a
+ * temporary file, which is synced and read back from the device to compare
+ * its CRC with the one in the CpuFileTrailer, then renamed and added to the manifest
+ * @param dir the directory of the file
+ * @param file_name the file to back up, ignored unless it starts with BACKUP_PREFIX
+ * @return true if the file was backed up or did not need to be
+ */
+bool UsbManager::BackupFile(std::string dir, std::string file_name) {
+
+  if (file_name.compare(0, strlen(BACKUP_PREFIX), BACKUP_PREFIX) != 0) {
+    return true;
+  }
+
+  std::string src_path = dir + "/" + file_name;
+  std::string dst_path = std::string(USB_MOUNTPOINT_1) + "/" + file_name;
+  std::string tmp_path = dst_path + ".part";
+
+  int src_fd = open(src_path.c_str(), O_RDONLY);
+  struct stat st;
+  if (src_fd < 0 || fstat(src_fd, &st) != 0) {
+    clog << "error: " << logstream::error << "cannot open " << src_path << " for the data backup" << std::endl;
+    if (src_fd >= 0) {
+      close(src_fd);
+    }
+    return false;
+  }
+  off_t size = st.st_size;
+
+  /* already backed up */
+  auto backed_up = this->_manifest.find(file_name);
+  if (backed_up != this->_manifest.end() && backed_up->second == size) {
+    close(src_fd);
+    return true;
+  }
+
+  /* only closed runs have a trailer with the CRC, runs are renamed into place before being written */
+  CpuFileTrailer cpu_file_trailer;
+  if (size < (off_t)(sizeof(CpuFileHeader) + sizeof(CpuFileTrailer))
+      || pread(src_fd, &cpu_file_trailer, sizeof(cpu_file_trailer), size - sizeof(cpu_file_trailer))
+      != sizeof(cpu_file_trailer)
+      || cpu_file_trailer.spacer != ID_TAG
+      || (char)(cpu_file_trailer.header >> 24) != TRAILER_PACKET_TYPE) {
+    clog << "info: " << logstream::info << "not backing up " << src_path
+	 << " as it has no trailer, it is still being written" << std::endl;
+    close(src_fd);
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  /* read and write, so that the copy can be read back */
+  int dst_fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (dst_fd < 0) {
+    clog << "error: " << logstream::error << "cannot create " << tmp_path << " for the data backup" << std::endl;
+    close(src_fd);
+    return false;
+  }
+
+  off_t copied = 0;
+  while (copied < size) {
+    size_t len = std::min(size - copied, (off_t)BACKUP_CHUNK_SIZE);
+    ssize_t ret = CpuTools::CopyFileRange(src_fd, copied, dst_fd, copied, len);
+    if (ret <= 0) {
+      break;
+    }
+    copied += ret;
+  }
+  close(src_fd);
+
+  /* drop the copy from the page cache, so the check reads the device */
+  uint32_t crc = 0;
+  bool ok = (copied == size) && fdatasync(dst_fd) == 0
+    && posix_fadvise(dst_fd, 0, 0, POSIX_FADV_DONTNEED) == 0
+    && ReadCrc(dst_fd, size - sizeof(CpuFileTrailer), crc) && crc == cpu_file_trailer.crc;
+  close(dst_fd);
+
+  if (!ok || rename(tmp_path.c_str(), dst_path.c_str()) != 0) {
+    clog << "error: " << logstream::error << "data backup of " << src_path << " failed, "
+	 << copied << " of " << size << " bytes copied, CRC " << std::hex << crc << " expected "
+	 << cpu_file_trailer.crc << std::dec << std::endl;
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  AddToManifest(file_name, size, crc);
+
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  clog << "info: " << logstream::info << "backed up " << src_path << " to " << dst_path << ", "
+       << size << " bytes at " << size / (1024 * 1024) / std::max(seconds, 1e-3) << " MB/s" << std::endl;
+
+  return true;
+}
+
+/**
+ * compute the CRC of the start of a file, as in the CpuFileTrailer
+ * @param fd the file to read
+ * @param len the number of bytes to include
+ * @param crc set to the result
+ * @return false if the file could not be read
+ */
+bool UsbManager::ReadCrc(int fd, off_t len, uint32_t & crc) {
+
+  boost::crc_32_type crc_32;
+  std::vector<char> buffer(std::min(len, (off_t)BACKUP_CHUNK_SIZE));
+  off_t done = 0;
+
+  while (done < len) {
+    ssize_t ret = pread(fd, buffer.data(), std::min(len - done, (off_t)buffer.size()), done);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    crc_32.process_bytes(buffer.data(), ret);
+    done += ret;
+  }
+
+  crc = crc_32.checksum();
+  return true;
+}
+
 
 /**
- * spawn thread to run data backup in the background 
+ * spawn thread to run data backup in the background
  */
 int UsbManager::RunDataBackup() {
 
   clog << "info: " << logstream::info << "running data backup in the background" << std::endl;
 
-  /* run the backup */
-  std::thread run_backup (&UsbManager::DataBackup, this);
+  if (this->_backup_thread.joinable()) {
+    return 0;
+  }
 
-  /* store the thread handle */
-  this->backup_thread_handle = run_backup.native_handle();
+  /* run the backup */
+  this->_stop_backup = false;
+  this->_backup_thread = std::thread(&UsbManager::DataBackup, this);
 
-  /* detach */
-  run_backup.detach();
-  
   return 0;
 }
 
 /**
- * kill the data backup thread,
- * used when shutting down
- * the data backup thread holds no locked resources
+ * stop the data backup thread,
+ * used when shutting down.
+ * a file being copied is finished first
  */
 int UsbManager::KillDataBackup() {
 
-  clog << "info: " << logstream::info << "killing the data backup thread" << std::endl;
-  
-  if (this->backup_launched) {
-    /* kill the thread */
-    /* justifiable as no locked resources */
-    pthread_cancel(this->backup_thread_handle);
+  if (this->_backup_thread.joinable()) {
+    clog << "info: " << logstream::info << "stopping the data backup thread" << std::endl;
+    this->_stop_backup = true;
+    this->_backup_thread.join();
   }
-  
+
   return 0;
 }
@@ -2,8 +2,20 @@
 #define _USB_INTERFACE_H
 
 #include <libusb-1.0/libusb.h>
+#ifndef __APPLE__
+#include <sys/inotify.h>
+#endif /* __APPLE__ */
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
 
 #include <thread>
+#include <atomic>
+#include <map>
+#include <fstream>
+#include <boost/crc.hpp>
 
 #include "log.h"
 #include "CpuTools.h"
@@ -13,6 +25,14 @@
 
 #define USB_MOUNTPOINT_0 "/media/usb0"
 #define USB_MOUNTPOINT_1 "/media/usb1"
+#define DONE_DIR "/home/minieusouser/DONE"
+
+/* data backup of the run files to USB_MOUNTPOINT_1 */
+#define BACKUP_PREFIX "CPU_RUN_" /* only files starting with this are backed up */
+#define BACKUP_MANIFEST "/backup_manifest.txt" /* list of the files backed up, on USB_MOUNTPOINT_1 */
+#define BACKUP_CHUNK_SIZE (16 * 1024 * 1024) /* bytes copied at once */
+#define BACKUP_POLL_MS 1000 /* how often the backup checks if it should stop */
+#define BACKUP_EVENT_BUF (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
 
 #define N_USB_UNDEF 0xFF
 
@@ -27,7 +47,10 @@
 
 /**
  * handles the interface to all USB devices, including 
- * data storage and automated backup
+ * data storage and automated backup.
+ * the backup copies each run file to USB_MOUNTPOINT_1 once it is closed,
+ * checks the copy against the CRC in its CpuFileTrailer and
+ * records it in a manifest, so that nothing is copied twice
  */
 class UsbManager {
 public:
@@ -46,6 +69,7 @@ public:
   bool backup_launched;
   
   UsbManager();
+  ~UsbManager();
   static int CheckUsb();
   uint8_t LookupUsbStorage();
   int RunDataBackup();
@@ -53,13 +77,26 @@ public:
   
 private:
   /**
-   * stores the backup thread handle
+   * the backup thread
+   */
+  std::thread _backup_thread;
+  /**
+   * set to stop the backup thread
+   */
+  std::atomic<bool> _stop_backup;
+  /**
+   * the files already on USB_MOUNTPOINT_1 and their sizes, from BACKUP_MANIFEST
    */
-  std::thread::native_handle_type backup_thread_handle;  
+  std::map<std::string, off_t> _manifest;
   
   void CheckCpuModel();
   static void PrintDev(libusb_device * dev);
   int DataBackup();
+  void LoadManifest();
+  void AddToManifest(std::string file_name, off_t size, uint32_t crc);
+  void BackupDir(std::string dir);
+  bool BackupFile(std::string dir, std::string file_name);
+  static bool ReadCrc(int fd, off_t len, uint32_t & crc);
   int GetDeviceInterface(libusb_device * dev);
 };
 #endif
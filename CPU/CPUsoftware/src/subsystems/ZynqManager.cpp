@@ -10,6 +10,7 @@ ZynqManager::ZynqManager () {
   this->zynq_mode = ZynqManager::NONE;
   this->test_mode = ZynqManager::T_NONE;
   this->telnet_connected = false;
+  this->scurve_cancel = false;
 
   /* initialise vector of EC values to 0 */
   for (int i = 0; i < N_EC; i++) {
@@ -18,26 +19,29 @@ ZynqManager::ZynqManager () {
 }
 
 
+/**
+ * destructor
+ * stops following an S-curve still in progress
+ */
+ZynqManager::~ZynqManager() {
+
+  StopScurve();
+}
+
 /**
  * check if the telnet socekt is responding as expected
  */
 bool ZynqManager::CheckTelnet() {
 
   bool connected = false;
-  int sockfd;
   std::string status_string = "";
-  
-  /* set up the telnet connection */
-  sockfd = ConnectTelnet();
 
   std::cout << "..." << std::endl;
-  if (sockfd > 0) {
-    status_string = SendRecvTelnet("instrument status\n", sockfd);
-    close(sockfd);
-  }
+  status_string = Session().Command("instrument status\n");
 
-  size_t found = status_string.find("40");
-  if (found != std::string::npos) {
+  ReplyParser::InstStatus inst_status;
+  if (ReplyParser::ParseInstStatus(status_string.c_str(), &inst_status)
+      && inst_status.code == ZYNQ_STATUS_OK) {
     connected = true;
   }
   
@@ -46,7 +50,7 @@ bool ZynqManager::CheckTelnet() {
 
 /**
  * check telnet connection on ZYNQ_IP (defined in ZynqManager.h)
- * and close the telnet connection after.
+ * and keep the telnet session open for the following commands.
  * has a timeout implemented of length CONNECT_TIMEOUT_SEC (defined in ZynqManager.h)
  */
 int ZynqManager::CheckConnect() {
@@ -107,180 +111,52 @@ int ZynqManager::CheckConnect() {
 }
 
 /**
- * send and recieve commands over the telnet connection
- * to be used inside a function which opens the telnet connection 
- * @param send_msg the message to be sent
- * @param sockfd the socket field descriptor
+ * the telnet session to ZYNQ_IP, shared by all commands.
+ * opened by the first command and kept open, reconnecting if it is lost
  */
-std::string ZynqManager::SendRecvTelnet(std::string send_msg, int sockfd) {
+TelnetSession & ZynqManager::Session() {
 
-  const char * kSendMsg = send_msg.c_str();
-  char buffer[256];
-  std::string recv_msg;
-  std::string err_msg = "error";
-  int n;
-  
-  /* prepare the message to send */
-  bzero(buffer, 256);
-  strncpy(buffer, kSendMsg, sizeof(buffer));
-  send_msg.erase(std::remove(send_msg.begin(), send_msg.end(), '\n'), send_msg.end());
-  clog << "info: " << logstream::info << "sending via telnet: " << send_msg << std::endl;
- 
-  n = write(sockfd, buffer, strlen(buffer));
-  if (n < 0) {
-    clog << "error: " << logstream::error << "error writing to socket" << std::endl;
-    return err_msg;
-  }
-  bzero(buffer, 256);
-  n = read(sockfd, buffer, 255);
-  if (n < 0) {
-    clog << "error: " << logstream::error << "error reading from socket" << std::endl;
-    return err_msg;
-  }
-  recv_msg = buffer;
-  recv_msg.erase(std::remove(recv_msg.begin(), recv_msg.end(), '\r'), recv_msg.end());
-  recv_msg.erase(std::remove(recv_msg.begin(), recv_msg.end(), '\n'), recv_msg.end());
-  clog << "info: " << logstream::info << "receiving via telnet: " << recv_msg << std::endl;
-  return recv_msg;
- }
+  static TelnetSession session(ZYNQ_IP, TELNET_PORT);
+  return session;
+}
 
 /**
- * wrapper for use of SendRecvTelnet() in more readable way
+ * send a command over the telnet session and wait for the reply
  * @param send_msg message to send
- * @param sockfd the socket file descriptor
  * @param print if true, received message is printed
  * returns the recieved telnet response
  */
-std::string ZynqManager::Telnet(std::string send_msg, int sockfd, bool print) {
+std::string ZynqManager::Telnet(std::string send_msg, bool print) {
 
-  std::string status_string = "";
-  
-  if (sockfd > 0) {
-    status_string = SendRecvTelnet(send_msg, sockfd);
-    if (print) {
-      std::cout << status_string << std::endl;
-    }
-    usleep(SLEEP_TIME);
-  }
-  else {
-    clog << "error: " << logstream::error << "bad socket passed to ZynqManager::Telnet()" << std::endl;
+  std::string status_string = Session().Command(send_msg);
+  if (print) {
+    std::cout << status_string << std::endl;
   }
   return status_string;
 }
 
-/**
- * connect via telnet to ZYNQ_IP.
- * NB: leaves telnet open to be closed with a separate function 
- */
-int ZynqManager::ConnectTelnet() {
-
-  /* definitions */
-  int sockfd;
-  struct sockaddr_in serv_addr;
-  struct hostent * server;
-  const char * ip = ZYNQ_IP;
-  struct timeval tv;
-  fd_set fdset;
-  
-  clog << "info: " << logstream::info << "checking connection to IP " << ZYNQ_IP  << std::endl;
-
-  /* debug */
-  clog << "info: " << logstream::info << "setting up telnet connection" << std::endl;  
-   
-  /* set up the telnet connection */
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0) { 
-    clog << "error: " << logstream::error << "error opening socket" << std::endl;
-    return 1;
-  }
-
-  /* debug */
-  clog << "info: " << logstream::info << "retrieving server" << std::endl;  
-   
-  server = gethostbyname(ip);
-  if (server == NULL) {
-    clog << "error: " << logstream::error << "no host found for " << ZYNQ_IP << std::endl;  
-    return 1;
-  }
-  
-  /* debug */
-  clog << "info: " << logstream::info << "setting server address" << std::endl;  
-
-  bzero((char *) &serv_addr, sizeof(serv_addr));
-  serv_addr.sin_family = AF_INET;
-  bcopy((char *)server->h_addr, 
-	(char *)&serv_addr.sin_addr.s_addr,
-	server->h_length);
-  serv_addr.sin_port = htons(TELNET_PORT);
-
-  /* debug */
-  clog << "info: " << logstream::info << "set port to non-blocking" << std::endl;  
-
-  /* set non-blocking */
-  int opts = fcntl(sockfd, F_SETFL, O_NONBLOCK);
-  connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr));
-
-  FD_ZERO(&fdset);
-  FD_SET(sockfd, &fdset);
-
-  /* add timeout */
-  tv.tv_sec = SHORT_TIMEOUT_SEC; 
-  tv.tv_usec = 0;
-
-  /* debug */
-  clog << "info: " << logstream::info << "connect to socket" << std::endl;  
-  
-  if (select(sockfd + 1, NULL, &fdset, NULL, &tv) == 1) {
-      int so_error;
-      socklen_t len = sizeof so_error;
-      
-      getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
-      
-      if (so_error == 0) {
-	clog << "info: " << logstream::info << "connected to " << ZYNQ_IP << " on port " << TELNET_PORT  << std::endl;
-
-	/* clear non-blocking */
-	opts = opts & (~O_NONBLOCK);
-	fcntl(sockfd, F_SETFL, opts);   
-      }
-      else {
-
-	clog << "error: " << logstream::error << "error connecting to " << ZYNQ_IP << " on port " << TELNET_PORT << std::endl;
-	return -1;
-      }
-      
-    }
-  
-  return sockfd;   
-}
-
 /**
  * check the instrument status 
  */
 int ZynqManager::GetInstStatus() {
 
-  int sockfd;
-
   clog << "info: " << logstream::info << "checking the instrument status" << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-
   /* get the instrument status */
   std::cout << "instrument status: ";
-  std::string status = Telnet("instrument status\n", sockfd, true);
-  close(sockfd);
+  std::string status = Telnet("instrument status\n", true);
 
   /* perform checks */
-  size_t found = status.find("40");
-  if (found == std::string::npos) {
+  ReplyParser::InstStatus inst_status;
+  if (!ReplyParser::ParseInstStatus(status.c_str(), &inst_status)) {
+    clog << "error: " << logstream::error << "cannot read instrument status: " << status << std::endl;
+    return 1;
+  }
+  if (inst_status.code != ZYNQ_STATUS_OK) {
     clog << "error: " << logstream::error << "instrument status is: " << status << std::endl;
   }
-
-  int reported_zynq_mode = stoi(status.substr(3, std::string::npos));
-
-  if (reported_zynq_mode != this->zynq_mode) {
-    clog << "error: " << logstream::error << "zynq_mode is: " << reported_zynq_mode << std::endl;
+  if (inst_status.mode != this->zynq_mode) {
+    clog << "error: " << logstream::error << "zynq_mode is: " << inst_status.mode << std::endl;
   }
   
   return 0;
@@ -292,17 +168,11 @@ int ZynqManager::GetInstStatus() {
  */
 int ZynqManager::GetHvpsStatus() {
 
-  int sockfd;
-
   clog << "info: " << logstream::info << "checking the HVPS status" << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-
   /* get the HVPS status */
   std::cout << "HVPS status: ";
-  std::string status = Telnet("hvps status gpio\n", sockfd, true);
-  close(sockfd);
+  std::string status = Telnet("hvps status gpio\n", true);
 
   /* perform checks */
   /* ! disabled this for now as causing problems ! */
@@ -330,31 +200,28 @@ int ZynqManager::GetHvpsStatus() {
  */
 int ZynqManager::HvpsTurnOn(int cv, int dv, std::string hvps_ec_string) {
 
-  int sockfd;
   std::string cmd;
  
   clog << "info: " << logstream::info << "turning on the HVPS" << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-  
   /* set the cathode voltage */
   /* make the command string from config file values */
   cmd = CpuTools::BuildStr("hvps cathode", " ", 3, N_EC);
   std::cout << "Set HVPS cathode to " << cv << ": "; 
-  Telnet(cmd, sockfd, true);
+  Telnet(cmd, true);
   
   /* set the dynode voltage to 0 */
   cmd = CpuTools::BuildStr("hvps setdac", " ", 0, N_EC);
   std::cout << "Set HVPS DAC to " << 0 << ": "; 
-  Telnet(cmd, sockfd, true);
+  Telnet(cmd, true);
   
   /* turn on */
   /* make the command string from hvps_ec_string */
   this->ec_values = CpuTools::DelimStrToVec(hvps_ec_string, ',', N_EC, true);
   cmd = CpuTools::BuildStrFromVec("hvps turnon", " ", this->ec_values); 
   std::cout << "Turn on HVPS: ";
-  Telnet(cmd, sockfd, true);
+  Telnet(cmd, true);
+  usleep(HVPS_RAMP_SLEEP);
   
   /* ramp up in steps of 500 DAC */
   int ramp_dac[8];
@@ -372,7 +239,8 @@ int ZynqManager::HvpsTurnOn(int cv, int dv, std::string hvps_ec_string) {
     if (dv > ramp_dac[i]) {
       cmd = CpuTools::BuildStr("hvps setdac", " ", ramp_dac[i], N_EC);
       std::cout << "Set HVPS DAC to " << ramp_dac[i] << ": ";
-      Telnet(cmd, sockfd, true);
+      Telnet(cmd, true);
+      usleep(HVPS_RAMP_SLEEP);
 
       i += 1;
     }
@@ -384,16 +252,15 @@ int ZynqManager::HvpsTurnOn(int cv, int dv, std::string hvps_ec_string) {
   /* set the final DAC */
   cmd = CpuTools::BuildStr("hvps setdac", " ", dv, N_EC);
   std::cout << "Set HVPS DAC to " << dv << ": ";
-  Telnet(cmd, sockfd, true);
+  Telnet(cmd, true);
   
   /* check the status */
   std::cout << "HVPS status: ";
-  Telnet("hvps status gpio\n", sockfd, true);
+  Telnet("hvps status gpio\n", true);
   
   /* update the HvpsStatus */
   this->hvps_status = ZynqManager::ON;
   
-  close(sockfd);
   return 0;
 }
 
@@ -403,23 +270,18 @@ int ZynqManager::HvpsTurnOn(int cv, int dv, std::string hvps_ec_string) {
  */
 int ZynqManager::HvpsTurnOff() {
 
-  int sockfd;
   std::string cmd;
 
   clog << "info: " << logstream::info << "turning off the HVPS" << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-
   /* turn off */
   std::cout << "HVPS turn off: ";
   cmd = CpuTools::BuildStr("hvps turnoff", " ", 1, N_EC);
-  Telnet(cmd, sockfd, true);
+  Telnet(cmd, true);
 
   /* check the status */
   std::cout << "HVPS status: ";
-  Telnet("hvps status gpio\n", sockfd, true);
-  close(sockfd); 
+  Telnet("hvps status gpio\n", true);
 
   /* update the HvpsStatus */
   this->hvps_status = ZynqManager::OFF;
@@ -434,58 +296,148 @@ int ZynqManager::HvpsTurnOff() {
 
 
 /**
- * take an scurve 
+ * take an scurve, waiting for it to complete
+ * @return 0 on success, 1 on failure
  */
 int ZynqManager::Scurve(int start, int step, int stop, int acc) {
+
+  return StartScurve(start, step, stop, acc).get();
+}
+
+/**
+ * start an scurve and return without waiting for it.
+ * the status is then checked every SCURVE_POLL_MS from another thread,
+ * each check being one exchange of the TelnetSession, so that other commands
+ * can go on. the thread does not take m_zynq, so this can be called with it held.
+ * an scurve still being followed is given up first
+ * @param start first threshold
+ * @param step between thresholds
+ * @param stop last threshold
+ * @param acc number of frames accumulated for each threshold
+ * @param progress if set, called from the other thread with each new threshold
+ * @param on_done if set, called with the result once the scurve is complete or has failed,
+ * from the other thread or from this one if the scurve cannot be started
+ * @return ready with 0 when the scurve is complete, 1 on failure
+ */
+std::future<int> ZynqManager::StartScurve(int start, int step, int stop, int acc,
+					  std::function<void(int)> progress,
+					  std::function<void(int)> on_done) {
   
-  int sockfd;
   std::string cmd;
   std::stringstream conv;
-  std::string status_string;
+  std::promise<int> done;
+  std::future<int> result = done.get_future();
   
   clog << "info: " << logstream::info << "taking an S-curve" << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-  
+  /* only one scurve at a time */
+  StopScurve();
+
   /* take an s-curve */
   std::cout << "S-Curve acquisition starting" << std::endl;
   conv << "acq scurve " << start << " " << step << " " << stop << " " << acc << std::endl;
   cmd = conv.str();
   std::cout << cmd;
   
-  status_string = SendRecvTelnet(cmd, sockfd);
+  if (Telnet(cmd, false) == "error") {
+    clog << "error: " << logstream::error << "failed to start the S-curve" << std::endl;
+    done.set_value(1);
+    if (on_done) {
+      on_done(1);
+    }
+    return result;
+  }
+
+  this->scurve_cancel = false;
+  this->scurve_job = std::thread(&ZynqManager::ScurveJob, this, std::move(done), progress, on_done);
+  return result;
+}
+
+/**
+ * stop following the scurve started by StartScurve(), if it is not complete,
+ * and wait for its thread to finish, so that its callbacks are no longer called
+ */
+void ZynqManager::StopScurve() {
 
-  while(!this->CheckScurve(sockfd)) {
-    sleep(1);
+  this->scurve_cancel = true;
+  if (this->scurve_job.joinable()) {
+    this->scurve_job.join();
+  }
+}
+
+/**
+ * follow the scurve started by StartScurve() until it is complete
+ * @param done set to 0 on completion, 1 on failure
+ * @param progress if set, called with each new threshold
+ * @param on_done if set, called with the value given to done
+ */
+void ZynqManager::ScurveJob(std::promise<int> done, std::function<void(int)> progress,
+			    std::function<void(int)> on_done) {
+
+  int threshold = -1;
+  int n_errors = 0;
+  int result = 1;
+
+  while (!this->scurve_cancel) {
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(SCURVE_POLL_MS));
+
+    /* m_zynq is not taken, as StartScurve() may be waiting for this thread with it held */
+    std::string status_string = Telnet("acq scurve status\n", false);
+
+    ReplyParser::ScurveStatus status;
+    if (!ReplyParser::ParseScurveStatus(status_string.c_str(), &status)) {
+      if (++n_errors >= SCURVE_MAX_ERRORS) {
+	clog << "error: " << logstream::error << "cannot read S-curve status: " << status_string << std::endl;
+	break;
+      }
+      continue;
+    }
+    n_errors = 0;
+
+    if (status.threshold >= 0 && status.threshold != threshold) {
+      threshold = status.threshold;
+      if (progress) {
+	progress(threshold);
+      }
+    }
+    if (!status.gathering) {
+      clog << "info: " << logstream::info << "S-curve acquisition complete" << std::endl;
+      result = 0;
+      break;
+    }
+  }
+
+  if (this->scurve_cancel) {
+    clog << "warning: " << logstream::warning << "stopped following the S-curve" << std::endl;
+  }
+  done.set_value(result);
+  if (on_done) {
+    on_done(result);
   }
-  
-  close(sockfd);
-  return 0;
 }
 
 
 /**
  * check the S-curve acquisition status and return true on completion
  */
-bool ZynqManager::CheckScurve(int sockfd) {
+bool ZynqManager::CheckScurve() {
 
   bool scurve_status = false;
   std::string status_string;
   
-  status_string = SendRecvTelnet("acq scurve status\n", sockfd);
+  status_string = Telnet("acq scurve status\n", false);
   std::cout << "acq scurve status: " << status_string << std::endl;
 
-  size_t noacq_found = status_string.find("GatheringInProgress=0");
-  if (noacq_found != std::string::npos) {
+  ReplyParser::ScurveStatus status;
+  if (!ReplyParser::ParseScurveStatus(status_string.c_str(), &status)) {
+    clog << "error: " << logstream::error << "cannot read S-curve status: " << status_string << std::endl;
+  }
+  else if (!status.gathering) {
 
     /* scurve gathering is done */
     scurve_status = true;
   }
-  else {
-    clog << "error: " << logstream::error << "bad socket in ZynqManager::CheckScurve()" << std::endl;
-    
-  }
   
   return scurve_status;
 }
@@ -498,23 +450,18 @@ int ZynqManager::SetDac(int dac_level) {
 
   /* definitions */
   std::string status_string;
-  int sockfd;
   std::string cmd;
   std::stringstream conv;
 
   clog << "info: " << logstream::info << "set the dac level to the SPACIROCs" << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-  
   /* set the dac level */
   conv << "slowctrl all dac " << dac_level << std::endl;
   cmd = conv.str();
   std::cout << cmd;
   
-  Telnet(cmd, sockfd, false);
+  Telnet(cmd, false);
 
-  close(sockfd);
   return 0;
 }
 
@@ -526,23 +473,18 @@ int ZynqManager::AcqShot() {
 
   /* definitions */
   std::string status_string;
-  int sockfd;
   std::string cmd;
   std::stringstream conv;
 
   clog << "info: " << logstream::info << "acquiring a single frame from the SPACIROCs" << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-  
   /* take a single frame */
   conv << "acq shot" << std::endl;
   cmd = conv.str();
   std::cout << cmd;
 
-  Telnet(cmd, sockfd, false);
+  Telnet(cmd, false);
 
-  close(sockfd);
   return 0;
 }
 
@@ -554,7 +496,6 @@ uint8_t ZynqManager::SetZynqMode() {
 
   /* definitions */
   std::string status_string;
-  int sockfd;
   std::string cmd;
   std::stringstream conv;
 
@@ -562,34 +503,28 @@ uint8_t ZynqManager::SetZynqMode() {
 
   clog << "info: " << logstream::info << "ZynqManager switching to zynq mode " << (int)input_mode << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-
   /* define the command to send via telnet */
   uint32_t timestamp = time(NULL);
   conv << "instrument mode " << (int)this->zynq_mode << " " << timestamp << std::endl;
   cmd = conv.str();
-  Telnet(cmd, sockfd, false);  
+  Telnet(cmd, false);  
 
   /* check the status */
-  std::string status = Telnet("instrument status\n", sockfd, false);
-
-  try {
-    int reported_zynq_mode = std::stoi(status.substr(2,5));
-    if (reported_zynq_mode != (int)this->zynq_mode) {
+  std::string status = Telnet("instrument status\n", false);
 
-      std::cout << "ERROR: zynq mode set incorrectly" << std::endl; 
-      clog << "error: " << logstream::error
-	   << "reported zynq mode is: " << reported_zynq_mode
-	   << "ZynqManager zynq mode is: " << (int)this->zynq_mode
-	   << std::endl;
-    }
-  }
-  catch (std::invalid_argument) {
+  ReplyParser::InstStatus inst_status;
+  if (!ReplyParser::ParseInstStatus(status.c_str(), &inst_status)) {
     std::cout << "ERROR: problem reading instrument status" << std::endl;
   }
+  else if (inst_status.mode != (int)this->zynq_mode) {
+
+    std::cout << "ERROR: zynq mode set incorrectly" << std::endl; 
+    clog << "error: " << logstream::error
+	 << "reported zynq mode is: " << inst_status.mode
+	 << "ZynqManager zynq mode is: " << (int)this->zynq_mode
+	 << std::endl;
+  }
 
-  close(sockfd); 
   return this->zynq_mode;
 }
 
@@ -602,7 +537,6 @@ ZynqManager::TestMode ZynqManager::SetTestMode() {
 
   /* definitions */
   std::string status_string;
-  int sockfd;
   std::string cmd;
   std::stringstream conv;
 
@@ -610,16 +544,12 @@ ZynqManager::TestMode ZynqManager::SetTestMode() {
   
   clog << "info: " << logstream::info << "switching to zynq test mode " << input_mode << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-
   /* define the command to send over telnet */
   conv << "acq test " << (int)this->test_mode << std::endl;
   cmd = conv.str();
   
-  Telnet(cmd, sockfd, false);
+  Telnet(cmd, false);
   
-  close(sockfd);
   return this->test_mode;
 }
 
@@ -631,15 +561,11 @@ int ZynqManager::StopAcquisition() {
 
   /* definitions */
   std::string status_string;
-  int sockfd;
 
   clog << "info: " << logstream::info << "switching off the Zynq acquisition" << std::endl;
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-  Telnet("instrument mode 0\n", sockfd, false);
+  Telnet("instrument mode 0\n", false);
   
-  close(sockfd);
   return 0;
 }
 
@@ -653,7 +579,6 @@ int ZynqManager::SetNPkts(int N1, int N2) {
 
   /* definitions */
   std::string status_string;
-  int sockfd;
   std::string cmd1, cmd2;
   std::stringstream conv1, conv2;
 
@@ -665,12 +590,11 @@ int ZynqManager::SetNPkts(int N1, int N2) {
   conv2 << "mmg N2 " << N2 << std::endl;
   cmd2 = conv2.str();
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-  Telnet(cmd1, sockfd, false);
-  Telnet(cmd2, sockfd, false);
+  /* send both together */
+  Session().Queue(cmd1);
+  Session().Queue(cmd2);
+  Session().Flush();
  
-  close(sockfd);
   return 0;
 }
 
@@ -684,7 +608,6 @@ int ZynqManager::SetL2TrigParams(int n_bg, int low_thresh) {
 
   /* definitions */
   std::string status_string;
-  int sockfd;
   std::string cmd1, cmd2;
   std::stringstream conv1, conv2;
 
@@ -696,12 +619,11 @@ int ZynqManager::SetL2TrigParams(int n_bg, int low_thresh) {
   conv2 << "trig low_thresh " << low_thresh << std::endl;
   cmd2 = conv2.str();
 
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
-  Telnet(cmd1, sockfd, false);
-  Telnet(cmd2, sockfd, false);
+  /* send both together */
+  Session().Queue(cmd1);
+  Session().Queue(cmd2);
+  Session().Flush();
  
-  close(sockfd);
   return 0;
 }
 
@@ -711,28 +633,31 @@ int ZynqManager::SetL2TrigParams(int n_bg, int low_thresh) {
  */
 std::string ZynqManager::GetZynqVer() {
 
-  std::string zynq_ver = "";
+  char zynq_ver[REPLY_MAX_LINE];
   std::string cmd = "instrument ver\n";
-  int sockfd;
-  
-  /* setup the telnet connection */
-  sockfd = ConnectTelnet();
 
   /* ask for the version */
-  zynq_ver = SendRecvTelnet(cmd, sockfd);
+  std::string reply = Telnet(cmd, false);
+  if (!ReplyParser::ParseVersion(reply.c_str(), zynq_ver, sizeof(zynq_ver))) {
+    clog << "error: " << logstream::error << "no Zynq version reported" << std::endl;
+    return "";
+  }
   
-  close(sockfd);
   return zynq_ver;
 } 
 
 
 /**
- * Hide the corrupted Pixels give in DeadPixelMask.txt
+ * Hide the corrupted Pixels give in DeadPixelMask.txt.
+ * the mask cannot be read back from the Zynq, which may still have pixels
+ * masked by an earlier run or none if it was restarted, so every pixel is
+ * sent, masked with "slowctrl mask 1" or unmasked with "slowctrl mask 0".
+ * the commands for each line are sent together before reading back the
+ * replies, so that the replies never fill the connection.
+ * without a valid DeadPixelMask.txt, all the pixels are unmasked
  */
 int ZynqManager::HidePixels() {
 
-  int sockfd;
-  
   clog << "info: " << logstream::info << "Hiding corrupted pixels" << std::endl;
   
   // Object containing the command list to send by telnet
@@ -741,27 +666,31 @@ int ZynqManager::HidePixels() {
   // Check that DI R_USB0 etc are defined in the right place
   int n_max=mask.c2send.size();
   
-  if(n_max>0){
-    
-    sockfd = ConnectTelnet();
-    
-    for(int i=0;i<n_max;i++){
-
-      Telnet(mask.c2send[i].line,sockfd,true);
-      Telnet(mask.c2send[i].asic,sockfd,true);
-      Telnet(mask.c2send[i].pixel,sockfd,true);
-      Telnet("slowctrl mask 1",sockfd,true);
-    }
-    
-    close(sockfd);
-    
-  }
-  else{
+  if (n_max == 0) {
 
     //*it is possible to print mask.readed_file*//
     clog << "info: " << logstream::info << "No DeadPixelMask.txt found or the file is incorrect" << std::endl;
-    
   }
+
+  clog << "info: " << logstream::info << n_max << " pixels in the mask, sending all "
+       << N_MASK_LINES * N_MASK_ASICS * N_MASK_PIXELS << " pixels to the Zynq" << std::endl;
+
+  for (int i = 0; i < N_MASK_LINES; i++) {
+    Session().Queue("slowctrl line " + std::to_string(i));
+    for (int j = 0; j < N_MASK_ASICS; j++) {
+      Session().Queue("slowctrl asic " + std::to_string(j));
+      for (int k = 0; k < N_MASK_PIXELS; k++) {
+	Session().Queue("slowctrl pixel " + std::to_string(k));
+	Session().Queue((mask.asic_mask[i][j] >> k) & 1 ? "slowctrl mask 1" : "slowctrl mask 0");
+      }
+    }
+
+    std::vector<std::string> replies = Session().Flush();
+    if (std::find(replies.begin(), replies.end(), "error") != replies.end()) {
+      clog << "error: " << logstream::error << "failed to upload the pixel mask for line " << i << std::endl;
+      return 1;
+    }
+  }
+
   return 0;
 }
-
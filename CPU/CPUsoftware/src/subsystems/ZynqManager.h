@@ -14,10 +14,15 @@
 
 #include <fstream>
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
 #include <mutex>
+#include <thread>
 
 #include "log.h"
 #include "CpuTools.h"
+#include "TelnetSession.h"
 /*Giammanco include the pxel mask*/
 #include "DeadPixelRead.h"
 
@@ -25,7 +30,6 @@
 #define ZYNQ_IP "192.168.7.10"
 #define TELNET_PORT 23
 #define CONNECT_TIMEOUT_SEC 100
-#define SHORT_TIMEOUT_SEC 2
 
 /* pedestal for the ASIC DAC */
 #define PEDESTAL 750
@@ -33,13 +37,18 @@
 /* for use with HV interface functions */
 #define N_EC 9
 
-/* time between consecutive telnet commands in mus */
-#define SLEEP_TIME 500000
+/* time between steps of the HV ramp in mus */
+#define HVPS_RAMP_SLEEP 500000
+
+/* time between checks of the S-curve status in ms */
+#define SCURVE_POLL_MS 200
+/* give up on an S-curve after this many unreadable status replies in a row */
+#define SCURVE_MAX_ERRORS 10
 
 /**
  * class to handle the Zynq interface. 
- * commands and information are sent and received over telnet
- * using socket programming.
+ * commands and information are sent and received over a
+ * telnet session kept open between commands (TelnetSession).
  * data from the Zynq board is placed on the FTP directory
  */
 class ZynqManager {
@@ -124,14 +133,18 @@ public:
   std::mutex m_zynq;
   
   ZynqManager();
+  ~ZynqManager();
   int CheckConnect();
-  static int ConnectTelnet();
   int GetInstStatus();
   int GetHvpsStatus();
   int HvpsTurnOn(int cv, int dv, std::string hvps_ec_string);
   int HvpsTurnOff();
   int HidePixels(); /*added by Giammanco*/
   int Scurve(int start, int step, int stop, int acc);
+  std::future<int> StartScurve(int start, int step, int stop, int acc,
+			       std::function<void(int)> progress = nullptr,
+			       std::function<void(int)> on_done = nullptr);
+  void StopScurve();
   int SetDac(int dac_level);
   int AcqShot();
   uint8_t SetZynqMode();
@@ -139,13 +152,21 @@ public:
   static int StopAcquisition();
   int SetNPkts(int N1, int N2);
   int SetL2TrigParams(int n_bg, int low_thresh); 
-  bool CheckScurve(int sockfd);
+  bool CheckScurve();
   static std::string GetZynqVer();
   
 private:
+
+  /**
+   * thread following the S-curve started by StartScurve()
+   */
+  std::thread scurve_job;
+  std::atomic<bool> scurve_cancel;
   
-  static std::string SendRecvTelnet(std::string send_msg, int sockfd);
-  static std::string Telnet(std::string send_msg, int sockfd, bool print);
+  static TelnetSession & Session();
+  static std::string Telnet(std::string send_msg, bool print);
+  void ScurveJob(std::promise<int> done, std::function<void(int)> progress,
+		 std::function<void(int)> on_done);
   int InstStatusTest(std::string send_msg);
   bool CheckTelnet();  
 
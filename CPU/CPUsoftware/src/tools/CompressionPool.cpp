@@ -0,0 +1,193 @@
+#include "CompressionPool.h"
+
+/* codec names for the statistics */
+static const char * kCodecNames[CMP_N_CODECS] = {"none", "frame delta", "sparse"};
+
+/**
+ * constructor.
+ * starts the worker threads
+ * @param n_threads number of worker threads, at least 1
+ * @param nice_level nice level of the workers, negative values need root
+ */
+CompressionPool::CompressionPool(int n_threads, int nice_level) {
+
+  this->_nice_level = nice_level;
+  this->_n_jobs = 0;
+  this->_next_job = 0;
+  this->_n_done = 0;
+  this->_stop = false;
+  for (int i = 0; i < CMP_N_CODECS; i++) {
+    this->_stats[i].n_segments = 0;
+    this->_stats[i].raw_bytes = 0;
+    this->_stats[i].cmp_bytes = 0;
+    this->_stats[i].busy_us = 0;
+  }
+  this->_n_packets = 0;
+  this->_wall_us = 0;
+
+  if (n_threads < 1) {
+    n_threads = 1;
+  }
+  clog << "info: " << logstream::info << "starting " << n_threads << " compression threads with nice level "
+       << nice_level << std::endl;
+  for (int i = 0; i < n_threads; i++) {
+    this->_threads.push_back(std::thread(&CompressionPool::Worker, this));
+  }
+}
+
+/**
+ * destructor.
+ * stops the worker threads
+ */
+CompressionPool::~CompressionPool() {
+
+  {
+    std::unique_lock<std::mutex> lock(this->_m_jobs);
+    this->_stop = true;
+  }
+  this->_cv_jobs.notify_all();
+  for (std::thread & worker : this->_threads) {
+    worker.join();
+  }
+}
+
+/**
+ * encode the Zynq data of a CPU_PACKET, each Zynq packet on a worker thread,
+ * waiting until all are done
+ * @param zynq_view the D1, D2 and D3 data
+ * @param codec the codec to use, as for PktCodec::EncodeZynqData()
+ * @param out the encoded data is written here, resized if needed and reused between calls
+ * @return the size of the encoded data in bytes
+ */
+size_t CompressionPool::EncodeZynqData(const ZynqPktView & zynq_view, uint8_t codec, std::vector<char> & out) {
+
+  std::unique_lock<std::mutex> encode_lock(this->_m_encode);
+  auto start = std::chrono::steady_clock::now();
+
+  /* one job per Zynq packet */
+  size_t n_jobs = zynq_view.level1_data.size() + zynq_view.level2_data.size() + 1;
+  std::unique_lock<std::mutex> lock(this->_m_jobs);
+  if (this->_jobs.size() < n_jobs) {
+    this->_jobs.resize(n_jobs);
+  }
+  size_t i = 0;
+  for (const Z_DATA_TYPE_SCI_L1_V2 & level1 : zynq_view.level1_data) {
+    this->_jobs[i].level = PktCodec::D1;
+    this->_jobs[i++].zynq_pkt = &level1;
+  }
+  for (const Z_DATA_TYPE_SCI_L2_V2 & level2 : zynq_view.level2_data) {
+    this->_jobs[i].level = PktCodec::D2;
+    this->_jobs[i++].zynq_pkt = &level2;
+  }
+  this->_jobs[i].level = PktCodec::D3;
+  this->_jobs[i].zynq_pkt = zynq_view.level3_data;
+  for (i = 0; i < n_jobs; i++) {
+    this->_jobs[i].codec = codec;
+    this->_jobs[i].size = 0;
+  }
+  this->_n_jobs = n_jobs;
+  this->_next_job = 0;
+  this->_n_done = 0;
+
+  this->_cv_jobs.notify_all();
+  this->_cv_done.wait(lock, [this] { return this->_n_done == this->_n_jobs; });
+  this->_n_jobs = 0;
+  lock.unlock();
+
+  /* put the Zynq packets back in order */
+  size_t size = 0;
+  for (i = 0; i < n_jobs; i++) {
+    size += this->_jobs[i].size;
+  }
+  if (out.size() < size) {
+    out.resize(size);
+  }
+  char * ptr = out.data();
+  for (i = 0; i < n_jobs; i++) {
+    memcpy(ptr, this->_jobs[i].buf.data(), this->_jobs[i].size);
+    ptr += this->_jobs[i].size;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  this->_wall_us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+  this->_n_packets++;
+
+  return size;
+}
+
+/**
+ * print and log the per-codec statistics.
+ * throughput is per thread, from the time spent encoding
+ */
+void CompressionPool::PrintStats() {
+
+  unsigned long n_packets = this->_n_packets;
+  std::cout << "compression pool: " << n_packets << " packets on " << this->_threads.size() << " threads, "
+	    << (n_packets ? this->_wall_us / n_packets / 1000 : 0) << " ms per packet" << std::endl;
+  clog << "info: " << logstream::info << "compression pool: " << n_packets << " packets on "
+       << this->_threads.size() << " threads, " << (n_packets ? this->_wall_us / n_packets / 1000 : 0)
+       << " ms per packet" << std::endl;
+
+  for (int i = 0; i < CMP_N_CODECS; i++) {
+    if (this->_stats[i].n_segments == 0) {
+      continue;
+    }
+    double ratio = (double)this->_stats[i].raw_bytes / std::max(1UL, this->_stats[i].cmp_bytes.load());
+    double mb_s = (double)this->_stats[i].raw_bytes / std::max(1UL, this->_stats[i].busy_us.load());
+    std::cout << "  " << kCodecNames[i] << ": " << this->_stats[i].n_segments << " Zynq packets, ratio "
+	      << ratio << ", " << mb_s << " MB/s" << std::endl;
+    clog << "info: " << logstream::info << "compression " << kCodecNames[i] << ": "
+	 << this->_stats[i].n_segments << " Zynq packets, ratio " << ratio << ", " << mb_s << " MB/s" << std::endl;
+  }
+}
+
+/**
+ * the loop run by each worker thread
+ */
+void CompressionPool::Worker() {
+
+  /* only lowers the priority of this thread */
+  if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), this->_nice_level) != 0) {
+    clog << "warning: " << logstream::warning << "cannot set the compression threads to nice level "
+	 << this->_nice_level << std::endl;
+  }
+
+  /* working buffers of the encoder, reused for each job of this thread */
+  PktCodec::Scratch scratch;
+  scratch.Reserve(N_OF_PIXEL_PER_PDM);
+
+  std::unique_lock<std::mutex> lock(this->_m_jobs);
+  while (true) {
+    this->_cv_jobs.wait(lock, [this] { return this->_stop || this->_next_job < this->_n_jobs; });
+    if (this->_stop) {
+      break;
+    }
+    Job & job = this->_jobs[this->_next_job++];
+    lock.unlock();
+
+    auto start = std::chrono::steady_clock::now();
+    size_t max_size = PktCodec::MaxSegmentSize(job.level);
+    if (job.buf.size() < max_size) {
+      job.buf.resize(max_size);
+    }
+    job.size = PktCodec::EncodeSegment(job.level, job.zynq_pkt, job.codec, job.buf.data(), scratch);
+    auto end = std::chrono::steady_clock::now();
+
+    /* count under the codec actually used */
+    uint8_t codec = PktCodec::SegmentCodec(job.level, job.buf.data());
+    if (codec < CMP_N_CODECS) {
+      CodecStats & stats = this->_stats[codec];
+      stats.n_segments++;
+      stats.raw_bytes += (job.level == PktCodec::D1) ? sizeof(Z_DATA_TYPE_SCI_L1_V2)
+	: (job.level == PktCodec::D2) ? sizeof(Z_DATA_TYPE_SCI_L2_V2) : sizeof(Z_DATA_TYPE_SCI_L3_V2);
+      stats.cmp_bytes += job.size;
+      stats.busy_us += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    }
+
+    lock.lock();
+    this->_n_done++;
+    if (this->_n_done == this->_n_jobs) {
+      this->_cv_done.notify_one();
+    }
+  }
+}
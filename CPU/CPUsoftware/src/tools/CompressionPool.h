@@ -0,0 +1,108 @@
+#ifndef _COMPRESSION_POOL_H
+#define _COMPRESSION_POOL_H
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+#include "PktCodec.h"
+
+/* number of codecs with statistics, indexed by the codec */
+#define CMP_N_CODECS (CMP_CODEC_SPARSE + 1)
+
+/**
+ * counters for one codec of the CompressionPool
+ */
+struct CodecStats {
+  std::atomic<unsigned long> n_segments;
+  std::atomic<unsigned long> raw_bytes;
+  std::atomic<unsigned long> cmp_bytes;
+  std::atomic<unsigned long> busy_us;
+};
+
+/**
+ * worker threads compressing the Zynq packets (D1, D2 and D3)
+ * of a CPU_PACKET in parallel with PktCodec.
+ * the encoded packets are put back in order for the writer,
+ * so the result is the same as with PktCodec::EncodeZynqData()
+ */
+class CompressionPool {
+public:
+  CompressionPool(int n_threads, int nice_level);
+  ~CompressionPool();
+  size_t EncodeZynqData(const ZynqPktView & zynq_view, uint8_t codec, std::vector<char> & out);
+  void PrintStats();
+
+private:
+  /**
+   * one Zynq packet to encode
+   */
+  struct Job {
+    PktCodec::Level level;
+    const void * zynq_pkt;
+    uint8_t codec;
+    /* encoded data, reused between CPU packets */
+    std::vector<char> buf;
+    size_t size;
+  };
+
+  /**
+   * worker threads
+   */
+  std::vector<std::thread> _threads;
+  /**
+   * nice level of the worker threads
+   */
+  int _nice_level;
+  /**
+   * jobs of the CPU packet being encoded, only the first _n_jobs are used
+   */
+  std::vector<Job> _jobs;
+  size_t _n_jobs;
+  /**
+   * next job to start and number of jobs finished
+   */
+  size_t _next_job;
+  size_t _n_done;
+  /**
+   * set to stop the workers
+   */
+  bool _stop;
+  /**
+   * protects the jobs and counters above
+   */
+  std::mutex _m_jobs;
+  /**
+   * to wake the workers when there are new jobs
+   */
+  std::condition_variable _cv_jobs;
+  /**
+   * to wake EncodeZynqData() when the jobs are done
+   */
+  std::condition_variable _cv_done;
+  /**
+   * serialises EncodeZynqData(), as jobs are for one CPU packet at a time
+   */
+  std::mutex _m_encode;
+  /**
+   * per-codec counters
+   */
+  CodecStats _stats[CMP_N_CODECS];
+  /**
+   * number of CPU packets encoded and time spent waiting for them
+   */
+  std::atomic<unsigned long> _n_packets;
+  std::atomic<unsigned long> _wall_us;
+
+  void Worker();
+};
+
+#endif
+/* _COMPRESSION_POOL_H */
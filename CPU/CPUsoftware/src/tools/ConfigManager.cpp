@@ -30,6 +30,33 @@ ConfigManager::ConfigManager () {
   this->ConfigOut->light_acq_time = -1;
   this->ConfigOut->status_period = -1;
   this->ConfigOut->pwr_on_delay =-1;
+
+  /* initialise optional struct members to their defaults */
+  this->ConfigOut->mmap_ingest = 0;
+  this->ConfigOut->crc_verify = 0;
+  this->ConfigOut->async_write = 0;
+  this->ConfigOut->async_queue_mb = 64;
+  this->ConfigOut->async_backpressure = 0;
+  this->ConfigOut->file_backend = 0;
+  this->ConfigOut->direct_io = 0;
+  this->ConfigOut->pipeline_ingest = 0;
+  this->ConfigOut->ftp_client = 0;
+  this->ConfigOut->ftp_poll_ms = 100;
+  this->ConfigOut->ftp_passive = 0;
+  this->ConfigOut->ftp_direct = 0;
+  this->ConfigOut->splice_ingest = 0;
+  this->ConfigOut->compress = 0;
+  this->ConfigOut->cmp_threads = 0;
+  this->ConfigOut->cmp_nice = 0;
+  this->ConfigOut->usb_mirror = 0;
+  this->ConfigOut->usb_backup = 0;
+  this->ConfigOut->fat32_prealloc = 0;
+  this->ConfigOut->write_block_kb = 0;
+  this->ConfigOut->run_rotate_pkts = RUN_SIZE;
+  this->ConfigOut->run_rotate_mb = 0;
+  this->ConfigOut->run_rotate_sec = 0;
+  this->ConfigOut->checkpoint_pkts = 0;
+  this->ConfigOut->fsync_checkpoints = 0;
   
   /* initialise HV switch to be set by InputParser */
   /* stored here to be easily passed around the DataAcquisition */
@@ -75,6 +102,33 @@ ConfigManager::ConfigManager (std::string cfl, std::string cf0, std::string cf1)
   this->ConfigOut->light_acq_time = -1;
   this->ConfigOut->status_period = -1;
   this->ConfigOut->pwr_on_delay =-1;
+
+  /* initialise optional struct members to their defaults */
+  this->ConfigOut->mmap_ingest = 0;
+  this->ConfigOut->crc_verify = 0;
+  this->ConfigOut->async_write = 0;
+  this->ConfigOut->async_queue_mb = 64;
+  this->ConfigOut->async_backpressure = 0;
+  this->ConfigOut->file_backend = 0;
+  this->ConfigOut->direct_io = 0;
+  this->ConfigOut->pipeline_ingest = 0;
+  this->ConfigOut->ftp_client = 0;
+  this->ConfigOut->ftp_poll_ms = 100;
+  this->ConfigOut->ftp_passive = 0;
+  this->ConfigOut->ftp_direct = 0;
+  this->ConfigOut->splice_ingest = 0;
+  this->ConfigOut->compress = 0;
+  this->ConfigOut->cmp_threads = 0;
+  this->ConfigOut->cmp_nice = 0;
+  this->ConfigOut->usb_mirror = 0;
+  this->ConfigOut->usb_backup = 0;
+  this->ConfigOut->fat32_prealloc = 0;
+  this->ConfigOut->write_block_kb = 0;
+  this->ConfigOut->run_rotate_pkts = RUN_SIZE;
+  this->ConfigOut->run_rotate_mb = 0;
+  this->ConfigOut->run_rotate_sec = 0;
+  this->ConfigOut->checkpoint_pkts = 0;
+  this->ConfigOut->fsync_checkpoints = 0;
   
   /* initialise HV switch to be set by InputParser */
   /* stored here to be easily passed around the DataAcquisition */
@@ -200,6 +254,81 @@ void ConfigManager::Parse(std::string config_file_name){
       else if (type == "PWR_ON_DELAY") {
 	in >> this->ConfigOut->pwr_on_delay;
       }
+      else if (type == "MMAP_INGEST") {
+	in >> this->ConfigOut->mmap_ingest;
+      }
+      else if (type == "CRC_VERIFY") {
+	in >> this->ConfigOut->crc_verify;
+      }
+      else if (type == "ASYNC_WRITE") {
+	in >> this->ConfigOut->async_write;
+      }
+      else if (type == "ASYNC_QUEUE_MB") {
+	in >> this->ConfigOut->async_queue_mb;
+      }
+      else if (type == "ASYNC_BACKPRESSURE") {
+	in >> this->ConfigOut->async_backpressure;
+      }
+      else if (type == "FILE_BACKEND") {
+	in >> this->ConfigOut->file_backend;
+      }
+      else if (type == "DIRECT_IO") {
+	in >> this->ConfigOut->direct_io;
+      }
+      else if (type == "PIPELINE_INGEST") {
+	in >> this->ConfigOut->pipeline_ingest;
+      }
+      else if (type == "FTP_CLIENT") {
+	in >> this->ConfigOut->ftp_client;
+      }
+      else if (type == "FTP_POLL_MS") {
+	in >> this->ConfigOut->ftp_poll_ms;
+      }
+      else if (type == "FTP_PASSIVE") {
+	in >> this->ConfigOut->ftp_passive;
+      }
+      else if (type == "FTP_DIRECT") {
+	in >> this->ConfigOut->ftp_direct;
+      }
+      else if (type == "SPLICE_INGEST") {
+	in >> this->ConfigOut->splice_ingest;
+      }
+      else if (type == "COMPRESS") {
+	in >> this->ConfigOut->compress;
+      }
+      else if (type == "CMP_THREADS") {
+	in >> this->ConfigOut->cmp_threads;
+      }
+      else if (type == "CMP_NICE") {
+	in >> this->ConfigOut->cmp_nice;
+      }
+      else if (type == "USB_MIRROR") {
+	in >> this->ConfigOut->usb_mirror;
+      }
+      else if (type == "USB_BACKUP") {
+	in >> this->ConfigOut->usb_backup;
+      }
+      else if (type == "FAT32_PREALLOC") {
+	in >> this->ConfigOut->fat32_prealloc;
+      }
+      else if (type == "WRITE_BLOCK_KB") {
+	in >> this->ConfigOut->write_block_kb;
+      }
+      else if (type == "RUN_ROTATE_PKTS") {
+	in >> this->ConfigOut->run_rotate_pkts;
+      }
+      else if (type == "RUN_ROTATE_MB") {
+	in >> this->ConfigOut->run_rotate_mb;
+      }
+      else if (type == "RUN_ROTATE_SEC") {
+	in >> this->ConfigOut->run_rotate_sec;
+      }
+      else if (type == "CHECKPOINT_PKTS") {
+	in >> this->ConfigOut->checkpoint_pkts;
+      }
+      else if (type == "FSYNC_CHECKPOINTS") {
+	in >> this->ConfigOut->fsync_checkpoints;
+      }
       
     }
     cfg_file.close();
@@ -277,6 +406,11 @@ void ConfigManager::Configure() {
     }
   } 
 
+  /* the asynchronous queue copies the Zynq data into memory, so there is nothing to splice */
+  if (this->ConfigOut->splice_ingest && this->ConfigOut->async_write) {
+    clog << "warning: " << logstream::warning << "SPLICE_INGEST is ignored with ASYNC_WRITE" << std::endl;
+    this->ConfigOut->splice_ingest = 0;
+  }
   
   return;
 }
@@ -10,6 +10,7 @@
 #include <memory>
 
 #include "log.h"
+#include "minieuso_data_format.h"
 
 #ifndef __APPLE__
 
@@ -64,6 +65,33 @@ struct Config {
   int status_period;
   int pwr_on_delay;
 
+  /* optional in configuration file, defaults set in ConfigManager */
+  int mmap_ingest;
+  int crc_verify;
+  int async_write;
+  int async_queue_mb;
+  int async_backpressure;
+  int file_backend;
+  int direct_io;
+  int pipeline_ingest;
+  int ftp_client;
+  int ftp_poll_ms;
+  int ftp_passive;
+  int ftp_direct;
+  int splice_ingest;
+  int compress;
+  int cmp_threads;
+  int cmp_nice;
+  int usb_mirror;
+  int usb_backup;
+  int fat32_prealloc;
+  int write_block_kb;
+  int run_rotate_pkts;
+  int run_rotate_mb;
+  int run_rotate_sec;
+  int checkpoint_pkts;
+  int fsync_checkpoints;
+
   /* set by RunInstrument and InputParser at runtime */
   bool hv_on;
   uint8_t instrument_mode;
@@ -242,3 +242,102 @@ uint32_t CpuTools::BuildCpuTimeStamp() {
 
   return timestamp;
 }
+
+/**
+ * copy part of a file to another file within the kernel.
+ * uses copy_file_range() if possible, then sendfile(), then 
+ * read() and write() through a small buffer
+ * @param fd_in the file to copy from
+ * @param offset_in where to start copying from
+ * @param fd_out the file to copy to, positioned at offset_out if opened with O_APPEND
+ * @param offset_out where to copy to
+ * @param len the number of bytes to copy
+ * @return the number of bytes copied, less than len if the copy failed part way
+ * or the end of fd_in was reached, or -1 if nothing could be copied
+ */
+ssize_t CpuTools::CopyFileRange(int fd_in, off_t offset_in, int fd_out, off_t offset_out, size_t len) {
+
+  /* remember what the kernel does not support, to avoid failing calls */
+  static std::atomic<bool> copy_file_range_ok(true);
+  static std::atomic<bool> sendfile_ok(true);
+  size_t copied = 0;
+
+  /* copy_file_range() refuses files opened with O_APPEND or on different file systems */
+#ifdef SYS_copy_file_range
+  while (copy_file_range_ok && copied < len) {
+    loff_t off_in = offset_in + copied;
+    loff_t off_out = offset_out + copied;
+    ssize_t ret = syscall(SYS_copy_file_range, fd_in, &off_in, fd_out, &off_out, len - copied, 0);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EBADF || errno == EOPNOTSUPP)) {
+      copy_file_range_ok = (errno != ENOSYS);
+      break;
+    }
+    /* some file systems return 0 instead of an error, the fallbacks find the real end of fd_in */
+    if (ret == 0) {
+      break;
+    }
+    if (ret < 0) {
+      return (copied > 0) ? (ssize_t)copied : -1;
+    }
+    copied += ret;
+  }
+  if (copied == len) {
+    return copied;
+  }
+#endif
+
+  /* sendfile() writes at the current position of fd_out */
+  if (sendfile_ok && lseek(fd_out, offset_out + copied, SEEK_SET) >= 0) {
+    while (copied < len) {
+      off_t off_in = offset_in + copied;
+      ssize_t ret = sendfile(fd_out, fd_in, &off_in, len - copied);
+      if (ret < 0 && errno == EINTR) {
+	continue;
+      }
+      if (ret < 0 && (errno == EINVAL || errno == ENOSYS)) {
+	sendfile_ok = false;
+	break;
+      }
+      if (ret == 0) {
+	break;
+      }
+      if (ret < 0) {
+	return (copied > 0) ? (ssize_t)copied : -1;
+      }
+      copied += ret;
+    }
+    if (copied == len) {
+      return copied;
+    }
+  }
+
+  /* last resort, through user space */
+  char buffer[COPY_BUFFER_SIZE];
+  while (copied < len) {
+    ssize_t n_read = pread(fd_in, buffer, std::min(len - copied, sizeof(buffer)), offset_in + copied);
+    if (n_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n_read <= 0) {
+      return (n_read < 0 && copied == 0) ? -1 : (ssize_t)copied;
+    }
+    ssize_t n_written = 0;
+    while (n_written < n_read) {
+      ssize_t ret = pwrite(fd_out, buffer + n_written, n_read - n_written, offset_out + copied + n_written);
+      if (ret < 0 && errno == EINTR) {
+	continue;
+      }
+      if (ret <= 0) {
+	copied += n_written;
+	return (copied > 0) ? (ssize_t)copied : -1;
+      }
+      n_written += ret;
+    }
+    copied += n_read;
+  }
+
+  return copied;
+}
@@ -10,10 +10,16 @@
 #include <string>
 #include <array>
 #include <vector>
+#include <atomic>
+#include <algorithm>
 
 #include <dirent.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 
 #include "ZynqManager.h"
 #include "minieuso_data_format.h"
@@ -21,6 +27,10 @@
  * define maximum output length for use with CpuTools::CommandToStr()
  */
 #define MAX_STR_LENGTH 2000
+/*
+ * size of the buffer used by CpuTools::CopyFileRange() when the kernel cannot copy
+ */
+#define COPY_BUFFER_SIZE (64 * 1024)
 
 /**
  * class to provide useful functions to other parts of the software 
@@ -42,6 +52,7 @@ public:
   static std::streampos FileSize(std::string file_path);
   static uint32_t BuildCpuHeader(uint32_t type, uint32_t ver);
   static uint32_t BuildCpuTimeStamp();
+  static ssize_t CopyFileRange(int fd_in, off_t offset_in, int fd_out, off_t offset_out, size_t len);
   
   
 };
@@ -6,8 +6,9 @@
 DeadPixelMask::DeadPixelMask(){
 
 
+     memset(asic_mask, 0, sizeof(asic_mask));
      Pick_File();
-     int a=ReadDead();
+     ReadDead();
 
      }
 
@@ -56,7 +57,6 @@ int DeadPixelMask::ReadDead(){
     //int ECU;
     int X; //x and y indices inside of a chip to be converted in pixel number
     int Y;
-    int Npixel;
 
 
 
@@ -116,6 +116,9 @@ int DeadPixelMask::ReadDead(){
 
                             Dead.push_back(pixel);
                             c2send.push_back(cmaskline);
+                            /* lines too long or too many are rejected below */
+                            if(pixel.BOARD<N_MASK_LINES && pixel.ASIC<N_MASK_ASICS)
+                                asic_mask[pixel.BOARD][pixel.ASIC] |= (uint64_t)1 << pixel.Number;
 
 
 
@@ -135,6 +138,7 @@ int DeadPixelMask::ReadDead(){
 
                         Dead.clear();
                         c2send.clear();
+                        memset(asic_mask, 0, sizeof(asic_mask));
                         return 0;
 
 					}
@@ -154,6 +158,7 @@ int DeadPixelMask::ReadDead(){
 
             Dead.clear();
             c2send.clear();
+            memset(asic_mask, 0, sizeof(asic_mask));
             return 0; /*its a format error*/
 
 
@@ -166,6 +171,7 @@ int DeadPixelMask::ReadDead(){
         std::cout << "Unable to open "<<filename<<std::endl;
         Dead.clear();
         c2send.clear();
+        memset(asic_mask, 0, sizeof(asic_mask));
         return 0;
         }
 
@@ -7,17 +7,24 @@
 
 /* to remove white space from matrix */
 #include <string>
+#include <cstring>
 #include <cctype>
 #include <algorithm>
 
 #include <math.h> /*for fmod*/
 
 #include <vector>
+#include <stdint.h>
 
 #define CONFIG_DIR_M  "/home/software/CPU/CPUsoftware/config"
 #define DIR_USB0  "/media/usb0"
 #define DIR_USB1 "/media/usb1"
 
+/* the mask is 48 x 48 pixels, 8 x 8 pixels per ASIC */
+#define N_MASK_LINES 6
+#define N_MASK_ASICS 6
+#define N_MASK_PIXELS 64
+
 
 /**
  * It reads the file DeadPixelMask.txt which contains the pixels to be switched-off. 
@@ -34,6 +41,8 @@ class DeadPixelMask{
 
     std::vector <str2mask>  c2send; /* vector containing the command to send in order to mask pixels,
 				      if empty it means that no file is provided or it is wrong */
+    uint64_t asic_mask[N_MASK_LINES][N_MASK_ASICS]; /* one bit per pixel to mask, for each line and ASIC,
+						       bit n is slowctrl pixel n */
     std::string directory = CONFIG_DIR_M;
     std::string direc_usb0 = DIR_USB0;
     std::string direc_usb1 = DIR_USB1;
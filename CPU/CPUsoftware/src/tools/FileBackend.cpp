@@ -0,0 +1,998 @@
+#include "FileBackend.h"
+#include "CpuTools.h"
+
+/**
+ * create a file backend of the requested type.
+ * falls back to the stdio backend if io_uring is not available
+ * @param backend_type the backend to create
+ * @param direct if true, bypass the page cache with O_DIRECT (io_uring only)
+ */
+FileBackend * FileBackend::Create(BackendType backend_type, bool direct) {
+
+  switch (backend_type) {
+  case URING:
+#ifdef HAVE_IO_URING
+    return new UringBackend(direct);
+#else
+    clog << "warning: " << logstream::warning << "io_uring not available, using stdio file backend" << std::endl;
+    break;
+#endif
+  case STDIO:
+    break;
+  }
+
+  return new StdioBackend();
+}
+
+/**
+ * size of the data which has reached the file and can be read back through it.
+ * by default everything appended is written straight away
+ */
+off_t FileBackend::Written() {
+
+  return Size();
+}
+
+/**
+ * reserve space for the file without changing its size, so that it is
+ * written to contiguous clusters. not supported by default
+ * @param len the expected size of the file in bytes
+ * @return true if the space was reserved
+ */
+bool FileBackend::Preallocate(off_t len) {
+
+  (void)len;
+  return false;
+}
+
+/**
+ * cut the file back to an earlier size, to undo an append which failed part way.
+ * not supported by default
+ * @param size the new size, no more than Size()
+ * @return true if the file was cut
+ */
+bool FileBackend::Truncate(off_t size) {
+
+  (void)size;
+  return false;
+}
+
+/**
+ * append part of another file.
+ * by default the data is read and appended with Append(),
+ * backends which can do better let the kernel copy it
+ * @param fd_in the file to copy from
+ * @param offset where to start copying from
+ * @param len the number of bytes to copy
+ * @return the number of bytes appended, less than len if the copy failed part way,
+ * or -1 if nothing was appended
+ */
+ssize_t FileBackend::AppendFromFile(int fd_in, off_t offset, size_t len) {
+
+  std::vector<char> buffer(std::min(len, (size_t)COPY_BUFFER_SIZE));
+  size_t copied = 0;
+
+  while (copied < len) {
+    ssize_t n_read = pread(fd_in, buffer.data(), std::min(len - copied, buffer.size()), offset + copied);
+    if (n_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n_read <= 0) {
+      return (n_read < 0 && copied == 0) ? -1 : (ssize_t)copied;
+    }
+    struct iovec segment;
+    segment.iov_base = buffer.data();
+    segment.iov_len = n_read;
+    while (segment.iov_len > 0) {
+      ssize_t ret = Append(&segment, 1);
+      if (ret < 0 && errno == EINTR) {
+	continue;
+      }
+      if (ret <= 0) {
+	copied += n_read - segment.iov_len;
+	return (copied > 0) ? (ssize_t)copied : -1;
+      }
+      segment.iov_base = static_cast<char *>(segment.iov_base) + ret;
+      segment.iov_len -= ret;
+    }
+    copied += n_read;
+  }
+
+  return copied;
+}
+
+
+/**
+ * constructor
+ */
+StdioBackend::StdioBackend() {
+
+  this->_ptr_to_file = nullptr;
+  this->_preallocated = false;
+  this->_block_size = 0;
+  this->_block_start = 0;
+  this->_fill = 0;
+  this->_synced_fill = 0;
+}
+
+/**
+ * destructor
+ * closes the file if still open
+ */
+StdioBackend::~StdioBackend() {
+
+  Close();
+}
+
+/**
+ * open the file for appending
+ * @param path path to the file
+ */
+bool StdioBackend::Open(std::string path) {
+
+  this->path = path;
+  this->_ptr_to_file = fopen(path.c_str(), "ab");
+
+  return this->_ptr_to_file != nullptr;
+}
+
+/**
+ * append data to the file with writev(),
+ * or gather it into blocks if a block size is set
+ * @param segments the data to append
+ * @param n_segments number of segments
+ */
+ssize_t StdioBackend::Append(const struct iovec * segments, int n_segments) {
+
+  if (this->_block_size == 0) {
+
+    /* anything buffered by stdio must go first */
+    fflush(this->_ptr_to_file);
+
+    return writev(fileno(this->_ptr_to_file), segments, n_segments);
+  }
+
+  ssize_t total = 0;
+  for (int i = 0; i < n_segments; i++) {
+
+    const char * ptr = static_cast<const char *>(segments[i].iov_base);
+    size_t remaining = segments[i].iov_len;
+    while (remaining > 0) {
+
+      /* whole blocks are written straight from the segment */
+      if (this->_fill == 0 && remaining >= this->_block_size) {
+	size_t len = remaining - (remaining % this->_block_size);
+	if (!WriteAt(ptr, len, this->_block_start)) {
+	  return -1;
+	}
+	this->_block_start += len;
+	ptr += len;
+	remaining -= len;
+	total += len;
+	continue;
+      }
+
+      size_t n = std::min(remaining, this->_block_size - this->_fill);
+      memcpy(this->_block.data() + this->_fill, ptr, n);
+      this->_fill += n;
+      ptr += n;
+      remaining -= n;
+      total += n;
+
+      /* write full blocks and start the next */
+      if (this->_fill == this->_block_size) {
+	if (!WriteAt(this->_block.data(), this->_block_size, this->_block_start)) {
+	  return -1;
+	}
+	this->_block_start += this->_block_size;
+	this->_fill = 0;
+	this->_synced_fill = 0;
+      }
+    }
+  }
+
+  return total;
+}
+
+/**
+ * append part of another file, copied by the kernel
+ * with CpuTools::CopyFileRange().
+ * if gathering blocks, the data is read and appended with Append() instead,
+ * to keep the writes aligned
+ * @param fd_in the file to copy from
+ * @param offset where to start copying from
+ * @param len the number of bytes to copy
+ */
+ssize_t StdioBackend::AppendFromFile(int fd_in, off_t offset, size_t len) {
+
+  if (this->_block_size > 0) {
+    return FileBackend::AppendFromFile(fd_in, offset, len);
+  }
+
+  fflush(this->_ptr_to_file);
+  int fd = fileno(this->_ptr_to_file);
+
+  /* the kernel will not copy into a file opened with O_APPEND */
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags & ~O_APPEND);
+  ssize_t ret = CpuTools::CopyFileRange(fd_in, offset, fd, Size(), len);
+  fcntl(fd, F_SETFL, flags);
+
+  return ret;
+}
+
+/**
+ * flush the stdio buffer.
+ * a partly filled block is written, and kept to be written again
+ * at the same offset once it is full
+ */
+void StdioBackend::Sync() {
+
+  if (!this->_ptr_to_file) {
+    return;
+  }
+
+  if (this->_block_size > 0 && this->_fill > this->_synced_fill) {
+    if (WriteAt(this->_block.data(), this->_fill, this->_block_start)) {
+      this->_synced_fill = this->_fill;
+    }
+  }
+  fflush(this->_ptr_to_file);
+}
+
+/**
+ * write everything appended, including a partly filled block, to the device
+ */
+bool StdioBackend::DataSync() {
+
+  if (!this->_ptr_to_file) {
+    return false;
+  }
+  Sync();
+  return fdatasync(fileno(this->_ptr_to_file)) == 0;
+}
+
+/**
+ * close the file, giving back any space preallocated past its end
+ */
+void StdioBackend::Close() {
+
+  if (this->_ptr_to_file) {
+    Sync();
+    if (this->_preallocated && ftruncate(fileno(this->_ptr_to_file), Size()) != 0) {
+      clog << "error: " << logstream::error << "cannot truncate " << this->path << std::endl;
+    }
+    fclose(this->_ptr_to_file);
+    this->_ptr_to_file = nullptr;
+  }
+}
+
+/**
+ * check the file is open
+ */
+bool StdioBackend::IsOpen() {
+
+  return this->_ptr_to_file != nullptr;
+}
+
+/**
+ * size of the file, including a block not yet written
+ */
+off_t StdioBackend::Size() {
+
+  if (this->_block_size > 0) {
+    return this->_block_start + this->_fill;
+  }
+
+  struct stat st;
+  if (!this->_ptr_to_file || fstat(fileno(this->_ptr_to_file), &st) != 0) {
+    return 0;
+  }
+
+  return st.st_size;
+}
+
+/**
+ * size of the data which has reached the file
+ */
+off_t StdioBackend::Written() {
+
+  if (this->_block_size > 0) {
+    return this->_block_start + this->_synced_fill;
+  }
+
+  return Size();
+}
+
+/**
+ * reserve space for the file without changing its size, with FALLOC_FL_KEEP_SIZE.
+ * if the file system cannot do it, as FAT32 before Linux 4.19, a warning is logged
+ * and the file is written without preallocation, its clusters allocated as it grows
+ * @param len the expected size of the file in bytes
+ * @return true if the space was reserved
+ */
+bool StdioBackend::Preallocate(off_t len) {
+
+  if (!this->_ptr_to_file || len <= Size()) {
+    return false;
+  }
+  if (fallocate(fileno(this->_ptr_to_file), FALLOC_FL_KEEP_SIZE, 0, len) != 0) {
+    clog << "warning: " << logstream::warning << "cannot preallocate " << len << " bytes for "
+	 << this->path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  this->_preallocated = true;
+  return true;
+}
+
+/**
+ * cut the file back to an earlier size, to undo an append which failed part way.
+ * when gathering into blocks, the start of the block being cut is read back
+ * if it was already written
+ * @param size the new size, no more than Size()
+ * @return true if the file was cut
+ */
+bool StdioBackend::Truncate(off_t size) {
+
+  if (!this->_ptr_to_file || size > Size()) {
+    return false;
+  }
+  fflush(this->_ptr_to_file);
+
+  if (this->_block_size > 0) {
+    off_t block_start = size - (size % this->_block_size);
+    size_t fill = size - block_start;
+    if (block_start != this->_block_start) {
+
+      /* the file is opened for appending only */
+      int fd_in = open(this->path.c_str(), O_RDONLY);
+      bool ok = (fd_in >= 0 && pread(fd_in, this->_block.data(), fill, block_start) == (ssize_t)fill);
+      if (fd_in >= 0) {
+	close(fd_in);
+      }
+      if (!ok) {
+	return false;
+      }
+      this->_block_start = block_start;
+      this->_synced_fill = fill;
+    }
+    this->_fill = fill;
+    this->_synced_fill = std::min(this->_synced_fill, fill);
+  }
+
+  return ftruncate(fileno(this->_ptr_to_file), size) == 0;
+}
+
+/**
+ * gather appends into blocks, so that the file is written in whole clusters.
+ * the block size is rounded up to a multiple of the file system block size,
+ * which is the cluster size on FAT32. writes then go to explicit offsets,
+ * so O_APPEND is cleared
+ * @param block_size the block size in bytes, 0 to write each append straight away
+ */
+void StdioBackend::SetBlockSize(size_t block_size) {
+
+  if (!this->_ptr_to_file || block_size == this->_block_size) {
+    return;
+  }
+  Sync();
+  int fd = fileno(this->_ptr_to_file);
+  off_t size = Size();
+
+  if (block_size == 0) {
+    this->_block_size = 0;
+    this->_block.clear();
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_APPEND);
+    return;
+  }
+
+  struct statvfs st;
+  size_t cluster_size = (fstatvfs(fd, &st) == 0 && st.f_bsize > 0) ? st.f_bsize : DIRECT_IO_ALIGN;
+  block_size = ((block_size + cluster_size - 1) / cluster_size) * cluster_size;
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_APPEND);
+  this->_block_size = block_size;
+  this->_block.resize(block_size);
+
+  /* carry on from the block holding the end of the file */
+  this->_block_start = size - (size % block_size);
+  this->_fill = size - this->_block_start;
+  this->_synced_fill = this->_fill;
+  if (this->_fill > 0 && pread(fd, this->_block.data(), this->_fill, this->_block_start) != (ssize_t)this->_fill) {
+    clog << "error: " << logstream::error << "cannot read the end of " << this->path << std::endl;
+  }
+
+  clog << "info: " << logstream::info << "writing " << this->path << " in blocks of " << block_size
+       << " bytes, cluster size " << cluster_size << std::endl;
+}
+
+/**
+ * write all of a buffer at an offset, retrying partial writes
+ * @param data the data to write
+ * @param len the number of bytes to write
+ * @param offset where to write it in the file
+ * @return false if the write failed
+ */
+bool StdioBackend::WriteAt(const char * data, size_t len, off_t offset) {
+
+  int fd = fileno(this->_ptr_to_file);
+  size_t done = 0;
+  while (done < len) {
+    ssize_t ret = pwrite(fd, data + done, len - done, offset + done);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    done += ret;
+  }
+  return true;
+}
+
+
+#ifdef HAVE_IO_URING
+/**
+ * constructor
+ * @param direct if true, open the file with O_DIRECT
+ */
+UringBackend::UringBackend(bool direct) {
+
+  this->_direct = direct;
+  this->_fd = -1;
+  this->_ring_fd = -1;
+  this->_offset = 0;
+  this->_synced_end = 0;
+  this->_registered = false;
+  this->_current = 0;
+  this->_fill = 0;
+  this->_in_flight = 0;
+  this->_error = false;
+  this->_preallocated = false;
+  this->_sq_ptr = MAP_FAILED;
+  this->_cq_ptr = MAP_FAILED;
+  this->_sqes = (struct io_uring_sqe *) MAP_FAILED;
+  this->_sq_len = 0;
+  this->_cq_len = 0;
+  this->_sqes_len = 0;
+}
+
+/**
+ * destructor
+ * writes anything pending and closes the file
+ */
+UringBackend::~UringBackend() {
+
+  Close();
+}
+
+/**
+ * open the file, set up the ring and register the buffers
+ * @param path path to the file
+ */
+bool UringBackend::Open(std::string path) {
+
+  this->path = path;
+
+  if (!SetupRing()) {
+    clog << "error: " << logstream::error << "io_uring setup failed" << std::endl;
+    TeardownRing();
+    return false;
+  }
+
+  /* explicit offsets are used, so no O_APPEND */
+  int flags = O_WRONLY | O_CREAT;
+  if (this->_direct) {
+    this->_fd = open(path.c_str(), flags | O_DIRECT, 0644);
+    if (this->_fd < 0 && errno == EINVAL) {
+      clog << "warning: " << logstream::warning << "O_DIRECT not supported for " << path << std::endl;
+      this->_direct = false;
+    }
+  }
+  if (this->_fd < 0) {
+    this->_fd = open(path.c_str(), flags, 0644);
+  }
+  if (this->_fd < 0) {
+    TeardownRing();
+    return false;
+  }
+
+  /* append to the end of the file */
+  struct stat st;
+  if (fstat(this->_fd, &st) != 0) {
+    Close();
+    return false;
+  }
+  this->_offset = st.st_size;
+  this->_synced_end = 0;
+
+  /* O_DIRECT needs aligned offsets */
+  if (this->_direct && (this->_offset % DIRECT_IO_ALIGN) != 0) {
+    clog << "warning: " << logstream::warning << "cannot use O_DIRECT to append to " << path << std::endl;
+    fcntl(this->_fd, F_SETFL, fcntl(this->_fd, F_GETFL) & ~O_DIRECT);
+    this->_direct = false;
+  }
+
+  clog << "info: " << logstream::info << "opened " << path << " with io_uring"
+       << (this->_direct ? " and O_DIRECT" : "") << std::endl;
+
+  return true;
+}
+
+/**
+ * create the ring, map it and allocate the buffers
+ */
+bool UringBackend::SetupRing() {
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  this->_ring_fd = syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &params);
+  if (this->_ring_fd < 0) {
+    return false;
+  }
+
+  /* map the rings */
+  this->_sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  this->_cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  this->_sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  this->_sq_ptr = mmap(nullptr, this->_sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       this->_ring_fd, IORING_OFF_SQ_RING);
+  this->_cq_ptr = mmap(nullptr, this->_cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       this->_ring_fd, IORING_OFF_CQ_RING);
+  this->_sqes = (struct io_uring_sqe *) mmap(nullptr, this->_sqes_len, PROT_READ | PROT_WRITE,
+					     MAP_SHARED | MAP_POPULATE, this->_ring_fd, IORING_OFF_SQES);
+  if (this->_sq_ptr == MAP_FAILED || this->_cq_ptr == MAP_FAILED || this->_sqes == MAP_FAILED) {
+    return false;
+  }
+
+  char * sq = static_cast<char *>(this->_sq_ptr);
+  char * cq = static_cast<char *>(this->_cq_ptr);
+  this->_sq_tail = (unsigned *) (sq + params.sq_off.tail);
+  this->_sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+  this->_sq_array = (unsigned *) (sq + params.sq_off.array);
+  this->_cq_head = (unsigned *) (cq + params.cq_off.head);
+  this->_cq_tail = (unsigned *) (cq + params.cq_off.tail);
+  this->_cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+  this->_cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  /* page-aligned buffers, as needed for O_DIRECT */
+  this->_bufs.resize(URING_QUEUE_DEPTH);
+  std::vector<struct iovec> iovecs;
+  for (UringBuf & buf : this->_bufs) {
+    void * data = nullptr;
+    if (posix_memalign(&data, DIRECT_IO_ALIGN, URING_BUF_SIZE) != 0) {
+      buf.data = nullptr;
+      return false;
+    }
+    buf.data = static_cast<char *>(data);
+    buf.iov.iov_base = data;
+    buf.iov.iov_len = URING_BUF_SIZE;
+    buf.busy = false;
+    buf.len = 0;
+    buf.offset = 0;
+    iovecs.push_back(buf.iov);
+  }
+
+  /* registered buffers avoid mapping the pages on each write */
+  /* can fail if the locked memory limit is too low, writes still work */
+  this->_registered = (syscall(__NR_io_uring_register, this->_ring_fd, IORING_REGISTER_BUFFERS,
+			       iovecs.data(), iovecs.size()) == 0);
+  if (!this->_registered) {
+    clog << "warning: " << logstream::warning << "io_uring buffer registration failed" << std::endl;
+  }
+
+  this->_current = 0;
+  this->_fill = 0;
+
+  return true;
+}
+
+/**
+ * unmap the rings, close the ring and free the buffers
+ */
+void UringBackend::TeardownRing() {
+
+  if (this->_sqes != MAP_FAILED) {
+    munmap(this->_sqes, this->_sqes_len);
+    this->_sqes = (struct io_uring_sqe *) MAP_FAILED;
+  }
+  if (this->_cq_ptr != MAP_FAILED) {
+    munmap(this->_cq_ptr, this->_cq_len);
+    this->_cq_ptr = MAP_FAILED;
+  }
+  if (this->_sq_ptr != MAP_FAILED) {
+    munmap(this->_sq_ptr, this->_sq_len);
+    this->_sq_ptr = MAP_FAILED;
+  }
+  if (this->_ring_fd >= 0) {
+    close(this->_ring_fd);
+    this->_ring_fd = -1;
+  }
+  for (UringBuf & buf : this->_bufs) {
+    free(buf.data);
+  }
+  this->_bufs.clear();
+}
+
+/**
+ * submit a write of a buffer
+ * @param buf_index the buffer to write
+ * @param len number of bytes to write
+ * @param offset offset in the file
+ */
+bool UringBackend::Submit(int buf_index, size_t len, off_t offset) {
+
+  UringBuf & buf = this->_bufs[buf_index];
+  buf.busy = true;
+  buf.len = len;
+  buf.offset = offset;
+  buf.iov.iov_len = len;
+
+  unsigned tail = *this->_sq_tail;
+  unsigned index = tail & *this->_sq_mask;
+  struct io_uring_sqe * sqe = &this->_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+
+  sqe->fd = this->_fd;
+  sqe->off = offset;
+  sqe->user_data = buf_index;
+  if (this->_registered) {
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->addr = (unsigned long) buf.data;
+    sqe->len = len;
+    sqe->buf_index = buf_index;
+  }
+  else {
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->addr = (unsigned long) &buf.iov;
+    sqe->len = 1;
+  }
+  this->_sq_array[index] = index;
+
+  /* make the entry visible to the kernel before the tail */
+  __atomic_store_n(this->_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  int ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, this->_ring_fd, 1, 0, 0, nullptr, 0);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0) {
+    clog << "warning: " << logstream::warning << "io_uring submit failed for " << this->path
+	 << ": " << strerror(errno) << std::endl;
+    buf.busy = false;
+
+    /* take the entry back, the kernel did not consume it */
+    __atomic_store_n(this->_sq_tail, tail, __ATOMIC_RELEASE);
+    return false;
+  }
+  this->_in_flight++;
+
+  return true;
+}
+
+/**
+ * write a buffer, or what is left of it, with pwrite().
+ * used when an io_uring write cannot be submitted or fails
+ * @param buf the buffer
+ * @param done number of bytes of the buffer already written
+ * @return true if the rest of the buffer was written
+ */
+bool UringBackend::WriteSync(const UringBuf & buf, size_t done) {
+
+  while (done < buf.len) {
+    ssize_t ret = pwrite(this->_fd, buf.data + done, buf.len - done, buf.offset + done);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      clog << "error: " << logstream::error << "write failed for " << this->path << std::endl;
+      return false;
+    }
+    done += ret;
+  }
+  return true;
+}
+
+/**
+ * write a buffer, through io_uring if it can be submitted,
+ * otherwise synchronously
+ * @param buf_index the buffer to write
+ * @param len number of bytes to write
+ * @param offset offset in the file
+ * @return true if the write was submitted or done, false if the data was not written
+ */
+bool UringBackend::WriteBuffer(int buf_index, size_t len, off_t offset) {
+
+  if (Submit(buf_index, len, offset)) {
+    return true;
+  }
+
+  UringBuf & buf = this->_bufs[buf_index];
+  buf.len = len;
+  buf.offset = offset;
+  return WriteSync(buf, 0);
+}
+
+/**
+ * process completed writes
+ * @param wait if true, wait for at least one completion
+ */
+void UringBackend::Reap(bool wait) {
+
+  unsigned head = *this->_cq_head;
+
+  if (wait && head == __atomic_load_n(this->_cq_tail, __ATOMIC_ACQUIRE)) {
+    int ret;
+    do {
+      ret = syscall(__NR_io_uring_enter, this->_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+  }
+
+  while (head != __atomic_load_n(this->_cq_tail, __ATOMIC_ACQUIRE)) {
+
+    struct io_uring_cqe * cqe = &this->_cqes[head & *this->_cq_mask];
+    UringBuf & buf = this->_bufs[cqe->user_data];
+
+    if (cqe->res < 0) {
+
+      /* the buffer is still intact, so write it again synchronously */
+      clog << "warning: " << logstream::warning << "io_uring write failed for " << this->path
+	   << ": " << strerror(-cqe->res) << ", writing synchronously" << std::endl;
+      if (!WriteSync(buf, 0)) {
+	this->_error = true;
+      }
+    }
+    else if ((size_t) cqe->res < buf.len) {
+
+      /* finish short writes synchronously */
+      if (!WriteSync(buf, cqe->res)) {
+	this->_error = true;
+      }
+    }
+
+    buf.busy = false;
+    this->_in_flight--;
+    head++;
+  }
+
+  __atomic_store_n(this->_cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * get a buffer that is not being written, waiting if needed
+ */
+int UringBackend::GetFreeBuffer() {
+
+  Reap(false);
+  while (true) {
+    for (size_t i = 0; i < this->_bufs.size(); i++) {
+      if (!this->_bufs[i].busy) {
+	return i;
+      }
+    }
+    Reap(true);
+  }
+}
+
+/**
+ * copy data into the buffers, submitting each buffer as it fills
+ * @param segments the data to append
+ * @param n_segments number of segments
+ */
+ssize_t UringBackend::Append(const struct iovec * segments, int n_segments) {
+
+  if (this->_error) {
+    this->_error = false;
+    errno = EIO;
+    return -1;
+  }
+
+  ssize_t total = 0;
+  for (int i = 0; i < n_segments; i++) {
+
+    const char * ptr = static_cast<const char *>(segments[i].iov_base);
+    size_t remaining = segments[i].iov_len;
+    while (remaining > 0) {
+
+      size_t n = std::min(remaining, (size_t) URING_BUF_SIZE - this->_fill);
+      memcpy(this->_bufs[this->_current].data + this->_fill, ptr, n);
+      this->_fill += n;
+      ptr += n;
+      remaining -= n;
+      total += n;
+
+      /* submit full buffers and move on to the next */
+      if (this->_fill == URING_BUF_SIZE) {
+	if (!WriteBuffer(this->_current, URING_BUF_SIZE, this->_offset)) {
+
+	  /* the data of this buffer is not in the file, so stop here */
+	  this->_fill -= n;
+	  total -= n;
+	  errno = EIO;
+	  return total > 0 ? total : -1;
+	}
+	this->_offset += URING_BUF_SIZE;
+	this->_fill = 0;
+	this->_current = GetFreeBuffer();
+      }
+    }
+  }
+
+  return total;
+}
+
+/**
+ * write the partly filled buffer and wait for all writes to complete
+ */
+void UringBackend::Sync() {
+
+  if (this->_fd < 0) {
+    return;
+  }
+
+  if (this->_fill > 0) {
+    if (this->_direct) {
+
+      /* O_DIRECT writes whole blocks, so pad and truncate to the real size */
+      /* the buffer is kept and rewritten at the same offset once more data arrives */
+      size_t len = ((this->_fill + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN) * DIRECT_IO_ALIGN;
+      memset(this->_bufs[this->_current].data + this->_fill, 0, len - this->_fill);
+      if (!WriteBuffer(this->_current, len, this->_offset)) {
+	this->_error = true;
+      }
+      while (this->_in_flight > 0) {
+	Reap(true);
+      }
+      if (ftruncate(this->_fd, this->_offset + this->_fill) != 0) {
+	clog << "error: " << logstream::error << "cannot truncate " << this->path << std::endl;
+      }
+      else if (!this->_error) {
+	this->_synced_end = this->_offset + this->_fill;
+      }
+    }
+    else {
+      if (!WriteBuffer(this->_current, this->_fill, this->_offset)) {
+	this->_error = true;
+      }
+      this->_offset += this->_fill;
+      this->_fill = 0;
+    }
+  }
+
+  while (this->_in_flight > 0) {
+    Reap(true);
+  }
+}
+
+/**
+ * write the buffer being filled, wait for all the writes
+ * in flight and sync the file to the device
+ */
+bool UringBackend::DataSync() {
+
+  if (this->_fd < 0) {
+    return false;
+  }
+  Sync();
+  return !this->_error && fdatasync(this->_fd) == 0;
+}
+
+/**
+ * write anything pending and close the file and ring
+ */
+void UringBackend::Close() {
+
+  if (this->_fd >= 0) {
+    Sync();
+    if (this->_preallocated && ftruncate(this->_fd, Size()) != 0) {
+      clog << "error: " << logstream::error << "cannot truncate " << this->path << std::endl;
+    }
+    close(this->_fd);
+    this->_fd = -1;
+  }
+  TeardownRing();
+}
+
+/**
+ * check the file is open
+ */
+bool UringBackend::IsOpen() {
+
+  return this->_fd >= 0;
+}
+
+/**
+ * size of the file including anything not yet written
+ */
+off_t UringBackend::Size() {
+
+  return this->_offset + this->_fill;
+}
+
+/**
+ * reserve space for the file without changing its size
+ * @param len the expected size of the file in bytes
+ * @return true if the space was reserved
+ */
+bool UringBackend::Preallocate(off_t len) {
+
+  if (this->_fd < 0 || len <= Size()) {
+    return false;
+  }
+  if (fallocate(this->_fd, FALLOC_FL_KEEP_SIZE, 0, len) != 0) {
+    clog << "warning: " << logstream::warning << "cannot preallocate " << len << " bytes for "
+	 << this->path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  this->_preallocated = true;
+  return true;
+}
+
+/**
+ * cut the file back to an earlier size, to undo an append which failed part way.
+ * if the cut is in data already submitted, the writes are waited for and,
+ * with O_DIRECT, the start of the block being cut is read back into the buffer
+ * @param size the new size, no more than Size()
+ * @return true if the file was cut
+ */
+bool UringBackend::Truncate(off_t size) {
+
+  if (this->_fd < 0 || size > Size()) {
+    return false;
+  }
+
+  if (size < this->_offset) {
+    Sync();
+    off_t offset = this->_direct ? size - (size % DIRECT_IO_ALIGN) : size;
+    size_t fill = size - offset;
+    if (fill > 0) {
+
+      /* the file is opened for writing only */
+      int fd_in = open(this->path.c_str(), O_RDONLY);
+      bool ok = (fd_in >= 0 && pread(fd_in, this->_bufs[this->_current].data, fill, offset) == (ssize_t)fill);
+      if (fd_in >= 0) {
+	close(fd_in);
+      }
+      if (!ok) {
+	return false;
+      }
+    }
+    this->_offset = offset;
+    this->_fill = fill;
+  }
+  else {
+    this->_fill = size - this->_offset;
+  }
+
+  /* drop what a Sync() wrote past the new end */
+  this->_synced_end = std::min(this->_synced_end, size);
+  struct stat st;
+  if (fstat(this->_fd, &st) == 0 && st.st_size > size) {
+    return ftruncate(this->_fd, size) == 0;
+  }
+  return true;
+}
+
+/**
+ * size of the data whose writes have completed,
+ * up to the first buffer still in flight, or up to the end
+ * of the last Sync() as rewriting its tail does not change it
+ */
+off_t UringBackend::Written() {
+
+  if (this->_fd < 0) {
+    return Size();
+  }
+  Reap(false);
+  off_t written = this->_offset;
+  for (const UringBuf & buf : this->_bufs) {
+    if (buf.busy) {
+      written = std::min(written, buf.offset);
+    }
+  }
+  return std::max(written, this->_synced_end);
+}
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,272 @@
+#ifndef _FILE_BACKEND_H
+#define _FILE_BACKEND_H
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "log.h"
+
+/* io_uring is only available on recent Linux */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/* number of buffers in flight with the io_uring backend */
+#define URING_QUEUE_DEPTH 4
+/* size of each io_uring buffer, a multiple of DIRECT_IO_ALIGN */
+#define URING_BUF_SIZE (1024 * 1024)
+/* alignment of offsets, lengths and buffers for O_DIRECT */
+#define DIRECT_IO_ALIGN 4096
+
+
+/**
+ * interface to the file written by a SynchronisedFile.
+ * data is only ever appended
+ */
+class FileBackend {
+public:
+  /**
+   * file backend options
+   */
+  enum BackendType : uint8_t {
+    STDIO = 0,
+    URING = 1,
+  };
+
+  /**
+   * path to the open file
+   */
+  std::string path;
+
+  virtual ~FileBackend() {}
+  /**
+   * open the file for appending, creating it if needed
+   * @param path path to the file
+   */
+  virtual bool Open(std::string path) = 0;
+  /**
+   * append data to the file, with the same return value as writev()
+   * @param segments the data to append
+   * @param n_segments number of segments
+   */
+  virtual ssize_t Append(const struct iovec * segments, int n_segments) = 0;
+  virtual ssize_t AppendFromFile(int fd_in, off_t offset, size_t len);
+  /**
+   * make everything appended so far visible to readers of the file
+   */
+  virtual void Sync() = 0;
+  /**
+   * write everything appended so far to the storage device, with fdatasync()
+   * @return false if the data could not be synced
+   */
+  virtual bool DataSync() = 0;
+  /**
+   * close the file, writing anything pending
+   */
+  virtual void Close() = 0;
+  /**
+   * check the file is open
+   */
+  virtual bool IsOpen() = 0;
+  /**
+   * size of the file including anything pending
+   */
+  virtual off_t Size() = 0;
+  virtual off_t Written();
+  virtual bool Preallocate(off_t len);
+  virtual bool Truncate(off_t size);
+  /**
+   * gather appends into blocks of a multiple of this size, written at aligned offsets.
+   * ignored by backends which already write aligned blocks
+   * @param block_size the block size in bytes, 0 to write each append straight away
+   */
+  virtual void SetBlockSize(size_t block_size) { (void)block_size; }
+
+  static FileBackend * Create(BackendType backend_type, bool direct);
+};
+
+
+/**
+ * the original backend, appending with stdio/writev() through the page cache
+ */
+class StdioBackend : public FileBackend {
+public:
+  StdioBackend();
+  ~StdioBackend();
+  bool Open(std::string path);
+  ssize_t Append(const struct iovec * segments, int n_segments);
+  ssize_t AppendFromFile(int fd_in, off_t offset, size_t len);
+  void Sync();
+  bool DataSync();
+  void Close();
+  bool IsOpen();
+  off_t Size();
+  off_t Written();
+  bool Preallocate(off_t len);
+  bool Truncate(off_t size);
+  void SetBlockSize(size_t block_size);
+
+private:
+  /**
+   * pointer to the file
+   */
+  FILE * _ptr_to_file;
+  /**
+   * true if space was preallocated past the end of the file,
+   * which is given back on closing
+   */
+  bool _preallocated;
+  /**
+   * size of the blocks, 0 if not gathering appends into blocks
+   */
+  size_t _block_size;
+  /**
+   * the block being filled
+   */
+  std::vector<char> _block;
+  /**
+   * file offset of the block being filled, a multiple of _block_size
+   */
+  off_t _block_start;
+  /**
+   * bytes in the block being filled
+   */
+  size_t _fill;
+  /**
+   * bytes of the block being filled already written by Sync()
+   */
+  size_t _synced_fill;
+
+  bool WriteAt(const char * data, size_t len, off_t offset);
+};
+
+
+#ifdef HAVE_IO_URING
+/**
+ * io_uring backend.
+ * data is gathered into page-aligned buffers registered with the kernel,
+ * and full buffers are written asynchronously while the next one is filled.
+ * optionally bypasses the page cache with O_DIRECT
+ */
+class UringBackend : public FileBackend {
+public:
+  UringBackend(bool direct);
+  ~UringBackend();
+  bool Open(std::string path);
+  ssize_t Append(const struct iovec * segments, int n_segments);
+  void Sync();
+  bool DataSync();
+  void Close();
+  bool IsOpen();
+  off_t Size();
+  off_t Written();
+  bool Preallocate(off_t len);
+  bool Truncate(off_t size);
+
+private:
+  /**
+   * a write in flight
+   */
+  struct UringBuf {
+    char * data;
+    struct iovec iov;
+    bool busy;
+    size_t len;
+    off_t offset;
+  };
+
+  /**
+   * true if the file is opened with O_DIRECT
+   */
+  bool _direct;
+  /**
+   * the file descriptor
+   */
+  int _fd;
+  /**
+   * the io_uring descriptor
+   */
+  int _ring_fd;
+  /**
+   * file offset of the start of the buffer being filled
+   */
+  off_t _offset;
+  /**
+   * end of the data written by the last Sync() with O_DIRECT, which can be
+   * past _offset as the partly filled buffer is kept to be rewritten
+   */
+  off_t _synced_end;
+  /**
+   * the buffers, registered with the kernel if possible
+   */
+  std::vector<UringBuf> _bufs;
+  /**
+   * true if the buffers were registered
+   */
+  bool _registered;
+  /**
+   * index of the buffer being filled
+   */
+  int _current;
+  /**
+   * bytes in the buffer being filled
+   */
+  size_t _fill;
+  /**
+   * number of writes submitted and not yet completed
+   */
+  unsigned int _in_flight;
+  /**
+   * set when a write fails, reported on the next Append()
+   */
+  bool _error;
+  /**
+   * true if space was preallocated past the end of the file,
+   * which is given back on closing
+   */
+  bool _preallocated;
+
+  /* the submission and completion rings */
+  void * _sq_ptr;
+  size_t _sq_len;
+  void * _cq_ptr;
+  size_t _cq_len;
+  struct io_uring_sqe * _sqes;
+  size_t _sqes_len;
+  unsigned * _sq_tail;
+  unsigned * _sq_mask;
+  unsigned * _sq_array;
+  unsigned * _cq_head;
+  unsigned * _cq_tail;
+  unsigned * _cq_mask;
+  struct io_uring_cqe * _cqes;
+
+  bool SetupRing();
+  void TeardownRing();
+  bool Submit(int buf_index, size_t len, off_t offset);
+  bool WriteSync(const UringBuf & buf, size_t done);
+  bool WriteBuffer(int buf_index, size_t len, off_t offset);
+  void Reap(bool wait);
+  int GetFreeBuffer();
+};
+#endif /* HAVE_IO_URING */
+
+#endif
+/* _FILE_BACKEND_H */
@@ -0,0 +1,367 @@
+#include "FileMirror.h"
+
+/**
+ * constructor.
+ * starts the mirror thread
+ * @param src_dir directory of the files to mirror
+ * @param dst_dir directory to mirror them to, with the same relative paths
+ * @param check_mount if true, only write to dst_dir when a device is mounted on it
+ */
+FileMirror::FileMirror(std::string src_dir, std::string dst_dir, bool check_mount) {
+
+  this->_src_dir = src_dir;
+  this->_dst_dir = dst_dir;
+  this->_check_mount = check_mount;
+  this->_stop = false;
+  this->_n_files = 0;
+  this->_n_outages = 0;
+  this->_bytes = 0;
+  this->_max_lag = 0;
+
+  this->_online = DeviceReady();
+  if (!this->_online) {
+    clog << "warning: " << logstream::warning << "mirror device " << dst_dir
+	 << " is not ready, files will be copied once it is" << std::endl;
+  }
+  clog << "info: " << logstream::info << "mirroring files from " << src_dir << " to " << dst_dir << std::endl;
+
+  this->_thread = std::thread(&FileMirror::MirrorThread, this);
+}
+
+/**
+ * destructor.
+ * copies what it can while the mirror is online, then stops the mirror thread
+ */
+FileMirror::~FileMirror() {
+
+  {
+    std::unique_lock<std::mutex> lock(this->_m_files);
+    this->_stop = true;
+  }
+  this->_cv_files.notify_all();
+  this->_thread.join();
+
+  off_t lag = 0;
+  for (MirrorFile & file : this->_files) {
+    lag += file.src_size - file.dst_size;
+    if (file.src_fd >= 0) {
+      close(file.src_fd);
+    }
+    if (file.dst_fd >= 0) {
+      close(file.dst_fd);
+    }
+  }
+  if (lag > 0) {
+    clog << "warning: " << logstream::warning << "stopping the mirror to " << this->_dst_dir << " with "
+	 << lag << " bytes not copied" << std::endl;
+  }
+}
+
+/**
+ * report that more of a file has been written.
+ * starts mirroring the file if it is new
+ * @param path path to the file, in the source directory
+ * @param size the amount of the file written so far
+ */
+void FileMirror::Written(std::string path, off_t size) {
+
+  std::unique_lock<std::mutex> lock(this->_m_files);
+
+  MirrorFile * file = FindFile(path);
+  if (file == nullptr) {
+    MirrorFile new_file;
+    new_file.src_path = path;
+    if (path.compare(0, this->_src_dir.size(), this->_src_dir) == 0) {
+      new_file.dst_path = this->_dst_dir + path.substr(this->_src_dir.size());
+    }
+    else {
+      new_file.dst_path = this->_dst_dir + path.substr(path.find_last_of('/'));
+    }
+    new_file.src_fd = -1;
+    new_file.dst_fd = -1;
+    new_file.src_size = 0;
+    new_file.dst_size = 0;
+    new_file.closed = false;
+    this->_files.push_back(new_file);
+    file = &this->_files.back();
+  }
+  if (size > file->src_size) {
+    file->src_size = size;
+  }
+
+  off_t lag = 0;
+  for (const MirrorFile & mirror_file : this->_files) {
+    lag += mirror_file.src_size - mirror_file.dst_size;
+  }
+  this->_max_lag = std::max(this->_max_lag, lag);
+
+  lock.unlock();
+  this->_cv_files.notify_one();
+}
+
+/**
+ * report that a file is complete.
+ * its mirror is synced and closed once it has been copied
+ * @param path path to the file, in the source directory
+ * @param size the final size of the file
+ */
+void FileMirror::Closed(std::string path, off_t size) {
+
+  Written(path, size);
+
+  {
+    std::unique_lock<std::mutex> lock(this->_m_files);
+    MirrorFile * file = FindFile(path);
+    if (file != nullptr) {
+      file->closed = true;
+    }
+  }
+  this->_cv_files.notify_one();
+}
+
+/**
+ * wait for everything reported so far to be copied
+ * @param timeout_ms longest time to wait, in ms
+ * @return true if the mirror is up to date, false if not after the timeout or if offline
+ */
+bool FileMirror::Drain(int timeout_ms) {
+
+  std::unique_lock<std::mutex> lock(this->_m_files);
+  return this->_cv_drained.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+      for (const MirrorFile & file : this->_files) {
+	if (file.dst_size < file.src_size || file.closed) {
+	  return false;
+	}
+      }
+      return true;
+    });
+}
+
+/**
+ * the amount of data written but not yet copied to the mirror, in bytes
+ */
+off_t FileMirror::Lag() {
+
+  std::unique_lock<std::mutex> lock(this->_m_files);
+  off_t lag = 0;
+  for (const MirrorFile & file : this->_files) {
+    lag += file.src_size - file.dst_size;
+  }
+  return lag;
+}
+
+/**
+ * check the mirror device can be written
+ */
+bool FileMirror::IsOnline() {
+
+  return this->_online;
+}
+
+/**
+ * print and log the amount copied, the lag and the number of times the mirror was lost
+ */
+void FileMirror::PrintStats() {
+
+  off_t lag = Lag();
+  std::unique_lock<std::mutex> lock(this->_m_files);
+  std::cout << "mirror to " << this->_dst_dir << ": " << (this->_online ? "online" : "offline") << ", "
+	    << this->_n_files << " files and " << this->_bytes / (1024 * 1024) << " MB copied, lag "
+	    << lag / 1024 << " kB (max " << this->_max_lag / 1024 << " kB), "
+	    << this->_n_outages << " outages" << std::endl;
+  clog << "info: " << logstream::info << "mirror to " << this->_dst_dir << ": "
+       << (this->_online ? "online" : "offline") << ", " << this->_n_files << " files and "
+       << this->_bytes << " bytes copied, lag " << lag << " bytes (max " << this->_max_lag << "), "
+       << this->_n_outages << " outages" << std::endl;
+}
+
+/**
+ * find a file being mirrored
+ * called with _m_files held
+ * @param path path to the file, in the source directory
+ * @return the file, or nullptr if not mirrored
+ */
+FileMirror::MirrorFile * FileMirror::FindFile(const std::string & path) {
+
+  for (MirrorFile & file : this->_files) {
+    if (file.src_path == path) {
+      return &file;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * check the mirror directory can be written,
+ * and is on a different device to its parent if _check_mount is set
+ */
+bool FileMirror::DeviceReady() {
+
+  if (access(this->_dst_dir.c_str(), W_OK) != 0) {
+    return false;
+  }
+  if (this->_check_mount) {
+    struct stat st_dir;
+    struct stat st_parent;
+    std::string parent = this->_dst_dir + "/..";
+    if (stat(this->_dst_dir.c_str(), &st_dir) != 0 || stat(parent.c_str(), &st_parent) != 0
+	|| st_dir.st_dev == st_parent.st_dev) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * copy the next chunk of a file to its mirror, opening both files if needed.
+ * an existing mirror is continued from its current size, so that files are
+ * not copied again from the start after the device returns.
+ * called without _m_files held, only from the mirror thread
+ * @param file the file to copy
+ * @param dst_size the amount already copied, updated with what is copied
+ * @param src_size the amount of the source file written
+ * @return true on success, false if the source could not be opened,
+ * leaving file.src_fd at -1, or if the mirror could not be written
+ */
+bool FileMirror::CopyChunk(MirrorFile & file, off_t & dst_size, off_t src_size) {
+
+  if (file.src_fd < 0) {
+    file.src_fd = open(file.src_path.c_str(), O_RDONLY);
+    if (file.src_fd < 0) {
+      clog << "error: " << logstream::error << "cannot open " << file.src_path << " to mirror it" << std::endl;
+      return false;
+    }
+  }
+
+  if (file.dst_fd < 0) {
+    file.dst_fd = open(file.dst_path.c_str(), O_WRONLY | O_CREAT, 0644);
+    struct stat st;
+    if (file.dst_fd < 0 || fstat(file.dst_fd, &st) != 0) {
+      return false;
+    }
+    dst_size = std::min(st.st_size, src_size);
+    if (dst_size > 0) {
+      clog << "info: " << logstream::info << "continuing the mirror of " << file.src_path
+	   << " from " << dst_size << " bytes" << std::endl;
+    }
+  }
+
+  size_t len = std::min(src_size - dst_size, (off_t)MIRROR_CHUNK_SIZE);
+  if (len == 0) {
+    return true;
+  }
+  ssize_t copied = CpuTools::CopyFileRange(file.src_fd, dst_size, file.dst_fd, dst_size, len);
+  if (copied <= 0) {
+    return false;
+  }
+  dst_size += copied;
+  return true;
+}
+
+/**
+ * stop writing to the mirror until the device is ready again
+ * called with _m_files held
+ */
+void FileMirror::GoOffline() {
+
+  for (MirrorFile & file : this->_files) {
+    if (file.dst_fd >= 0) {
+      close(file.dst_fd);
+      file.dst_fd = -1;
+    }
+  }
+  this->_online = false;
+  this->_n_outages++;
+
+  off_t lag = 0;
+  for (const MirrorFile & file : this->_files) {
+    lag += file.src_size - file.dst_size;
+  }
+  clog << "warning: " << logstream::warning << "lost the mirror device " << this->_dst_dir << " with "
+       << lag << " bytes not copied, retrying every " << MIRROR_RETRY_MS << " ms" << std::endl;
+  std::cout << "WARNING: lost the mirror device " << this->_dst_dir << std::endl;
+}
+
+/**
+ * the loop run by the mirror thread.
+ * copies the files in the order they were started, a chunk at a time
+ */
+void FileMirror::MirrorThread() {
+
+  std::unique_lock<std::mutex> lock(this->_m_files);
+  while (true) {
+
+    /* wait for the device to come back */
+    if (!this->_online) {
+      if (this->_cv_files.wait_for(lock, std::chrono::milliseconds(MIRROR_RETRY_MS),
+				   [this] { return this->_stop; })) {
+	break;
+      }
+      lock.unlock();
+      bool ready = DeviceReady();
+      lock.lock();
+      if (ready) {
+	this->_online = true;
+	clog << "info: " << logstream::info << "mirror device " << this->_dst_dir << " is back, catching up"
+	     << std::endl;
+      }
+      continue;
+    }
+
+    /* the first file with something to do */
+    MirrorFile * file = nullptr;
+    for (MirrorFile & mirror_file : this->_files) {
+      if (mirror_file.dst_size < mirror_file.src_size || mirror_file.closed) {
+	file = &mirror_file;
+	break;
+      }
+    }
+    if (file == nullptr) {
+      this->_cv_drained.notify_all();
+      if (this->_stop) {
+	break;
+      }
+      this->_cv_files.wait(lock);
+      continue;
+    }
+
+    off_t src_size = file->src_size;
+    off_t dst_size = file->dst_size;
+    lock.unlock();
+
+    bool ok = true;
+    bool done = false;
+    if (dst_size < src_size || file->dst_fd < 0) {
+      ok = CopyChunk(*file, dst_size, src_size);
+    }
+    else {
+
+      /* closed and completely copied, make sure it is on the device */
+      ok = (fdatasync(file->dst_fd) == 0);
+      done = ok;
+    }
+
+    lock.lock();
+    this->_bytes += dst_size - std::min(dst_size, file->dst_size);
+    file->dst_size = dst_size;
+    if (!ok && file->src_fd < 0) {
+
+      /* nothing wrong with the device, give up on this file only */
+      clog << "error: " << logstream::error << "not mirroring " << file->src_path << std::endl;
+      if (file->dst_fd >= 0) {
+	close(file->dst_fd);
+      }
+      this->_files.remove_if([file](const MirrorFile & mirror_file) { return &mirror_file == file; });
+    }
+    else if (!ok) {
+      GoOffline();
+    }
+    else if (done) {
+      close(file->dst_fd);
+      close(file->src_fd);
+      clog << "info: " << logstream::info << "mirrored " << file->src_path << " to " << file->dst_path << std::endl;
+      this->_n_files++;
+      this->_files.remove_if([file](const MirrorFile & mirror_file) { return &mirror_file == file; });
+    }
+  }
+}
@@ -0,0 +1,116 @@
+#ifndef _FILE_MIRROR_H
+#define _FILE_MIRROR_H
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "log.h"
+#include "CpuTools.h"
+
+/* largest amount copied to the mirror in one go */
+#define MIRROR_CHUNK_SIZE (4 * 1024 * 1024)
+/* time between checks for the mirror device after it is lost */
+#define MIRROR_RETRY_MS 1000
+
+/**
+ * copies files being written in one directory to another, such as from one
+ * USB storage device to the other, as they grow.
+ * writers report how much of each file is written, and a background thread
+ * appends the new data to the mirror, read back from the page cache.
+ * if the mirror device is lost, files are kept track of and copied from
+ * where their mirror stopped once it returns
+ */
+class FileMirror {
+public:
+  FileMirror(std::string src_dir, std::string dst_dir, bool check_mount);
+  ~FileMirror();
+  void Written(std::string path, off_t size);
+  void Closed(std::string path, off_t size);
+  bool Drain(int timeout_ms);
+  off_t Lag();
+  bool IsOnline();
+  void PrintStats();
+
+private:
+  /**
+   * a file being mirrored
+   */
+  struct MirrorFile {
+    std::string src_path;
+    std::string dst_path;
+    int src_fd;
+    int dst_fd;
+    /* data written to the source file so far */
+    off_t src_size;
+    /* data copied to the mirror so far */
+    off_t dst_size;
+    /* true once the source file will not grow any more */
+    bool closed;
+  };
+
+  /**
+   * directory of the files to mirror
+   */
+  std::string _src_dir;
+  /**
+   * directory of the mirror
+   */
+  std::string _dst_dir;
+  /**
+   * if true, only write to _dst_dir when a device is mounted on it,
+   * so that nothing goes to the root file system while it is missing
+   */
+  bool _check_mount;
+  /**
+   * files with data still to copy, in the order they were started
+   */
+  std::list<MirrorFile> _files;
+  /**
+   * true while the mirror can be written
+   */
+  std::atomic<bool> _online;
+  /**
+   * set to stop the mirror thread
+   */
+  bool _stop;
+  /**
+   * protects the files and counters
+   */
+  std::mutex _m_files;
+  /**
+   * to wake the mirror thread when there is new data
+   */
+  std::condition_variable _cv_files;
+  /**
+   * to wake Drain() when everything is copied
+   */
+  std::condition_variable _cv_drained;
+  /**
+   * counters for PrintStats()
+   */
+  unsigned long _n_files;
+  unsigned long _n_outages;
+  unsigned long long _bytes;
+  off_t _max_lag;
+  /**
+   * the mirror thread
+   */
+  std::thread _thread;
+
+  MirrorFile * FindFile(const std::string & path);
+  bool DeviceReady();
+  bool CopyChunk(MirrorFile & file, off_t & dst_size, off_t src_size);
+  void GoOffline();
+  void MirrorThread();
+};
+
+#endif
+/* _FILE_MIRROR_H */
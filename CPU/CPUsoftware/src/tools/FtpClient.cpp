@@ -0,0 +1,529 @@
+#include "FtpClient.h"
+
+/**
+ * constructor.
+ * does not connect, use FtpClient::Connect()
+ * @param host host name or IP of the server
+ * @param port control port of the server
+ * @param passive if true, use passive mode for data connections
+ */
+FtpClient::FtpClient(std::string host, int port, bool passive) {
+
+  this->host = host;
+  this->port = port;
+  this->passive = passive;
+  this->_ctrl_fd = -1;
+  this->_data_fd = -1;
+}
+
+/**
+ * destructor
+ * closes the connection
+ */
+FtpClient::~FtpClient() {
+
+  Disconnect();
+}
+
+/**
+ * open a TCP connection with a timeout
+ * @param addr address to connect to
+ * @param addr_len size of addr
+ * @return the socket, or -1 on failure
+ */
+int FtpClient::OpenSocket(const struct sockaddr * addr, socklen_t addr_len) {
+
+  int sockfd = socket(addr->sa_family, SOCK_STREAM, 0);
+  if (sockfd < 0) {
+    clog << "error: " << logstream::error << "error opening socket" << std::endl;
+    return -1;
+  }
+
+  /* connect without blocking, then wait up to FTP_TIMEOUT_SEC */
+  int opts = fcntl(sockfd, F_GETFL);
+  fcntl(sockfd, F_SETFL, opts | O_NONBLOCK);
+  int ret = connect(sockfd, addr, addr_len);
+  if (ret < 0 && errno == EINPROGRESS) {
+
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(sockfd, &fdset);
+    struct timeval tv;
+    tv.tv_sec = FTP_TIMEOUT_SEC;
+    tv.tv_usec = 0;
+
+    if (select(sockfd + 1, NULL, &fdset, NULL, &tv) == 1) {
+      int so_error;
+      socklen_t len = sizeof so_error;
+      getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+      ret = (so_error == 0) ? 0 : -1;
+    }
+  }
+  if (ret < 0) {
+    close(sockfd);
+    return -1;
+  }
+
+  /* back to blocking, with timeouts */
+  fcntl(sockfd, F_SETFL, opts);
+  struct timeval tv;
+  tv.tv_sec = FTP_TIMEOUT_SEC;
+  tv.tv_usec = 0;
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  return sockfd;
+}
+
+/**
+ * connect to the server, log in and set binary mode
+ * @param user user name
+ * @param pass password
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::Connect(std::string user, std::string pass) {
+
+  std::string reply;
+
+  Disconnect();
+
+  /* find the server */
+  struct addrinfo hints;
+  struct addrinfo * res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(this->host.c_str(), std::to_string(this->port).c_str(), &hints, &res) != 0) {
+    clog << "error: " << logstream::error << "no host found for " << this->host << std::endl;
+    return 1;
+  }
+  this->_ctrl_fd = OpenSocket(res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+
+  if (this->_ctrl_fd < 0) {
+    clog << "error: " << logstream::error << "cannot connect to FTP server " << this->host
+	 << " on port " << this->port << std::endl;
+    return 1;
+  }
+
+  /* welcome message */
+  if (ReadReply(reply) != 220) {
+    clog << "error: " << logstream::error << "bad welcome from FTP server: " << reply << std::endl;
+    Disconnect();
+    return 1;
+  }
+
+  /* log in */
+  int code = SendCmd("USER " + user, reply);
+  if (code == 331) {
+    code = SendCmd("PASS " + pass, reply);
+  }
+  if (code != 230) {
+    clog << "error: " << logstream::error << "FTP login failed: " << reply << std::endl;
+    Disconnect();
+    return 1;
+  }
+
+  /* binary transfers */
+  if (SendCmd("TYPE I", reply) != 200) {
+    clog << "error: " << logstream::error << "cannot set FTP binary mode: " << reply << std::endl;
+    Disconnect();
+    return 1;
+  }
+
+  clog << "info: " << logstream::info << "connected to FTP server " << this->host
+       << " on port " << this->port << std::endl;
+  return 0;
+}
+
+/**
+ * close the connection
+ */
+void FtpClient::Disconnect() {
+
+  CloseData();
+  if (this->_ctrl_fd >= 0) {
+    close(this->_ctrl_fd);
+    this->_ctrl_fd = -1;
+  }
+  this->_ctrl_buf.clear();
+}
+
+/**
+ * check the control connection is open
+ * it is closed on any error communicating with the server
+ */
+bool FtpClient::IsConnected() {
+
+  return this->_ctrl_fd >= 0;
+}
+
+/**
+ * list the files in the current directory of the server (NLST)
+ * @param names the file names, replaced
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::List(std::vector<std::string> & names) {
+
+  std::vector<char> data;
+  names.clear();
+
+  if (Transfer("NLST", data) != 0) {
+    return 1;
+  }
+
+  /* one name per line */
+  size_t start = 0;
+  for (size_t i = 0; i <= data.size(); i++) {
+    if (i == data.size() || data[i] == '\n') {
+      size_t end = i;
+      if (end > start && data[end - 1] == '\r') {
+	end--;
+      }
+      if (end > start) {
+	std::string name(&data[start], end - start);
+
+	/* some servers give the path */
+	size_t pos = name.find_last_of('/');
+	if (pos != std::string::npos) {
+	  name = name.substr(pos + 1);
+	}
+	names.push_back(name);
+      }
+      start = i + 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * download a file into memory (RETR)
+ * @param name the file to download
+ * @param data replaced with the file contents, reuse the vector to avoid allocation
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::Retrieve(std::string name, std::vector<char> & data) {
+
+  return Transfer("RETR " + name, data);
+}
+
+/**
+ * get the size of a file on the server (SIZE), in binary mode
+ * @param name the file
+ * @param size set to the size in bytes
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::Size(std::string name, size_t & size) {
+
+  std::string reply;
+
+  if (SendCmd("SIZE " + name, reply) != 213 || reply.size() < 5) {
+    clog << "error: " << logstream::error << "cannot get the size of " << name << " from FTP server: " << reply << std::endl;
+    return 1;
+  }
+  size = strtoull(reply.c_str() + 4, NULL, 10);
+
+  return 0;
+}
+
+/**
+ * delete a file on the server (DELE)
+ * @param name the file to delete
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::Delete(std::string name) {
+
+  std::string reply;
+
+  if (SendCmd("DELE " + name, reply) != 250) {
+    clog << "error: " << logstream::error << "cannot delete " << name << " from FTP server: " << reply << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * send a command and read the reply
+ * disconnects on communication errors
+ * @param cmd the command, without line ending
+ * @param reply the last line of the reply
+ * @return the reply code, or -1 on error
+ */
+int FtpClient::SendCmd(std::string cmd, std::string & reply) {
+
+  if (this->_ctrl_fd < 0) {
+    reply = "not connected";
+    return -1;
+  }
+
+  /* do not log the password */
+  if (cmd.compare(0, 5, "PASS ") == 0) {
+    clog << "info: " << logstream::info << "sending via FTP: PASS ****" << std::endl;
+  }
+  else {
+    clog << "info: " << logstream::info << "sending via FTP: " << cmd << std::endl;
+  }
+
+  cmd += "\r\n";
+  size_t sent = 0;
+  while (sent < cmd.size()) {
+    ssize_t n = send(this->_ctrl_fd, cmd.data() + sent, cmd.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      clog << "error: " << logstream::error << "error writing to FTP control connection" << std::endl;
+      Disconnect();
+      reply = "write failed";
+      return -1;
+    }
+    sent += n;
+  }
+
+  return ReadReply(reply);
+}
+
+/**
+ * read a reply, which may span several lines
+ * disconnects on communication errors
+ * @param reply the last line of the reply
+ * @return the reply code, or -1 on error
+ */
+int FtpClient::ReadReply(std::string & reply) {
+
+  /* first line */
+  if (ReadLine(reply) != 0 || reply.size() < 3) {
+    Disconnect();
+    return -1;
+  }
+  int code = atoi(reply.substr(0, 3).c_str());
+
+  /* multi-line replies end with the same code followed by a space */
+  if (reply.size() > 3 && reply[3] == '-') {
+    std::string end = reply.substr(0, 3) + " ";
+    do {
+      if (ReadLine(reply) != 0) {
+	Disconnect();
+	return -1;
+      }
+    } while (reply.compare(0, 4, end) != 0);
+  }
+
+  clog << "info: " << logstream::info << "receiving via FTP: " << reply << std::endl;
+  return code;
+}
+
+/**
+ * read one line from the control connection
+ * @param line the line, without line ending
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::ReadLine(std::string & line) {
+
+  char buffer[256];
+  size_t pos;
+
+  while ((pos = this->_ctrl_buf.find("\r\n")) == std::string::npos) {
+    ssize_t n = recv(this->_ctrl_fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      clog << "error: " << logstream::error << "error reading from FTP control connection" << std::endl;
+      return 1;
+    }
+    this->_ctrl_buf.append(buffer, n);
+  }
+
+  line = this->_ctrl_buf.substr(0, pos);
+  this->_ctrl_buf.erase(0, pos + 2);
+  return 0;
+}
+
+/**
+ * prepare a data connection.
+ * in passive mode, connects to the address given by the server.
+ * in active mode, listens on the local address of the control connection
+ * and sends it to the server, the connection is accepted in AcceptData()
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::OpenData() {
+
+  std::string reply;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+
+  CloseData();
+
+  if (this->passive) {
+
+    /* 227 Entering Passive Mode (h1,h2,h3,h4,p1,p2) */
+    if (SendCmd("PASV", reply) != 227) {
+      clog << "error: " << logstream::error << "FTP passive mode failed: " << reply << std::endl;
+      return 1;
+    }
+    unsigned int h[4], p[2];
+    size_t start = reply.find('(');
+    if (start == std::string::npos
+	|| sscanf(reply.c_str() + start, "(%u,%u,%u,%u,%u,%u)", &h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) != 6) {
+      clog << "error: " << logstream::error << "bad FTP passive reply: " << reply << std::endl;
+      return 1;
+    }
+
+    /* connect to the same host as the control connection */
+    if (getpeername(this->_ctrl_fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+      return 1;
+    }
+    addr.sin_port = htons((p[0] << 8) | p[1]);
+    this->_data_fd = OpenSocket((struct sockaddr *) &addr, sizeof(addr));
+    if (this->_data_fd < 0) {
+      clog << "error: " << logstream::error << "cannot open FTP data connection" << std::endl;
+      return 1;
+    }
+  }
+  else {
+
+    /* listen on any port of the interface used for control */
+    if (getsockname(this->_ctrl_fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+      return 1;
+    }
+    addr.sin_port = 0;
+    this->_data_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (this->_data_fd < 0
+	|| bind(this->_data_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+	|| listen(this->_data_fd, 1) != 0
+	|| getsockname(this->_data_fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+      clog << "error: " << logstream::error << "cannot listen for FTP data connection" << std::endl;
+      CloseData();
+      return 1;
+    }
+
+    /* PORT h1,h2,h3,h4,p1,p2 */
+    uint32_t ip = ntohl(addr.sin_addr.s_addr);
+    uint16_t data_port = ntohs(addr.sin_port);
+    char port_cmd[64];
+    snprintf(port_cmd, sizeof(port_cmd), "PORT %u,%u,%u,%u,%u,%u",
+	     (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff,
+	     (data_port >> 8) & 0xff, data_port & 0xff);
+    if (SendCmd(port_cmd, reply) != 200) {
+      clog << "error: " << logstream::error << "FTP active mode failed: " << reply << std::endl;
+      CloseData();
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * in active mode, accept the connection from the server
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::AcceptData() {
+
+  if (this->passive) {
+    return 0;
+  }
+
+  fd_set fdset;
+  FD_ZERO(&fdset);
+  FD_SET(this->_data_fd, &fdset);
+  struct timeval tv;
+  tv.tv_sec = FTP_TIMEOUT_SEC;
+  tv.tv_usec = 0;
+
+  if (select(this->_data_fd + 1, &fdset, NULL, NULL, &tv) != 1) {
+    clog << "error: " << logstream::error << "timeout waiting for FTP data connection" << std::endl;
+    return 1;
+  }
+
+  int data_fd = accept(this->_data_fd, NULL, NULL);
+  close(this->_data_fd);
+  this->_data_fd = data_fd;
+  if (data_fd < 0) {
+    return 1;
+  }
+
+  tv.tv_sec = FTP_TIMEOUT_SEC;
+  tv.tv_usec = 0;
+  setsockopt(data_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  return 0;
+}
+
+/**
+ * close the data connection, if open
+ */
+void FtpClient::CloseData() {
+
+  if (this->_data_fd >= 0) {
+    close(this->_data_fd);
+    this->_data_fd = -1;
+  }
+}
+
+/**
+ * run a command which sends data back on a data connection
+ * @param cmd the command
+ * @param data replaced with the data received
+ * @return 0 on success, 1 on failure
+ */
+int FtpClient::Transfer(std::string cmd, std::vector<char> & data) {
+
+  std::string reply;
+  data.clear();
+
+  if (OpenData() != 0) {
+    return 1;
+  }
+
+  /* 125 or 150 when the transfer starts */
+  int code = SendCmd(cmd, reply);
+  if (code < 100 || code >= 200) {
+    clog << "error: " << logstream::error << "FTP " << cmd << " failed: " << reply << std::endl;
+    CloseData();
+    return 1;
+  }
+
+  if (AcceptData() != 0) {
+    CloseData();
+    Disconnect();
+    return 1;
+  }
+
+  /* read until the server closes the connection */
+  size_t size = 0;
+  while (true) {
+    if (data.size() < size + FTP_CHUNK_SIZE) {
+      data.resize(size + FTP_CHUNK_SIZE);
+    }
+    ssize_t n = recv(this->_data_fd, &data[size], FTP_CHUNK_SIZE, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      clog << "error: " << logstream::error << "error reading from FTP data connection" << std::endl;
+      data.resize(size);
+      CloseData();
+      Disconnect();
+      return 1;
+    }
+    if (n == 0) {
+      break;
+    }
+    size += n;
+  }
+  data.resize(size);
+  CloseData();
+
+  /* 226 or 250 when complete */
+  code = ReadReply(reply);
+  if (code != 226 && code != 250) {
+    clog << "error: " << logstream::error << "FTP " << cmd << " incomplete: " << reply << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+#ifndef _FTP_CLIENT_H
+#define _FTP_CLIENT_H
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include "log.h"
+
+#define FTP_PORT 21
+#define FTP_USER "minieusouser"
+#define FTP_PASS "minieusopass"
+/* timeout for connecting and for each read or write, in seconds */
+#define FTP_TIMEOUT_SEC 5
+/* size of each read from a data connection, in bytes */
+#define FTP_CHUNK_SIZE (64 * 1024)
+
+
+/**
+ * minimal FTP client keeping a single control connection open,
+ * to transfer files from the Zynq board without spawning lftp.
+ * all transfers are binary. uses active mode (PORT) by default,
+ * like lftp with passive mode off, or passive mode (PASV)
+ */
+class FtpClient {
+public:
+  /**
+   * host name or IP of the server
+   */
+  std::string host;
+  /**
+   * control port of the server
+   */
+  int port;
+  /**
+   * if true, use passive mode for data connections
+   */
+  bool passive;
+
+  FtpClient(std::string host, int port = FTP_PORT, bool passive = false);
+  ~FtpClient();
+  int Connect(std::string user = FTP_USER, std::string pass = FTP_PASS);
+  void Disconnect();
+  bool IsConnected();
+  int List(std::vector<std::string> & names);
+  int Retrieve(std::string name, std::vector<char> & data);
+  int Size(std::string name, size_t & size);
+  int Delete(std::string name);
+
+private:
+  /**
+   * control connection socket, -1 if not connected
+   */
+  int _ctrl_fd;
+  /**
+   * bytes read from the control connection but not yet used
+   */
+  std::string _ctrl_buf;
+  /**
+   * data connection socket, or listening socket in active mode before accept()
+   */
+  int _data_fd;
+
+  int OpenSocket(const struct sockaddr * addr, socklen_t addr_len);
+  int SendCmd(std::string cmd, std::string & reply);
+  int ReadReply(std::string & reply);
+  int ReadLine(std::string & line);
+  int OpenData();
+  int AcceptData();
+  void CloseData();
+  int Transfer(std::string cmd, std::vector<char> & data);
+};
+
+#endif
+/* _FTP_CLIENT_H */
@@ -27,6 +27,7 @@ InputParser::InputParser(int &argc, char **argv) {
   this->CmdLine->check_status = false;
   this->CmdLine->zynq_reboot = false;
   this->CmdLine->hide_pixel = false;
+  this->CmdLine->bench = false;
   
   this->CmdLine->dv = -1;
   this->CmdLine->asic_dac = -1;
@@ -51,7 +52,7 @@ InputParser::InputParser(int &argc, char **argv) {
   this->allowed_tokens = {"-db", "-log", "-comment", "-ver", "-lvps", "-hvswitch", "-help",
 			  "-dv", "-dvr", "-asicdac", "-check_status", "-cam", "-v", "-therm",
 			  "-hv", "-scurve", "-start", "-stop", "-step", "-acc", "-short",
-			  "-test_zynq", "-keep_zynq_pkt", "-zynq", "-subsystem", "-zynq_reboot", "-hide_pixel"};
+			  "-test_zynq", "-keep_zynq_pkt", "-zynq", "-subsystem", "-zynq_reboot", "-hide_pixel", "-bench", "-readrun", "-recover"};
 
   /* get command line input */
   std::string space = " ";
@@ -70,6 +71,8 @@ InputParser::InputParser(int &argc, char **argv) {
   /* initialise comment field */
   this->CmdLine->comment = "none";
   this->CmdLine->comment_fn = "";
+  this->CmdLine->read_run_file = "";
+  this->CmdLine->recover_run_file = "";
 
 }
 
@@ -372,6 +375,29 @@ CmdLineInputs * InputParser::ParseCmdLineInputs() {
   if(cmdOptionExists("-check_status")){
     this->CmdLine->check_status = true;
   }
+  if(cmdOptionExists("-bench")){
+    this->CmdLine->bench = true;
+  }
+  if(cmdOptionExists("-readrun")){
+    const std::string & read_run_str = getCmdOption("-readrun");
+    if (!read_run_str.empty()) {
+      this->CmdLine->read_run_file = read_run_str;
+    }
+    else {
+      std::cout << "Error: for -readrun option a run file must be provided" << std::endl;
+      return NULL;
+    }
+  }
+  if(cmdOptionExists("-recover")){
+    const std::string & recover_run_str = getCmdOption("-recover");
+    if (!recover_run_str.empty()) {
+      this->CmdLine->recover_run_file = recover_run_str;
+    }
+    else {
+      std::cout << "Error: for -recover option a run file must be provided" << std::endl;
+      return NULL;
+    }
+  }
 
   /* comment to go in file header and filename */
    if(cmdOptionExists("-comment")){
@@ -475,6 +501,9 @@ int InputParser::PrintHelpMsg() {
   std::cout << "-dvr <X>:            provide the dynode voltage in VOLTS (<X> = 0 - 1100)" << std::endl;
   std::cout << "-asicdac <X>:        provide the HV DAC (<X> = 0 - 1000)" << std::endl;
   std::cout << "-check_status:       check the Zynq telnet connection, instrument status and HV status" << std::endl;
+  std::cout << "-bench:              measure the speed and ratio of the Zynq data compression (COMPRESS) on simulated data" << std::endl;
+  std::cout << "-readrun <FILE>:     check a CPU, SC or HV run file, print its contents and the read speed" << std::endl;
+  std::cout << "-recover <FILE>:     close a run file which was not closed, up to its last checkpoint" << std::endl;
   std::cout << std::endl;
   std::cout << "Switching the LVPS manually" << std::endl;
   std::cout << "Example use case: mecontrol -lvps on -subsystem zynq" << std::endl;
@@ -41,6 +41,7 @@ struct CmdLineInputs {
   bool check_status;
   bool zynq_reboot;
   bool hide_pixel;
+  bool bench;
   /* command line arguments */
   int dv;
   int asic_dac;
@@ -65,6 +66,8 @@ struct CmdLineInputs {
   std::string zynq_mode_string;
   std::string comment;
   std::string comment_fn;
+  std::string read_run_file;
+  std::string recover_run_file;
  
 };
 
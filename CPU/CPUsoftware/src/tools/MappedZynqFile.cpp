@@ -0,0 +1,125 @@
+#include "MappedZynqFile.h"
+
+/**
+ * constructor.
+ * maps the file read-only and sets up the views of D1, D2 and D3
+ * @param path path to the frm_cc file from the Zynq
+ * @param N1 the number of D1 packets expected in the file
+ * @param N2 the number of D2 packets expected in the file
+ */
+MappedZynqFile::MappedZynqFile(std::string path, uint8_t N1, uint8_t N2) {
+
+  this->path = path;
+  this->_addr = nullptr;
+  this->_len = ExpectedSize(N1, N2);
+
+  this->view.N1 = N1;
+  this->view.N2 = N2;
+  this->view.level3_data = nullptr;
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    clog << "error: " << logstream::error << "cannot open the file " << path << std::endl;
+    return;
+  }
+
+  /* check the file holds a full packet */
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < this->_len) {
+    clog << "error: " << logstream::error << "file " << path << " is too small for N1 = "
+	 << (int)N1 << " and N2 = " << (int)N2 << std::endl;
+    close(fd);
+    return;
+  }
+
+  void * addr = mmap(nullptr, this->_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  /* the mapping stays valid after the descriptor is closed */
+  close(fd);
+  if (addr == MAP_FAILED) {
+    clog << "error: " << logstream::error << "mmap of " << path << " failed" << std::endl;
+    return;
+  }
+  this->_addr = addr;
+
+  /* the whole file is read once, front to back */
+  madvise(this->_addr, this->_len, MADV_SEQUENTIAL);
+  madvise(this->_addr, this->_len, MADV_WILLNEED);
+
+  MakeView(static_cast<const char *>(this->_addr), this->_len, N1, N2, this->view);
+}
+
+/**
+ * destructor.
+ * unmaps the file, invalidating the views
+ */
+MappedZynqFile::~MappedZynqFile() {
+
+  if (this->_addr != nullptr) {
+    munmap(this->_addr, this->_len);
+  }
+}
+
+/**
+ * check the file was mapped successfully
+ */
+bool MappedZynqFile::IsValid() {
+
+  return this->_addr != nullptr;
+}
+
+/**
+ * size in bytes of a frm_cc file for a given N1 and N2
+ * @param N1 the number of D1 packets
+ * @param N2 the number of D2 packets
+ */
+size_t MappedZynqFile::ExpectedSize(uint8_t N1, uint8_t N2) {
+
+  return N1 * sizeof(Z_DATA_TYPE_SCI_L1_V2)
+    + N2 * sizeof(Z_DATA_TYPE_SCI_L2_V2)
+    + sizeof(Z_DATA_TYPE_SCI_L3_V2);
+}
+
+/**
+ * build a ZynqPktView of a ZYNQ_PACKET read into memory
+ * @param zynq_packet the packet to view, must outlive the view
+ */
+ZynqPktView MappedZynqFile::MakeView(ZYNQ_PACKET * zynq_packet) {
+
+  ZynqPktView view;
+  view.N1 = zynq_packet->N1;
+  view.N2 = zynq_packet->N2;
+  view.level1_data = PktView<Z_DATA_TYPE_SCI_L1_V2>(zynq_packet->level1_data.data(), zynq_packet->level1_data.size());
+  view.level2_data = PktView<Z_DATA_TYPE_SCI_L2_V2>(zynq_packet->level2_data.data(), zynq_packet->level2_data.size());
+  view.level3_data = &zynq_packet->level3_data;
+
+  return view;
+}
+
+/**
+ * build a ZynqPktView of the contents of a frm_cc file already in memory,
+ * e.g. received directly from the FTP server
+ * @param data the file contents, must outlive the view
+ * @param size the number of bytes in data
+ * @param N1 the number of D1 packets expected
+ * @param N2 the number of D2 packets expected
+ * @param view set to the D1, D2 and D3 data
+ * @return false if data is too small
+ */
+bool MappedZynqFile::MakeView(const char * data, size_t size, uint8_t N1, uint8_t N2, ZynqPktView & view) {
+
+  if (size < ExpectedSize(N1, N2)) {
+    return false;
+  }
+
+  /* D1, D2 and D3 are contiguous in the file */
+  const char * ptr = data;
+  view.N1 = N1;
+  view.N2 = N2;
+  view.level1_data = PktView<Z_DATA_TYPE_SCI_L1_V2>(reinterpret_cast<const Z_DATA_TYPE_SCI_L1_V2 *>(ptr), N1);
+  ptr += N1 * sizeof(Z_DATA_TYPE_SCI_L1_V2);
+  view.level2_data = PktView<Z_DATA_TYPE_SCI_L2_V2>(reinterpret_cast<const Z_DATA_TYPE_SCI_L2_V2 *>(ptr), N2);
+  ptr += N2 * sizeof(Z_DATA_TYPE_SCI_L2_V2);
+  view.level3_data = reinterpret_cast<const Z_DATA_TYPE_SCI_L3_V2 *>(ptr);
+
+  return true;
+}
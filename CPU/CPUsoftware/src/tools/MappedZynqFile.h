@@ -0,0 +1,82 @@
+#ifndef _MAPPED_ZYNQ_FILE_H
+#define _MAPPED_ZYNQ_FILE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "log.h"
+#include "minieuso_data_format.h"
+
+/**
+ * read-only view of a contiguous array of packets
+ * does not own the memory it points to
+ */
+template <class T>
+class PktView {
+public:
+  PktView() : _data(nullptr), _size(0) {}
+  PktView(const T * data, size_t size) : _data(data), _size(size) {}
+
+  const T * data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  const T & operator[](size_t i) const { return _data[i]; }
+  const T * begin() const { return _data; }
+  const T * end() const { return _data + _size; }
+
+private:
+  const T * _data;
+  size_t _size;
+};
+
+/**
+ * typed views of the D1, D2 and D3 data making up one Zynq packet,
+ * as consumed by DataAcquisition::WriteCpuPkt()
+ */
+struct ZynqPktView {
+  uint8_t N1;
+  uint8_t N2;
+  PktView<Z_DATA_TYPE_SCI_L1_V2> level1_data;
+  PktView<Z_DATA_TYPE_SCI_L2_V2> level2_data;
+  const Z_DATA_TYPE_SCI_L3_V2 * level3_data;
+};
+
+/**
+ * maps a frm_cc file from the Zynq into memory and exposes
+ * its contents as a ZynqPktView without copying the data
+ */
+class MappedZynqFile {
+public:
+  /**
+   * path to the mapped file
+   */
+  std::string path;
+  /**
+   * views of the mapped data, only valid while the object exists
+   */
+  ZynqPktView view;
+
+  MappedZynqFile(std::string path, uint8_t N1, uint8_t N2);
+  ~MappedZynqFile();
+  bool IsValid();
+  static size_t ExpectedSize(uint8_t N1, uint8_t N2);
+  static ZynqPktView MakeView(ZYNQ_PACKET * zynq_packet);
+  static bool MakeView(const char * data, size_t size, uint8_t N1, uint8_t N2, ZynqPktView & view);
+
+private:
+  /**
+   * start of the mapping, nullptr if mapping failed
+   */
+  void * _addr;
+  /**
+   * length of the mapping in bytes
+   */
+  size_t _len;
+};
+
+#endif
+/* _MAPPED_ZYNQ_FILE_H */
@@ -0,0 +1,192 @@
+#ifndef _PACKET_POOL_H
+#define _PACKET_POOL_H
+
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "log.h"
+
+template <class T> class PacketPool;
+
+/**
+ * handle to a packet taken from a PacketPool.
+ * can be moved but not copied, and returns the packet
+ * to the pool when destroyed
+ */
+template <class T>
+class PktHandle {
+public:
+  PktHandle() : _pkt(nullptr), _pool(nullptr) {}
+  PktHandle(T * pkt, PacketPool<T> * pool) : _pkt(pkt), _pool(pool) {}
+  PktHandle(PktHandle && other) : _pkt(other._pkt), _pool(other._pool) {
+    other._pkt = nullptr;
+  }
+  PktHandle & operator=(PktHandle && other) {
+    if (this != &other) {
+      Reset();
+      _pkt = other._pkt;
+      _pool = other._pool;
+      other._pkt = nullptr;
+    }
+    return *this;
+  }
+  PktHandle(const PktHandle &) = delete;
+  PktHandle & operator=(const PktHandle &) = delete;
+  ~PktHandle() { Reset(); }
+
+  T * get() const { return _pkt; }
+  T * operator->() const { return _pkt; }
+  T & operator*() const { return *_pkt; }
+  explicit operator bool() const { return _pkt != nullptr; }
+
+  /**
+   * return the packet to the pool early
+   */
+  void Reset() {
+    if (_pkt != nullptr) {
+      _pool->Release(_pkt);
+      _pkt = nullptr;
+    }
+  }
+
+private:
+  T * _pkt;
+  PacketPool<T> * _pool;
+};
+
+/**
+ * fixed-capacity pool of preallocated packets.
+ * packets are allocated once in Reserve() and reused, so that
+ * steady state acquisition does not allocate.
+ * the pool must outlive all handles taken from it
+ */
+template <class T>
+class PacketPool {
+public:
+  /**
+   * function applied to each packet in Reserve(), e.g. to reserve vector capacity
+   */
+  typedef std::function<void(T &)> PrepareFn;
+
+  PacketPool() : _n_out(0) {}
+  PacketPool(const PacketPool &) = delete;
+  PacketPool & operator=(const PacketPool &) = delete;
+
+  /**
+   * make sure the pool holds at least capacity packets and prepare the free ones.
+   * called at the start of a run, when the sizes from Config are known
+   * @param capacity the number of packets in the pool
+   * @param prepare applied to each free packet (optional)
+   */
+  void Reserve(size_t capacity, PrepareFn prepare = nullptr) {
+
+    std::lock_guard<std::mutex> lock(_m_pool);
+    _free.reserve(capacity);
+    while (_packets.size() < capacity) {
+      _packets.emplace_back(new T());
+      _free.push_back(_packets.back().get());
+    }
+    if (prepare) {
+      for (T * pkt : _free) {
+	prepare(*pkt);
+      }
+    }
+  }
+
+  /**
+   * take a packet from the pool, waiting if all are in use
+   * the packet is not cleared, so holds the data of its last use
+   */
+  PktHandle<T> Acquire() {
+
+    std::unique_lock<std::mutex> lock(_m_pool);
+    if (_packets.empty()) {
+      clog << "error: " << logstream::error << "packet pool used before Reserve()" << std::endl;
+      return PktHandle<T>();
+    }
+    if (_free.empty()) {
+      clog << "warning: " << logstream::warning << "packet pool exhausted, waiting for a free packet" << std::endl;
+      _cv_pool.wait(lock, [this] { return !_free.empty(); });
+    }
+
+    T * pkt = _free.back();
+    _free.pop_back();
+    _n_out++;
+    return PktHandle<T>(pkt, this);
+  }
+
+  /**
+   * take a packet from the pool if one is free
+   * @return an empty handle if all packets are in use
+   */
+  PktHandle<T> TryAcquire() {
+
+    std::lock_guard<std::mutex> lock(_m_pool);
+    if (_free.empty()) {
+      return PktHandle<T>();
+    }
+
+    T * pkt = _free.back();
+    _free.pop_back();
+    _n_out++;
+    return PktHandle<T>(pkt, this);
+  }
+
+  /**
+   * number of packets currently in use
+   */
+  size_t InUse() {
+    std::lock_guard<std::mutex> lock(_m_pool);
+    return _n_out;
+  }
+
+  /**
+   * total number of packets in the pool
+   */
+  size_t Capacity() {
+    std::lock_guard<std::mutex> lock(_m_pool);
+    return _packets.size();
+  }
+
+private:
+  friend class PktHandle<T>;
+
+  /**
+   * give a packet back to the pool, called by PktHandle
+   */
+  void Release(T * pkt) {
+    {
+      std::lock_guard<std::mutex> lock(_m_pool);
+      _free.push_back(pkt);
+      _n_out--;
+    }
+    _cv_pool.notify_one();
+  }
+
+  /**
+   * owns all the packets
+   */
+  std::vector<std::unique_ptr<T>> _packets;
+  /**
+   * packets not in use
+   */
+  std::vector<T *> _free;
+  /**
+   * number of packets in use
+   */
+  size_t _n_out;
+  /**
+   * protection for the free list
+   */
+  std::mutex _m_pool;
+  /**
+   * to wait for a free packet
+   */
+  std::condition_variable _cv_pool;
+};
+
+#endif
+/* _PACKET_POOL_H */
@@ -0,0 +1,916 @@
+#include "PktCodec.h"
+
+/* size in bytes of the part of each Zynq packet stored unchanged, before the pixel data */
+static const size_t kL1Prefix = offsetof(Z_DATA_TYPE_SCI_L1_V2, payload.raw_data);
+static const size_t kL2Prefix = offsetof(Z_DATA_TYPE_SCI_L2_V2, payload.int16_data);
+static const size_t kL3Prefix = offsetof(Z_DATA_TYPE_SCI_L3_V2, payload.int32_data);
+
+/**
+ * map signed differences to unsigned values, small in magnitude either side of 0
+ */
+template <class T>
+static inline T ZigZag(T d) {
+  return (T)((T)(d << 1) ^ (T)(0 - (d >> (sizeof(T) * 8 - 1))));
+}
+
+/**
+ * inverse of ZigZag()
+ */
+template <class T>
+static inline T UnZigZag(T z) {
+  return (T)((z >> 1) ^ (T)(0 - (z & 1)));
+}
+
+#ifdef __SSE2__
+/**
+ * SSE2 operations on 16 bytes of values of type T
+ */
+template <class T>
+struct Sse2Ops;
+
+template <>
+struct Sse2Ops<uint8_t> {
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi8(a, b); }
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi8(a, b); }
+  static __m128i ZigZag(__m128i d) {
+    return _mm_xor_si128(_mm_add_epi8(d, d), _mm_cmpgt_epi8(_mm_setzero_si128(), d));
+  }
+  static __m128i UnZigZag(__m128i z) {
+    /* no 8 bit shift in SSE2, shift 16 bits and clear what came from the next byte */
+    __m128i half = _mm_and_si128(_mm_srli_epi16(z, 1), _mm_set1_epi8(0x7f));
+    return _mm_xor_si128(half, _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi8(1))));
+  }
+};
+
+template <>
+struct Sse2Ops<uint16_t> {
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi16(a, b); }
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi16(a, b); }
+  static __m128i ZigZag(__m128i d) {
+    return _mm_xor_si128(_mm_slli_epi16(d, 1), _mm_srai_epi16(d, 15));
+  }
+  static __m128i UnZigZag(__m128i z) {
+    return _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi16(1))));
+  }
+};
+
+template <>
+struct Sse2Ops<uint32_t> {
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi32(a, b); }
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+  static __m128i ZigZag(__m128i d) {
+    return _mm_xor_si128(_mm_slli_epi32(d, 1), _mm_srai_epi32(d, 31));
+  }
+  static __m128i UnZigZag(__m128i z) {
+    return _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi32(1))));
+  }
+};
+#endif
+
+/**
+ * zigzag encoded difference of each value to the same pixel in the previous frame
+ * @param cur the values to encode
+ * @param prev the previous frame
+ * @param res the encoded values are written here
+ * @param n the number of values
+ * @return all the encoded values OR'ed together, to find the bit width
+ */
+template <class T>
+static T Residuals(const T * cur, const T * prev, T * res, size_t n) {
+
+  T bits = 0;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const size_t step = sizeof(__m128i) / sizeof(T);
+  __m128i acc = _mm_setzero_si128();
+  for (; i + step <= n; i += step) {
+    __m128i d = Sse2Ops<T>::Sub(_mm_loadu_si128((const __m128i *)(cur + i)),
+				_mm_loadu_si128((const __m128i *)(prev + i)));
+    __m128i z = Sse2Ops<T>::ZigZag(d);
+    _mm_storeu_si128((__m128i *)(res + i), z);
+    acc = _mm_or_si128(acc, z);
+  }
+  T lanes[sizeof(__m128i) / sizeof(T)];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  for (size_t j = 0; j < step; j++) {
+    bits |= lanes[j];
+  }
+#endif
+
+  for (; i < n; i++) {
+    res[i] = ZigZag<T>((T)(cur[i] - prev[i]));
+    bits |= res[i];
+  }
+  return bits;
+}
+
+/**
+ * inverse of Residuals()
+ * @param res the encoded values
+ * @param prev the previous frame
+ * @param out the decoded values are written here
+ * @param n the number of values
+ */
+template <class T>
+static void Reconstruct(const T * res, const T * prev, T * out, size_t n) {
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const size_t step = sizeof(__m128i) / sizeof(T);
+  for (; i + step <= n; i += step) {
+    __m128i d = Sse2Ops<T>::UnZigZag(_mm_loadu_si128((const __m128i *)(res + i)));
+    _mm_storeu_si128((__m128i *)(out + i), Sse2Ops<T>::Add(_mm_loadu_si128((const __m128i *)(prev + i)), d));
+  }
+#endif
+
+  for (; i < n; i++) {
+    out[i] = (T)(prev[i] + UnZigZag<T>(res[i]));
+  }
+}
+
+/**
+ * number of bits needed to hold a value
+ */
+static inline uint8_t BitWidth(uint32_t bits) {
+  return bits ? (uint8_t)(32 - __builtin_clz(bits)) : 0;
+}
+
+/**
+ * pack values into width bits each, least significant bits first
+ * @return the end of the packed data
+ */
+template <class T>
+static uint8_t * Pack(const T * in, size_t n, uint8_t width, uint8_t * out) {
+
+  uint64_t acc = 0;
+  unsigned int n_bits = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    acc |= (uint64_t)in[i] << n_bits;
+    n_bits += width;
+    if (n_bits >= 32) {
+      uint32_t word = (uint32_t)acc;
+      memcpy(out, &word, sizeof(word));
+      out += sizeof(word);
+      acc >>= 32;
+      n_bits -= 32;
+    }
+  }
+  while (n_bits > 0) {
+    *out++ = (uint8_t)acc;
+    acc >>= 8;
+    n_bits = n_bits > 8 ? n_bits - 8 : 0;
+  }
+  return out;
+}
+
+/**
+ * inverse of Pack()
+ * @return the end of the packed data
+ */
+template <class T>
+static const uint8_t * Unpack(const uint8_t * in, size_t n, uint8_t width, T * out) {
+
+  uint64_t acc = 0;
+  unsigned int n_bits = 0;
+  uint64_t mask = (1ULL << width) - 1;
+
+  for (size_t i = 0; i < n; i++) {
+    while (n_bits < width) {
+      acc |= (uint64_t)(*in++) << n_bits;
+      n_bits += 8;
+    }
+    out[i] = (T)(acc & mask);
+    acc >>= width;
+    n_bits -= width;
+  }
+  return in;
+}
+
+/**
+ * find the nonzero pixels of a frame
+ * @param in the frame
+ * @param n_pixels number of pixels, less than 65536
+ * @param bitmap bit p is set if pixel p is nonzero, (n_pixels + 7) / 8 bytes
+ * @param index the nonzero pixels are written here
+ * @param count their values are written here
+ * @return the number of nonzero pixels
+ */
+static size_t ScanNonZero(const uint8_t * in, size_t n_pixels, uint8_t * bitmap, uint16_t * index, uint8_t * count) {
+
+  size_t n = 0;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  /* 16 pixels at a time, with the zero pixels found in one comparison */
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n_pixels; i += 16) {
+    uint16_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(in + i)), zero));
+    memcpy(bitmap + i / 8, &mask, sizeof(mask));
+    while (mask) {
+      size_t j = i + __builtin_ctz(mask);
+      index[n] = j;
+      count[n] = in[j];
+      n++;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  memset(bitmap + i / 8, 0, (n_pixels + 7) / 8 - i / 8);
+  for (; i < n_pixels; i++) {
+    if (in[i]) {
+      bitmap[i / 8] |= 1 << (i % 8);
+      index[n] = i;
+      count[n] = in[i];
+      n++;
+    }
+  }
+  return n;
+}
+
+/**
+ * size the buffers for frames of n_pixels pixels,
+ * does nothing if they are already large enough
+ * @param n_pixels number of pixels per frame
+ */
+void PktCodec::Scratch::Reserve(size_t n_pixels) {
+
+  if (this->index.size() < n_pixels) {
+    this->bitmap.resize((n_pixels + 7) / 8);
+    this->index.resize(n_pixels);
+    this->count.resize(n_pixels);
+  }
+}
+
+/**
+ * largest possible size of the data encoded by Encode()
+ * @param n_frames number of frames
+ * @param n_pixels number of pixels per frame
+ * @param value_size size of each value in bytes
+ */
+size_t PktCodec::MaxEncodedSize(size_t n_frames, size_t n_pixels, size_t value_size) {
+
+  size_t n_blocks = (n_pixels + CMP_BLOCK_SIZE - 1) / CMP_BLOCK_SIZE;
+  return n_frames * (n_blocks + n_pixels * value_size);
+}
+
+/**
+ * encode frames of pixel data.
+ * for each block of CMP_BLOCK_SIZE values of a frame, one byte giving
+ * the bit width is followed by the packed values
+ * @param in n_frames x n_pixels values
+ * @param n_frames number of frames
+ * @param n_pixels number of pixels per frame
+ * @param out at least MaxEncodedSize() bytes
+ * @return the size of the encoded data in bytes
+ */
+template <class T>
+size_t PktCodec::Encode(const T * in, size_t n_frames, size_t n_pixels, uint8_t * out) {
+
+  /* the first frame is predicted from zero */
+  const T zero[CMP_BLOCK_SIZE] = {};
+  T res[CMP_BLOCK_SIZE];
+  uint8_t * start = out;
+
+  for (size_t f = 0; f < n_frames; f++) {
+    const T * cur = in + f * n_pixels;
+
+    for (size_t i = 0; i < n_pixels; i += CMP_BLOCK_SIZE) {
+      size_t n = std::min((size_t)CMP_BLOCK_SIZE, n_pixels - i);
+      const T * prev = f ? cur + i - n_pixels : zero;
+      uint8_t width = BitWidth(Residuals<T>(cur + i, prev, res, n));
+      *out++ = width;
+      out = Pack<T>(res, n, width, out);
+    }
+  }
+  return out - start;
+}
+
+/**
+ * decode frames of pixel data encoded with Encode()
+ * @param in the encoded data
+ * @param in_size the size of the encoded data in bytes
+ * @param n_frames number of frames
+ * @param n_pixels number of pixels per frame
+ * @param out n_frames x n_pixels values are written here
+ * @return 0 on success, 1 if the data is corrupted
+ */
+template <class T>
+int PktCodec::Decode(const uint8_t * in, size_t in_size, size_t n_frames, size_t n_pixels, T * out) {
+
+  const T zero[CMP_BLOCK_SIZE] = {};
+  T res[CMP_BLOCK_SIZE];
+  const uint8_t * end = in + in_size;
+
+  for (size_t f = 0; f < n_frames; f++) {
+    T * cur = out + f * n_pixels;
+
+    for (size_t i = 0; i < n_pixels; i += CMP_BLOCK_SIZE) {
+      size_t n = std::min((size_t)CMP_BLOCK_SIZE, n_pixels - i);
+      const T * prev = f ? cur + i - n_pixels : zero;
+      if (in >= end) {
+	return 1;
+      }
+      uint8_t width = *in++;
+      if (width > sizeof(T) * 8 || (size_t)(end - in) < (n * width + 7) / 8) {
+	return 1;
+      }
+      in = Unpack<T>(in, n, width, res);
+      Reconstruct<T>(res, prev, cur + i, n);
+    }
+  }
+  return (in == end) ? 0 : 1;
+}
+
+/**
+ * largest possible size of the data encoded by EncodeSparse()
+ * @param n_frames number of frames
+ * @param n_pixels number of pixels per frame
+ */
+size_t PktCodec::MaxSparseSize(size_t n_frames, size_t n_pixels) {
+
+  return n_frames * (1 + (n_pixels + 7) / 8 + n_pixels);
+}
+
+/**
+ * encode frames of D1 data where most pixels are 0.
+ * each frame starts with a byte giving its format, the smaller of:
+ * CMP_SPARSE_LIST, the number of nonzero pixels (uint16_t),
+ * their indices (uint16_t) then their counts (uint8_t), or
+ * CMP_SPARSE_BITMAP, a bitmap of the nonzero pixels then their counts
+ * @param in n_frames x n_pixels values
+ * @param n_frames number of frames
+ * @param n_pixels number of pixels per frame, less than 65536
+ * @param out at least MaxSparseSize() bytes
+ * @param scratch working buffers, grown only if smaller than n_pixels
+ * @return the size of the encoded data in bytes
+ */
+size_t PktCodec::EncodeSparse(const uint8_t * in, size_t n_frames, size_t n_pixels, uint8_t * out, Scratch & scratch) {
+
+  size_t bitmap_size = (n_pixels + 7) / 8;
+  scratch.Reserve(n_pixels);
+  uint8_t * start = out;
+
+  for (size_t f = 0; f < n_frames; f++) {
+    uint16_t n = ScanNonZero(in + f * n_pixels, n_pixels, scratch.bitmap.data(), scratch.index.data(),
+			     scratch.count.data());
+
+    if (sizeof(n) + n * sizeof(uint16_t) < bitmap_size) {
+      *out++ = CMP_SPARSE_LIST;
+      memcpy(out, &n, sizeof(n));
+      out += sizeof(n);
+      memcpy(out, scratch.index.data(), n * sizeof(uint16_t));
+      out += n * sizeof(uint16_t);
+    }
+    else {
+      *out++ = CMP_SPARSE_BITMAP;
+      memcpy(out, scratch.bitmap.data(), bitmap_size);
+      out += bitmap_size;
+    }
+    memcpy(out, scratch.count.data(), n);
+    out += n;
+  }
+  return out - start;
+}
+
+/**
+ * size of D1 data once encoded by Encode() and by EncodeSparse(),
+ * found in one pass without encoding it
+ * @param in n_frames x n_pixels values
+ * @param n_frames number of frames
+ * @param n_pixels number of pixels per frame
+ * @param delta_size set to the size with Encode()
+ * @param sparse_size set to the size with EncodeSparse()
+ */
+void PktCodec::EncodedSizes(const uint8_t * in, size_t n_frames, size_t n_pixels, size_t & delta_size, size_t & sparse_size) {
+
+  const uint8_t zero[CMP_BLOCK_SIZE] = {};
+  size_t bitmap_size = (n_pixels + 7) / 8;
+  delta_size = 0;
+  sparse_size = 0;
+
+  for (size_t f = 0; f < n_frames; f++) {
+    const uint8_t * cur = in + f * n_pixels;
+    size_t n_nonzero = 0;
+
+    for (size_t i = 0; i < n_pixels; i += CMP_BLOCK_SIZE) {
+      size_t n = std::min((size_t)CMP_BLOCK_SIZE, n_pixels - i);
+      const uint8_t * prev = f ? cur + i - n_pixels : zero;
+      uint8_t bits = 0;
+      size_t j = 0;
+
+#ifdef __SSE2__
+      /* the OR of the residuals and the zero pixels, 16 at a time */
+      __m128i acc = _mm_setzero_si128();
+      for (; j + 16 <= n; j += 16) {
+	__m128i c = _mm_loadu_si128((const __m128i *)(cur + i + j));
+	__m128i d = Sse2Ops<uint8_t>::Sub(c, _mm_loadu_si128((const __m128i *)(prev + j)));
+	acc = _mm_or_si128(acc, Sse2Ops<uint8_t>::ZigZag(d));
+	n_nonzero += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_setzero_si128())));
+      }
+      uint8_t lanes[16];
+      _mm_storeu_si128((__m128i *)lanes, acc);
+      for (size_t k = 0; k < 16; k++) {
+	bits |= lanes[k];
+      }
+#endif
+
+      for (; j < n; j++) {
+	bits |= ZigZag<uint8_t>((uint8_t)(cur[i + j] - prev[j]));
+	n_nonzero += (cur[i + j] != 0);
+      }
+      delta_size += 1 + (n * BitWidth(bits) + 7) / 8;
+    }
+
+    /* as chosen by EncodeSparse() */
+    if (sizeof(uint16_t) + n_nonzero * sizeof(uint16_t) < bitmap_size) {
+      sparse_size += 1 + sizeof(uint16_t) + n_nonzero * sizeof(uint16_t) + n_nonzero;
+    }
+    else {
+      sparse_size += 1 + bitmap_size + n_nonzero;
+    }
+  }
+}
+
+/**
+ * decode frames of D1 data encoded with EncodeSparse()
+ * @param in the encoded data
+ * @param in_size the size of the encoded data in bytes
+ * @param n_frames number of frames
+ * @param n_pixels number of pixels per frame
+ * @param out n_frames x n_pixels values are written here
+ * @return 0 on success, 1 if the data is corrupted
+ */
+int PktCodec::DecodeSparse(const uint8_t * in, size_t in_size, size_t n_frames, size_t n_pixels, uint8_t * out) {
+
+  size_t bitmap_size = (n_pixels + 7) / 8;
+  const uint8_t * end = in + in_size;
+
+  memset(out, 0, n_frames * n_pixels);
+
+  for (size_t f = 0; f < n_frames; f++) {
+    uint8_t * cur = out + f * n_pixels;
+    if (in >= end) {
+      return 1;
+    }
+
+    switch (*in++) {
+    case CMP_SPARSE_LIST: {
+      uint16_t n;
+      if ((size_t)(end - in) < sizeof(n)) {
+	return 1;
+      }
+      memcpy(&n, in, sizeof(n));
+      in += sizeof(n);
+      if ((size_t)(end - in) < n * (sizeof(uint16_t) + 1)) {
+	return 1;
+      }
+      const uint8_t * count = in + n * sizeof(uint16_t);
+      for (size_t i = 0; i < n; i++) {
+	uint16_t j;
+	memcpy(&j, in + i * sizeof(j), sizeof(j));
+	if (j >= n_pixels) {
+	  return 1;
+	}
+	cur[j] = count[i];
+      }
+      in = count + n;
+      break;
+    }
+    case CMP_SPARSE_BITMAP: {
+      if ((size_t)(end - in) < bitmap_size) {
+	return 1;
+      }
+      const uint8_t * bitmap = in;
+      in += bitmap_size;
+      for (size_t i = 0; i < bitmap_size; i++) {
+	uint8_t mask = bitmap[i];
+	while (mask) {
+	  size_t j = i * 8 + __builtin_ctz(mask);
+	  if (in >= end || j >= n_pixels) {
+	    return 1;
+	  }
+	  cur[j] = *in++;
+	  mask &= mask - 1;
+	}
+      }
+      break;
+    }
+    default:
+      return 1;
+    }
+  }
+  return (in == end) ? 0 : 1;
+}
+
+/**
+ * write a CpuCmpHeader and the encoded pixel data,
+ * stored unchanged if it does not get smaller
+ * @param in n_frames x n_pixels values
+ * @param codec CMP_CODEC_FRAME_DELTA or CMP_CODEC_SPARSE to compress,
+ * CMP_CODEC_SPARSE is only used for D1, and only if smaller than with CMP_CODEC_FRAME_DELTA
+ * @param out where to write, with space for the header and
+ * MaxEncodedSize() or MaxSparseSize() bytes
+ * @param scratch working buffers for CMP_CODEC_SPARSE
+ * @return the number of bytes written
+ */
+template <class T>
+size_t PktCodec::EncodeBlock(const T * in, size_t n_frames, size_t n_pixels, uint8_t codec, char * out,
+			     Scratch & scratch) {
+
+  CpuCmpHeader cmp_header;
+  size_t raw_size = n_frames * n_pixels * sizeof(T);
+  uint8_t * data = (uint8_t *)out + sizeof(cmp_header);
+  size_t cmp_size = raw_size;
+
+  if (codec == CMP_CODEC_SPARSE && sizeof(T) != sizeof(uint8_t)) {
+    codec = CMP_CODEC_FRAME_DELTA;
+  }
+  if (codec == CMP_CODEC_FRAME_DELTA) {
+    cmp_size = Encode<T>(in, n_frames, n_pixels, data);
+  }
+  else if (codec == CMP_CODEC_SPARSE) {
+
+    /* with a bright background, the frame delta codec does better */
+    size_t delta_size, sparse_size;
+    EncodedSizes((const uint8_t *)in, n_frames, n_pixels, delta_size, sparse_size);
+    if (delta_size < sparse_size) {
+      codec = CMP_CODEC_FRAME_DELTA;
+      cmp_size = Encode<T>(in, n_frames, n_pixels, data);
+    }
+    else {
+      cmp_size = EncodeSparse((const uint8_t *)in, n_frames, n_pixels, data, scratch);
+    }
+  }
+  if (cmp_size >= raw_size) {
+    codec = CMP_CODEC_NONE;
+    cmp_size = raw_size;
+    memcpy(data, in, raw_size);
+  }
+
+  cmp_header.header = CpuTools::BuildCpuHeader(CMP_PACKET_TYPE, codec);
+  cmp_header.raw_size = raw_size;
+  cmp_header.cmp_size = cmp_size;
+  memcpy(out, &cmp_header, sizeof(cmp_header));
+
+  return sizeof(cmp_header) + cmp_size;
+}
+
+/**
+ * read a CpuCmpHeader and decode the pixel data following it
+ * @param in the header and encoded data
+ * @param in_size the number of bytes available
+ * @param n_frames number of frames
+ * @param n_pixels number of pixels per frame
+ * @param out n_frames x n_pixels values are written here
+ * @param in_used set to the number of bytes read
+ * @return 0 on success, 1 if the data is corrupted
+ */
+template <class T>
+int PktCodec::DecodeBlock(const char * in, size_t in_size, size_t n_frames, size_t n_pixels, T * out,
+			  size_t & in_used) {
+
+  CpuCmpHeader cmp_header;
+  size_t raw_size = n_frames * n_pixels * sizeof(T);
+
+  if (in_size < sizeof(cmp_header)) {
+    return 1;
+  }
+  memcpy(&cmp_header, in, sizeof(cmp_header));
+  if (cmp_header.spacer != ID_TAG || (cmp_header.header >> 24) != CMP_PACKET_TYPE
+      || cmp_header.raw_size != raw_size || cmp_header.cmp_size > in_size - sizeof(cmp_header)) {
+    return 1;
+  }
+  in += sizeof(cmp_header);
+  in_used = sizeof(cmp_header) + cmp_header.cmp_size;
+
+  switch (cmp_header.header & 0xff) {
+  case CMP_CODEC_NONE:
+    if (cmp_header.cmp_size != raw_size) {
+      return 1;
+    }
+    memcpy(out, in, raw_size);
+    return 0;
+  case CMP_CODEC_FRAME_DELTA:
+    return Decode<T>((const uint8_t *)in, cmp_header.cmp_size, n_frames, n_pixels, out);
+  case CMP_CODEC_SPARSE:
+    if (sizeof(T) != sizeof(uint8_t)) {
+      return 1;
+    }
+    return DecodeSparse((const uint8_t *)in, cmp_header.cmp_size, n_frames, n_pixels, (uint8_t *)out);
+  default:
+    return 1;
+  }
+}
+
+/**
+ * largest possible size of a Zynq packet encoded by EncodeSegment()
+ * @param level the type of Zynq packet
+ */
+size_t PktCodec::MaxSegmentSize(Level level) {
+
+  switch (level) {
+  case D1:
+    return kL1Prefix + sizeof(CpuCmpHeader)
+      + std::max(MaxEncodedSize(N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM, sizeof(uint8_t)),
+		 MaxSparseSize(N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM));
+  case D2:
+    return kL2Prefix + sizeof(CpuCmpHeader) + MaxEncodedSize(N_OF_FRAMES_L2_V0, N_OF_PIXEL_PER_PDM, sizeof(uint16_t));
+  case D3:
+    return kL3Prefix + sizeof(CpuCmpHeader) + MaxEncodedSize(N_OF_FRAMES_L3_V0, N_OF_PIXEL_PER_PDM, sizeof(uint32_t));
+  }
+  return 0;
+}
+
+/**
+ * encode one Zynq packet.
+ * the data before the pixels is copied and the pixels are replaced
+ * by a CpuCmpHeader and the encoded data
+ * @param level the type of Zynq packet
+ * @param zynq_pkt the Z_DATA_TYPE_SCI_L1_V2, Z_DATA_TYPE_SCI_L2_V2 or Z_DATA_TYPE_SCI_L3_V2
+ * @param codec the codec to use, as for EncodeZynqData()
+ * @param out at least MaxSegmentSize() bytes
+ * @param scratch working buffers, reused between calls
+ * @return the size of the encoded data in bytes
+ */
+size_t PktCodec::EncodeSegment(Level level, const void * zynq_pkt, uint8_t codec, char * out, Scratch & scratch) {
+
+  switch (level) {
+  case D1: {
+    const Z_DATA_TYPE_SCI_L1_V2 * level1 = (const Z_DATA_TYPE_SCI_L1_V2 *)zynq_pkt;
+    memcpy(out, level1, kL1Prefix);
+    return kL1Prefix + EncodeBlock<uint8_t>(&level1->payload.raw_data[0][0], N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM,
+					    codec, out + kL1Prefix, scratch);
+  }
+  case D2: {
+    const Z_DATA_TYPE_SCI_L2_V2 * level2 = (const Z_DATA_TYPE_SCI_L2_V2 *)zynq_pkt;
+    memcpy(out, level2, kL2Prefix);
+    return kL2Prefix + EncodeBlock<uint16_t>(&level2->payload.int16_data[0][0], N_OF_FRAMES_L2_V0, N_OF_PIXEL_PER_PDM,
+					     codec, out + kL2Prefix, scratch);
+  }
+  case D3: {
+    const Z_DATA_TYPE_SCI_L3_V2 * level3 = (const Z_DATA_TYPE_SCI_L3_V2 *)zynq_pkt;
+    memcpy(out, level3, kL3Prefix);
+    return kL3Prefix + EncodeBlock<uint32_t>(&level3->payload.int32_data[0][0], N_OF_FRAMES_L3_V0, N_OF_PIXEL_PER_PDM,
+					     codec, out + kL3Prefix, scratch);
+  }
+  }
+  return 0;
+}
+
+/**
+ * codec actually used for a segment encoded by EncodeSegment(),
+ * which can differ from the one asked for
+ * @param level the type of Zynq packet
+ * @param segment the encoded data
+ */
+uint8_t PktCodec::SegmentCodec(Level level, const char * segment) {
+
+  size_t prefix = (level == D1) ? kL1Prefix : (level == D2) ? kL2Prefix : kL3Prefix;
+  CpuCmpHeader cmp_header;
+  memcpy(&cmp_header, segment + prefix, sizeof(cmp_header));
+  return cmp_header.header & 0xff;
+}
+
+/**
+ * encode the Zynq data of a CPU_PACKET, one Zynq packet after the other
+ * with EncodeSegment()
+ * @param zynq_view the D1, D2 and D3 data
+ * @param codec the codec to use, CMP_CODEC_NONE, CMP_CODEC_FRAME_DELTA
+ * or CMP_CODEC_SPARSE for D1 with CMP_CODEC_FRAME_DELTA for D2 and D3
+ * @param out the encoded data is written here, resized if needed and reused between calls
+ * @param scratch working buffers, reused between calls
+ * @return the size of the encoded data in bytes
+ */
+size_t PktCodec::EncodeZynqData(const ZynqPktView & zynq_view, uint8_t codec, std::vector<char> & out,
+				Scratch & scratch) {
+
+  size_t max_size = zynq_view.level1_data.size() * MaxSegmentSize(D1)
+    + zynq_view.level2_data.size() * MaxSegmentSize(D2) + MaxSegmentSize(D3);
+  if (out.size() < max_size) {
+    out.resize(max_size);
+  }
+  char * ptr = out.data();
+
+  for (const Z_DATA_TYPE_SCI_L1_V2 & level1 : zynq_view.level1_data) {
+    ptr += EncodeSegment(D1, &level1, codec, ptr, scratch);
+  }
+  for (const Z_DATA_TYPE_SCI_L2_V2 & level2 : zynq_view.level2_data) {
+    ptr += EncodeSegment(D2, &level2, codec, ptr, scratch);
+  }
+  ptr += EncodeSegment(D3, zynq_view.level3_data, codec, ptr, scratch);
+
+  return ptr - out.data();
+}
+
+/**
+ * decode the Zynq data of a CPU_PACKET with version CPU_PACKET_VER_CMP
+ * @param in the encoded data, following N1 and N2 in the packet
+ * @param in_size the number of bytes available
+ * @param N1 number of D1 packets
+ * @param N2 number of D2 packets
+ * @param out MappedZynqFile::ExpectedSize(N1, N2) bytes, laid out as in the frm_cc files
+ * @param in_used if given, set to the number of bytes read
+ * @return 0 on success, 1 if the data is corrupted
+ */
+int PktCodec::DecodeZynqData(const char * in, size_t in_size, uint8_t N1, uint8_t N2, char * out,
+			     size_t * in_used) {
+
+  const char * start = in;
+  const char * end = in + in_size;
+  size_t used = 0;
+
+  for (int i = 0; i < N1; i++) {
+    Z_DATA_TYPE_SCI_L1_V2 * level1 = (Z_DATA_TYPE_SCI_L1_V2 *)out;
+    if ((size_t)(end - in) < kL1Prefix) {
+      return 1;
+    }
+    memcpy(level1, in, kL1Prefix);
+    in += kL1Prefix;
+    if (DecodeBlock<uint8_t>(in, end - in, N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM,
+			     &level1->payload.raw_data[0][0], used) != 0) {
+      return 1;
+    }
+    in += used;
+    out += sizeof(Z_DATA_TYPE_SCI_L1_V2);
+  }
+  for (int i = 0; i < N2; i++) {
+    Z_DATA_TYPE_SCI_L2_V2 * level2 = (Z_DATA_TYPE_SCI_L2_V2 *)out;
+    if ((size_t)(end - in) < kL2Prefix) {
+      return 1;
+    }
+    memcpy(level2, in, kL2Prefix);
+    in += kL2Prefix;
+    if (DecodeBlock<uint16_t>(in, end - in, N_OF_FRAMES_L2_V0, N_OF_PIXEL_PER_PDM,
+			      &level2->payload.int16_data[0][0], used) != 0) {
+      return 1;
+    }
+    in += used;
+    out += sizeof(Z_DATA_TYPE_SCI_L2_V2);
+  }
+  Z_DATA_TYPE_SCI_L3_V2 * level3 = (Z_DATA_TYPE_SCI_L3_V2 *)out;
+  if ((size_t)(end - in) < kL3Prefix) {
+    return 1;
+  }
+  memcpy(level3, in, kL3Prefix);
+  in += kL3Prefix;
+  if (DecodeBlock<uint32_t>(in, end - in, N_OF_FRAMES_L3_V0, N_OF_PIXEL_PER_PDM,
+			    &level3->payload.int32_data[0][0], used) != 0) {
+    return 1;
+  }
+  in += used;
+
+  if (in_used) {
+    *in_used = in - start;
+  }
+  return 0;
+}
+
+/**
+ * measure the compression ratio and speed on simulated night-time data,
+ * MAX_PACKETS_L1 D1, MAX_PACKETS_L2 D2 and one D3 packet with Poisson counts,
+ * then D1 alone for different background levels,
+ * and check the data is decoded unchanged
+ * @return 0 if the decoded data matches, 1 otherwise
+ */
+int PktCodec::Benchmark() {
+
+  uint8_t N1 = MAX_PACKETS_L1;
+  uint8_t N2 = MAX_PACKETS_L2;
+  size_t raw_size = MappedZynqFile::ExpectedSize(N1, N2);
+  std::vector<char> raw(raw_size, 0);
+  ZynqPktView zynq_view;
+  MappedZynqFile::MakeView(raw.data(), raw.size(), N1, N2, zynq_view);
+
+  std::cout << "simulating " << raw_size / (1024 * 1024.0) << " MB of Zynq data" << std::endl;
+
+  /* background of about 1 count per pixel per GTU, varying between pixels */
+  std::mt19937 gen(1);
+  std::vector<double> mean(N_OF_PIXEL_PER_PDM);
+  std::uniform_real_distribution<double> pixel_gain(0.5, 1.5);
+  for (double & m : mean) {
+    m = pixel_gain(gen);
+  }
+  Z_DATA_TYPE_SCI_L1_V2 * level1 = (Z_DATA_TYPE_SCI_L1_V2 *)raw.data();
+  Z_DATA_TYPE_SCI_L2_V2 * level2 = (Z_DATA_TYPE_SCI_L2_V2 *)(level1 + N1);
+  Z_DATA_TYPE_SCI_L3_V2 * level3 = (Z_DATA_TYPE_SCI_L3_V2 *)(level2 + N2);
+  for (int i = 0; i < N1; i++) {
+    for (int f = 0; f < N_OF_FRAMES_L1_V0; f++) {
+      for (int p = 0; p < N_OF_PIXEL_PER_PDM; p++) {
+	level1[i].payload.raw_data[f][p] = std::poisson_distribution<int>(mean[p])(gen);
+      }
+    }
+  }
+  for (int i = 0; i < N2; i++) {
+    for (int f = 0; f < N_OF_FRAMES_L2_V0; f++) {
+      for (int p = 0; p < N_OF_PIXEL_PER_PDM; p++) {
+	level2[i].payload.int16_data[f][p] = std::poisson_distribution<int>(mean[p] * SCALE_GTU_SMALL_PER_BIG)(gen);
+      }
+    }
+  }
+  for (int f = 0; f < N_OF_FRAMES_L3_V0; f++) {
+    for (int p = 0; p < N_OF_PIXEL_PER_PDM; p++) {
+      level3->payload.int32_data[f][p] = std::poisson_distribution<int>(mean[p] * SCALE_GTU_SMALL_PER_BIG * SCALE_GTU_BIG_PER_HUGE)(gen);
+    }
+  }
+
+  /* time the encoding and decoding of the whole packet */
+  std::vector<char> encoded;
+  std::vector<char> decoded(raw_size);
+  Scratch scratch;
+  scratch.Reserve(N_OF_PIXEL_PER_PDM);
+  double mb = (double)raw_size * CMP_BENCH_ITER / (1024 * 1024);
+  bool match = true;
+
+#ifdef __SSE2__
+  std::cout << "using SSE2" << std::endl;
+#else
+  std::cout << "using scalar code" << std::endl;
+#endif
+  std::cout << std::fixed << std::setprecision(2);
+
+  for (uint8_t codec : {CMP_CODEC_FRAME_DELTA, CMP_CODEC_SPARSE}) {
+    size_t cmp_size = 0;
+    int ret = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CMP_BENCH_ITER; i++) {
+      cmp_size = EncodeZynqData(zynq_view, codec, encoded, scratch);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    for (int i = 0; i < CMP_BENCH_ITER; i++) {
+      ret |= DecodeZynqData(encoded.data(), cmp_size, N1, N2, decoded.data());
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double enc_s = std::chrono::duration<double>(mid - start).count();
+    double dec_s = std::chrono::duration<double>(end - mid).count();
+    bool codec_match = (ret == 0) && (memcmp(raw.data(), decoded.data(), raw_size) == 0);
+    match = match && codec_match;
+
+    std::cout << "COMPRESS " << (int)codec << ": " << cmp_size / (1024 * 1024.0) << " MB, ratio "
+	      << (double)raw_size / cmp_size << ", encode " << mb / enc_s << " MB/s, decode "
+	      << mb / dec_s << " MB/s, round trip " << (codec_match ? "OK" : "FAILED") << std::endl;
+    clog << "info: " << logstream::info << "codec benchmark COMPRESS " << (int)codec << ": ratio "
+	 << (double)raw_size / cmp_size << ", encode " << mb / enc_s << " MB/s, decode " << mb / dec_s
+	 << " MB/s, round trip " << (codec_match ? "OK" : "FAILED") << std::endl;
+  }
+
+  /* D1 alone for darker and brighter backgrounds */
+  size_t d1_size = N_OF_FRAMES_L1_V0 * N_OF_PIXEL_PER_PDM;
+  std::vector<uint8_t> d1(d1_size);
+  std::vector<uint8_t> d1_decoded(d1_size);
+  std::vector<uint8_t> d1_encoded(std::max(MaxEncodedSize(N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM, sizeof(uint8_t)),
+					   MaxSparseSize(N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM)));
+  for (double d1_mean : {0.01, 0.1, 1.0}) {
+    std::poisson_distribution<int> counts(d1_mean);
+    for (uint8_t & c : d1) {
+      c = counts(gen);
+    }
+    std::cout << "D1 with " << d1_mean << " counts/pixel/GTU:";
+
+    for (uint8_t codec : {CMP_CODEC_FRAME_DELTA, CMP_CODEC_SPARSE}) {
+      size_t cmp_size = 0;
+      int ret = 0;
+
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < CMP_BENCH_ITER; i++) {
+	cmp_size = (codec == CMP_CODEC_SPARSE)
+	  ? EncodeSparse(d1.data(), N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM, d1_encoded.data(), scratch)
+	  : Encode<uint8_t>(d1.data(), N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM, d1_encoded.data());
+      }
+      auto mid = std::chrono::steady_clock::now();
+      for (int i = 0; i < CMP_BENCH_ITER; i++) {
+	ret |= (codec == CMP_CODEC_SPARSE)
+	  ? DecodeSparse(d1_encoded.data(), cmp_size, N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM, d1_decoded.data())
+	  : Decode<uint8_t>(d1_encoded.data(), cmp_size, N_OF_FRAMES_L1_V0, N_OF_PIXEL_PER_PDM, d1_decoded.data());
+      }
+      auto end = std::chrono::steady_clock::now();
+
+      double d1_mb = (double)d1_size * CMP_BENCH_ITER / (1024 * 1024);
+      double enc_s = std::chrono::duration<double>(mid - start).count();
+      double dec_s = std::chrono::duration<double>(end - mid).count();
+      match = match && (ret == 0) && (d1 == d1_decoded);
+
+      std::cout << " COMPRESS " << (int)codec << " ratio " << (double)d1_size / cmp_size
+		<< " (" << d1_mb / enc_s << "/" << d1_mb / dec_s << " MB/s)";
+    }
+    std::cout << std::endl;
+  }
+
+  std::cout << "round trip: " << (match ? "OK" : "FAILED") << std::endl;
+  std::cout.unsetf(std::ios::floatfield);
+
+  return match ? 0 : 1;
+}
+
+/* the pixel data types of the Zynq packets */
+template size_t PktCodec::Encode<uint8_t>(const uint8_t *, size_t, size_t, uint8_t *);
+template size_t PktCodec::Encode<uint16_t>(const uint16_t *, size_t, size_t, uint8_t *);
+template size_t PktCodec::Encode<uint32_t>(const uint32_t *, size_t, size_t, uint8_t *);
+template int PktCodec::Decode<uint8_t>(const uint8_t *, size_t, size_t, size_t, uint8_t *);
+template int PktCodec::Decode<uint16_t>(const uint8_t *, size_t, size_t, size_t, uint16_t *);
+template int PktCodec::Decode<uint32_t>(const uint8_t *, size_t, size_t, size_t, uint32_t *);
@@ -0,0 +1,88 @@
+#ifndef _PKT_CODEC_H
+#define _PKT_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "log.h"
+#include "CpuTools.h"
+#include "MappedZynqFile.h"
+#include "minieuso_data_format.h"
+
+/* number of values bit packed with the same width */
+#define CMP_BLOCK_SIZE 128
+/* number of packets encoded and decoded by PktCodec::Benchmark() */
+#define CMP_BENCH_ITER 10
+
+/**
+ * lossless codec for the Zynq pixel data in the CPU_PACKET.
+ * each frame is predicted from the previous frame of the same packet,
+ * the differences are zigzag encoded then bit packed in blocks of
+ * CMP_BLOCK_SIZE values, each block with the smallest width holding all of its values.
+ * the prediction and zigzag steps use SSE2 when available.
+ * D1 data, mostly 0 or 1 counts, can instead be stored sparsely
+ * as the list or bitmap of nonzero pixels and their counts
+ */
+class PktCodec {
+public:
+  /**
+   * the types of Zynq packet
+   */
+  enum Level : uint8_t {
+    D1 = 1,
+    D2 = 2,
+    D3 = 3,
+  };
+
+  /**
+   * working buffers of the encoder, owned by the caller so that
+   * they are sized once and reused for each packet
+   */
+  struct Scratch {
+    std::vector<uint8_t> bitmap;
+    std::vector<uint16_t> index;
+    std::vector<uint8_t> count;
+
+    void Reserve(size_t n_pixels);
+  };
+
+  static size_t MaxEncodedSize(size_t n_frames, size_t n_pixels, size_t value_size);
+  template <class T>
+  static size_t Encode(const T * in, size_t n_frames, size_t n_pixels, uint8_t * out);
+  template <class T>
+  static int Decode(const uint8_t * in, size_t in_size, size_t n_frames, size_t n_pixels, T * out);
+  static size_t MaxSparseSize(size_t n_frames, size_t n_pixels);
+  static size_t EncodeSparse(const uint8_t * in, size_t n_frames, size_t n_pixels, uint8_t * out, Scratch & scratch);
+  static void EncodedSizes(const uint8_t * in, size_t n_frames, size_t n_pixels, size_t & delta_size, size_t & sparse_size);
+  static int DecodeSparse(const uint8_t * in, size_t in_size, size_t n_frames, size_t n_pixels, uint8_t * out);
+  static size_t MaxSegmentSize(Level level);
+  static size_t EncodeSegment(Level level, const void * zynq_pkt, uint8_t codec, char * out, Scratch & scratch);
+  static uint8_t SegmentCodec(Level level, const char * segment);
+  static size_t EncodeZynqData(const ZynqPktView & zynq_view, uint8_t codec, std::vector<char> & out,
+			       Scratch & scratch);
+  static int DecodeZynqData(const char * in, size_t in_size, uint8_t N1, uint8_t N2, char * out,
+			    size_t * in_used = nullptr);
+  static int Benchmark();
+
+private:
+  template <class T>
+  static size_t EncodeBlock(const T * in, size_t n_frames, size_t n_pixels, uint8_t codec, char * out,
+			    Scratch & scratch);
+  template <class T>
+  static int DecodeBlock(const char * in, size_t in_size, size_t n_frames, size_t n_pixels, T * out,
+			 size_t & in_used);
+};
+
+#endif
+/* _PKT_CODEC_H */
@@ -0,0 +1,220 @@
+#include "ReplyParser.h"
+
+/**
+ * constructor.
+ * starts empty
+ */
+ReplyParser::ReplyParser() {
+
+  Reset();
+}
+
+/**
+ * drop everything received, such as after reconnecting
+ */
+void ReplyParser::Reset() {
+
+  this->_head = 0;
+  this->_tail = 0;
+  this->_n_lines = 0;
+  this->_iac_skip = 0;
+}
+
+/**
+ * add received bytes.
+ * stops when the ring is full, the rest should be added
+ * again after taking lines out with NextLine()
+ * @param data the bytes, as read from the connection
+ * @param len number of bytes
+ * @return number of bytes used
+ */
+size_t ReplyParser::Feed(const char * data, size_t len) {
+
+  size_t i;
+  for (i = 0; i < len; i++) {
+
+    unsigned char c = data[i];
+
+    /* telnet commands, WILL, WONT, DO and DONT take an option byte */
+    if (this->_iac_skip < 0) {
+      this->_iac_skip = (c >= 251 && c <= 254) ? 1 : 0;
+      continue;
+    }
+    if (this->_iac_skip > 0) {
+      this->_iac_skip--;
+      continue;
+    }
+    if (c == TELNET_IAC) {
+      this->_iac_skip = -1;
+      continue;
+    }
+    if (c == '\r' || c == '\0') {
+      continue;
+    }
+
+    if (this->_head - this->_tail == REPLY_RING_SIZE) {
+      break;
+    }
+    this->_ring[this->_head & (REPLY_RING_SIZE - 1)] = c;
+    this->_head++;
+    if (c == '\n') {
+      this->_n_lines++;
+    }
+  }
+
+  return i;
+}
+
+/**
+ * space left in the ring
+ */
+size_t ReplyParser::Free() {
+
+  return REPLY_RING_SIZE - (this->_head - this->_tail);
+}
+
+/**
+ * take out the next complete line.
+ * if the ring fills up without a line ending, its contents
+ * are returned as one line so that reading can go on
+ * @param line set to the line without its line ending, NUL terminated
+ * @param max_len size of line, longer lines are cut
+ * @param line_len set to the length of line
+ * @return true if a line was taken out, false if none is complete yet
+ */
+bool ReplyParser::NextLine(char * line, size_t max_len, size_t * line_len) {
+
+  size_t used = this->_head - this->_tail;
+  if (this->_n_lines == 0 && used < REPLY_RING_SIZE) {
+    return false;
+  }
+
+  size_t n = 0;
+  bool ended = false;
+  while (this->_tail != this->_head) {
+    char c = this->_ring[this->_tail & (REPLY_RING_SIZE - 1)];
+    this->_tail++;
+    if (c == '\n') {
+      ended = true;
+      break;
+    }
+    if (n + 1 < max_len) {
+      line[n++] = c;
+    }
+  }
+  if (ended) {
+    this->_n_lines--;
+  }
+
+  line[n] = '\0';
+  *line_len = n;
+  return true;
+}
+
+/**
+ * read the reply to "instrument status",
+ * the status code followed by the instrument mode
+ * @param line the reply
+ * @param status set to the values read
+ * @return true if both values were found
+ */
+bool ReplyParser::ParseInstStatus(const char * line, InstStatus * status) {
+
+  /* skip anything before the code, such as a prompt */
+  while (*line != '\0' && (*line < '0' || *line > '9')) {
+    line++;
+  }
+
+  char * end;
+  long code = strtol(line, &end, 10);
+  if (end == line) {
+    return false;
+  }
+  const char * next = end;
+  long mode = strtol(next, &end, 10);
+  if (end == next) {
+    return false;
+  }
+
+  status->code = (int)code;
+  status->mode = (int)mode;
+  return true;
+}
+
+/**
+ * read the reply to "acq scurve status"
+ * @param line the reply, made of SCURVE_GATHERING_KEY=N and other key=value fields
+ * @param status set to the values read
+ * @return true if the gathering state was found
+ */
+bool ReplyParser::ParseScurveStatus(const char * line, ScurveStatus * status) {
+
+  long value;
+  if (!ParseField(line, SCURVE_GATHERING_KEY, &value)) {
+    return false;
+  }
+  status->gathering = (value != 0);
+
+  status->threshold = -1;
+  if (ParseField(line, SCURVE_THRESHOLD_KEY, &value)) {
+    status->threshold = (int)value;
+  }
+  return true;
+}
+
+/**
+ * read the reply to "instrument ver", skipping surrounding spaces
+ * @param line the reply
+ * @param ver set to the version string, NUL terminated
+ * @param max_len size of ver, longer versions are cut
+ * @return true if the reply was not empty
+ */
+bool ReplyParser::ParseVersion(const char * line, char * ver, size_t max_len) {
+
+  const char * start = line;
+  while (*start == ' ' || *start == '\t') {
+    start++;
+  }
+  size_t len = strlen(start);
+  while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t')) {
+    len--;
+  }
+  if (len == 0 || max_len == 0) {
+    return false;
+  }
+
+  len = (len < max_len - 1) ? len : max_len - 1;
+  memcpy(ver, start, len);
+  ver[len] = '\0';
+  return true;
+}
+
+/**
+ * find an integer field key=value in a reply
+ * @param line the reply
+ * @param key name of the field
+ * @param value set to the value of the field
+ * @return true if the field was found with a number
+ */
+bool ReplyParser::ParseField(const char * line, const char * key, long * value) {
+
+  size_t key_len = strlen(key);
+  const char * found = line;
+
+  while ((found = strstr(found, key)) != NULL) {
+    /* only whole names, "Threshold" is not "CurrentThreshold" */
+    bool start = (found == line || found[-1] == ' ' || found[-1] == ',' || found[-1] == '\t');
+    const char * eq = found + key_len;
+    if (start && *eq == '=') {
+      char * end;
+      long v = strtol(eq + 1, &end, 10);
+      if (end != eq + 1) {
+	*value = v;
+	return true;
+      }
+    }
+    found += key_len;
+  }
+
+  return false;
+}
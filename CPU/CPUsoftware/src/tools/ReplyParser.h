@@ -0,0 +1,81 @@
+#ifndef _REPLY_PARSER_H
+#define _REPLY_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* bytes held while waiting for a line ending, a power of 2 */
+#define REPLY_RING_SIZE 4096
+/* longest reply line kept, longer lines are cut */
+#define REPLY_MAX_LINE 1024
+/* telnet "interpret as command" byte, starting option negotiation */
+#define TELNET_IAC 0xFF
+
+/* status code reported by "instrument status" when the instrument is ready */
+#define ZYNQ_STATUS_OK 40
+/* fields of the "acq scurve status" reply */
+#define SCURVE_GATHERING_KEY "GatheringInProgress"
+#define SCURVE_THRESHOLD_KEY "CurrentThreshold"
+
+/**
+ * splits the bytes received from the Zynq telnet server into reply lines
+ * and reads typed values out of them.
+ * bytes are added as they arrive, in reads of any size, and a line is
+ * only returned once its line ending has been received, so a reply split
+ * over several reads is put back together and several replies in one read
+ * are separated. telnet option negotiation, carriage returns and NUL bytes
+ * are dropped on the way in, even when split between reads.
+ * works on a fixed ring buffer and never allocates
+ */
+class ReplyParser {
+public:
+  /**
+   * reply to "instrument status"
+   */
+  struct InstStatus {
+    int code;
+    int mode;
+  };
+  /**
+   * reply to "acq scurve status"
+   */
+  struct ScurveStatus {
+    bool gathering;
+    /**
+     * threshold being acquired, -1 if not reported
+     */
+    int threshold;
+  };
+
+  ReplyParser();
+  void Reset();
+  size_t Feed(const char * data, size_t len);
+  size_t Free();
+  bool NextLine(char * line, size_t max_len, size_t * line_len);
+
+  static bool ParseInstStatus(const char * line, InstStatus * status);
+  static bool ParseScurveStatus(const char * line, ScurveStatus * status);
+  static bool ParseVersion(const char * line, char * ver, size_t max_len);
+  static bool ParseField(const char * line, const char * key, long * value);
+
+private:
+  /**
+   * received bytes, from _tail up to _head, wrapping at REPLY_RING_SIZE
+   */
+  char _ring[REPLY_RING_SIZE];
+  size_t _head;
+  size_t _tail;
+  /**
+   * line endings in the ring, so NextLine() does not have to search for nothing
+   */
+  size_t _n_lines;
+  /**
+   * bytes of a telnet command still to be dropped, carried between reads
+   */
+  int _iac_skip;
+};
+
+#endif
+/* _REPLY_PARSER_H */
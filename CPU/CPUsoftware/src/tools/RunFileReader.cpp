@@ -0,0 +1,670 @@
+#include "RunFileReader.h"
+
+/**
+ * constructor.
+ * maps the file read-only and checks its header and trailer
+ * @param path path to the CPU_RUN_MAIN, CPU_RUN_SC or CPU_RUN_HV file
+ * @param unterminated if true, also accept a file with no trailer,
+ * which was never closed, to read the records it has
+ */
+RunFileReader::RunFileReader(std::string path, bool unterminated) {
+
+  this->path = path;
+  this->_addr = nullptr;
+  this->_len = 0;
+  this->_closed = false;
+  this->_data_end = 0;
+  this->_pos = 0;
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    this->error = "cannot open the file";
+    clog << "error: " << logstream::error << "cannot open the file " << path << std::endl;
+    return;
+  }
+
+  struct stat st;
+  size_t min_size = sizeof(CpuFileHeader) + (unterminated ? 0 : sizeof(CpuFileTrailer));
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < min_size) {
+    this->error = "file too small for a header and trailer";
+    clog << "error: " << logstream::error << "file " << path << " is too small to be a run file" << std::endl;
+    close(fd);
+    return;
+  }
+  this->_len = st.st_size;
+
+  void * addr = mmap(nullptr, this->_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  /* the mapping stays valid after the descriptor is closed */
+  close(fd);
+  if (addr == MAP_FAILED) {
+    this->error = "mmap failed";
+    clog << "error: " << logstream::error << "mmap of " << path << " failed" << std::endl;
+    return;
+  }
+  this->_addr = static_cast<const char *>(addr);
+
+  /* files are usually read front to back */
+  madvise(addr, this->_len, MADV_SEQUENTIAL);
+
+  if (!CheckFile(unterminated)) {
+    clog << "error: " << logstream::error << "run file " << path << ": " << this->error << std::endl;
+  }
+  Rewind();
+}
+
+/**
+ * destructor.
+ * unmaps the file, invalidating the records
+ */
+RunFileReader::~RunFileReader() {
+
+  if (this->_addr != nullptr) {
+    munmap(const_cast<char *>(this->_addr), this->_len);
+  }
+}
+
+/**
+ * check the header and trailer, and find the packet index
+ * @param unterminated if true, a file with no trailer is read up to its end
+ * @return true if the file can be read
+ */
+bool RunFileReader::CheckFile(bool unterminated) {
+
+  const CpuFileHeader * cpu_file_header = Header();
+  if (cpu_file_header->spacer != ID_TAG) {
+    this->error = "no ID tag at the start of the file";
+    return false;
+  }
+  char file_type = FileType();
+  if (file_type != CPU_FILE_TYPE && file_type != SC_FILE_TYPE && file_type != HV_FILE_TYPE) {
+    this->error = "unknown file type";
+    return false;
+  }
+
+  const CpuFileTrailer * cpu_file_trailer = Trailer();
+  if (this->_len < sizeof(CpuFileHeader) + sizeof(CpuFileTrailer) || cpu_file_trailer->spacer != ID_TAG
+      || (char)(cpu_file_trailer->header >> 24) != TRAILER_PACKET_TYPE) {
+    if (unterminated) {
+      this->_data_end = this->_len;
+      return true;
+    }
+    this->error = "no trailer at the end of the file, it may not have been closed";
+    return false;
+  }
+  this->_closed = true;
+  this->_data_end = this->_len - sizeof(CpuFileTrailer);
+
+  /* the index is just before the trailer, from CPU_FILE_VER 2 */
+  if (file_type == CPU_FILE_TYPE && FileVersion() >= 2
+      && this->_data_end >= sizeof(CpuFileHeader) + sizeof(CpuFileIndex)) {
+    const CpuFileIndex * cpu_file_index = (const CpuFileIndex *)(this->_addr + this->_data_end - sizeof(CpuFileIndex));
+    if (cpu_file_index->spacer == ID_TAG && (char)(cpu_file_index->header >> 24) == INDEX_PACKET_TYPE
+	&& cpu_file_index->index_size == cpu_file_index->n_entries * sizeof(CpuPktIndexEntry) + sizeof(CpuFileIndex)
+	&& cpu_file_index->index_size <= this->_data_end - sizeof(CpuFileHeader)) {
+      this->_data_end -= cpu_file_index->index_size;
+      this->_index = PktView<CpuPktIndexEntry>((const CpuPktIndexEntry *)(this->_addr + this->_data_end),
+					       cpu_file_index->n_entries);
+    }
+    else {
+      this->error = "packet index not found";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * check the file was mapped and has a valid header and trailer
+ */
+bool RunFileReader::IsValid() {
+
+  return this->_addr != nullptr && this->error.empty();
+}
+
+/**
+ * check the file ends with a trailer
+ */
+bool RunFileReader::IsClosed() {
+
+  return this->_closed;
+}
+
+/**
+ * the file type, CPU_FILE_TYPE, SC_FILE_TYPE or HV_FILE_TYPE
+ */
+char RunFileReader::FileType() {
+
+  return (char)((Header()->header >> 8) & 0xff);
+}
+
+/**
+ * the file version from the header
+ */
+uint8_t RunFileReader::FileVersion() {
+
+  return Header()->header & 0xff;
+}
+
+/**
+ * the file header
+ */
+const CpuFileHeader * RunFileReader::Header() {
+
+  return (const CpuFileHeader *)this->_addr;
+}
+
+/**
+ * the file trailer
+ */
+const CpuFileTrailer * RunFileReader::Trailer() {
+
+  return (const CpuFileTrailer *)(this->_addr + this->_len - sizeof(CpuFileTrailer));
+}
+
+/**
+ * compare the CRC of the file with the one in the trailer
+ * reads the whole file
+ */
+bool RunFileReader::VerifyChecksum() {
+
+  if (!IsValid() || !this->_closed) {
+    return false;
+  }
+  boost::crc_32_type crc;
+  crc.process_bytes(this->_addr, this->_len - sizeof(CpuFileTrailer));
+  return crc.checksum() == Trailer()->crc;
+}
+
+/**
+ * the packet index, with the offset of each packet in the file
+ * empty for SC and HV files and before CPU_FILE_VER 2
+ */
+PktView<CpuPktIndexEntry> RunFileReader::Index() {
+
+  return this->_index;
+}
+
+/**
+ * go back to the first record for Next()
+ */
+void RunFileReader::Rewind() {
+
+  this->_pos = sizeof(CpuFileHeader);
+}
+
+/**
+ * get the next record
+ * @param record set to the record
+ * @return false at the end of the records, or if the next one cannot be read
+ */
+bool RunFileReader::Next(RunRecord & record) {
+
+  if (!RecordAt(this->_pos, record)) {
+    return false;
+  }
+  this->_pos += record.size;
+  return true;
+}
+
+/**
+ * get the record at a given position, such as from the index
+ * @param offset position from the start of the file, in bytes
+ * @param record set to the record
+ * @return false if there is no valid record at this position
+ */
+bool RunFileReader::RecordAt(uint64_t offset, RunRecord & record) {
+
+  if (!IsValid() || offset < sizeof(CpuFileHeader) || offset + sizeof(CpuPktHeader) > this->_data_end) {
+    return false;
+  }
+
+  const CpuPktHeader * header = (const CpuPktHeader *)(this->_addr + offset);
+  if (header->spacer != ID_TAG) {
+    clog << "error: " << logstream::error << "run file " << this->path << ": no ID tag at offset " << offset << std::endl;
+    return false;
+  }
+
+  record.type = (char)((header->header >> 8) & 0xff);
+  record.ver = header->header & 0xff;
+  record.offset = offset;
+  record.header = header;
+  record.size = RecordSize(offset, record.type, record.ver);
+  if (record.size == 0 || offset + record.size > this->_data_end) {
+    clog << "error: " << logstream::error << "run file " << this->path << ": bad record of type "
+	 << record.type << " at offset " << offset << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * size of a record, found from its header and contents
+ * @param offset position of the record
+ * @param type the record type
+ * @param ver the record version
+ * @return the size in bytes, 0 if unknown
+ */
+size_t RunFileReader::RecordSize(size_t offset, char type, uint8_t ver) {
+
+  const char * ptr = this->_addr + offset;
+  size_t available = this->_data_end - offset;
+  size_t size = 0;
+
+  switch (type) {
+  case CPU_PACKET_TYPE: {
+    /* N1 and N2 follow the HK packet */
+    size_t zynq_offset = sizeof(CpuPktHeader) + sizeof(CpuTimeStamp) + sizeof(HK_PACKET);
+    if (ver == CPU_PACKET_VER_CMP) {
+      size = ((const CpuPktHeader *)ptr)->pkt_size;
+      if (size < zynq_offset + 2) {
+	size = 0;
+      }
+    }
+    else if (available >= zynq_offset + 2) {
+      size = zynq_offset + 2 + MappedZynqFile::ExpectedSize(ptr[zynq_offset], ptr[zynq_offset + 1]);
+    }
+    break;
+  }
+  case THERM_PACKET_TYPE:
+    size = sizeof(THERM_PACKET);
+    break;
+  case SC_PACKET_TYPE:
+    size = sizeof(SC_PACKET);
+    break;
+  case CHECKPOINT_PACKET_TYPE:
+    size = sizeof(CpuCheckpoint);
+    break;
+  case HV_PACKET_TYPE: {
+    size_t log_offset = sizeof(CpuPktHeader) + sizeof(CpuTimeStamp) + sizeof(uint32_t) + sizeof(ZynqBoardHeader);
+    if (available >= log_offset) {
+      uint32_t N;
+      memcpy(&N, ptr + sizeof(CpuPktHeader) + sizeof(CpuTimeStamp), sizeof(N));
+      size = log_offset + (size_t)N * sizeof(DATA_TYPE_HVPS_LOG_V1);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  return size;
+}
+
+/**
+ * typed view of a CPU_PACKET record
+ * @param record the record, of type CPU_PACKET_TYPE
+ * @param cpu_packet set to the view
+ * @return false if the record is not a CPU_PACKET
+ */
+bool RunFileReader::ReadCpuPkt(const RunRecord & record, CpuPktRecord & cpu_packet) {
+
+  if (record.type != CPU_PACKET_TYPE) {
+    return false;
+  }
+
+  const char * ptr = (const char *)record.header;
+  const char * end = ptr + record.size;
+  cpu_packet.cpu_packet_header = record.header;
+  ptr += sizeof(CpuPktHeader);
+  cpu_packet.cpu_time = (const CpuTimeStamp *)ptr;
+  ptr += sizeof(CpuTimeStamp);
+  cpu_packet.hk_packet = (const HK_PACKET *)ptr;
+  ptr += sizeof(HK_PACKET);
+  cpu_packet.N1 = ptr[0];
+  cpu_packet.N2 = ptr[1];
+  ptr += 2;
+
+  cpu_packet.compressed = (record.ver == CPU_PACKET_VER_CMP);
+  if (cpu_packet.compressed) {
+    cpu_packet.cmp_data = ptr;
+    cpu_packet.cmp_size = end - ptr;
+    cpu_packet.zynq_view = ZynqPktView();
+    cpu_packet.zynq_view.N1 = cpu_packet.N1;
+    cpu_packet.zynq_view.N2 = cpu_packet.N2;
+    cpu_packet.zynq_view.level3_data = nullptr;
+  }
+  else {
+    cpu_packet.cmp_data = nullptr;
+    cpu_packet.cmp_size = 0;
+    MappedZynqFile::MakeView(ptr, end - ptr, cpu_packet.N1, cpu_packet.N2, cpu_packet.zynq_view);
+  }
+  return true;
+}
+
+/**
+ * typed view of a THERM_PACKET record
+ * @return nullptr if the record is not a THERM_PACKET
+ */
+const THERM_PACKET * RunFileReader::ReadThermPkt(const RunRecord & record) {
+
+  return (record.type == THERM_PACKET_TYPE) ? (const THERM_PACKET *)record.header : nullptr;
+}
+
+/**
+ * typed view of a SC_PACKET record
+ * @return nullptr if the record is not a SC_PACKET
+ */
+const SC_PACKET * RunFileReader::ReadScPkt(const RunRecord & record) {
+
+  return (record.type == SC_PACKET_TYPE) ? (const SC_PACKET *)record.header : nullptr;
+}
+
+/**
+ * typed view of a HV_PACKET record
+ * @param record the record, of type HV_PACKET_TYPE
+ * @param hv_packet set to the view
+ * @return false if the record is not a HV_PACKET
+ */
+bool RunFileReader::ReadHvPkt(const RunRecord & record, HvPktRecord & hv_packet) {
+
+  if (record.type != HV_PACKET_TYPE) {
+    return false;
+  }
+
+  const char * ptr = (const char *)record.header;
+  hv_packet.hv_packet_header = record.header;
+  ptr += sizeof(CpuPktHeader);
+  hv_packet.hv_time = (const CpuTimeStamp *)ptr;
+  ptr += sizeof(CpuTimeStamp);
+  memcpy(&hv_packet.N, ptr, sizeof(hv_packet.N));
+  ptr += sizeof(uint32_t);
+  hv_packet.zbh = (const ZynqBoardHeader *)ptr;
+  ptr += sizeof(ZynqBoardHeader);
+  hv_packet.hvps_log = PktView<DATA_TYPE_HVPS_LOG_V1>((const DATA_TYPE_HVPS_LOG_V1 *)ptr, hv_packet.N);
+  return true;
+}
+
+/**
+ * typed view of a checkpoint record
+ * @return nullptr if the record is not a checkpoint
+ */
+const CpuCheckpoint * RunFileReader::ReadCheckpoint(const RunRecord & record) {
+
+  return (record.type == CHECKPOINT_PACKET_TYPE) ? (const CpuCheckpoint *)record.header : nullptr;
+}
+
+/**
+ * get the D1, D2 and D3 data of a CPU_PACKET, decoding it if compressed
+ * @param cpu_packet the packet
+ * @param buf holds the decoded data, resized if needed and reused between calls
+ * @param zynq_view set to the view of the data, in the file or in buf
+ * @return 0 on success, 1 if the data is corrupted
+ */
+int RunFileReader::DecodeZynqData(const CpuPktRecord & cpu_packet, std::vector<char> & buf, ZynqPktView & zynq_view) {
+
+  if (!cpu_packet.compressed) {
+    zynq_view = cpu_packet.zynq_view;
+    return 0;
+  }
+
+  size_t raw_size = MappedZynqFile::ExpectedSize(cpu_packet.N1, cpu_packet.N2);
+  if (buf.size() < raw_size) {
+    buf.resize(raw_size);
+  }
+  if (PktCodec::DecodeZynqData(cpu_packet.cmp_data, cpu_packet.cmp_size, cpu_packet.N1, cpu_packet.N2, buf.data()) != 0) {
+    return 1;
+  }
+  return MappedZynqFile::MakeView(buf.data(), raw_size, cpu_packet.N1, cpu_packet.N2, zynq_view) ? 0 : 1;
+}
+
+/**
+ * read a run file, printing a summary of its records and the read speed.
+ * every record is read, the Zynq data is decoded and summed
+ * @param path the run file
+ * @return 0 if the whole file was read, 1 otherwise
+ */
+int RunFileReader::Benchmark(std::string path) {
+
+  auto start = std::chrono::steady_clock::now();
+  RunFileReader reader(path);
+  if (!reader.IsValid()) {
+    std::cout << "ERROR: cannot read " << path << ": " << reader.error << std::endl;
+    return 1;
+  }
+  bool crc_ok = reader.VerifyChecksum();
+  auto mid = std::chrono::steady_clock::now();
+
+  /* go through every record, touching all the Zynq data */
+  RunRecord record;
+  CpuPktRecord cpu_packet;
+  HvPktRecord hv_packet;
+  ZynqPktView zynq_view;
+  std::vector<char> buf;
+  unsigned int n_cpu = 0, n_cmp = 0, n_therm = 0, n_sc = 0, n_hv = 0, n_checkpoint = 0, n_bad = 0;
+  uint64_t sum = 0;
+  size_t zynq_bytes = 0;
+  size_t pos = sizeof(CpuFileHeader);
+
+  while (reader.Next(record)) {
+    pos = record.offset + record.size;
+    switch (record.type) {
+    case CPU_PACKET_TYPE:
+      reader.ReadCpuPkt(record, cpu_packet);
+      n_cpu++;
+      n_cmp += cpu_packet.compressed;
+      if (DecodeZynqData(cpu_packet, buf, zynq_view) != 0) {
+	n_bad++;
+	break;
+      }
+      zynq_bytes += MappedZynqFile::ExpectedSize(cpu_packet.N1, cpu_packet.N2);
+      for (const Z_DATA_TYPE_SCI_L1_V2 & level1 : zynq_view.level1_data) {
+	const uint8_t * d1 = &level1.payload.raw_data[0][0];
+	for (size_t i = 0; i < N_OF_FRAMES_L1_V0 * N_OF_PIXEL_PER_PDM; i++) {
+	  sum += d1[i];
+	}
+      }
+      for (const Z_DATA_TYPE_SCI_L2_V2 & level2 : zynq_view.level2_data) {
+	const uint16_t * d2 = &level2.payload.int16_data[0][0];
+	for (size_t i = 0; i < N_OF_FRAMES_L2_V0 * N_OF_PIXEL_PER_PDM; i++) {
+	  sum += d2[i];
+	}
+      }
+      {
+	const uint32_t * d3 = &zynq_view.level3_data->payload.int32_data[0][0];
+	for (size_t i = 0; i < N_OF_FRAMES_L3_V0 * N_OF_PIXEL_PER_PDM; i++) {
+	  sum += d3[i];
+	}
+      }
+      break;
+    case THERM_PACKET_TYPE:
+      n_therm += (reader.ReadThermPkt(record) != nullptr);
+      break;
+    case SC_PACKET_TYPE:
+      n_sc += (reader.ReadScPkt(record) != nullptr);
+      break;
+    case HV_PACKET_TYPE:
+      n_hv += reader.ReadHvPkt(record, hv_packet);
+      break;
+    case CHECKPOINT_PACKET_TYPE:
+      n_checkpoint += (reader.ReadCheckpoint(record) != nullptr);
+      break;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  /* check the index against the records */
+  unsigned int n_index_bad = 0;
+  for (const CpuPktIndexEntry & entry : reader.Index()) {
+    if (!reader.RecordAt(entry.offset, record) || record.type != (char)entry.pkt_type
+	|| record.header->pkt_num != entry.pkt_num) {
+      n_index_bad++;
+    }
+  }
+
+  double mb = reader._len / (1024 * 1024.0);
+  double crc_s = std::chrono::duration<double>(mid - start).count();
+  double read_s = std::chrono::duration<double>(end - mid).count();
+  bool complete = (pos == reader._data_end) && (n_bad == 0);
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << path << ": type " << reader.FileType() << ", version " << (int)reader.FileVersion()
+	    << ", " << mb << " MB" << std::endl;
+  std::cout << "records: " << n_cpu << " CPU (" << n_cmp << " compressed), " << n_therm << " THERM, "
+	    << n_sc << " SC, " << n_hv << " HV, " << n_checkpoint << " checkpoints"
+	    << (complete ? "" : ", stopped before the end") << std::endl;
+  std::cout << "index: " << reader.Index().size() << " entries, " << n_index_bad << " not matching" << std::endl;
+  std::cout << "CRC: " << (crc_ok ? "OK" : "FAILED") << ", " << mb / crc_s << " MB/s" << std::endl;
+  std::cout << "records read: " << mb / read_s << " MB/s of file, " << zynq_bytes / (1024 * 1024.0) / read_s
+	    << " MB/s of Zynq data (sum " << sum << ")" << std::endl;
+  std::cout.unsetf(std::ios::floatfield);
+
+  return (complete && crc_ok && n_index_bad == 0) ? 0 : 1;
+}
+
+/**
+ * close a run file which was never closed, such as after a power cut.
+ * the records are checked in one pass against the checkpoints written every
+ * CHECKPOINT_PKTS CPU packets, and the file is cut after the last complete
+ * record, then the packet index and trailer are written so that it reads as
+ * a normal closed run. the records after the last checkpoint are kept but
+ * are not verified. if a checkpoint does not match the data, the file is cut
+ * after the last checkpoint which does
+ * @param path the run file, modified in place
+ * @return 0 if the file was recovered or did not need to be, 1 otherwise
+ */
+int RunFileReader::Recover(std::string path) {
+
+  auto start = std::chrono::steady_clock::now();
+
+  /* state of the file at the end of the data kept */
+  struct RecoverPoint {
+    size_t end;
+    boost::crc_32_type crc;
+    size_t n_index;
+    unsigned int n_packets;
+  };
+
+  std::vector<CpuPktIndexEntry> index;
+  RecoverPoint checkpoint, last_record;
+  unsigned int n_checkpoints = 0;
+  bool mismatch = false;
+  char file_type;
+  uint8_t file_ver;
+  size_t len;
+  {
+    RunFileReader reader(path, true);
+    if (!reader.IsValid()) {
+      std::cout << "ERROR: cannot read " << path << ": " << reader.error << std::endl;
+      return 1;
+    }
+    if (reader.IsClosed()) {
+      std::cout << path << " has a trailer, nothing to recover" << std::endl;
+      return 0;
+    }
+    file_type = reader.FileType();
+    file_ver = reader.FileVersion();
+    len = reader._len;
+    bool indexed = (file_type == CPU_FILE_TYPE && file_ver >= 2);
+
+    /* go through the records, keeping a running CRC to compare with the checkpoints */
+    boost::crc_32_type crc;
+    crc.process_bytes(reader._addr, sizeof(CpuFileHeader));
+    unsigned int n_packets = 0;
+    last_record = {sizeof(CpuFileHeader), crc, 0, 0};
+    checkpoint = last_record;
+
+    RunRecord record;
+    CpuPktRecord cpu_packet;
+    std::vector<char> buf;
+    ZynqPktView zynq_view;
+    while (reader.Next(record)) {
+
+      const CpuCheckpoint * cpu_checkpoint = reader.ReadCheckpoint(record);
+      if (cpu_checkpoint) {
+	if (cpu_checkpoint->offset != record.offset || cpu_checkpoint->crc != crc.checksum()
+	    || cpu_checkpoint->n_packets != n_packets) {
+	  clog << "warning: " << logstream::warning << "run file " << path << ": checkpoint "
+	       << record.header->pkt_num << " at offset " << record.offset << " does not match the data" << std::endl;
+	  mismatch = true;
+	  break;
+	}
+	crc.process_bytes(record.header, record.size);
+	checkpoint = {record.offset + record.size, crc, index.size(), n_packets};
+	last_record = checkpoint;
+	n_checkpoints++;
+	continue;
+      }
+
+      if (indexed && (record.type == CPU_PACKET_TYPE || record.type == THERM_PACKET_TYPE)) {
+	CpuPktIndexEntry index_entry = CpuPktIndexEntry();
+	index_entry.offset = record.offset;
+	index_entry.pkt_type = record.type;
+	index_entry.pkt_num = record.header->pkt_num;
+	if (reader.ReadCpuPkt(record, cpu_packet)) {
+	  index_entry.unix_time = cpu_packet.cpu_time->cpu_time_stamp;
+	  /* as written by DataAcquisition::WriteCpuPkt(), from the D3 timestamp */
+	  if (DecodeZynqData(cpu_packet, buf, zynq_view) == 0 && zynq_view.level3_data) {
+	    index_entry.n_gtu = zynq_view.level3_data->payload.ts.n_gtu;
+	  }
+	}
+	else {
+	  index_entry.unix_time = reader.ReadThermPkt(record)->therm_time.cpu_time_stamp;
+	}
+	index.push_back(index_entry);
+      }
+      if (file_type == CPU_FILE_TYPE ? record.type == CPU_PACKET_TYPE : record.type != CHECKPOINT_PACKET_TYPE) {
+	n_packets++;
+      }
+      crc.process_bytes(record.header, record.size);
+      last_record = {record.offset + record.size, crc, index.size(), n_packets};
+    }
+  }
+
+  /* keep all the complete records, unless a checkpoint showed the data to be corrupted */
+  RecoverPoint & cut = mismatch ? checkpoint : last_record;
+  if (n_checkpoints == 0) {
+    clog << "warning: " << logstream::warning << "run file " << path
+	 << " has no checkpoints, keeping all complete records without checking them" << std::endl;
+  }
+  else if (cut.end > checkpoint.end) {
+    clog << "warning: " << logstream::warning << "run file " << path << ": keeping "
+	 << cut.n_packets - checkpoint.n_packets << " packets after the last checkpoint, "
+	 << "which are not covered by a checkpoint CRC" << std::endl;
+  }
+  index.resize(cut.n_index);
+
+  /* the index, its footer and the trailer go where the data is cut */
+  std::vector<struct iovec> segments;
+  CpuFileIndex cpu_file_index;
+  if (file_type == CPU_FILE_TYPE && file_ver >= 2) {
+    cpu_file_index.header = CpuTools::BuildCpuHeader(INDEX_PACKET_TYPE, INDEX_PACKET_VER);
+    cpu_file_index.n_entries = index.size();
+    cpu_file_index.index_size = index.size() * sizeof(CpuPktIndexEntry) + sizeof(cpu_file_index);
+    segments.push_back({index.data(), index.size() * sizeof(CpuPktIndexEntry)});
+    segments.push_back({&cpu_file_index, sizeof(cpu_file_index)});
+  }
+  for (const struct iovec & segment : segments) {
+    cut.crc.process_bytes(segment.iov_base, segment.iov_len);
+  }
+  CpuFileTrailer cpu_file_trailer;
+  cpu_file_trailer.header = CpuTools::BuildCpuHeader(TRAILER_PACKET_TYPE, file_ver);
+  cpu_file_trailer.run_size = cut.n_packets;
+  cpu_file_trailer.crc = cut.crc.checksum();
+  segments.push_back({&cpu_file_trailer, sizeof(cpu_file_trailer)});
+
+  int fd = open(path.c_str(), O_WRONLY);
+  if (fd < 0) {
+    std::cout << "ERROR: cannot open " << path << " to write" << std::endl;
+    return 1;
+  }
+  ssize_t closing_size = 0;
+  for (const struct iovec & segment : segments) {
+    closing_size += segment.iov_len;
+  }
+  bool ok = pwritev(fd, segments.data(), segments.size(), cut.end) == closing_size
+    && ftruncate(fd, cut.end + closing_size) == 0 && fdatasync(fd) == 0;
+  close(fd);
+  if (!ok) {
+    std::cout << "ERROR: cannot write the trailer of " << path << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << path << ": kept " << cut.end << " of " << len << " bytes, " << cut.n_packets << " packets, "
+	    << n_checkpoints << " checkpoints" << (cut.end > checkpoint.end ? " (tail not verified)" : "") << ", "
+	    << len / (1024 * 1024.0) / std::max(seconds, 1e-3) << " MB/s" << std::endl;
+  std::cout.unsetf(std::ios::floatfield);
+
+  return 0;
+}
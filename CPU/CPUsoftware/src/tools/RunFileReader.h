@@ -0,0 +1,139 @@
+#ifndef _RUN_FILE_READER_H
+#define _RUN_FILE_READER_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <boost/crc.hpp>
+
+#include "log.h"
+#include "CpuTools.h"
+#include "MappedZynqFile.h"
+#include "PktCodec.h"
+#include "minieuso_data_format.h"
+
+/**
+ * one record of a run file, pointing into the mapped file
+ */
+struct RunRecord {
+  /* CPU_PACKET_TYPE, THERM_PACKET_TYPE, SC_PACKET_TYPE, HV_PACKET_TYPE or CHECKPOINT_PACKET_TYPE */
+  char type;
+  /* version from the packet header */
+  uint8_t ver;
+  /* position from the start of the file, in bytes */
+  uint64_t offset;
+  /* size of the record, in bytes */
+  size_t size;
+  const CpuPktHeader * header;
+};
+
+/**
+ * typed view of a CPU_PACKET record.
+ * zynq_view is only set if the Zynq data is not compressed,
+ * otherwise use RunFileReader::DecodeZynqData()
+ */
+struct CpuPktRecord {
+  const CpuPktHeader * cpu_packet_header;
+  const CpuTimeStamp * cpu_time;
+  const HK_PACKET * hk_packet;
+  uint8_t N1;
+  uint8_t N2;
+  bool compressed;
+  ZynqPktView zynq_view;
+  /* the compressed Zynq data, following N1 and N2 */
+  const char * cmp_data;
+  size_t cmp_size;
+};
+
+/**
+ * typed view of a HV_PACKET record
+ */
+struct HvPktRecord {
+  const CpuPktHeader * hv_packet_header;
+  const CpuTimeStamp * hv_time;
+  uint32_t N;
+  const ZynqBoardHeader * zbh;
+  PktView<DATA_TYPE_HVPS_LOG_V1> hvps_log;
+};
+
+/**
+ * read-only access to CPU, SC and HV run files written by DataAcquisition.
+ * the file is mapped into memory and the records are returned as views into it,
+ * so they are only valid while the reader exists.
+ * the header and trailer are checked on opening, the records are found
+ * from their headers, or from the packet index for random access
+ */
+class RunFileReader {
+public:
+  /**
+   * path to the mapped file
+   */
+  std::string path;
+  /**
+   * why the file could not be read, empty if valid
+   */
+  std::string error;
+
+  RunFileReader(std::string path, bool unterminated = false);
+  ~RunFileReader();
+  bool IsValid();
+  bool IsClosed();
+  char FileType();
+  uint8_t FileVersion();
+  const CpuFileHeader * Header();
+  const CpuFileTrailer * Trailer();
+  bool VerifyChecksum();
+  PktView<CpuPktIndexEntry> Index();
+  void Rewind();
+  bool Next(RunRecord & record);
+  bool RecordAt(uint64_t offset, RunRecord & record);
+  bool ReadCpuPkt(const RunRecord & record, CpuPktRecord & cpu_packet);
+  const THERM_PACKET * ReadThermPkt(const RunRecord & record);
+  const SC_PACKET * ReadScPkt(const RunRecord & record);
+  bool ReadHvPkt(const RunRecord & record, HvPktRecord & hv_packet);
+  const CpuCheckpoint * ReadCheckpoint(const RunRecord & record);
+  static int DecodeZynqData(const CpuPktRecord & cpu_packet, std::vector<char> & buf, ZynqPktView & zynq_view);
+  static int Benchmark(std::string path);
+  static int Recover(std::string path);
+
+private:
+  /**
+   * start of the mapping, nullptr if mapping failed
+   */
+  const char * _addr;
+  /**
+   * length of the mapping in bytes
+   */
+  size_t _len;
+  /**
+   * true if the file ends with a trailer,
+   * false for a file opened unterminated which was never closed
+   */
+  bool _closed;
+  /**
+   * end of the records, where the index or trailer starts
+   */
+  size_t _data_end;
+  /**
+   * the packet index, empty before CPU_FILE_VER 2
+   */
+  PktView<CpuPktIndexEntry> _index;
+  /**
+   * position of the next record for Next()
+   */
+  size_t _pos;
+
+  bool CheckFile(bool unterminated);
+  size_t RecordSize(size_t offset, char type, uint8_t ver);
+};
+
+#endif
+/* _RUN_FILE_READER_H */
@@ -0,0 +1,130 @@
+#include "RunRotation.h"
+
+/**
+ * constructor.
+ * runs of RUN_SIZE packets until configured
+ */
+RunRotation::RunRotation() {
+
+  this->_max_packets = RUN_SIZE;
+  this->_max_bytes = 0;
+  this->_max_sec = 0;
+  this->_single_run = false;
+  this->_n_packets = 0;
+  this->_start = std::chrono::steady_clock::now();
+}
+
+/**
+ * set the limits of a run from the configuration
+ * @param ConfigOut the configuration, giving RUN_ROTATE_PKTS, RUN_ROTATE_MB and RUN_ROTATE_SEC
+ * @param single_run if true, the acquisition is a single run, only split at MAX_RUN_FILE_SIZE
+ */
+void RunRotation::Configure(std::shared_ptr<Config> ConfigOut, bool single_run) {
+
+  this->_max_packets = std::max(ConfigOut->run_rotate_pkts, 0);
+  this->_max_bytes = (off_t)std::max(ConfigOut->run_rotate_mb, 0) * 1024 * 1024;
+  this->_max_sec = std::max(ConfigOut->run_rotate_sec, 0);
+  this->_single_run = single_run;
+
+  if (this->_max_packets == 0 && this->_max_bytes == 0 && this->_max_sec == 0 && !single_run) {
+    clog << "warning: " << logstream::warning << "no limit set on the CPU runs, "
+	 << "new runs are only started at the FAT32 file size limit" << std::endl;
+  }
+  else {
+    clog << "info: " << logstream::info << "new CPU run every " << this->_max_packets << " packets, "
+	 << this->_max_bytes << " bytes or " << this->_max_sec << " s (0 for no limit)" << std::endl;
+  }
+}
+
+/**
+ * start counting a new run
+ */
+void RunRotation::Started() {
+
+  this->_n_packets = 0;
+  this->_start = std::chrono::steady_clock::now();
+}
+
+/**
+ * count a CPU packet written to the run
+ */
+void RunRotation::Written() {
+
+  this->_n_packets++;
+}
+
+/**
+ * check if the run should be closed before writing the next packet.
+ * an empty run is never closed
+ * @param run_size size of the run file so far
+ * @param next_pkt_size size of the next packet
+ * @return the reason to close the run, or NONE
+ */
+RunRotation::Reason RunRotation::Due(off_t run_size, size_t next_pkt_size) {
+
+  if (this->_n_packets == 0) {
+    return NONE;
+  }
+  if (run_size + (off_t)next_pkt_size + RUN_FILE_RESERVE > MAX_RUN_FILE_SIZE) {
+    return FILE_LIMIT;
+  }
+  if (this->_single_run) {
+    return NONE;
+  }
+  if (this->_max_packets > 0 && this->_n_packets >= this->_max_packets) {
+    return PACKETS;
+  }
+  if (this->_max_bytes > 0 && run_size + (off_t)next_pkt_size > this->_max_bytes) {
+    return BYTES;
+  }
+  if (this->_max_sec > 0 && std::chrono::steady_clock::now() - this->_start >= std::chrono::seconds(this->_max_sec)) {
+    return TIME;
+  }
+
+  return NONE;
+}
+
+/**
+ * number of CPU packets written to the current run
+ */
+unsigned int RunRotation::Packets() {
+
+  return this->_n_packets;
+}
+
+/**
+ * number of packets expected in a run, from the packet and size limits.
+ * used to size the run file before it is written
+ * @param pkt_size size of an uncompressed CPU packet
+ * @return the number of packets, 0 if the run is only limited in time
+ */
+unsigned int RunRotation::ExpectedPackets(size_t pkt_size) {
+
+  unsigned int n_packets = this->_max_packets;
+  if (this->_max_bytes > 0 && pkt_size > 0) {
+    unsigned int n_fit = std::max(this->_max_bytes / (off_t)pkt_size, (off_t)1);
+    n_packets = (n_packets == 0) ? n_fit : std::min(n_packets, n_fit);
+  }
+
+  return n_packets;
+}
+
+/**
+ * name of a reason to close a run, for the log
+ */
+const char * RunRotation::ReasonName(Reason reason) {
+
+  switch (reason) {
+  case PACKETS:
+    return "packet limit";
+  case BYTES:
+    return "size limit";
+  case TIME:
+    return "time limit";
+  case FILE_LIMIT:
+    return "FAT32 file size limit";
+  default:
+    break;
+  }
+  return "none";
+}
@@ -0,0 +1,68 @@
+#ifndef _RUN_ROTATION_H
+#define _RUN_ROTATION_H
+
+#include <sys/types.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "log.h"
+#include "ConfigManager.h"
+
+/* largest run file, the file size limit of FAT32 */
+#define MAX_RUN_FILE_SIZE 0xFFFFFFFFLL
+/* kept free at the end of a run file for THERM packets, the index and the trailer */
+#define RUN_FILE_RESERVE (1024 * 1024)
+
+/**
+ * decides when to close a CPU run file and start the next one,
+ * after a number of packets, a file size or a time from the configuration
+ * (RUN_ROTATE_PKTS, RUN_ROTATE_MB and RUN_ROTATE_SEC), whichever comes first.
+ * a new run is always started before the file would pass MAX_RUN_FILE_SIZE
+ */
+class RunRotation {
+public:
+  /**
+   * why a run is to be closed
+   */
+  enum Reason : uint8_t {
+    NONE = 0,
+    PACKETS = 1,
+    BYTES = 2,
+    TIME = 3,
+    FILE_LIMIT = 4,
+  };
+
+  RunRotation();
+  void Configure(std::shared_ptr<Config> ConfigOut, bool single_run);
+  void Started();
+  void Written();
+  Reason Due(off_t run_size, size_t next_pkt_size);
+  unsigned int Packets();
+  unsigned int ExpectedPackets(size_t pkt_size);
+  static const char * ReasonName(Reason reason);
+
+private:
+  /**
+   * limits of a run, 0 for no limit
+   */
+  unsigned int _max_packets;
+  off_t _max_bytes;
+  int _max_sec;
+  /**
+   * single runs are only split at MAX_RUN_FILE_SIZE
+   */
+  bool _single_run;
+  /**
+   * packets written to the current run
+   */
+  unsigned int _n_packets;
+  /**
+   * when the current run started
+   */
+  std::chrono::steady_clock::time_point _start;
+};
+
+#endif
+/* _RUN_ROTATION_H */
@@ -0,0 +1,99 @@
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+
+/* size of a cache line, to keep the producer and consumer indices apart */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * lock-free ring buffer for one producer thread and one consumer thread.
+ * items are moved in and out of preallocated slots
+ */
+template <class T>
+class SpscRing {
+public:
+  /**
+   * constructor
+   * @param capacity number of slots, rounded up to a power of 2
+   */
+  explicit SpscRing(size_t capacity) : _head(0), _tail(0) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    _slots.resize(size);
+    _mask = size - 1;
+  }
+  SpscRing(const SpscRing &) = delete;
+  SpscRing & operator=(const SpscRing &) = delete;
+
+  /**
+   * add an item, called by the producer only
+   * @param item moved into the ring on success
+   * @return false if the ring is full
+   */
+  bool TryPush(T && item) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == _slots.size()) {
+      return false;
+    }
+    _slots[tail & _mask] = std::move(item);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * remove the oldest item, called by the consumer only
+   * @param item the item is moved here on success
+   * @return false if the ring is empty
+   */
+  bool TryPop(T & item) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = std::move(_slots[head & _mask]);
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * number of items in the ring, approximate if called while in use
+   */
+  size_t Size() const {
+    return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+  }
+
+  /**
+   * number of slots
+   */
+  size_t Capacity() const {
+    return _slots.size();
+  }
+
+private:
+  /**
+   * the slots holding the items
+   */
+  std::vector<T> _slots;
+  /**
+   * to wrap the indices
+   */
+  size_t _mask;
+  /**
+   * next slot to read, written by the consumer
+   */
+  std::atomic<size_t> _head;
+  char _pad_head[CACHE_LINE_SIZE];
+  /**
+   * next slot to write, written by the producer
+   */
+  std::atomic<size_t> _tail;
+  char _pad_tail[CACHE_LINE_SIZE];
+};
+
+#endif
+/* _SPSC_RING_H */
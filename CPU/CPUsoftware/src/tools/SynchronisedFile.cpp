@@ -1,43 +1,222 @@
 #include "SynchronisedFile.h"
+#include "CpuTools.h"
 
 /**
  * constructor.
  * @param path path to the SynchronisedFile to be created 
+ * @param backend_type how the file is written, falls back to STDIO if unavailable
+ * @param direct if true, bypass the page cache (URING backend only)
  */
-SynchronisedFile::SynchronisedFile(std::string path) {
+SynchronisedFile::SynchronisedFile(std::string path, FileBackend::BackendType backend_type, bool direct) {
 
   this->path = path;
-  const char * file_name = path.c_str();
+  this->verify_checksum = false;
+  this->_async = false;
+  this->_queue_bytes = 0;
+  this->_max_queue_bytes = 0;
+  this->_backpressure = BLOCK;
+  this->_writing = false;
+  this->_stop_writer = false;
+  this->_spill_fd = -1;
+  this->_spill_end = 0;
+  this->_n_dropped = 0;
+  this->_n_lost = 0;
+  this->_size = 0;
+  this->_n_checkpoints = 0;
   
   /* open file for appending */
-  this->_ptr_to_file = fopen(file_name, "ab");
-  if (!this->_ptr_to_file) {
+  this->_file.reset(FileBackend::Create(backend_type, direct));
+  if (!this->_file->Open(path) && backend_type != FileBackend::STDIO) {
+    clog << "warning: " << logstream::warning << "falling back to stdio to open " << this->path << std::endl;
+    this->_file.reset(new StdioBackend());
+    this->_file->Open(path);
+  }
+  if (!this->_file->IsOpen()) {
     clog << "error: " << logstream::error << "cannot open the file " << this->path << std::endl;
     std::cout << "ERROR: cannot open the file " << this->path << std::endl;
+    return;
+  }
+
+  this->_size = this->_file->Size();
+
+  /* include anything already in the file in the streaming CRC */
+  if (this->_file->Size() > 0) {
+    clog << "info: " << logstream::info << "appending to existing file " << this->path << std::endl;
+    ReadChecksum();
   }
 
 }
 
 /**
  * destructor 
- * closes the SynchronisedFile
+ * closes the SynchronisedFile if still open
  */
 SynchronisedFile::~SynchronisedFile() {
 
-  /* close the file */
-  fclose(this->_ptr_to_file);
+  Close();
+}
+
+/**
+ * switch to asynchronous writing.
+ * writes are copied into a bounded queue and written by a dedicated thread,
+ * so producers no longer wait on the storage device
+ * @param max_queue_bytes maximum amount of data held in memory
+ * @param backpressure what to do when the queue is full
+ * @param spill_dir directory for the spill file, used with SPILL backpressure
+ */
+void SynchronisedFile::StartAsync(size_t max_queue_bytes, Backpressure backpressure, std::string spill_dir) {
+
+  if (this->_async || !this->_file->IsOpen()) {
+    return;
+  }
+  
+  this->_max_queue_bytes = max_queue_bytes;
+  this->_backpressure = backpressure;
+
+  /* spill file named after the run file */
+  size_t pos = this->path.find_last_of('/');
+  std::string file_name = (pos == std::string::npos) ? this->path : this->path.substr(pos + 1);
+  this->_spill_path = spill_dir + "/" + file_name + ".spill";
+  
+  this->_async = true;
+  this->_writer = std::thread(&SynchronisedFile::WriterThread, this);
+
+  clog << "info: " << logstream::info << "asynchronous writing to " << this->path << " with a "
+       << max_queue_bytes << " byte queue" << std::endl;
+}
+
+/**
+ * copy the file to another device as it is written.
+ * the mirror is told how much of the file has reached it after each write
+ * @param mirror the mirror to report to
+ */
+void SynchronisedFile::SetMirror(std::shared_ptr<FileMirror> mirror) {
+
+  std::lock_guard<std::mutex> lock(_accessMutex);
+  this->_mirror = mirror;
+  if (this->_mirror && this->_file->IsOpen()) {
+    this->_mirror->Written(this->path, this->_file->Written());
+  }
+}
+
+/**
+ * gather the writes into blocks of a multiple of the file system cluster size,
+ * written at aligned offsets. must be set before writing asynchronously
+ * @param block_size the block size in bytes, 0 to write each packet straight away
+ */
+void SynchronisedFile::SetBlockSize(size_t block_size) {
+
+  std::lock_guard<std::mutex> lock(_accessMutex);
+  this->_file->SetBlockSize(block_size);
+}
+
+/**
+ * reserve space for the file so that it is written to contiguous clusters.
+ * the size of the file is unchanged, and what is not used is given back on closing
+ * @param len the expected size of the file in bytes
+ * @return true if the space was reserved
+ */
+bool SynchronisedFile::Preallocate(off_t len) {
+
+  std::lock_guard<std::mutex> lock(_accessMutex);
+  if (!this->_file->IsOpen()) {
+    return false;
+  }
+  bool preallocated = this->_file->Preallocate(len);
+  if (preallocated) {
+    clog << "info: " << logstream::info << "preallocated " << len << " bytes for " << this->path << std::endl;
+  }
+  return preallocated;
+}
+
+/**
+ * size of the file once everything written or queued so far is in it
+ */
+off_t SynchronisedFile::Size() {
+
+  return this->_size;
 }
 
 /**
- * calculate the CRC checksum and append to file
+ * rename the file, which is kept open.
+ * for files prepared before they are needed, so must be called
+ * before starting a mirror or asynchronous writing
+ * @param new_path the new path to the file
+ * @return true if the file was renamed
+ */
+bool SynchronisedFile::Rename(std::string new_path) {
+
+  std::lock_guard<std::mutex> lock(_accessMutex);
+  if (rename(this->path.c_str(), new_path.c_str()) != 0) {
+    clog << "error: " << logstream::error << "cannot rename " << this->path << " to " << new_path
+	 << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  this->path = new_path;
+  this->_file->path = new_path;
+
+  return true;
+}
+
+/**
+ * wait until everything queued has been written to the file.
+ * returns immediately if not writing asynchronously
+ */
+void SynchronisedFile::Flush() {
+
+  if (!this->_async) {
+    return;
+  }
+  
+  std::unique_lock<std::mutex> lock(this->_queueMutex);
+  this->_cv_drained.wait(lock, [this] { return this->_queue.empty() && !this->_writing; });
+}
+
+/**
+ * get the CRC checksum of everything written to the file so far.
+ * the CRC is updated with each write, so no file access is needed.
+ * if verify_checksum is set, the file is also re-read to check the result
  */
 uint32_t SynchronisedFile::Checksum() {
 
+  /* everything queued must be in the CRC */
+  Flush();
+  
   /* lock to one thread at a time */
   std::lock_guard<std::mutex> lock(_accessMutex);
 
-  /* close the file */
-  fclose(this->_ptr_to_file);
+  uint32_t checksum = this->_crc.checksum();
+  
+  std::cout << std::hex << std::uppercase << "CRC = " << checksum << std::dec << std::endl;
+  clog << "info: " << logstream::info << "CRC for " << this->path << " = "
+       << std::hex << std::uppercase << checksum << std::dec << std::endl;
+
+  /* optional check against the file contents */
+  if (this->verify_checksum) {
+    
+    uint32_t file_checksum = ReadChecksum();
+    if (file_checksum != checksum) {
+      std::cout << "ERROR: CRC mismatch for " << this->path << std::endl;
+      clog << "error: " << logstream::error << "CRC mismatch for " << this->path << ": file CRC = "
+	   << std::hex << std::uppercase << file_checksum << std::dec << std::endl;
+
+      /* the trailer must match what is actually in the file */
+      checksum = file_checksum;
+    }
+  }
+  
+  return checksum;
+}
+
+/**
+ * calculate the CRC checksum by re-reading the whole file
+ * also resets the streaming CRC to the result
+ * called with _accessMutex held, or before the file is shared
+ */
+uint32_t SynchronisedFile::ReadChecksum() {
+
+  /* make sure everything written is in the file */
+  this->_file->Sync();
   
   /* calculate the CRC */
   boost::crc_32_type crc_result;
@@ -53,27 +232,640 @@ uint32_t SynchronisedFile::Checksum() {
     clog << "error: " << logstream::error << "cannot open the file " << this->path << std::endl;
     return 1;
   }
-  std::cout << std::hex << std::uppercase << "CRC = " << crc_result.checksum() << std::endl;
-  clog << "info: " << logstream::info << "CRC for " << this->path << " = "
-       << std::hex << std::uppercase << crc_result.checksum() << std::endl;
 
-  /* reopen the file for further appending */
-  const char * file_name = this->path.c_str();
-  this->_ptr_to_file = fopen(file_name, "ab");
-  if (!this->_ptr_to_file) {
-    clog << "error: " << logstream::error << "cannot open the file " << this->path << std::endl;
+  this->_crc = crc_result;
+  return crc_result.checksum();
+}
+
+/**
+ * append all the segments of a packet to the file as a single write, 
+ * so that no other thread can interleave.
+ * if writing asynchronously the packet is copied to the queue instead
+ * @param pkt the packet to write
+ * @param priority decides what is dropped first when the queue is full
+ * @param index_entry if given, added to the packet index with the offset of the packet once written
+ * @return the number of bytes written or queued 
+ */
+size_t SynchronisedFile::WritePkt(const PacketBuilder & pkt, PktPriority priority,
+				  const CpuPktIndexEntry * index_entry) {
+
+  if (this->_async) {
+    size_t queued = Enqueue(pkt, priority, index_entry);
+    this->_size += queued;
+    return queued;
   }
   
-  return crc_result.checksum();
+  /* lock to one thread at a time */
+  std::lock_guard<std::mutex> lock(_accessMutex);
+
+  clog << "info: " << logstream::info << "writing " << pkt.Size() << " bytes to SynchronisedFile " << this->path << std::endl;
+
+  if (index_entry) {
+    this->_index.push_back(*index_entry);
+    this->_index.back().offset = this->_file->Size();
+  }
+
+  /* copy as the iovecs are advanced on partial writes */
+  std::vector<struct iovec> segments(pkt.Segments());
+  size_t written = WriteSegments(segments);
+  this->_size += written;
+  return written;
+}
+
+/**
+ * write a packet made of segments in memory followed by part of another file,
+ * which is copied by the kernel where the backend allows it.
+ * the copied data is read for the CRC through a mapping of the other file
+ * @param pkt the start of the packet, in memory
+ * @param fd_in the file holding the rest of the packet
+ * @param offset where the rest of the packet starts in fd_in
+ * @param len the number of bytes to copy from fd_in
+ * @param priority decides what is dropped first when the queue is full
+ * @param index_entry if given, added to the packet index with the offset of the packet once written
+ * @return the number of bytes written or queued, less than the size of the packet on failure
+ * and 0 if the partly written packet could be cut off again
+ */
+size_t SynchronisedFile::WritePktFromFile(const PacketBuilder & pkt, int fd_in, off_t offset, size_t len,
+					  PktPriority priority, const CpuPktIndexEntry * index_entry) {
+
+  /* mappings start on a page boundary */
+  off_t map_offset = offset - (offset % sysconf(_SC_PAGESIZE));
+  size_t map_len = len + (offset - map_offset);
+  void * addr = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd_in, map_offset);
+  if (addr == MAP_FAILED) {
+    clog << "error: " << logstream::error << "cannot map the data to write to " << this->path << std::endl;
+    return 0;
+  }
+  madvise(addr, map_len, MADV_SEQUENTIAL);
+  const char * data = static_cast<const char *>(addr) + (offset - map_offset);
+
+  size_t written = 0;
+  if (this->_async) {
+
+    /* the queue needs its own copy anyway, so nothing is gained over writing from memory */
+    PacketBuilder full_pkt(pkt);
+    full_pkt.Add(data, len);
+    written = Enqueue(full_pkt, priority, index_entry);
+  }
+  else {
+
+    /* lock to one thread at a time */
+    std::lock_guard<std::mutex> lock(_accessMutex);
+
+    clog << "info: " << logstream::info << "writing " << pkt.Size() + len << " bytes to SynchronisedFile "
+	 << this->path << ", " << len << " copied from file" << std::endl;
+
+    /* to undo a partly written packet */
+    off_t start = this->_file->Size();
+    boost::crc_32_type crc = this->_crc;
+
+    std::vector<struct iovec> segments(pkt.Segments());
+    written = WriteSegments(segments, false);
+
+    ssize_t ret = (written == pkt.Size()) ? this->_file->AppendFromFile(fd_in, offset, len) : -1;
+    size_t copied = (ret > 0) ? ret : 0;
+    this->_crc.process_bytes(data, copied);
+    written += copied;
+
+    /* the rest through the mapping, if the kernel could not copy all of it */
+    if (written == pkt.Size() + copied && copied < len) {
+      clog << "warning: " << logstream::warning << "copied " << copied << " of " << len
+	   << " bytes to " << this->path << ", writing the rest" << std::endl;
+      PacketBuilder rest;
+      rest.Add(data + copied, len - copied);
+      std::vector<struct iovec> rest_segments(rest.Segments());
+      written += WriteSegments(rest_segments, false);
+    }
+
+    if (written == pkt.Size() + len) {
+      if (index_entry) {
+	this->_index.push_back(*index_entry);
+	this->_index.back().offset = start;
+      }
+    }
+    else {
+      clog << "error: " << logstream::error << "write failed to " << this->path << ", "
+	   << written << " of " << pkt.Size() + len << " bytes written" << std::endl;
+      std::cout << "ERROR: write failed to " << this->path << std::endl;
+
+      /* cut off what was written so that the file ends on a complete record */
+      if (written > 0) {
+	if (this->_file->Truncate(start)) {
+	  this->_crc = crc;
+	  written = 0;
+	}
+	else {
+	  clog << "error: " << logstream::error << "cannot cut the partly written packet from "
+	       << this->path << std::endl;
+	}
+      }
+    }
+    if (this->_mirror) {
+      this->_mirror->Written(this->path, this->_file->Written());
+    }
+  }
+
+  munmap(addr, map_len);
+  this->_size += written;
+  return written;
+}
+
+/**
+ * append the packet index to the file, followed by a CpuFileIndex footer,
+ * and clear it. called before the trailer is written, so that the 
+ * index is included in the CRC and can be found from the end of the file
+ * @return the number of entries written
+ */
+size_t SynchronisedFile::WriteIndex() {
+
+  /* everything queued must be indexed */
+  Flush();
+
+  std::lock_guard<std::mutex> lock(_accessMutex);
+
+  CpuFileIndex cpu_file_index;
+  cpu_file_index.header = CpuTools::BuildCpuHeader(INDEX_PACKET_TYPE, INDEX_PACKET_VER);
+  cpu_file_index.n_entries = this->_index.size();
+  cpu_file_index.index_size = this->_index.size() * sizeof(CpuPktIndexEntry) + sizeof(cpu_file_index);
+
+  clog << "info: " << logstream::info << "writing index of " << cpu_file_index.n_entries
+       << " packets to SynchronisedFile " << this->path << std::endl;
+
+  /* the index is small, write it directly even if asynchronous */
+  PacketBuilder index_pkt;
+  index_pkt.Add(this->_index.data(), this->_index.size());
+  index_pkt.Add(&cpu_file_index);
+  std::vector<struct iovec> segments(index_pkt.Segments());
+  this->_size += WriteSegments(segments);
+
+  size_t n_entries = this->_index.size();
+  this->_index.clear();
+  return n_entries;
+}
+
+/**
+ * append a checkpoint record with the CRC of everything before it and 
+ * the number of CPU packets, so that the file can be recovered up to
+ * this point if it is never closed. 
+ * if writing asynchronously, the record is built by the writer thread
+ * once the packets queued before it are written
+ * @param n_packets number of CPU packets in the file so far
+ * @param sync if true, the file is synced to the storage device after the record
+ * @return the size of the record written or queued
+ */
+size_t SynchronisedFile::WriteCheckpoint(uint32_t n_packets, bool sync) {
+
+  if (this->_async) {
+    QueuedPkt queued_pkt;
+    queued_pkt.priority = SCIENCE;
+    queued_pkt.spilled = false;
+    queued_pkt.spill_offset = 0;
+    queued_pkt.size = sizeof(CpuCheckpoint);
+    queued_pkt.indexed = false;
+    queued_pkt.checkpoint = true;
+    queued_pkt.n_packets = n_packets;
+    queued_pkt.sync = sync;
+    {
+      std::lock_guard<std::mutex> lock(this->_queueMutex);
+      this->_queue_bytes += queued_pkt.size;
+      this->_queue.push_back(std::move(queued_pkt));
+    }
+    this->_cv_queue.notify_one();
+    this->_size += sizeof(CpuCheckpoint);
+    return sizeof(CpuCheckpoint);
+  }
+
+  std::lock_guard<std::mutex> lock(_accessMutex);
+  size_t written = WriteCheckpointRecord(n_packets, sync);
+  this->_size += written;
+  return written;
+}
+
+/**
+ * build and append a checkpoint record at the end of the file
+ * called with _accessMutex held
+ * @param n_packets number of CPU packets in the file so far
+ * @param sync if true, the file is synced to the storage device after the record
+ * @return the number of bytes written
+ */
+size_t SynchronisedFile::WriteCheckpointRecord(uint32_t n_packets, bool sync) {
+
+  CpuCheckpoint cpu_checkpoint;
+  cpu_checkpoint.checkpoint_header.header = CpuTools::BuildCpuHeader(CHECKPOINT_PACKET_TYPE, CHECKPOINT_PACKET_VER);
+  cpu_checkpoint.checkpoint_header.pkt_size = sizeof(cpu_checkpoint);
+  cpu_checkpoint.checkpoint_header.pkt_num = this->_n_checkpoints++;
+  cpu_checkpoint.offset = this->_file->Size();
+  cpu_checkpoint.n_packets = n_packets;
+  cpu_checkpoint.crc = this->_crc.checksum();
+
+  PacketBuilder checkpoint_pkt;
+  checkpoint_pkt.Add(&cpu_checkpoint);
+  std::vector<struct iovec> segments(checkpoint_pkt.Segments());
+  size_t written = WriteSegments(segments);
+
+  if (sync && !this->_file->DataSync()) {
+    clog << "error: " << logstream::error << "cannot sync " << this->path << " to the device" << std::endl;
+  }
+  
+  return written;
+}
+
+/**
+ * write segments to the file through the backend, handling partial writes,
+ * and update the CRC with what was written
+ * called with _accessMutex held
+ * @param segments the segments to write, modified on partial writes
+ * @param notify if false, the mirror is left for the caller to notify
+ * @return the number of bytes written
+ */
+size_t SynchronisedFile::WriteSegments(std::vector<struct iovec> & segments, bool notify) {
+
+  size_t written = 0;
+
+  if (!this->_file->IsOpen()) {
+    clog << "error: " << logstream::error << "write to closed file " << this->path << std::endl;
+    return 0;
+  }
+
+  size_t first = 0;
+  while (first < segments.size()) {
+    
+    int n_segments = std::min(segments.size() - first, (size_t)IOV_MAX);
+    ssize_t ret = this->_file->Append(&segments[first], n_segments);
+    if (ret < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      clog << "error: " << logstream::error << "write failed to " << this->path << std::endl;
+      std::cout << "ERROR: write failed to " << this->path << std::endl;
+      break;
+    }
+    written += ret;
+
+    /* update the CRC and skip the segments that were written */
+    size_t remaining = ret;
+    while (first < segments.size() && remaining >= segments[first].iov_len) {
+      this->_crc.process_bytes(segments[first].iov_base, segments[first].iov_len);
+      remaining -= segments[first].iov_len;
+      first++;
+    }
+    if (remaining > 0) {
+      this->_crc.process_bytes(segments[first].iov_base, remaining);
+      segments[first].iov_base = static_cast<char *>(segments[first].iov_base) + remaining;
+      segments[first].iov_len -= remaining;
+    }
+  }
+
+  if (notify && this->_mirror) {
+    this->_mirror->Written(this->path, this->_file->Written());
+  }
+
+  return written;
+}
+
+/**
+ * add a packet to the asynchronous queue, applying backpressure if full
+ * @param pkt the packet to queue
+ * @param priority HK packets are dropped first with DROP_HK backpressure
+ * @param index_entry if given, indexed when the writer thread writes the packet
+ * @return the number of bytes queued, 0 if dropped
+ */
+size_t SynchronisedFile::Enqueue(const PacketBuilder & pkt, PktPriority priority, const CpuPktIndexEntry * index_entry) {
+
+  QueuedPkt queued_pkt;
+  queued_pkt.priority = priority;
+  queued_pkt.spilled = false;
+  queued_pkt.spill_offset = 0;
+  queued_pkt.size = pkt.Size();
+  queued_pkt.indexed = (index_entry != nullptr);
+  if (index_entry) {
+    queued_pkt.index_entry = *index_entry;
+  }
+  queued_pkt.checkpoint = false;
+  queued_pkt.n_packets = 0;
+  queued_pkt.sync = false;
+  
+  std::unique_lock<std::mutex> lock(this->_queueMutex);
+
+  /* an empty queue always accepts a packet, however large */
+  auto fits = [this, &queued_pkt] {
+    return this->_queue.empty() || this->_queue_bytes + queued_pkt.size <= this->_max_queue_bytes;
+  };
+
+  if (!fits()) {
+    switch (this->_backpressure) {
+    case DROP_HK:
+
+      /* drop this packet if HK */
+      if (priority == HK) {
+	this->_n_dropped++;
+	clog << "warning: " << logstream::warning << "write queue full, dropped HK packet for "
+	     << this->path << " (" << this->_n_dropped << " dropped)" << std::endl;
+	return 0;
+      }
+
+      /* otherwise drop queued HK packets, oldest first */
+      for (auto it = this->_queue.begin(); it != this->_queue.end() && !fits(); ) {
+	if (it->priority == HK && !it->spilled) {
+	  this->_queue_bytes -= it->size;
+	  this->_n_dropped++;
+	  it = this->_queue.erase(it);
+	}
+	else {
+	  ++it;
+	}
+      }
+      clog << "warning: " << logstream::warning << "write queue full, dropping HK packets for "
+	   << this->path << " (" << this->_n_dropped << " dropped)" << std::endl;
+      break;
+      
+    case SPILL:
+      
+      /* write to the spill file, to be replayed in order by the writer */
+      queued_pkt.spilled = Spill(pkt, queued_pkt);
+      break;
+
+    case BLOCK:
+      break;
+    }
+    
+    /* wait for space if nothing else worked */
+    if (!queued_pkt.spilled && !fits()) {
+      clog << "warning: " << logstream::warning << "write queue full, waiting for " << this->path << std::endl;
+      this->_cv_space.wait(lock, fits);
+    }
+  }
+
+  /* copy the packet into the queue */
+  if (!queued_pkt.spilled) {
+    queued_pkt.data.resize(queued_pkt.size);
+    char * ptr = queued_pkt.data.data();
+    for (const struct iovec & segment : pkt.Segments()) {
+      memcpy(ptr, segment.iov_base, segment.iov_len);
+      ptr += segment.iov_len;
+    }
+    this->_queue_bytes += queued_pkt.size;
+  }
+  this->_queue.push_back(std::move(queued_pkt));
+  
+  lock.unlock();
+  this->_cv_queue.notify_one();
+
+  return pkt.Size();
+}
+
+/**
+ * append a packet to the spill file, opening it if needed
+ * called with _queueMutex held
+ * @param pkt the packet to spill
+ * @param queued_pkt set to where the packet is in the spill file
+ * @return true if the packet was spilled
+ */
+bool SynchronisedFile::Spill(const PacketBuilder & pkt, QueuedPkt & queued_pkt) {
+
+  if (this->_spill_fd < 0) {
+    this->_spill_fd = open(this->_spill_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (this->_spill_fd < 0) {
+      clog << "error: " << logstream::error << "cannot open the spill file " << this->_spill_path << std::endl;
+      return false;
+    }
+    this->_spill_end = 0;
+  }
+
+  std::vector<struct iovec> segments(pkt.Segments());
+  ssize_t ret = pwritev(this->_spill_fd, segments.data(), segments.size(), this->_spill_end);
+  if (ret < 0 || (size_t)ret != pkt.Size()) {
+    clog << "error: " << logstream::error << "write to the spill file " << this->_spill_path << " failed" << std::endl;
+    return false;
+  }
+
+  queued_pkt.spill_offset = this->_spill_end;
+  this->_spill_end += ret;
+  
+  return true;
+}
+
+/**
+ * read a spilled packet back into memory, retrying on failure
+ * @param queued_pkt the packet, filled with its data
+ * @return true if the whole packet was read
+ */
+bool SynchronisedFile::ReadSpill(QueuedPkt & queued_pkt) {
+
+  queued_pkt.data.resize(queued_pkt.size);
+
+  for (int attempt = 0; attempt < SPILL_READ_RETRIES; attempt++) {
+    size_t done = 0;
+    while (done < queued_pkt.size) {
+      ssize_t ret = pread(this->_spill_fd, queued_pkt.data.data() + done, queued_pkt.size - done,
+			  queued_pkt.spill_offset + done);
+      if (ret < 0 && errno == EINTR) {
+	continue;
+      }
+      if (ret <= 0) {
+	break;
+      }
+      done += ret;
+    }
+    if (done == queued_pkt.size) {
+      return true;
+    }
+    clog << "error: " << logstream::error << "read from the spill file " << this->_spill_path
+	 << " failed: " << strerror(errno) << std::endl;
+    std::this_thread::sleep_for(std::chrono::milliseconds(SPILL_RETRY_MS));
+  }
+  
+  return false;
+}
+
+/**
+ * the asynchronous writer thread.
+ * takes batches of packets from the queue and writes each batch in one go
+ */
+void SynchronisedFile::WriterThread() {
+
+  std::unique_lock<std::mutex> lock(this->_queueMutex);
+  while (true) {
+
+    this->_cv_queue.wait(lock, [this] { return !this->_queue.empty() || this->_stop_writer; });
+    if (this->_queue.empty()) {
+      break;
+    }
+
+    /* take a batch of packets in order */
+    std::vector<QueuedPkt> batch;
+    size_t batch_bytes = 0;
+    while (!this->_queue.empty() && batch.size() < ASYNC_MAX_BATCH
+	   && batch_bytes < ASYNC_MAX_BATCH_BYTES) {
+      batch_bytes += this->_queue.front().size;
+      if (!this->_queue.front().spilled) {
+	this->_queue_bytes -= this->_queue.front().size;
+      }
+      batch.push_back(std::move(this->_queue.front()));
+      this->_queue.pop_front();
+    }
+    this->_writing = true;
+    lock.unlock();
+    this->_cv_space.notify_all();
+
+    /* read back spilled packets and gather the batch */
+    /* index entries get their offset relative to the start of the batch for now */
+    /* checkpoints are kept with the number of segments before them */
+    std::vector<struct iovec> segments;
+    std::vector<CpuPktIndexEntry> batch_index;
+    std::vector<std::pair<size_t, const QueuedPkt *>> batch_checkpoints;
+    size_t batch_offset = 0;
+    for (QueuedPkt & queued_pkt : batch) {
+      if (queued_pkt.checkpoint) {
+	batch_checkpoints.push_back(std::make_pair(segments.size(), &queued_pkt));
+	batch_offset += queued_pkt.size;
+	continue;
+      }
+      if (queued_pkt.spilled && !ReadSpill(queued_pkt)) {
+	this->_n_lost++;
+	clog << "error: " << logstream::error << "lost a packet of " << queued_pkt.size << " bytes for "
+	     << this->path << ", cannot read it back from the spill file (" << this->_n_lost << " lost)" << std::endl;
+	std::cout << "ERROR: lost a packet for " << this->path << std::endl;
+	continue;
+      }
+      struct iovec segment;
+      segment.iov_base = queued_pkt.data.data();
+      segment.iov_len = queued_pkt.size;
+      segments.push_back(segment);
+      if (queued_pkt.indexed) {
+	batch_index.push_back(queued_pkt.index_entry);
+	batch_index.back().offset = batch_offset;
+      }
+      batch_offset += queued_pkt.size;
+    }
+
+    /* write the batch */
+    {
+      std::lock_guard<std::mutex> file_lock(this->_accessMutex);
+      clog << "info: " << logstream::info << "writing " << batch_bytes << " bytes in "
+	   << batch.size() << " packets to SynchronisedFile " << this->path << std::endl;
+      off_t start = this->_file->Size();
+      for (CpuPktIndexEntry & index_entry : batch_index) {
+	index_entry.offset += start;
+	this->_index.push_back(index_entry);
+      }
+
+      /* the checkpoints go between the packets, with the CRC up to them */
+      size_t first = 0;
+      for (const std::pair<size_t, const QueuedPkt *> & checkpoint : batch_checkpoints) {
+	WriteQueuedSegments(segments, first, checkpoint.first);
+	WriteCheckpointRecord(checkpoint.second->n_packets, checkpoint.second->sync);
+	first = checkpoint.first;
+      }
+      WriteQueuedSegments(segments, first, segments.size());
+    }
+    
+    lock.lock();
+    this->_writing = false;
+
+    /* nothing left to replay, so the spill file can be reused from the start */
+    if (this->_queue.empty() && this->_spill_fd >= 0 && this->_spill_end > 0) {
+      if (ftruncate(this->_spill_fd, 0) != 0) {
+	clog << "error: " << logstream::error << "cannot truncate the spill file " << this->_spill_path << std::endl;
+      }
+      this->_spill_end = 0;
+    }
+    this->_cv_drained.notify_all();
+  }
+}
+
+/**
+ * write packets taken from the queue, one per segment, 
+ * counting those not completely written as lost
+ * called with _accessMutex held
+ * @param segments the packets of the batch
+ * @param first the first packet to write
+ * @param last one past the last packet to write
+ */
+void SynchronisedFile::WriteQueuedSegments(const std::vector<struct iovec> & segments, size_t first, size_t last) {
+
+  std::vector<struct iovec> part(segments.begin() + first, segments.begin() + last);
+  size_t written = WriteSegments(part);
+
+  /* the packets from the first one not completely written */
+  unsigned int n_lost = 0;
+  for (size_t i = first; i < last; i++) {
+    if (written >= segments[i].iov_len) {
+      written -= segments[i].iov_len;
+    }
+    else {
+      written = 0;
+      n_lost++;
+    }
+  }
+  if (n_lost > 0) {
+    this->_n_lost += n_lost;
+    clog << "error: " << logstream::error << n_lost << " packets were not written to " << this->path
+	 << " (" << this->_n_lost << " lost)" << std::endl;
+  }
+}
+
+/**
+ * write out the queue and stop the asynchronous writer thread
+ */
+void SynchronisedFile::StopAsync() {
+
+  if (!this->_async) {
+    return;
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(this->_queueMutex);
+    this->_stop_writer = true;
+  }
+  this->_cv_queue.notify_one();
+  this->_writer.join();
+  this->_async = false;
+
+  /* remove the spill file */
+  if (this->_spill_fd >= 0) {
+    close(this->_spill_fd);
+    this->_spill_fd = -1;
+    std::remove(this->_spill_path.c_str());
+  }
+  
+  if (this->_n_dropped > 0) {
+    clog << "warning: " << logstream::warning << this->_n_dropped << " HK packets were dropped for "
+	 << this->path << std::endl;
+  }
+  if (this->_n_lost > 0) {
+    clog << "error: " << logstream::error << this->_n_lost << " packets were lost by the writer for "
+	 << this->path << std::endl;
+  }
+}
+
+/**
+ * number of queued packets the asynchronous writer could not write,
+ * as they could not be read back from the spill file or the write failed
+ */
+unsigned int SynchronisedFile::Lost() {
+
+  return this->_n_lost;
 }
 
 /**
  * close the SynchronisedFile
+ * anything still queued is written first
  */
 void SynchronisedFile::Close() {
 
+  StopAsync();
+  
   /* close the file */
-  fclose(this->_ptr_to_file);
+  std::lock_guard<std::mutex> lock(_accessMutex);
+  off_t size = this->_file->Size();
+  this->_file->Close();
+
+  /* the mirror can finish the copy */
+  if (this->_mirror) {
+    this->_mirror->Closed(this->path, size);
+    this->_mirror.reset();
+  }
 }
 
 /**
@@ -83,6 +875,7 @@ void SynchronisedFile::Close() {
 Access::Access(std::shared_ptr<SynchronisedFile> sf) {
   this->_sf = sf;
   this->path = sf->path;
+  this->_n_lost_seen = 0;
 }
 
 /**
@@ -94,6 +887,64 @@ uint32_t Access::GetChecksum() {
   return checksum;
 }
 
+/**
+ * write a packet to the SynchronisedFile accessed in a single operation
+ * @param pkt the packet to write
+ * @param priority priority of the packet for the asynchronous queue
+ * @param index_entry if given, the packet is added to the packet index
+ */
+size_t Access::WritePktToSynchFile(const PacketBuilder & pkt, SynchronisedFile::PktPriority priority,
+				   const CpuPktIndexEntry * index_entry) {
+
+  return this->_sf->WritePkt(pkt, priority, index_entry);
+}
+
+/**
+ * write a packet followed by part of another file to the SynchronisedFile
+ * @param pkt the start of the packet, in memory
+ * @param fd_in the file holding the rest of the packet
+ * @param offset where the rest of the packet starts in fd_in
+ * @param len the number of bytes to copy from fd_in
+ * @param priority decides what is dropped first when the queue is full
+ * @param index_entry if given, the packet is added to the packet index
+ */
+size_t Access::WritePktFromFileToSynchFile(const PacketBuilder & pkt, int fd_in, off_t offset, size_t len,
+					   SynchronisedFile::PktPriority priority, const CpuPktIndexEntry * index_entry) {
+
+  return this->_sf->WritePktFromFile(pkt, fd_in, offset, len, priority, index_entry);
+}
+
+/**
+ * number of packets lost by the asynchronous writer of the SynchronisedFile
+ * since the last call, so that each loss is reported once
+ */
+unsigned int Access::LostFromSynchFile() {
+
+  unsigned int n_lost = this->_sf->Lost();
+  unsigned int n_new = n_lost - this->_n_lost_seen;
+  this->_n_lost_seen = n_lost;
+  return n_new;
+}
+
+/**
+ * append the packet index to the SynchronisedFile
+ * @return the number of entries written
+ */
+size_t Access::WriteIndexToSynchFile() {
+
+  return this->_sf->WriteIndex();
+}
+
+/**
+ * append a checkpoint record to the SynchronisedFile
+ * @param n_packets number of CPU packets in the file so far
+ * @param sync if true, the file is synced to the storage device after the record
+ */
+size_t Access::WriteCheckpointToSynchFile(uint32_t n_packets, bool sync) {
+
+  return this->_sf->WriteCheckpoint(n_packets, sync);
+}
+
 /**
  * close the SynchronisedFile accessed
  */
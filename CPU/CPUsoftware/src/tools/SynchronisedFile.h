@@ -2,12 +2,29 @@
 #define _SYNCHRONISED_FILE_H
 
 #include <boost/crc.hpp>  
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
 #include <mutex>
 #include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
 
 #include "log.h"
 #include "minieuso_data_format.h"
 #include "ConfigManager.h"
+#include "FileBackend.h"
+#include "FileMirror.h"
 
 /* for use with CRC checksum calculation */
 /* redefine this to change to processing buffer size */
@@ -17,6 +34,68 @@
 /* global objects */
 std::streamsize const buffer_size = PRIVATE_BUFFER_SIZE;
 
+/* limits on what the asynchronous writer coalesces into one write */
+#define ASYNC_MAX_BATCH 64
+#define ASYNC_MAX_BATCH_BYTES (8 * 1024 * 1024)
+/* attempts to read back a spilled packet, and the wait between them */
+#define SPILL_READ_RETRIES 3
+#define SPILL_RETRY_MS 10
+
+
+/**
+ * gathers the segments of a packet so that they can be appended 
+ * to a SynchronisedFile as a single write 
+ * does not copy or own the segments, which must stay valid until written
+ */
+class PacketBuilder {
+public:
+  PacketBuilder() : _size(0) {}
+
+  /**
+   * template to allow different objects to be added to the packet
+   */
+  template <class GenericType>
+  /**
+   * add a segment to the end of the packet
+   * @param payload pointer to the data to add
+   * @param n_items number of objects of the type pointed to
+   */
+  void Add(const GenericType * payload, size_t n_items = 1) {
+
+    struct iovec segment;
+    segment.iov_base = const_cast<GenericType *>(payload);
+    segment.iov_len = n_items * sizeof(GenericType);
+
+    if (segment.iov_len > 0) {
+      this->_segments.push_back(segment);
+      this->_size += segment.iov_len;
+    }
+  }
+
+  /**
+   * the segments added so far, in order
+   */
+  const std::vector<struct iovec> & Segments() const { return this->_segments; }
+  /**
+   * total size of the packet in bytes
+   */
+  size_t Size() const { return this->_size; }
+  /**
+   * remove all segments
+   */
+  void Clear() { this->_segments.clear(); this->_size = 0; }
+  
+private:
+  /**
+   * the segments making up the packet
+   */
+  std::vector<struct iovec> _segments;
+  /**
+   * sum of the segment lengths
+   */
+  size_t _size;
+};
+
 
 /**
  * handles asynchronous writing to file from multiple threads 
@@ -28,7 +107,7 @@ public:
    */
   std::string path;
 
-  SynchronisedFile(std::string path); 
+  SynchronisedFile(std::string path, FileBackend::BackendType backend_type = FileBackend::STDIO, bool direct = false);
   ~SynchronisedFile();
 
   /**
@@ -41,8 +120,44 @@ public:
     VARIABLE_HV = 3,
   };
 
+  /**
+   * packet priority, used to decide what to drop when the asynchronous queue is full
+   */
+  enum PktPriority : uint8_t {
+    SCIENCE = 0,
+    HK = 1,
+  };
+
+  /**
+   * what to do when the asynchronous queue is full
+   */
+  enum Backpressure : uint8_t {
+    BLOCK = 0,
+    DROP_HK = 1,
+    SPILL = 2,
+  };
+
+  /**
+   * if true, Checksum() also re-reads the file to verify the streaming CRC
+   */
+  bool verify_checksum;
+
   uint32_t Checksum();
   void Close();
+  void StartAsync(size_t max_queue_bytes, Backpressure backpressure, std::string spill_dir);
+  void SetMirror(std::shared_ptr<FileMirror> mirror);
+  void SetBlockSize(size_t block_size);
+  bool Preallocate(off_t len);
+  off_t Size();
+  bool Rename(std::string new_path);
+  void Flush();
+  size_t WritePkt(const PacketBuilder & pkt, PktPriority priority = SCIENCE,
+		  const CpuPktIndexEntry * index_entry = nullptr);
+  size_t WritePktFromFile(const PacketBuilder & pkt, int fd_in, off_t offset, size_t len,
+			  PktPriority priority = SCIENCE, const CpuPktIndexEntry * index_entry = nullptr);
+  size_t WriteIndex();
+  size_t WriteCheckpoint(uint32_t n_packets, bool sync);
+  unsigned int Lost();
   /**
    * template to allow different objects to be passed for writing
    */
@@ -55,74 +170,29 @@ public:
    */
   size_t Write(GenericType payload, WriteType write_type, std::shared_ptr<Config> ConfigOut = nullptr) {
 
-    size_t check = 0;
+    size_t n_items = 1;
     
-    /* lock to one thread at a time */
-    std::lock_guard<std::mutex> lock(_accessMutex);
-
-    clog << "info: " << logstream::info << "writing to SynchronisedFile " << this->path << std::endl;
-      
-    /*  write the payload to the file */
+    /* get the number of items to write */
     switch(write_type) {
     case CONSTANT:
-   
-      check = fwrite(payload, sizeof(*payload), 1, this->_ptr_to_file);
-      if (check != 1) {
-	clog << "error: " << logstream::error << "fwrite failed to " << this->path << std::endl;
-	return check;
-      }
-      
-    break;
+      n_items = 1;
+      break;
     case VARIABLE_D1:
-
-      check = fwrite(payload, sizeof(*payload), ConfigOut->N1, this->_ptr_to_file);
-      if (check != size_t(ConfigOut->N1)) {
-	clog << "error: " << logstream::error << "fwrite failed to " << this->path << std::endl;
-
-	/* DEBUG check why fwrite fails */
-	std::cout << "FWRITE FAIL" << std::endl;
-	std::cout << "check = " << check << std::endl;
-	std::cout << "feof: " << feof(this->_ptr_to_file) << std::endl;
-	std::cout << "ferror: " << ferror(this->_ptr_to_file) << std::endl;
-  
-	return check;
-      }
-
+      n_items = ConfigOut->N1;
       break;
     case VARIABLE_D2:
-      
-      check = fwrite(payload, sizeof(*payload), ConfigOut->N2, this->_ptr_to_file);
-      if (check != size_t(ConfigOut->N2)) {
-	clog << "error: " << logstream::error << "fwrite failed to " << this->path << std::endl;
-	
-	/* DEBUG check why fwrite fails */
-	std::cout << "FWRITE FAIL" << std::endl;
-	std::cout << "check = " << check << std::endl;
-	std::cout << "feof: " << feof(this->_ptr_to_file) << std::endl;
-	std::cout << "ferror: " << ferror(this->_ptr_to_file) << std::endl;
-  
-	return check;
-      }
+      n_items = ConfigOut->N2;
       break;
     case VARIABLE_HV:
-
-      check = fwrite(payload, sizeof(*payload), ConfigOut->hvps_log_len, this->_ptr_to_file);
-      if (check != size_t(ConfigOut->hvps_log_len)) {
-	clog << "error: " << logstream::error << "fwrite failed to " << this->path << std::endl;
-	
-	/* DEBUG check why fwrite fails */
-	std::cout << "FWRITE FAIL" << std::endl;
-	std::cout << "check = " << check << std::endl;
-	std::cout << "feof: " << feof(this->_ptr_to_file) << std::endl;
-	std::cout << "ferror: " << ferror(this->_ptr_to_file) << std::endl;
-  
-	return check;
-      }
-      
+      n_items = ConfigOut->hvps_log_len;
       break;
-   
     }
-
+      
+    /*  write the payload to the file */
+    PacketBuilder pkt;
+    pkt.Add(payload, n_items);
+    size_t check = WritePkt(pkt) / sizeof(*payload);
+    
     return check;
   }
 
@@ -132,9 +202,125 @@ private:
    */
   std::mutex _accessMutex;
   /**
-   * pointer to the SynchronisedFile
+   * the file being written
+   */
+  std::unique_ptr<FileBackend> _file;
+  /**
+   * CRC of everything written so far, updated on each write
+   */
+  boost::crc_32_type _crc;
+  /**
+   * index of the packets written with an index entry, completed with their offsets
+   */
+  std::vector<CpuPktIndexEntry> _index;
+  /**
+   * copies the file to another device as it is written, if set
+   */
+  std::shared_ptr<FileMirror> _mirror;
+  /**
+   * size of the file once everything written or queued so far is in it
+   */
+  std::atomic<off_t> _size;
+  /**
+   * number of checkpoints written, for their pkt_num
+   */
+  uint32_t _n_checkpoints;
+
+  /**
+   * a packet waiting to be written by the asynchronous writer 
+   */
+  struct QueuedPkt {
+    std::vector<char> data;
+    PktPriority priority;
+    bool spilled;
+    off_t spill_offset;
+    size_t size;
+    bool indexed;
+    CpuPktIndexEntry index_entry;
+    /* a checkpoint, only built once everything before it is written */
+    bool checkpoint;
+    uint32_t n_packets;
+    bool sync;
+  };
+  
+  /**
+   * true if writes go through the asynchronous writer thread
+   */
+  bool _async;
+  /**
+   * packets waiting to be written, in order 
+   */
+  std::deque<QueuedPkt> _queue;
+  /**
+   * bytes held in memory by the queue
+   */
+  size_t _queue_bytes;
+  /**
+   * maximum bytes held in memory by the queue
+   */
+  size_t _max_queue_bytes;
+  /**
+   * what to do when the queue is full
+   */
+  Backpressure _backpressure;
+  /**
+   * protection for the queue, separate from file access
+   */
+  std::mutex _queueMutex;
+  /**
+   * to wake the writer thread
+   */
+  std::condition_variable _cv_queue;
+  /**
+   * to wake producers waiting for space in the queue
+   */
+  std::condition_variable _cv_space;
+  /**
+   * to wake threads waiting for the queue to be written
+   */
+  std::condition_variable _cv_drained;
+  /**
+   * true while the writer thread has a batch in hand
+   */
+  bool _writing;
+  /**
+   * to stop the writer thread
+   */
+  bool _stop_writer;
+  /**
+   * the writer thread
+   */
+  std::thread _writer;
+  /**
+   * path to the spill file, used with SPILL backpressure
+   */
+  std::string _spill_path;
+  /**
+   * descriptor of the spill file, -1 until first used
+   */
+  int _spill_fd;
+  /**
+   * end of the data in the spill file
    */
-  FILE * _ptr_to_file;
+  off_t _spill_end;
+  /**
+   * number of HK packets dropped with DROP_HK backpressure
+   */
+  unsigned int _n_dropped;
+  /**
+   * number of packets the writer thread could not read back from the spill file or write
+   */
+  std::atomic<unsigned int> _n_lost;
+
+  uint32_t ReadChecksum();
+  size_t WriteSegments(std::vector<struct iovec> & segments, bool notify = true);
+  size_t WriteCheckpointRecord(uint32_t n_packets, bool sync);
+  size_t Enqueue(const PacketBuilder & pkt, PktPriority priority, const CpuPktIndexEntry * index_entry);
+  bool Spill(const PacketBuilder & pkt, QueuedPkt & queued_pkt);
+  bool ReadSpill(QueuedPkt & queued_pkt);
+  void WriteQueuedSegments(const std::vector<struct iovec> & segments, size_t first, size_t last);
+  void WriterThread();
+  void StopAsync();
 };
 
 /**
@@ -150,6 +336,15 @@ public:
   std::string path;
   uint32_t GetChecksum();
   void CloseSynchFile();
+  size_t WritePktToSynchFile(const PacketBuilder & pkt,
+			     SynchronisedFile::PktPriority priority = SynchronisedFile::SCIENCE,
+			     const CpuPktIndexEntry * index_entry = nullptr);
+  size_t WritePktFromFileToSynchFile(const PacketBuilder & pkt, int fd_in, off_t offset, size_t len,
+				     SynchronisedFile::PktPriority priority = SynchronisedFile::SCIENCE,
+				     const CpuPktIndexEntry * index_entry = nullptr);
+  size_t WriteIndexToSynchFile();
+  size_t WriteCheckpointToSynchFile(uint32_t n_packets, bool sync);
+  unsigned int LostFromSynchFile();
 
   /**
    * template to allow different objects to be passed for writing
@@ -171,6 +366,10 @@ private:
    * pointer to the SynchronisedFile
    */
   std::shared_ptr<SynchronisedFile> _sf;
+  /**
+   * packets lost by the writer already reported by LostFromSynchFile()
+   */
+  unsigned int _n_lost_seen;
 };
 
 #endif
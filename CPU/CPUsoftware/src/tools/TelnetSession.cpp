@@ -0,0 +1,301 @@
+#include "TelnetSession.h"
+
+/**
+ * constructor.
+ * does not connect, the connection is opened by the first command
+ * @param host host name or IP of the server
+ * @param port port of the server
+ */
+TelnetSession::TelnetSession(std::string host, int port) {
+
+  this->host = host;
+  this->port = port;
+  this->_sockfd = -1;
+  this->_resolved = false;
+  memset(&this->_addr, 0, sizeof(this->_addr));
+}
+
+/**
+ * destructor
+ * closes the connection
+ */
+TelnetSession::~TelnetSession() {
+
+  Disconnect();
+}
+
+/**
+ * open the connection, with a timeout of TELNET_CONNECT_TIMEOUT_SEC.
+ * the server address is only looked up the first time
+ * @return 0 on success, 1 on failure
+ */
+int TelnetSession::Connect() {
+
+  Disconnect();
+
+  if (!this->_resolved) {
+    struct addrinfo hints;
+    struct addrinfo * res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(this->host.c_str(), std::to_string(this->port).c_str(), &hints, &res) != 0) {
+      clog << "error: " << logstream::error << "no host found for " << this->host << std::endl;
+      return 1;
+    }
+    memcpy(&this->_addr, res->ai_addr, sizeof(this->_addr));
+    freeaddrinfo(res);
+    this->_resolved = true;
+  }
+
+  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sockfd < 0) {
+    clog << "error: " << logstream::error << "error opening socket" << std::endl;
+    return 1;
+  }
+
+  /* connect without blocking, then wait up to TELNET_CONNECT_TIMEOUT_SEC */
+  int opts = fcntl(sockfd, F_GETFL);
+  fcntl(sockfd, F_SETFL, opts | O_NONBLOCK);
+  int ret = connect(sockfd, (struct sockaddr *)&this->_addr, sizeof(this->_addr));
+  if (ret < 0 && errno == EINPROGRESS) {
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, TELNET_CONNECT_TIMEOUT_SEC * 1000) == 1) {
+      int so_error;
+      socklen_t len = sizeof so_error;
+      getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+      ret = (so_error == 0) ? 0 : -1;
+    }
+  }
+  if (ret < 0) {
+    clog << "error: " << logstream::error << "error connecting to " << this->host << " on port " << this->port << std::endl;
+    close(sockfd);
+    return 1;
+  }
+
+  /* commands are short, send them straight away */
+  fcntl(sockfd, F_SETFL, opts);
+  int one = 1;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  this->_sockfd = sockfd;
+  clog << "info: " << logstream::info << "connected to " << this->host << " on port " << this->port << std::endl;
+  return 0;
+}
+
+/**
+ * close the connection
+ */
+void TelnetSession::Disconnect() {
+
+  if (this->_sockfd >= 0) {
+    close(this->_sockfd);
+    this->_sockfd = -1;
+  }
+  this->_parser.Reset();
+}
+
+/**
+ * check the connection is open
+ * it is closed when the server closes it or a write fails
+ */
+bool TelnetSession::IsConnected() {
+
+  return this->_sockfd >= 0;
+}
+
+/**
+ * send a command and wait for its reply
+ * @param cmd the command, a line ending is added if missing
+ * @param expect if not empty, lines not containing it are skipped
+ * until one does or the timeout is reached
+ * @param timeout_ms how long to wait for the reply
+ * @return the reply without its line ending, "error" on failure
+ */
+std::string TelnetSession::Command(std::string cmd, std::string expect, int timeout_ms) {
+
+  std::vector<std::string> replies;
+  std::lock_guard<std::mutex> lock(this->_m_session);
+
+  Exchange(std::vector<std::string>(1, cmd), replies, expect, timeout_ms);
+  return replies[0];
+}
+
+/**
+ * add a command to be sent by the next Flush()
+ * @param cmd the command, a line ending is added if missing
+ */
+void TelnetSession::Queue(std::string cmd) {
+
+  std::lock_guard<std::mutex> lock(this->_m_session);
+  this->_queue.push_back(cmd);
+}
+
+/**
+ * send all the queued commands in one write, then read their replies
+ * @param timeout_ms how long to wait for each reply
+ * @return the replies, in the order of the commands, "error" for those not received
+ */
+std::vector<std::string> TelnetSession::Flush(int timeout_ms) {
+
+  std::vector<std::string> replies;
+  std::lock_guard<std::mutex> lock(this->_m_session);
+
+  std::vector<std::string> cmds;
+  cmds.swap(this->_queue);
+  if (!cmds.empty()) {
+    Exchange(cmds, replies, "", timeout_ms);
+  }
+  return replies;
+}
+
+/**
+ * send commands and read one reply for each.
+ * if the connection is lost before any reply, it is reopened
+ * and the commands sent again, once.
+ * called with _m_session held
+ * @param cmds the commands
+ * @param replies set to the replies, "error" for those not received
+ * @param expect if not empty, lines not containing it are skipped
+ * @param timeout_ms how long to wait for each reply
+ * @return 0 if all the replies were received, 1 otherwise
+ */
+int TelnetSession::Exchange(const std::vector<std::string> & cmds, std::vector<std::string> & replies,
+			    const std::string & expect, int timeout_ms) {
+
+  std::string send_msg;
+  for (const std::string & cmd : cmds) {
+    send_msg += cmd;
+    if (send_msg.empty() || send_msg.back() != '\n') {
+      send_msg += '\n';
+    }
+    std::string log_cmd = cmd;
+    log_cmd.erase(std::remove(log_cmd.begin(), log_cmd.end(), '\n'), log_cmd.end());
+    clog << "info: " << logstream::info << "sending via telnet: " << log_cmd << std::endl;
+  }
+  replies.assign(cmds.size(), "error");
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+
+    if (!IsConnected() && Connect() != 0) {
+      return 1;
+    }
+
+    /* a reply which came after its timeout would be taken for the next one */
+    DiscardInput();
+    if (SendAll(send_msg) != 0) {
+      clog << "warning: " << logstream::warning << "telnet connection to " << this->host << " lost, reconnecting" << std::endl;
+      Disconnect();
+      continue;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    size_t n_replies = 0;
+    int ret = 0;
+    while (n_replies < cmds.size()) {
+      std::string line;
+      ret = ReadLine(line, deadline);
+      if (ret != 0) {
+	break;
+      }
+      if (line.empty() || (!expect.empty() && line.find(expect) == std::string::npos)) {
+	continue;
+      }
+      clog << "info: " << logstream::info << "receiving via telnet: " << line << std::endl;
+      replies[n_replies++] = line;
+      deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+    if (n_replies == cmds.size()) {
+      return 0;
+    }
+
+    /* the server closed the connection before replying, try again */
+    if (ret < 0 && n_replies == 0) {
+      clog << "warning: " << logstream::warning << "telnet connection to " << this->host << " lost, reconnecting" << std::endl;
+      Disconnect();
+      continue;
+    }
+    clog << "error: " << logstream::error << "no reply via telnet after " << n_replies << " of "
+	 << cmds.size() << " commands" << std::endl;
+    return 1;
+  }
+
+  return 1;
+}
+
+/**
+ * write all of a message to the connection
+ * @return 0 on success, 1 on failure
+ */
+int TelnetSession::SendAll(const std::string & data) {
+
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = send(this->_sockfd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return 1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+/**
+ * read the next line from the connection.
+ * a reply split over several reads is waited for until its line ending arrives
+ * @param line set to the line, without its line ending
+ * @param deadline when to give up waiting
+ * @return 0 on success, 1 on timeout, -1 if the connection was closed
+ */
+int TelnetSession::ReadLine(std::string & line, std::chrono::steady_clock::time_point deadline) {
+
+  char buffer[256];
+  char reply[REPLY_MAX_LINE];
+  size_t reply_len;
+
+  while (!this->_parser.NextLine(reply, sizeof(reply), &reply_len)) {
+
+    int wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    struct pollfd pfd;
+    pfd.fd = this->_sockfd;
+    pfd.events = POLLIN;
+    int ready = poll(&pfd, 1, std::max(wait_ms, 0));
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ready <= 0) {
+      return 1;
+    }
+
+    /* only read what the parser can take, the rest stays in the socket */
+    ssize_t n = recv(this->_sockfd, buffer, std::min(sizeof(buffer), this->_parser.Free()), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      Disconnect();
+      return -1;
+    }
+    this->_parser.Feed(buffer, n);
+  }
+
+  line.assign(reply, reply_len);
+  return 0;
+}
+
+/**
+ * drop anything received but not asked for,
+ * such as the reply to a command which timed out
+ */
+void TelnetSession::DiscardInput() {
+
+  char buffer[256];
+  this->_parser.Reset();
+  while (recv(this->_sockfd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+  }
+}
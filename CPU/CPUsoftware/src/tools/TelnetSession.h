@@ -0,0 +1,89 @@
+#ifndef _TELNET_SESSION_H
+#define _TELNET_SESSION_H
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+
+#include "log.h"
+#include "ReplyParser.h"
+
+/* timeout for connecting, in seconds */
+#define TELNET_CONNECT_TIMEOUT_SEC 2
+/* timeout for the reply to each command, in ms */
+#define TELNET_REPLY_TIMEOUT_MS 5000
+
+/**
+ * long-lived telnet connection to a line-based command server such as the Zynq board.
+ * each command is answered by one line, so a reply is complete as soon as its
+ * line ending arrives, with no fixed wait between commands (see ReplyParser).
+ * commands can be queued and sent together, with the replies read back in order.
+ * the connection is opened on the first command and reopened if it is lost.
+ * thread safe, one command or batch is exchanged at a time
+ */
+class TelnetSession {
+public:
+  /**
+   * host name or IP of the server
+   */
+  std::string host;
+  /**
+   * port of the server
+   */
+  int port;
+
+  TelnetSession(std::string host, int port);
+  ~TelnetSession();
+  int Connect();
+  void Disconnect();
+  bool IsConnected();
+  std::string Command(std::string cmd, std::string expect = "", int timeout_ms = TELNET_REPLY_TIMEOUT_MS);
+  void Queue(std::string cmd);
+  std::vector<std::string> Flush(int timeout_ms = TELNET_REPLY_TIMEOUT_MS);
+
+private:
+  /**
+   * the connection, -1 if not connected
+   */
+  int _sockfd;
+  /**
+   * address of the server, looked up on the first connection
+   */
+  struct sockaddr_in _addr;
+  bool _resolved;
+  /**
+   * bytes read but not yet part of a complete reply
+   */
+  ReplyParser _parser;
+  /**
+   * commands waiting for Flush()
+   */
+  std::vector<std::string> _queue;
+  /**
+   * one exchange with the server at a time
+   */
+  std::mutex _m_session;
+
+  int Exchange(const std::vector<std::string> & cmds, std::vector<std::string> & replies,
+	       const std::string & expect, int timeout_ms);
+  int SendAll(const std::string & data);
+  int ReadLine(std::string & line, std::chrono::steady_clock::time_point deadline);
+  void DiscardInput();
+};
+
+#endif
+/* _TELNET_SESSION_H */
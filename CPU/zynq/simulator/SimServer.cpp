@@ -0,0 +1,411 @@
+#include "SimServer.h"
+
+/**
+ * constructor.
+ * does not listen until Listen()
+ * @param port the port to listen on
+ */
+SimServer::SimServer(int port) {
+
+  this->port = port;
+  this->_listen_fd = -1;
+}
+
+/**
+ * destructor
+ * stops listening
+ */
+SimServer::~SimServer() {
+
+  if (this->_listen_fd >= 0) {
+    close(this->_listen_fd);
+  }
+}
+
+/**
+ * start listening on all interfaces
+ * @return 0 on success, 1 on failure
+ */
+int SimServer::Listen() {
+
+  this->_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (this->_listen_fd < 0) {
+    perror("zynqsim: socket");
+    return 1;
+  }
+  int one = 1;
+  setsockopt(this->_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(this->port);
+  if (bind(this->_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+      || listen(this->_listen_fd, 8) != 0) {
+    std::cout << "zynqsim: cannot listen on port " << this->port << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * accept connections, each handled by Session() in its own thread
+ */
+void SimServer::Run() {
+
+  while (true) {
+    int fd = accept(this->_listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::thread(&SimServer::Session, this, fd).detach();
+  }
+}
+
+/**
+ * read the next line from a connection
+ * @param fd the connection
+ * @param buf bytes read but not yet used, kept between calls
+ * @param line set to the line, without \r or \n
+ * @return 0 on success, 1 if the connection was closed
+ */
+int SimServer::ReadLine(int fd, std::string & buf, std::string & line) {
+
+  char buffer[1024];
+  size_t pos;
+
+  while ((pos = buf.find('\n')) == std::string::npos) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return 1;
+    }
+    buf.append(buffer, n);
+  }
+
+  line = buf.substr(0, pos);
+  buf.erase(0, pos + 1);
+  line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+  return 0;
+}
+
+/**
+ * write all of a buffer to a connection
+ * @return 0 on success, 1 on failure
+ */
+int SimServer::SendAll(int fd, const char * data, size_t size) {
+
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = send(fd, data + done, size - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return 1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+
+/**
+ * constructor
+ * @param sim the simulated board carrying out the commands
+ */
+SimTelnetServer::SimTelnetServer(ZynqSim * sim) : SimServer(sim->opt.telnet_port) {
+
+  this->_sim = sim;
+  this->_n_cmds = 0;
+}
+
+/**
+ * answer commands until the connection is closed
+ * @param fd the connection
+ */
+void SimTelnetServer::Session(int fd) {
+
+  std::string buf, line;
+
+  while (ReadLine(fd, buf, line) == 0) {
+    if (line.empty()) {
+      continue;
+    }
+
+    unsigned int n = ++this->_n_cmds;
+    if (this->_sim->opt.telnet_drop_every > 0 && n % this->_sim->opt.telnet_drop_every == 0) {
+      std::cout << "zynqsim: dropping the telnet connection on \"" << line << "\"" << std::endl;
+      break;
+    }
+    if (this->_sim->opt.reply_delay_ms > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(this->_sim->opt.reply_delay_ms));
+    }
+
+    std::string reply = this->_sim->Command(line) + "\r\n";
+    if (SendAll(fd, reply.data(), reply.size()) != 0) {
+      break;
+    }
+  }
+
+  close(fd);
+}
+
+
+/**
+ * constructor
+ * @param sim the simulated board writing the files served
+ */
+SimFtpServer::SimFtpServer(ZynqSim * sim) : SimServer(sim->opt.ftp_port) {
+
+  this->_sim = sim;
+  this->_n_transfers = 0;
+}
+
+/**
+ * answer FTP commands until the connection is closed
+ * @param fd the control connection
+ */
+void SimFtpServer::Session(int fd) {
+
+  std::string buf, line;
+  std::string dir = this->_sim->opt.ftp_dir;
+  int pasv_fd = -1;
+  struct sockaddr_in port_addr;
+  memset(&port_addr, 0, sizeof(port_addr));
+
+  Reply(fd, "220 zynqsim FTP server");
+
+  while (ReadLine(fd, buf, line) == 0) {
+
+    std::string cmd = line.substr(0, line.find(' '));
+    std::string arg = (line.find(' ') != std::string::npos) ? line.substr(line.find(' ') + 1) : "";
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    /* only the file name, the server has a single directory */
+    std::string name = arg.substr(arg.rfind('/') == std::string::npos ? 0 : arg.rfind('/') + 1);
+
+    if (cmd == "USER") {
+      Reply(fd, "331 password required");
+    }
+    else if (cmd == "PASS") {
+      Reply(fd, "230 logged in");
+    }
+    else if (cmd == "SYST") {
+      Reply(fd, "215 UNIX Type: L8");
+    }
+    else if (cmd == "PWD") {
+      Reply(fd, "257 \"/\"");
+    }
+    else if (cmd == "CWD" || cmd == "CDUP") {
+      Reply(fd, "250 directory unchanged");
+    }
+    else if (cmd == "TYPE" || cmd == "NOOP" || cmd == "MODE" || cmd == "STRU") {
+      Reply(fd, "200 ok");
+    }
+    else if (cmd == "PORT") {
+      unsigned int h1, h2, h3, h4, p1, p2;
+      if (sscanf(arg.c_str(), "%u,%u,%u,%u,%u,%u", &h1, &h2, &h3, &h4, &p1, &p2) != 6) {
+	Reply(fd, "501 bad PORT");
+	continue;
+      }
+      port_addr.sin_family = AF_INET;
+      port_addr.sin_addr.s_addr = htonl((h1 << 24) | (h2 << 16) | (h3 << 8) | h4);
+      port_addr.sin_port = htons((p1 << 8) | p2);
+      if (pasv_fd >= 0) {
+	close(pasv_fd);
+	pasv_fd = -1;
+      }
+      Reply(fd, "200 PORT ok");
+    }
+    else if (cmd == "PASV") {
+      if (pasv_fd >= 0) {
+	close(pasv_fd);
+      }
+      pasv_fd = socket(AF_INET, SOCK_STREAM, 0);
+      struct sockaddr_in addr;
+      socklen_t len = sizeof(addr);
+      /* listen on the address the client reached us on */
+      getsockname(fd, (struct sockaddr *)&addr, &len);
+      addr.sin_port = 0;
+      if (pasv_fd < 0 || bind(pasv_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+	  || listen(pasv_fd, 1) != 0) {
+	Reply(fd, "425 cannot open data connection");
+	continue;
+      }
+      getsockname(pasv_fd, (struct sockaddr *)&addr, &len);
+      uint32_t ip = ntohl(addr.sin_addr.s_addr);
+      uint16_t p = ntohs(addr.sin_port);
+      char reply[128];
+      snprintf(reply, sizeof(reply), "227 Entering Passive Mode (%u,%u,%u,%u,%u,%u)",
+	       ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, p >> 8, p & 0xFF);
+      Reply(fd, reply);
+    }
+    else if (cmd == "NLST" || cmd == "LIST") {
+      std::string listing;
+      for (const std::string & file : ListFiles()) {
+	if (cmd == "NLST") {
+	  listing += file + "\r\n";
+	}
+	else {
+	  /* ls -l format, as parsed by lftp */
+	  struct stat st;
+	  stat((dir + "/" + file).c_str(), &st);
+	  char entry[512];
+	  snprintf(entry, sizeof(entry), "-rw-r--r-- 1 zynq zynq %lld Jan  1 00:00 %s\r\n",
+		   (long long)st.st_size, file.c_str());
+	  listing += entry;
+	}
+      }
+      Reply(fd, "150 listing");
+      int data_fd = OpenData(pasv_fd, port_addr);
+      pasv_fd = -1;
+      if (data_fd < 0) {
+	Reply(fd, "425 cannot open data connection");
+	continue;
+      }
+      SendAll(data_fd, listing.data(), listing.size());
+      close(data_fd);
+      Reply(fd, "226 done");
+    }
+    else if (cmd == "SIZE") {
+      struct stat st;
+      if (stat((dir + "/" + name).c_str(), &st) != 0) {
+	Reply(fd, "550 no such file");
+	continue;
+      }
+      Reply(fd, "213 " + std::to_string((long long)st.st_size));
+    }
+    else if (cmd == "RETR") {
+      FILE * file = fopen((dir + "/" + name).c_str(), "rb");
+      if (file == NULL) {
+	Reply(fd, "550 no such file");
+	continue;
+      }
+      struct stat st;
+      fstat(fileno(file), &st);
+      Reply(fd, "150 opening data connection");
+      int data_fd = OpenData(pasv_fd, port_addr);
+      pasv_fd = -1;
+      if (data_fd < 0) {
+	fclose(file);
+	Reply(fd, "425 cannot open data connection");
+	continue;
+      }
+
+      /* a dropped transfer stops half way, the client has to notice the short file */
+      unsigned int n = ++this->_n_transfers;
+      off_t limit = st.st_size;
+      if (this->_sim->opt.ftp_drop_every > 0 && n % this->_sim->opt.ftp_drop_every == 0) {
+	std::cout << "zynqsim: dropping the FTP transfer of " << name << std::endl;
+	limit /= 2;
+      }
+
+      std::vector<char> chunk(SIM_FTP_CHUNK);
+      off_t sent = 0;
+      bool ok = true;
+      while (sent < limit) {
+	size_t len = fread(chunk.data(), 1, std::min((off_t)chunk.size(), limit - sent), file);
+	if (len == 0 || SendAll(data_fd, chunk.data(), len) != 0) {
+	  ok = false;
+	  break;
+	}
+	sent += len;
+      }
+      fclose(file);
+      close(data_fd);
+      if (limit < st.st_size) {
+	/* the control connection goes with it, as when the board resets */
+	break;
+      }
+      Reply(fd, ok ? "226 transfer complete" : "426 transfer aborted");
+    }
+    else if (cmd == "DELE") {
+      if (unlink((dir + "/" + name).c_str()) != 0) {
+	Reply(fd, "550 no such file");
+	continue;
+      }
+      Reply(fd, "250 deleted");
+    }
+    else if (cmd == "QUIT") {
+      Reply(fd, "221 bye");
+      break;
+    }
+    else {
+      Reply(fd, "502 not implemented");
+    }
+  }
+
+  if (pasv_fd >= 0) {
+    close(pasv_fd);
+  }
+  close(fd);
+}
+
+/**
+ * open the data connection of a transfer,
+ * accepting on the PASV socket or connecting to the PORT address
+ * @param pasv_fd the passive listening socket, -1 in active mode, closed here
+ * @param port_addr the address from PORT, used in active mode
+ * @return the data connection, -1 on failure
+ */
+int SimFtpServer::OpenData(int pasv_fd, const struct sockaddr_in & port_addr) {
+
+  int data_fd;
+
+  if (pasv_fd >= 0) {
+    data_fd = accept(pasv_fd, NULL, NULL);
+    close(pasv_fd);
+    return data_fd;
+  }
+
+  if (port_addr.sin_family != AF_INET) {
+    return -1;
+  }
+  data_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (data_fd < 0) {
+    return -1;
+  }
+  if (connect(data_fd, (const struct sockaddr *)&port_addr, sizeof(port_addr)) != 0) {
+    close(data_fd);
+    return -1;
+  }
+  return data_fd;
+}
+
+/**
+ * the files waiting on the server, oldest name first, without the hidden ones being written
+ */
+std::vector<std::string> SimFtpServer::ListFiles() {
+
+  std::vector<std::string> files;
+  DIR * dir = opendir(this->_sim->opt.ftp_dir.c_str());
+  if (dir == NULL) {
+    return files;
+  }
+  struct dirent * entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      files.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+/**
+ * send a reply line on the control connection
+ */
+int SimFtpServer::Reply(int fd, const std::string & reply) {
+
+  std::string line = reply + "\r\n";
+  return SendAll(fd, line.data(), line.size());
+}
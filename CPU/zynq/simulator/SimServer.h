@@ -0,0 +1,85 @@
+#ifndef _SIM_SERVER_H
+#define _SIM_SERVER_H
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ZynqSim.h"
+
+/* size of each write of an FTP transfer */
+#define SIM_FTP_CHUNK (64 * 1024)
+
+/**
+ * TCP server handing each connection to its own thread
+ */
+class SimServer {
+public:
+  int port;
+
+  SimServer(int port);
+  virtual ~SimServer();
+  int Listen();
+  void Run();
+
+protected:
+  int _listen_fd;
+
+  virtual void Session(int fd) = 0;
+  static int ReadLine(int fd, std::string & buf, std::string & line);
+  static int SendAll(int fd, const char * data, size_t size);
+};
+
+/**
+ * the telnet server of the Zynq board.
+ * each command line gets a one line reply from ZynqSim::Command()
+ */
+class SimTelnetServer : public SimServer {
+public:
+  SimTelnetServer(ZynqSim * sim);
+
+private:
+  ZynqSim * _sim;
+  /**
+   * commands received over all connections, for dropping every Nth
+   */
+  std::atomic<unsigned int> _n_cmds;
+
+  void Session(int fd);
+};
+
+/**
+ * the FTP server of the Zynq board, serving the files written by ZynqSim.
+ * has the commands used by FtpClient and by lftp mirror, in active and passive mode
+ */
+class SimFtpServer : public SimServer {
+public:
+  SimFtpServer(ZynqSim * sim);
+
+private:
+  ZynqSim * _sim;
+  /**
+   * transfers over all connections, for dropping every Nth
+   */
+  std::atomic<unsigned int> _n_transfers;
+
+  void Session(int fd);
+  int OpenData(int pasv_fd, const struct sockaddr_in & port_addr);
+  std::vector<std::string> ListFiles();
+  static int Reply(int fd, const std::string & reply);
+};
+
+#endif
+/* _SIM_SERVER_H */
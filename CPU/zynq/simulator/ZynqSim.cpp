@@ -0,0 +1,502 @@
+#include "ZynqSim.h"
+
+/**
+ * constructor.
+ * nothing is produced until Start()
+ * @param opt the settings
+ */
+ZynqSim::ZynqSim(const SimOptions & opt) {
+
+  this->opt = opt;
+  this->_mode = 0;
+  this->_N1 = opt.N1;
+  this->_N2 = opt.N2;
+  this->_hv_on = false;
+  this->_ec_values.assign(SIM_N_EC, 0);
+  this->_scurve_running = false;
+  this->_scurve_threshold = 0;
+  this->_trigger = false;
+  this->_stop = false;
+  this->_template_N1 = -1;
+  this->_template_N2 = -1;
+  this->_n_frm = 0;
+  this->_n_files = 0;
+  this->_n_bytes = 0;
+  this->_start = std::chrono::steady_clock::now();
+}
+
+/**
+ * destructor
+ * stops the threads
+ */
+ZynqSim::~ZynqSim() {
+
+  Stop();
+}
+
+/**
+ * start writing files
+ */
+void ZynqSim::Start() {
+
+  mkdir(OutDir().c_str(), 0755);
+  this->_start = std::chrono::steady_clock::now();
+  this->_producer = std::thread(&ZynqSim::Produce, this);
+}
+
+/**
+ * stop writing files, waiting for an S-curve in progress to be cut short
+ */
+void ZynqSim::Stop() {
+
+  {
+    std::unique_lock<std::mutex> lock(this->_m_state);
+    this->_stop = true;
+  }
+  this->_cv_produce.notify_all();
+  if (this->_producer.joinable()) {
+    this->_producer.join();
+  }
+  if (this->_scurve.joinable()) {
+    this->_scurve.join();
+  }
+}
+
+/**
+ * carry out a telnet command
+ * @param cmd the command, without line ending
+ * @return the reply, one line without line ending
+ */
+std::string ZynqSim::Command(const std::string & cmd) {
+
+  std::istringstream in(cmd);
+  std::string group, name;
+  in >> group >> name;
+
+  std::unique_lock<std::mutex> lock(this->_m_state);
+
+  if (group == "instrument") {
+    if (name == "status") {
+      return std::to_string(SIM_STATUS_OK) + " " + std::to_string(this->_mode);
+    }
+    if (name == "mode") {
+      int mode;
+      if (!(in >> mode)) {
+	return "Error: missing mode";
+      }
+      this->_mode = mode;
+      lock.unlock();
+      this->_cv_produce.notify_all();
+      return "Ok";
+    }
+    if (name == "ver") {
+      return std::string(MINIEUSO_ZYNQ_VER_STRING) + " (simulator)";
+    }
+  }
+
+  else if (group == "acq") {
+    if (name == "scurve") {
+      std::string arg;
+      in >> arg;
+      if (arg == "status") {
+	return "GatheringInProgress=" + std::to_string(this->_scurve_running ? 1 : 0)
+	  + " CurrentThreshold=" + std::to_string(this->_scurve_threshold);
+      }
+      int start, step, stop;
+      std::istringstream args(arg);
+      if (!(args >> start) || !(in >> step >> stop) || step <= 0 || start > stop
+	  || stop >= NMAX_OF_THESHOLDS) {
+	return "Error: bad S-curve parameters";
+      }
+      if (this->_scurve_running) {
+	return "Error: S-curve in progress";
+      }
+      this->_scurve_running = true;
+      this->_scurve_threshold = start;
+      if (this->_scurve.joinable()) {
+	this->_scurve.join();
+      }
+      this->_scurve = std::thread(&ZynqSim::RunScurve, this, start, step, stop);
+      return "Ok";
+    }
+    if (name == "shot") {
+      this->_trigger = true;
+      lock.unlock();
+      this->_cv_produce.notify_all();
+      return "Ok";
+    }
+    if (name == "test") {
+      return "Ok";
+    }
+  }
+
+  else if (group == "trg") {
+    this->_trigger = true;
+    lock.unlock();
+    this->_cv_produce.notify_all();
+    return "Ok";
+  }
+
+  else if (group == "hvps") {
+    if (name == "status") {
+      std::string status;
+      for (int i = 0; i < SIM_N_EC; i++) {
+	/* 3: on and at the correct voltage */
+	status += (i > 0 ? " " : "") + std::to_string(this->_hv_on && this->_ec_values[i] ? 3 : 0);
+      }
+      return status;
+    }
+    if (name == "turnon") {
+      for (int i = 0; i < SIM_N_EC; i++) {
+	if (!(in >> this->_ec_values[i])) {
+	  this->_ec_values[i] = 0;
+	}
+      }
+      this->_hv_on = true;
+      LogHv(HVPS_TURN_ON);
+      return "Ok";
+    }
+    if (name == "turnoff") {
+      this->_hv_on = false;
+      LogHv(HVPS_TURN_OFF);
+      return "Ok";
+    }
+    if (name == "setdac") {
+      LogHv(HVPS_DACS_LOADED);
+      return "Ok";
+    }
+    if (name == "cathode") {
+      return "Ok";
+    }
+  }
+
+  else if (group == "mmg") {
+    int n;
+    if (!(in >> n) || n < 0 || n > 255) {
+      return "Error: bad number of packets";
+    }
+    if (name == "N1") {
+      this->_N1 = n;
+      return "Ok";
+    }
+    if (name == "N2") {
+      this->_N2 = n;
+      return "Ok";
+    }
+  }
+
+  else if (group == "trig" || group == "slowctrl") {
+    return "Ok";
+  }
+
+  return "Unknown command: " + cmd;
+}
+
+/**
+ * print the files written so far and how many wait to be collected
+ */
+void ZynqSim::PrintStats() {
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->_start).count();
+  double mb = this->_n_bytes / (1024.0 * 1024.0);
+
+  std::cout << "zynqsim: " << elapsed << " s, " << this->_n_frm << " frm_cc files, "
+	    << this->_n_files << " files in all, " << mb << " MB ("
+	    << (elapsed > 0 ? mb / elapsed : 0) << " MB/s), "
+	    << Backlog() << " not yet collected" << std::endl;
+}
+
+/**
+ * write a frm_cc file every 1 / rate seconds while acquiring,
+ * or straight away on a trigger, and the HV log every hv_period_sec
+ */
+void ZynqSim::Produce() {
+
+  auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>
+    (std::chrono::duration<double>(1.0 / this->opt.rate));
+  auto hv_interval = std::chrono::seconds(this->opt.hv_period_sec);
+  auto next = std::chrono::steady_clock::now() + interval;
+  auto hv_next = std::chrono::steady_clock::now() + hv_interval;
+
+  std::unique_lock<std::mutex> lock(this->_m_state);
+  while (!this->_stop) {
+
+    auto wake = next;
+    if (this->opt.hv_period_sec > 0 && hv_next < wake) {
+      wake = hv_next;
+    }
+    this->_cv_produce.wait_until(lock, wake, [this] { return this->_stop || this->_trigger; });
+    if (this->_stop) {
+      break;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool acquiring = (this->_mode & SIM_TRIGGER_MODES) && !this->_scurve_running
+      && (this->opt.max_files == 0 || this->_n_frm < this->opt.max_files);
+
+    if (this->_trigger || (acquiring && now >= next)) {
+      this->_trigger = false;
+      lock.unlock();
+      WriteFrm();
+      lock.lock();
+    }
+    if (now >= next) {
+      /* catch up after a slow write, but never by more than one file */
+      next += interval;
+      if (next < now) {
+	next = now + interval;
+      }
+    }
+
+    if (this->opt.hv_period_sec > 0 && now >= hv_next) {
+      hv_next = now + hv_interval;
+      if (!this->_hv_log.empty()) {
+	lock.unlock();
+	WriteHv();
+	lock.lock();
+      }
+    }
+  }
+}
+
+/**
+ * step through the thresholds of an S-curve, then write the scurve file
+ * @param start first threshold
+ * @param step between thresholds
+ * @param stop last threshold
+ */
+void ZynqSim::RunScurve(int start, int step, int stop) {
+
+  for (int thr = start; thr <= stop; thr += step) {
+    {
+      std::unique_lock<std::mutex> lock(this->_m_state);
+      if (this->_stop) {
+	this->_scurve_running = false;
+	return;
+      }
+      this->_scurve_threshold = thr;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(this->opt.scurve_step_ms));
+  }
+
+  /* only the header is filled, the counts are left empty */
+  std::vector<char> data(sizeof(Z_DATA_TYPE_SCURVE_V1), 0);
+  ZynqBoardHeader * zbh = (ZynqBoardHeader *)data.data();
+  zbh->header = BuildHeader(DATA_TYPE_SCURVE, 1);
+  zbh->payload_size = sizeof(DATA_TYPE_SCURVE_V1);
+
+  static unsigned int n_scurve = 0;
+  char name[64];
+  snprintf(name, sizeof(name), FILENAME_SCURVE, n_scurve++);
+  WriteFile(name, data.data(), data.size());
+
+  std::unique_lock<std::mutex> lock(this->_m_state);
+  this->_scurve_running = false;
+}
+
+/**
+ * write one frm_cc file with the current N1 and N2
+ */
+void ZynqSim::WriteFrm() {
+
+  int N1, N2;
+  {
+    std::unique_lock<std::mutex> lock(this->_m_state);
+    N1 = this->_N1;
+    N2 = this->_N2;
+  }
+  if (N1 != this->_template_N1 || N2 != this->_template_N2) {
+    MakeTemplate(N1, N2);
+  }
+
+  /* only the time stamps change from one file to the next */
+  uint32_t unix_time = time(NULL);
+  uint32_t n_gtu = this->_n_frm * N_FRAMES_PER_LIFECYCLE;
+  char * ptr = this->_frm_template.data();
+  for (int i = 0; i < N1; i++, ptr += sizeof(Z_DATA_TYPE_SCI_L1_V2)) {
+    Z_DATA_TYPE_SCI_L1_V2 * l1 = (Z_DATA_TYPE_SCI_L1_V2 *)ptr;
+    l1->payload.ts.n_gtu = n_gtu;
+    l1->payload.ts.unix_time = unix_time;
+  }
+  for (int i = 0; i < N2; i++, ptr += sizeof(Z_DATA_TYPE_SCI_L2_V2)) {
+    Z_DATA_TYPE_SCI_L2_V2 * l2 = (Z_DATA_TYPE_SCI_L2_V2 *)ptr;
+    l2->payload.ts.n_gtu = n_gtu;
+    l2->payload.ts.unix_time = unix_time;
+  }
+  Z_DATA_TYPE_SCI_L3_V2 * l3 = (Z_DATA_TYPE_SCI_L3_V2 *)ptr;
+  l3->payload.ts.n_gtu = n_gtu;
+  l3->payload.ts.unix_time = unix_time;
+
+  char name[64];
+  snprintf(name, sizeof(name), FILENAME_CONCATED, (unsigned int)this->_n_frm);
+  WriteFile(name, this->_frm_template.data(), this->_frm_template.size());
+  this->_n_frm++;
+}
+
+/**
+ * write the HV log records gathered since the last HV file
+ */
+void ZynqSim::WriteHv() {
+
+  std::vector<DATA_TYPE_HVPS_LOG_V1> records;
+  {
+    std::unique_lock<std::mutex> lock(this->_m_state);
+    records.swap(this->_hv_log);
+  }
+
+  std::vector<char> data(sizeof(ZynqBoardHeader) + records.size() * sizeof(DATA_TYPE_HVPS_LOG_V1));
+  ZynqBoardHeader * zbh = (ZynqBoardHeader *)data.data();
+  zbh->header = BuildHeader(DATA_TYPE_HV_STATUS, 1);
+  zbh->payload_size = records.size() * sizeof(DATA_TYPE_HVPS_LOG_V1);
+  memcpy(data.data() + sizeof(ZynqBoardHeader), records.data(), zbh->payload_size);
+
+  /* named as expected by DataAcquisition::ProcessIncomingData() */
+  static unsigned int n_hv = 0;
+  char name[64];
+  snprintf(name, sizeof(name), "HV_%08u.dat", n_hv++);
+  WriteFile(name, data.data(), data.size());
+}
+
+/**
+ * write a file where the CPU collects it.
+ * files for FTP are written under a hidden name, then renamed,
+ * so that they are not listed before they are complete.
+ * files written to out_dir keep their name, so that the CPU
+ * sees them when they are closed, as with the FTP server
+ * @param name the file name
+ * @param data the contents
+ * @param size the size of the contents
+ */
+void ZynqSim::WriteFile(const std::string & name, const char * data, size_t size) {
+
+  unsigned int n = ++this->_n_files;
+  if (this->opt.truncate_every > 0 && n % this->opt.truncate_every == 0) {
+    std::cout << "zynqsim: truncating " << name << std::endl;
+    size /= 2;
+  }
+
+  std::string path = OutDir() + "/" + name;
+  std::string tmp_path = this->opt.out_dir.empty() ? OutDir() + "/." + name : path;
+
+  FILE * file = fopen(tmp_path.c_str(), "wb");
+  if (file == NULL) {
+    std::cout << "zynqsim: cannot open " << tmp_path << std::endl;
+    return;
+  }
+  size_t written = fwrite(data, 1, size, file);
+  fclose(file);
+  if (written != size) {
+    std::cout << "zynqsim: failed to write " << tmp_path << std::endl;
+  }
+  if (tmp_path != path) {
+    rename(tmp_path.c_str(), path.c_str());
+  }
+  this->_n_bytes += written;
+}
+
+/**
+ * add a record to the HV log.
+ * called with _m_state held
+ * @param record_type HVPS_TURN_ON, HVPS_TURN_OFF...
+ */
+void ZynqSim::LogHv(uint32_t record_type) {
+
+  if (this->_hv_log.size() >= HVPS_LOG_SIZE_NRECORDS) {
+    return;
+  }
+
+  DATA_TYPE_HVPS_LOG_V1 record;
+  record.ts.n_gtu = this->_n_frm * N_FRAMES_PER_LIFECYCLE;
+  record.ts.unix_time = time(NULL);
+  record.record_type = record_type;
+  record.channels = 0;
+  for (int i = 0; i < SIM_N_EC; i++) {
+    record.channels |= (this->_ec_values[i] & 3) << (2 * i);
+  }
+  this->_hv_log.push_back(record);
+}
+
+/**
+ * make the frm_cc file contents for N1 and N2,
+ * with the low counts of a dark background
+ * @param N1 number of L1 blocks
+ * @param N2 number of L2 blocks
+ */
+void ZynqSim::MakeTemplate(int N1, int N2) {
+
+  size_t size = N1 * sizeof(Z_DATA_TYPE_SCI_L1_V2) + N2 * sizeof(Z_DATA_TYPE_SCI_L2_V2)
+    + sizeof(Z_DATA_TYPE_SCI_L3_V2);
+  this->_frm_template.assign(size, 0);
+  this->_template_N1 = N1;
+  this->_template_N2 = N2;
+
+  /* xorshift, the same data on every run */
+  uint32_t x = 2463534242u;
+  auto next = [&x]() {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+  };
+
+  char * ptr = this->_frm_template.data();
+  for (int i = 0; i < N1; i++, ptr += sizeof(Z_DATA_TYPE_SCI_L1_V2)) {
+    Z_DATA_TYPE_SCI_L1_V2 * l1 = (Z_DATA_TYPE_SCI_L1_V2 *)ptr;
+    l1->zbh.header = BuildHeader(DATA_TYPE_SCI_L1, 2);
+    l1->zbh.payload_size = sizeof(DATA_TYPE_SCI_L1_V2);
+    l1->payload.trig_type = TRIG_PERIODIC;
+    for (int f = 0; f < N_OF_FRAMES_L1_V0; f++) {
+      for (int p = 0; p < N_OF_PIXEL_PER_PDM; p++) {
+	l1->payload.raw_data[f][p] = ((next() & 7) == 0);
+      }
+    }
+  }
+  for (int i = 0; i < N2; i++, ptr += sizeof(Z_DATA_TYPE_SCI_L2_V2)) {
+    Z_DATA_TYPE_SCI_L2_V2 * l2 = (Z_DATA_TYPE_SCI_L2_V2 *)ptr;
+    l2->zbh.header = BuildHeader(DATA_TYPE_SCI_L2, 2);
+    l2->zbh.payload_size = sizeof(DATA_TYPE_SCI_L2_V2);
+    l2->payload.trig_type = TRIG_PERIODIC;
+    for (int f = 0; f < N_OF_FRAMES_L2_V0; f++) {
+      for (int p = 0; p < N_OF_PIXEL_PER_PDM; p++) {
+	l2->payload.int16_data[f][p] = 16 + (next() & 7);
+      }
+    }
+  }
+  Z_DATA_TYPE_SCI_L3_V2 * l3 = (Z_DATA_TYPE_SCI_L3_V2 *)ptr;
+  l3->zbh.header = BuildHeader(DATA_TYPE_SCI_L3, 2);
+  l3->zbh.payload_size = sizeof(DATA_TYPE_SCI_L3_V2);
+  l3->payload.trig_type = TRIG_PERIODIC;
+  for (int f = 0; f < N_OF_FRAMES_L3_V0; f++) {
+    for (int p = 0; p < N_OF_PIXEL_PER_PDM; p++) {
+      l3->payload.int32_data[f][p] = 2048 + (next() & 63);
+    }
+  }
+}
+
+/**
+ * directory the files are written to
+ */
+std::string ZynqSim::OutDir() {
+
+  return this->opt.out_dir.empty() ? this->opt.ftp_dir : this->opt.out_dir;
+}
+
+/**
+ * number of files written and not yet collected by the CPU
+ */
+size_t ZynqSim::Backlog() {
+
+  size_t n = 0;
+  DIR * dir = opendir(OutDir().c_str());
+  if (dir == NULL) {
+    return 0;
+  }
+  struct dirent * entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      n++;
+    }
+  }
+  closedir(dir);
+  return n;
+}
@@ -0,0 +1,156 @@
+#ifndef _ZYNQ_SIM_H
+#define _ZYNQ_SIM_H
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "minieuso_data_format.h"
+
+/* default lifecycle of the real board, in seconds */
+#define SIM_LIFECYCLE_SEC 5.24288
+/* number of EC units reported by "hvps status gpio" */
+#define SIM_N_EC 9
+/* status code reported by "instrument status" */
+#define SIM_STATUS_OK 40
+/* trigger bits of the instrument mode which produce frm_cc files */
+#define SIM_TRIGGER_MODES 62
+
+/**
+ * settings of the simulator, from the command line
+ */
+struct SimOptions {
+  int telnet_port = 23;
+  int ftp_port = 21;
+  /**
+   * files are made available here for FTP
+   */
+  std::string ftp_dir = "/tmp/zynqsim";
+  /**
+   * if set, files are written here directly instead (such as DATA_DIR)
+   */
+  std::string out_dir = "";
+  /**
+   * frm_cc files per second while acquiring
+   */
+  double rate = 1.0 / SIM_LIFECYCLE_SEC;
+  /**
+   * initial N1 and N2, changed by "mmg N1" and "mmg N2"
+   */
+  int N1 = 4;
+  int N2 = 4;
+  /**
+   * seconds between HV files while the HV is on, 0 for none
+   */
+  int hv_period_sec = 60;
+  /**
+   * time taken by each threshold of an S-curve, in ms
+   */
+  int scurve_step_ms = 10;
+  /**
+   * stop acquiring after this many frm_cc files, 0 for no limit
+   */
+  unsigned int max_files = 0;
+
+  /* fault injection, 0 to disable */
+  /**
+   * delay before each telnet reply, in ms
+   */
+  int reply_delay_ms = 0;
+  /**
+   * close the telnet connection instead of answering every Nth command
+   */
+  unsigned int telnet_drop_every = 0;
+  /**
+   * write every Nth file with only half of its contents
+   */
+  unsigned int truncate_every = 0;
+  /**
+   * close the data connection half way through every Nth FTP transfer
+   */
+  unsigned int ftp_drop_every = 0;
+};
+
+/**
+ * stand-in for the Zynq board of the PDM.
+ * keeps the state changed by the telnet commands used by ZynqManager,
+ * and writes frm_cc, scurve and HV files as the board would,
+ * at a configurable rate
+ */
+class ZynqSim {
+public:
+  SimOptions opt;
+
+  ZynqSim(const SimOptions & opt);
+  ~ZynqSim();
+  void Start();
+  void Stop();
+  std::string Command(const std::string & cmd);
+  void PrintStats();
+
+private:
+  /**
+   * state set by the telnet commands
+   */
+  std::mutex _m_state;
+  int _mode;
+  int _N1;
+  int _N2;
+  bool _hv_on;
+  std::vector<int> _ec_values;
+  bool _scurve_running;
+  int _scurve_threshold;
+  /**
+   * HV log records since the last HV file
+   */
+  std::vector<DATA_TYPE_HVPS_LOG_V1> _hv_log;
+
+  /**
+   * wakes up the producer on a mode change, a trigger or stopping
+   */
+  std::condition_variable _cv_produce;
+  bool _trigger;
+  bool _stop;
+  std::thread _producer;
+  std::thread _scurve;
+
+  /**
+   * frm_cc file contents, made once for each N1 and N2
+   */
+  std::vector<char> _frm_template;
+  int _template_N1;
+  int _template_N2;
+
+  /**
+   * counters for the statistics
+   */
+  std::atomic<unsigned int> _n_frm;
+  std::atomic<unsigned int> _n_files;
+  std::atomic<unsigned long long> _n_bytes;
+  std::chrono::steady_clock::time_point _start;
+
+  void Produce();
+  void RunScurve(int start, int step, int stop);
+  void WriteFrm();
+  void WriteHv();
+  void WriteFile(const std::string & name, const char * data, size_t size);
+  void LogHv(uint32_t record_type);
+  void MakeTemplate(int N1, int N2);
+  std::string OutDir();
+  size_t Backlog();
+};
+
+#endif
+/* _ZYNQ_SIM_H */
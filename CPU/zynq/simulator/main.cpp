@@ -0,0 +1,130 @@
+/*
+ * zynqsim - stand-in for the Zynq board of the Mini-EUSO PDM
+ *
+ * serves the telnet commands used by ZynqManager and the FTP transfers
+ * used by DataAcquisition, and writes frm_cc, scurve and HV files
+ * at a configurable rate, to run mecontrol without the real board.
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ZynqSim.h"
+#include "SimServer.h"
+
+static void PrintHelp() {
+
+  std::cout << "usage: zynqsim [options]" << std::endl;
+  std::cout << "  -telnet_port N     telnet port (default 23)" << std::endl;
+  std::cout << "  -ftp_port N        FTP port (default 21)" << std::endl;
+  std::cout << "  -ftp_dir DIR       directory of the files served over FTP (default /tmp/zynqsim)" << std::endl;
+  std::cout << "  -out DIR           write the files straight to DIR instead, such as DATA_DIR" << std::endl;
+  std::cout << "  -rate R            frm_cc files per second while acquiring (default 1/5.24)" << std::endl;
+  std::cout << "  -n1 N, -n2 N       initial N1 and N2 (default 4), changed by mmg N1/N2" << std::endl;
+  std::cout << "  -hv_period S       seconds between HV files, 0 for none (default 60)" << std::endl;
+  std::cout << "  -scurve_step MS    time per S-curve threshold (default 10)" << std::endl;
+  std::cout << "  -max_files N       stop acquiring after N frm_cc files" << std::endl;
+  std::cout << "  -stats S           print statistics every S seconds (default 10)" << std::endl;
+  std::cout << "fault injection:" << std::endl;
+  std::cout << "  -delay MS          delay each telnet reply" << std::endl;
+  std::cout << "  -drop_telnet N     close the telnet connection on every Nth command" << std::endl;
+  std::cout << "  -truncate N        write every Nth file with half its contents" << std::endl;
+  std::cout << "  -drop_ftp N        cut every Nth FTP transfer half way" << std::endl;
+}
+
+int main(int argc, char ** argv) {
+
+  SimOptions opt;
+  int stats_sec = 10;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-help") {
+      PrintHelp();
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      std::cout << "zynqsim: missing value for " << arg << std::endl;
+      PrintHelp();
+      return 1;
+    }
+    std::string value = argv[++i];
+
+    if (arg == "-telnet_port") opt.telnet_port = atoi(value.c_str());
+    else if (arg == "-ftp_port") opt.ftp_port = atoi(value.c_str());
+    else if (arg == "-ftp_dir") opt.ftp_dir = value;
+    else if (arg == "-out") opt.out_dir = value;
+    else if (arg == "-rate") opt.rate = atof(value.c_str());
+    else if (arg == "-n1") opt.N1 = atoi(value.c_str());
+    else if (arg == "-n2") opt.N2 = atoi(value.c_str());
+    else if (arg == "-hv_period") opt.hv_period_sec = atoi(value.c_str());
+    else if (arg == "-scurve_step") opt.scurve_step_ms = atoi(value.c_str());
+    else if (arg == "-max_files") opt.max_files = atoi(value.c_str());
+    else if (arg == "-stats") stats_sec = atoi(value.c_str());
+    else if (arg == "-delay") opt.reply_delay_ms = atoi(value.c_str());
+    else if (arg == "-drop_telnet") opt.telnet_drop_every = atoi(value.c_str());
+    else if (arg == "-truncate") opt.truncate_every = atoi(value.c_str());
+    else if (arg == "-drop_ftp") opt.ftp_drop_every = atoi(value.c_str());
+    else {
+      std::cout << "zynqsim: unknown option " << arg << std::endl;
+      PrintHelp();
+      return 1;
+    }
+  }
+  if (opt.rate <= 0) {
+    std::cout << "zynqsim: the rate must be positive" << std::endl;
+    return 1;
+  }
+
+  ZynqSim sim_board(opt);
+  ZynqSim * sim = &sim_board;
+  SimTelnetServer telnet(sim);
+  SimFtpServer ftp(sim);
+  if (telnet.Listen() != 0) {
+    return 1;
+  }
+  /* no FTP server when the files are written straight to the CPU */
+  bool serve_ftp = opt.out_dir.empty();
+  if (serve_ftp && ftp.Listen() != 0) {
+    return 1;
+  }
+
+  /* SIGINT and SIGTERM are only taken by the main thread, in sigtimedwait() */
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+  sim->Start();
+  std::thread telnet_thread(&SimServer::Run, &telnet);
+  std::thread ftp_thread;
+  if (serve_ftp) {
+    ftp_thread = std::thread(&SimServer::Run, &ftp);
+  }
+  std::cout << "zynqsim: telnet on port " << opt.telnet_port;
+  if (serve_ftp) {
+    std::cout << ", FTP on port " << opt.ftp_port << " from " << opt.ftp_dir;
+  }
+  else {
+    std::cout << ", files written to " << opt.out_dir;
+  }
+  std::cout << std::endl;
+
+  /* print the statistics until stopped */
+  struct timespec period;
+  period.tv_sec = stats_sec > 0 ? stats_sec : 60;
+  period.tv_nsec = 0;
+  while (sigtimedwait(&stop_signals, NULL, &period) < 0) {
+    if (stats_sec > 0) {
+      sim->PrintStats();
+    }
+  }
+
+  sim->Stop();
+  sim->PrintStats();
+  /* the server threads are left blocked in accept() */
+  _exit(0);
+}
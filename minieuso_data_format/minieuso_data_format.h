@@ -65,6 +65,49 @@ typedef struct
   uint32_t crc; /* checksum */
 } CpuFileTrailer; 
 
+/**
+ * entry of the packet index, one for each packet in a CPU_RUN_MAIN file
+ * from CPU_FILE_VER 2 
+ * 24 bytes
+ */
+typedef struct
+{
+  uint64_t offset; /* position of the packet from the start of the file, in bytes */
+  uint32_t pkt_type; /* CPU_PACKET_TYPE or THERM_PACKET_TYPE */
+  uint32_t pkt_num; /* counter for each pkt_type, as in the packet header */
+  uint32_t unix_time; /* timestamp, as in the packet */
+  uint32_t n_gtu; /* GTU counter of the packet, from the timestamp of its D3 data, 0 for other packets */
+} CpuPktIndexEntry;
+
+/**
+ * packet index footer
+ * written after the index entries and just before the CpuFileTrailer
+ * so that the index can be found from the end of the file
+ * 16 bytes
+ */
+typedef struct
+{
+  uint32_t spacer = ID_TAG; /* AA55AA55 HEX */
+  uint32_t header; /* 'I'(31:24) | instrument_id(23:16) | pkt_type(15:8) | pkt_ver(7:0) */
+  uint32_t n_entries; /* number of CpuPktIndexEntry before the footer */
+  uint32_t index_size; /* size of the entries and the footer, in bytes */
+} CpuFileIndex;
+
+/**
+ * header of a block of compressed pixel data 
+ * in a CPU_PACKET with version CPU_PACKET_VER_CMP, 
+ * followed by cmp_size bytes of compressed data 
+ * from CPU_FILE_VER 3 
+ * 16 bytes 
+ */
+typedef struct
+{
+  uint32_t spacer = ID_TAG; /* AA55AA55 HEX */
+  uint32_t header; /* 'Z'(31:24) | instrument_id(23:16) | pkt_type(15:8) | codec(7:0) */
+  uint32_t raw_size; /* size of the pixel data once decoded, in bytes */
+  uint32_t cmp_size; /* size of the compressed data, in bytes */
+} CpuCmpHeader;
+
 /**
  * generic packet header for all cpu packets 
  * the zynq packet has its own header defined in minieuso_pdmdata.h 
@@ -78,6 +121,21 @@ typedef struct
   uint32_t pkt_num; /* counter for each pkt_type, reset each run */
 } CpuPktHeader; 
 
+/**
+ * checkpoint record in a CPU_RUN_MAIN file, written every CHECKPOINT_PKTS 
+ * CPU packets so that a run which was not closed can be checked and 
+ * recovered up to its last checkpoint 
+ * from CPU_FILE_VER 5 
+ * 32 bytes 
+ */
+typedef struct
+{
+  CpuPktHeader checkpoint_header; /* pkt_type CHECKPOINT_PACKET_TYPE, pkt_num counts the checkpoints */
+  uint64_t offset; /* position of this record from the start of the file, in bytes */
+  uint32_t n_packets; /* number of CPU packets before this record */
+  uint32_t crc; /* CRC of the file before this record */
+} CpuCheckpoint;
+
 /**
  * generic packet header for all hk sub packets 
  * the zynq packet has its own header defined in minieuso_pdmdata.h 
@@ -101,7 +159,7 @@ typedef struct
 #define HV_FILE_TYPE 'H'  
 #define SC_FILE_VER 1
 #define HV_FILE_VER 1
-#define CPU_FILE_VER 1
+#define CPU_FILE_VER 5
 
 
 /*
@@ -114,11 +172,33 @@ typedef struct
 #define SC_PACKET_TYPE 'S'
 #define CPU_PACKET_TYPE 'P'
 #define TRAILER_PACKET_TYPE 'Q'
+#define INDEX_PACKET_TYPE 'I'
+#define CMP_PACKET_TYPE 'Z'
+#define CHECKPOINT_PACKET_TYPE 'K'
 #define THERM_PACKET_VER 1
 #define HK_PACKET_VER 1
 #define HV_PACKET_VER 1
 #define SC_PACKET_VER 2
 #define CPU_PACKET_VER 2
+#define INDEX_PACKET_VER 1
+#define CHECKPOINT_PACKET_VER 1
+/* CPU_PACKET with compressed Zynq data, from CPU_FILE_VER 3 */
+#define CPU_PACKET_VER_CMP 3
+
+/*
+ * codecs for the Zynq pixel data, stored as the version in CpuCmpHeader 
+ */
+
+#define CMP_CODEC_NONE 0 /* stored unchanged */
+#define CMP_CODEC_FRAME_DELTA 1 /* difference to the previous frame, zigzag and bit packing */
+#define CMP_CODEC_SPARSE 2 /* D1 only, nonzero pixels of each frame, from CPU_FILE_VER 4 */
+
+/*
+ * frame formats with CMP_CODEC_SPARSE, stored in the first byte of each frame
+ */
+
+#define CMP_SPARSE_LIST 0 /* uint16_t n, n uint16_t pixel indices, n uint8_t counts */
+#define CMP_SPARSE_BITMAP 1 /* bitmap of the nonzero pixels, one uint8_t count per bit set */
 
 /*
  * for the analog readout 
@@ -189,6 +269,9 @@ typedef struct
 /**
  * CPU packet for incoming data every 5.24 s 
  * variable size 
+ * with version CPU_PACKET_VER_CMP, the pixel data of each Zynq packet 
+ * (raw_data, int16_data or int32_data) is replaced by a CpuCmpHeader 
+ * and the compressed data, the rest of the Zynq packet is unchanged 
  */
 typedef struct
 {
@@ -206,7 +289,9 @@ typedef struct
 typedef struct
 {
   CpuFileHeader cpu_file_header; /* 12 bytes */
-  CPU_PACKET cpu_run_payload[RUN_SIZE]; /* variable size */
+  CPU_PACKET cpu_run_payload[RUN_SIZE]; /* variable size, with THERM_PACKET in between */
+  CpuPktIndexEntry cpu_pkt_index[RUN_SIZE]; /* 24 bytes per packet, from CPU_FILE_VER 2 */
+  CpuFileIndex cpu_file_index; /* 16 bytes, from CPU_FILE_VER 2 */
   CpuFileTrailer cpu_file_trailer; /* 12 bytes */
 } CPU_FILE;
 